@@ -0,0 +1,115 @@
+// You can execute this example with `cargo run --release --example batch_scan`
+// Optionally, the number of records can be given as an argument, e.g.
+// `cargo run --release --example batch_scan -- 1000000`.
+// Small records are bulk loaded into a database, which is then scanned as a
+// whole: record by record (moving the cursor, checking it, and copying its key
+// and value out every time), in batches read by `LsmCursor::next_batch`, and
+// through the iterator of `LsmCursor::records`. The records scanned per second
+// show what reading every record on its own costs.
+
+use chrono::Utc;
+use lsmlite_rs::{
+    Cursor, DbConf, Disk, LsmCompressionLib, LsmCursorBatch, LsmDb, LsmHandleMode, LsmMode,
+};
+use std::time::Instant;
+
+// Size of every value persisted.
+const VALUE_SIZE_B: usize = 16;
+// Records read per batch, at most.
+const BATCH_RECORDS: usize = 1024;
+// Bytes read per batch, at most.
+const BATCH_B: usize = 256 << 10;
+// Times every scan is done, the fastest one is reported.
+const NUM_SCANS: usize = 3;
+
+#[derive(Copy, Clone, Debug)]
+enum Scan {
+    Records,
+    Batches,
+    Iterator,
+}
+
+// Scans the whole database, and returns the number of bytes of keys and values seen.
+fn scan(db: &LsmDb, how: Scan) -> Result<usize, Box<dyn std::error::Error>> {
+    let mut cursor = db.cursor_open()?;
+    let mut scanned_b = 0;
+    cursor.first()?;
+    match how {
+        Scan::Records => {
+            while cursor.valid().is_ok() {
+                scanned_b += cursor.get_key()?.len() + cursor.get_value()?.len();
+                cursor.next()?;
+            }
+        }
+        Scan::Batches => {
+            let mut batch = LsmCursorBatch::default();
+            while cursor.next_batch(BATCH_RECORDS, BATCH_B, &mut batch)? > 0 {
+                for (key, value) in &batch {
+                    scanned_b += key.len() + value.len();
+                }
+            }
+        }
+        Scan::Iterator => {
+            for record in cursor.records(BATCH_RECORDS, BATCH_B) {
+                let (key, value) = record?;
+                scanned_b += key.len() + value.len();
+            }
+        }
+    }
+    Ok(scanned_b)
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let num_records: u64 = std::env::args()
+        .nth(1)
+        .map(|n| n.parse())
+        .transpose()?
+        .unwrap_or(1_000_000);
+
+    let now = Utc::now();
+    let db_base_name = format!(
+        "{}-{}",
+        "example-batch-scan",
+        now.timestamp_nanos_opt().unwrap()
+    );
+    let db_conf = DbConf::new_with_parameters(
+        "/tmp".to_string(),
+        db_base_name,
+        LsmMode::LsmNoBackgroundThreads,
+        LsmHandleMode::ReadWrite,
+        None,
+        LsmCompressionLib::NoCompression,
+    );
+    let mut db: LsmDb = Default::default();
+    db.initialize(db_conf)?;
+    db.connect()?;
+
+    let value = vec![b'x'; VALUE_SIZE_B];
+    let mut loader = db.bulk_loader()?;
+    for i in 0..num_records {
+        loader.insert(&i.to_be_bytes(), &value)?;
+    }
+    loader.commit()?;
+
+    let expected_b = num_records as usize * (8 + VALUE_SIZE_B);
+    for how in [Scan::Records, Scan::Batches, Scan::Iterator] {
+        let mut best = f64::MAX;
+        for _ in 0..NUM_SCANS {
+            let start = Instant::now();
+            let scanned_b = scan(&db, how)?;
+            best = best.min(start.elapsed().as_secs_f64());
+            assert_eq!(scanned_b, expected_b);
+        }
+        println!(
+            "{:<8} | scan {:>10.0} records/s",
+            format!("{how:?}"),
+            num_records as f64 / best,
+        );
+    }
+
+    let db_path = db.get_full_db_path()?;
+    db.disconnect()?;
+    let _ = std::fs::remove_file(&db_path);
+    let _ = std::fs::remove_file(format!("{db_path}-log"));
+    Ok(())
+}
@@ -0,0 +1,122 @@
+// You can execute this example with `cargo run --release --example bulk_load`
+// Optionally, the number of records to load can be given as an argument, e.g.
+// `cargo run --release --example bulk_load -- 1000000`.
+// The same sorted records are loaded into a database once through regular
+// writes (that go through the log, main memory, and are merged into a single
+// segment in the end), and once through a bulk load. Then, the same records
+// in random order are loaded through regular writes, and through a loader that
+// sorts them (spilling sorted runs to temporary files) before bulk loading them.
+
+use chrono::Utc;
+use lsmlite_rs::{DbConf, Disk, LsmCompressionLib, LsmDb, LsmHandleMode, LsmMode};
+use std::time::Instant;
+
+// Size of every value persisted.
+const VALUE_SIZE_B: usize = 256;
+// Memory the sorting loader buffers records in.
+const SORT_MEMORY_KB: u32 = 64 << 10;
+
+#[derive(Copy, Clone, Debug)]
+enum Loader {
+    Writes,
+    Bulk,
+    Sorting,
+}
+
+// A tiny deterministic PRNG (xorshift64*) so that every run sees the very same workload.
+struct Prng(u64);
+
+impl Prng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_F491_4F6C_DD1D)
+    }
+}
+
+fn run(load: Loader, keys: &[u64]) -> Result<(), Box<dyn std::error::Error>> {
+    let now = Utc::now();
+    let db_base_name = format!(
+        "{}-{:?}-{}",
+        "example-bulk-load",
+        load,
+        now.timestamp_nanos_opt().unwrap()
+    );
+    let db_conf = DbConf::new_with_parameters(
+        "/tmp".to_string(),
+        db_base_name,
+        LsmMode::LsmNoBackgroundThreads,
+        LsmHandleMode::ReadWrite,
+        None,
+        LsmCompressionLib::NoCompression,
+    );
+    let mut db: LsmDb = Default::default();
+    db.initialize(db_conf)?;
+    db.connect()?;
+
+    let value = vec![b'x'; VALUE_SIZE_B];
+    let start = Instant::now();
+    match load {
+        Loader::Writes => {
+            for key in keys {
+                db.persist(&key.to_be_bytes(), &value)?;
+            }
+            // Merge everything into a single segment, as a bulk load produces.
+            db.optimize()?;
+        }
+        Loader::Bulk => {
+            let mut loader = db.bulk_loader()?;
+            for key in keys {
+                loader.insert(&key.to_be_bytes(), &value)?;
+            }
+            loader.commit()?;
+        }
+        Loader::Sorting => {
+            let mut loader = db.sorting_loader(SORT_MEMORY_KB)?;
+            for key in keys {
+                loader.insert(&key.to_be_bytes(), &value)?;
+            }
+            loader.commit()?;
+        }
+    }
+    let load_time = start.elapsed();
+
+    println!(
+        "{:<12} | records {:>9.0}/s | pages written {:>9} | segments {}",
+        format!("{load:?}"),
+        keys.len() as f64 / load_time.as_secs_f64(),
+        db.get_num_pages_written()?,
+        db.get_num_segments()?,
+    );
+
+    let db_path = db.get_full_db_path()?;
+    db.disconnect()?;
+    let _ = std::fs::remove_file(&db_path);
+    let _ = std::fs::remove_file(format!("{db_path}-log"));
+    Ok(())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let num_records: u64 = std::env::args()
+        .nth(1)
+        .map(|n| n.parse())
+        .transpose()?
+        .unwrap_or(1_000_000);
+
+    let mut keys: Vec<u64> = (0..num_records).collect();
+    println!("Sorted records:");
+    run(Loader::Writes, &keys)?;
+    run(Loader::Bulk, &keys)?;
+
+    // Fisher-Yates shuffle.
+    let mut prng = Prng(0x9E37_79B9_7F4A_7C15);
+    for i in (1..keys.len()).rev() {
+        keys.swap(i, (prng.next() % (i as u64 + 1)) as usize);
+    }
+    println!("Records in random order:");
+    run(Loader::Writes, &keys)?;
+    run(Loader::Sorting, &keys)?;
+
+    Ok(())
+}
@@ -0,0 +1,157 @@
+// You can execute this example with `cargo run --release --example compaction_policies`
+// Optionally, the number of records to write can be given as an argument, e.g.
+// `cargo run --release --example compaction_policies -- 4000000`. Keys are random, unless
+// `sequential` is given as a second argument, e.g.
+// `cargo run --release --example compaction_policies -- 4000000 sequential`.
+
+use chrono::Utc;
+use lsmlite_rs::{
+    Cursor, DbConf, Disk, LsmCompactionPolicy, LsmCompressionLib, LsmCursorSeekOp, LsmDb,
+    LsmHandleMode, LsmMode,
+};
+use std::time::Instant;
+
+// Size of a database page in bytes (as configured by the bindings).
+const PAGE_SIZE_B: f64 = 4096.;
+// Size of every value persisted.
+const VALUE_SIZE_B: usize = 128;
+// Number of point reads performed once all data has been written.
+const NUM_READS: usize = 100_000;
+
+// A tiny deterministic PRNG (xorshift64*) so that every policy sees the very same workload.
+struct Prng(u64);
+
+impl Prng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_F491_4F6C_DD1D)
+    }
+}
+
+fn run(
+    policy: LsmCompactionPolicy,
+    num_writes: usize,
+    sequential: bool,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let now = Utc::now();
+    let db_path = "/tmp".to_string();
+    let db_base_name = format!(
+        "{}-{:?}-{}",
+        "example-compaction-policies",
+        policy,
+        now.timestamp_nanos_opt().unwrap()
+    );
+
+    // All work is done by the writer, so that the pages written by merges are
+    // accounted for by its handle.
+    let db_conf = DbConf::new_with_parameters(
+        db_path,
+        db_base_name,
+        LsmMode::LsmNoBackgroundThreads,
+        LsmHandleMode::ReadWrite,
+        None,
+        LsmCompressionLib::NoCompression,
+    )
+    .with_compaction_policy(policy);
+    let mut db: LsmDb = Default::default();
+    db.initialize(db_conf)?;
+    db.connect()?;
+
+    // Half of the key space gets overwritten on average, so that merges have
+    // outdated records to get rid of. Sequential keys are never overwritten.
+    let num_keys = if sequential {
+        num_writes as u64
+    } else {
+        (num_writes / 2).max(1) as u64
+    };
+    let mut prng = Prng(0x9E37_79B9_7F4A_7C15);
+    let mut value = vec![0u8; VALUE_SIZE_B];
+
+    let start = Instant::now();
+    for n in 0..num_writes {
+        let key = if sequential {
+            n as u64
+        } else {
+            prng.next() % num_keys
+        };
+        value[..8].copy_from_slice(&(n as u64).to_be_bytes());
+        db.persist(&key.to_be_bytes(), &value)?;
+    }
+    let write_time = start.elapsed();
+
+    let user_bytes = (num_writes * (8 + VALUE_SIZE_B)) as f64;
+    let write_amplification = db.get_num_pages_written()? as f64 * PAGE_SIZE_B / user_bytes;
+    let num_segments = db.get_num_segments()?;
+
+    // Point reads of random keys.
+    let pages_read_before = db.get_num_pages_read()?;
+    let read_time = {
+        let mut cursor = db.cursor_open()?;
+        let start = Instant::now();
+        for _ in 0..NUM_READS {
+            let key = prng.next() % num_keys;
+            cursor.seek(&key.to_be_bytes(), LsmCursorSeekOp::LsmCursorSeekEq)?;
+        }
+        let read_time = start.elapsed();
+        cursor.close()?;
+        read_time
+    };
+    let pages_read = db.get_num_pages_read()? - pages_read_before;
+
+    // Live data is what a full scan returns.
+    let live_bytes = {
+        let mut cursor = db.cursor_open()?;
+        cursor.first()?;
+        let mut live_bytes: usize = 0;
+        while cursor.valid().is_ok() {
+            live_bytes += cursor.get_key()?.len() + cursor.get_value()?.len();
+            cursor.next()?;
+        }
+        cursor.close()?;
+        live_bytes
+    };
+
+    let file_size = std::fs::metadata(db.get_full_db_path()?)?.len() as f64;
+    let space_amplification = file_size / live_bytes as f64;
+
+    println!(
+        "{:<8} | writes {:>9.0}/s | reads {:>9.0}/s | segments {:>3} | write amp. {:>6.2} \
+        | read amp. (pages/read) {:>6.2} | space amp. {:>5.2}",
+        format!("{policy:?}"),
+        num_writes as f64 / write_time.as_secs_f64(),
+        NUM_READS as f64 / read_time.as_secs_f64(),
+        num_segments,
+        write_amplification,
+        pages_read as f64 / NUM_READS as f64,
+        space_amplification,
+    );
+
+    let db_path = db.get_full_db_path()?;
+    db.disconnect()?;
+    let _ = std::fs::remove_file(&db_path);
+    let _ = std::fs::remove_file(format!("{db_path}-log"));
+
+    Ok(())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let num_writes: usize = std::env::args()
+        .nth(1)
+        .map(|n| n.parse())
+        .transpose()?
+        .unwrap_or(2_000_000);
+    let sequential = std::env::args()
+        .nth(2)
+        .is_some_and(|arg| arg == "sequential");
+
+    for policy in [
+        LsmCompactionPolicy::Tiered,
+        LsmCompactionPolicy::Leveled,
+        LsmCompactionPolicy::Hybrid,
+    ] {
+        run(policy, num_writes, sequential)?;
+    }
+    Ok(())
+}
@@ -0,0 +1,160 @@
+// You can execute this example with `cargo run --release --example compression_throughput`
+// Optionally, the number of records to write can be given as an argument, e.g.
+// `cargo run --release --example compression_throughput -- 1000000`, as well as the
+// compression level (or acceleration for LZ4) to use, e.g.
+// `cargo run --release --example compression_throughput -- 1000000 9`. ZStd is
+// run a second time compressing pages with a trained dictionary. LZ4 and ZStd are
+// also run encrypting pages once compressed with either cipher.
+
+use chrono::Utc;
+use lsmlite_rs::{
+    Cursor, DbConf, Disk, LsmCipher, LsmCompressionLib, LsmDb, LsmHandleMode, LsmMode,
+};
+use std::time::Instant;
+
+// Size of a database page in bytes (as configured by the bindings).
+const PAGE_SIZE_B: f64 = 4096.;
+// Size of every value persisted.
+const VALUE_SIZE_B: usize = 256;
+
+// A tiny deterministic PRNG (xorshift64*) so that every library sees the very same workload.
+struct Prng(u64);
+
+impl Prng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_F491_4F6C_DD1D)
+    }
+}
+
+fn run(
+    compression: LsmCompressionLib,
+    num_writes: usize,
+    level: Option<i32>,
+    dictionary_size_b: Option<usize>,
+    cipher: Option<LsmCipher>,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let now = Utc::now();
+    let db_path = "/tmp".to_string();
+    let db_base_name = format!(
+        "{}-{:?}-{}",
+        "example-compression-throughput",
+        compression,
+        now.timestamp_nanos_opt().unwrap()
+    );
+
+    // All work is done by the writer, so that every page compressed by merges is
+    // accounted for by its handle.
+    let mut db_conf = DbConf::new_with_parameters(
+        db_path,
+        db_base_name,
+        LsmMode::LsmNoBackgroundThreads,
+        LsmHandleMode::ReadWrite,
+        None,
+        compression,
+    );
+    if let Some(level) = level {
+        db_conf = db_conf.with_compression_level(level);
+    }
+    if let Some(dictionary_size_b) = dictionary_size_b {
+        db_conf = db_conf.with_compression_dictionary(dictionary_size_b);
+    }
+    if let Some(cipher) = cipher {
+        db_conf = db_conf.with_encryption(cipher, [0x5a; 32]);
+    }
+    let mut db: LsmDb = Default::default();
+    db.initialize(db_conf)?;
+    db.connect()?;
+
+    // Values are half random and half a repeated pattern, so that they compress
+    // to roughly half their size.
+    let mut prng = Prng(0x9E37_79B9_7F4A_7C15);
+    let mut value = vec![b'x'; VALUE_SIZE_B];
+
+    let start = Instant::now();
+    for _ in 0..num_writes {
+        let key = prng.next();
+        for chunk in value[..VALUE_SIZE_B / 2].chunks_mut(8) {
+            chunk.copy_from_slice(&prng.next().to_be_bytes()[..chunk.len()]);
+        }
+        db.persist(&key.to_be_bytes(), &value)?;
+    }
+    // Merge everything into a single segment.
+    db.optimize()?;
+    let write_time = start.elapsed();
+    let pages_written = db.get_num_pages_written()? as f64;
+
+    // A full scan decompresses every page of the database.
+    let start = Instant::now();
+    let num_records = {
+        let mut cursor = db.cursor_open()?;
+        cursor.first()?;
+        let mut num_records: usize = 0;
+        while cursor.valid().is_ok() {
+            num_records += 1;
+            cursor.next()?;
+        }
+        cursor.close()?;
+        num_records
+    };
+    let scan_time = start.elapsed();
+    assert_eq!(num_records, num_writes);
+
+    let file_size = std::fs::metadata(db.get_full_db_path()?)?.len() as f64;
+    let user_bytes = (num_writes * (8 + VALUE_SIZE_B)) as f64;
+
+    println!(
+        "{:<24} | writes {:>9.0}/s | merged pages {:>7.1} MiB/s | scan {:>9.0} records/s \
+        | file size / user data {:>5.2}",
+        match (dictionary_size_b, cipher) {
+            (None, None) => format!("{compression:?}"),
+            (Some(_), _) => format!("{compression:?} (dict)"),
+            (None, Some(cipher)) => format!("{compression:?} ({cipher:?})"),
+        },
+        num_writes as f64 / write_time.as_secs_f64(),
+        pages_written * PAGE_SIZE_B / write_time.as_secs_f64() / (1 << 20) as f64,
+        num_records as f64 / scan_time.as_secs_f64(),
+        file_size / user_bytes,
+    );
+
+    let db_path = db.get_full_db_path()?;
+    db.disconnect()?;
+    let _ = std::fs::remove_file(&db_path);
+    let _ = std::fs::remove_file(format!("{db_path}-log"));
+
+    Ok(())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let num_writes: usize = std::env::args()
+        .nth(1)
+        .map(|n| n.parse())
+        .transpose()?
+        .unwrap_or(1_000_000);
+    let level: Option<i32> = std::env::args().nth(2).map(|n| n.parse()).transpose()?;
+
+    for (compression, dictionary_size_b, cipher) in [
+        (LsmCompressionLib::NoCompression, None, None),
+        (LsmCompressionLib::LZ4, None, None),
+        (LsmCompressionLib::LZ4, None, Some(LsmCipher::Aes256Gcm)),
+        (
+            LsmCompressionLib::LZ4,
+            None,
+            Some(LsmCipher::ChaCha20Poly1305),
+        ),
+        (LsmCompressionLib::ZLib, None, None),
+        (LsmCompressionLib::ZStd, None, None),
+        (LsmCompressionLib::ZStd, Some(16 << 10), None),
+        (LsmCompressionLib::ZStd, None, Some(LsmCipher::Aes256Gcm)),
+        (
+            LsmCompressionLib::ZStd,
+            None,
+            Some(LsmCipher::ChaCha20Poly1305),
+        ),
+    ] {
+        run(compression, num_writes, level, dictionary_size_b, cipher)?;
+    }
+    Ok(())
+}
@@ -0,0 +1,130 @@
+// You can execute this example with `cargo run --release --example key_formats`
+// Optionally, the number of records can be given as an argument, e.g.
+// `cargo run --release --example key_formats -- 1000000`.
+// The same records, keyed by random 8-byte big-endian integers, are written to
+// a database comparing keys as byte strings, as 8-byte integers, and through a
+// key comparator given from Rust. All segments are then merged into one, and
+// every key is looked up again in random order. The time spent merging and the
+// lookups per second show what key comparisons cost in each case.
+
+use chrono::Utc;
+use lsmlite_rs::{
+    Cursor, DbConf, Disk, LsmCompressionLib, LsmCursorSeekOp, LsmDb, LsmHandleMode,
+    LsmKeyComparator, LsmKeyFormat, LsmMode,
+};
+use std::cmp::Ordering;
+use std::time::Instant;
+
+// Size of every value persisted.
+const VALUE_SIZE_B: usize = 16;
+
+// Compares 8-byte keys as big-endian integers, as LsmKeyFormat::U64 does, but
+// from Rust.
+struct U64Keys;
+
+impl LsmKeyComparator for U64Keys {
+    fn compare(lhs: &[u8], rhs: &[u8]) -> Ordering {
+        match (<[u8; 8]>::try_from(lhs), <[u8; 8]>::try_from(rhs)) {
+            (Ok(lhs), Ok(rhs)) => u64::from_be_bytes(lhs).cmp(&u64::from_be_bytes(rhs)),
+            _ => lhs.cmp(rhs),
+        }
+    }
+}
+
+#[derive(Copy, Clone, Debug)]
+enum KeyOrder {
+    Bytes,
+    U64,
+    Comparator,
+}
+
+// A tiny deterministic PRNG (xorshift64*) so that every run sees the very same workload.
+struct Prng(u64);
+
+impl Prng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_F491_4F6C_DD1D)
+    }
+}
+
+fn run(order: KeyOrder, keys: &[u64]) -> Result<(), Box<dyn std::error::Error>> {
+    let now = Utc::now();
+    let db_base_name = format!(
+        "{}-{:?}-{}",
+        "example-key-formats",
+        order,
+        now.timestamp_nanos_opt().unwrap()
+    );
+    let db_conf = DbConf::new_with_parameters(
+        "/tmp".to_string(),
+        db_base_name,
+        LsmMode::LsmNoBackgroundThreads,
+        LsmHandleMode::ReadWrite,
+        None,
+        LsmCompressionLib::NoCompression,
+    );
+    let db_conf = match order {
+        KeyOrder::Bytes => db_conf.with_key_format(LsmKeyFormat::Bytes),
+        KeyOrder::U64 => db_conf.with_key_format(LsmKeyFormat::U64),
+        KeyOrder::Comparator => db_conf.with_key_comparator::<U64Keys>(),
+    };
+    let mut db: LsmDb = Default::default();
+    db.initialize(db_conf)?;
+    db.connect()?;
+
+    let value = vec![b'x'; VALUE_SIZE_B];
+    let start = Instant::now();
+    for key in keys {
+        db.persist(&key.to_be_bytes(), &value)?;
+    }
+    let write_time = start.elapsed();
+
+    // Merge everything into a single segment.
+    let start = Instant::now();
+    db.optimize()?;
+    let merge_time = start.elapsed();
+
+    // The keys were written in random order already, so they are looked up in
+    // the order they were written.
+    let mut cursor = db.cursor_open()?;
+    let start = Instant::now();
+    for key in keys {
+        cursor.seek(&key.to_be_bytes(), LsmCursorSeekOp::LsmCursorSeekEq)?;
+        cursor.valid()?;
+    }
+    let seek_time = start.elapsed();
+    drop(cursor);
+
+    println!(
+        "{:<10} | writes {:>9.0}/s | merge {:>7.3} s | seeks {:>9.0}/s",
+        format!("{order:?}"),
+        keys.len() as f64 / write_time.as_secs_f64(),
+        merge_time.as_secs_f64(),
+        keys.len() as f64 / seek_time.as_secs_f64(),
+    );
+
+    let db_path = db.get_full_db_path()?;
+    db.disconnect()?;
+    let _ = std::fs::remove_file(&db_path);
+    let _ = std::fs::remove_file(format!("{db_path}-log"));
+    Ok(())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let num_records: u64 = std::env::args()
+        .nth(1)
+        .map(|n| n.parse())
+        .transpose()?
+        .unwrap_or(1_000_000);
+
+    let mut prng = Prng(0x9E37_79B9_7F4A_7C15);
+    let keys: Vec<u64> = (0..num_records).map(|_| prng.next()).collect();
+    run(KeyOrder::Bytes, &keys)?;
+    run(KeyOrder::U64, &keys)?;
+    run(KeyOrder::Comparator, &keys)?;
+
+    Ok(())
+}
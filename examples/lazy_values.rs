@@ -0,0 +1,93 @@
+// You can execute this example with `cargo run --release --example lazy_values`
+// Optionally, the number of records can be given as an argument, e.g.
+// `cargo run --release --example lazy_values -- 100000`.
+// Records are bulk loaded into a database, once with small values and once
+// with values that span several pages of the database file. Every database is
+// then scanned counting its keys, with cursors reading values eagerly, lazily,
+// and not at all (see `LsmCursorValues`). None of the scans retrieves a value,
+// thus the records scanned per second show what reading values costs when
+// they are not needed.
+
+use chrono::Utc;
+use lsmlite_rs::{
+    Cursor, DbConf, Disk, LsmCompressionLib, LsmCursorValues, LsmDb, LsmHandleMode, LsmMode,
+};
+use std::time::Instant;
+
+// Times every scan is done, the fastest one is reported.
+const NUM_SCANS: usize = 3;
+
+fn run(value_size_b: usize, num_records: u64) -> Result<(), Box<dyn std::error::Error>> {
+    let now = Utc::now();
+    let db_base_name = format!(
+        "{}-{}-{}",
+        "example-lazy-values",
+        value_size_b,
+        now.timestamp_nanos_opt().unwrap()
+    );
+    let db_conf = DbConf::new_with_parameters(
+        "/tmp".to_string(),
+        db_base_name,
+        LsmMode::LsmNoBackgroundThreads,
+        LsmHandleMode::ReadWrite,
+        None,
+        LsmCompressionLib::NoCompression,
+    );
+    let mut db: LsmDb = Default::default();
+    db.initialize(db_conf)?;
+    db.connect()?;
+
+    let value = vec![b'x'; value_size_b];
+    let mut loader = db.bulk_loader()?;
+    for i in 0..num_records {
+        loader.insert(&i.to_be_bytes(), &value)?;
+    }
+    loader.commit()?;
+
+    for values in [
+        LsmCursorValues::Eager,
+        LsmCursorValues::Lazy,
+        LsmCursorValues::KeysOnly,
+    ] {
+        let mut best = f64::MAX;
+        for _ in 0..NUM_SCANS {
+            let mut cursor = db.cursor_open()?;
+            cursor.set_values(values)?;
+            let start = Instant::now();
+            let mut scanned = 0_u64;
+            cursor.first()?;
+            while cursor.valid().is_ok() {
+                scanned += 1;
+                cursor.next()?;
+            }
+            best = best.min(start.elapsed().as_secs_f64());
+            assert_eq!(scanned, num_records);
+        }
+        println!(
+            "value bytes {:>5} | {:<8} | scan {:>10.0} records/s",
+            value_size_b,
+            format!("{values:?}"),
+            num_records as f64 / best,
+        );
+    }
+
+    let db_path = db.get_full_db_path()?;
+    db.disconnect()?;
+    let _ = std::fs::remove_file(&db_path);
+    let _ = std::fs::remove_file(format!("{db_path}-log"));
+    Ok(())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let num_records: u64 = std::env::args()
+        .nth(1)
+        .map(|n| n.parse())
+        .transpose()?
+        .unwrap_or(100_000);
+
+    for value_size_b in [16, 16 << 10] {
+        run(value_size_b, num_records)?;
+    }
+
+    Ok(())
+}
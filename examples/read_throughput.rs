@@ -0,0 +1,188 @@
+// You can execute this example with `cargo run --release --example read_throughput`
+// Optionally, the number of records to write can be given as an argument, e.g.
+// `cargo run --release --example read_throughput -- 1000000`, as well as the
+// number of point reads to perform, e.g.
+// `cargo run --release --example read_throughput -- 1000000 2000000`.
+// Point reads of a compressed database are run with the default cache of
+// decompressed pages, with a tiny one, and with a tiny one backed by a cache of
+// compressed pages (zcache). Point reads of a database without compression are
+// run by read-only handles with and without mapping the file.
+
+use chrono::Utc;
+use lsmlite_rs::{
+    Cursor, DbConf, Disk, LsmCompressionLib, LsmCursorSeekOp, LsmDb, LsmHandleMode, LsmMmapAdvice,
+    LsmMode,
+};
+use std::time::Instant;
+
+// Size of every value persisted.
+const VALUE_SIZE_B: usize = 256;
+// Reads skew towards this many keys, so that hot pages are read over and over.
+const NUM_HOT_KEYS: u64 = 10_000;
+
+// A tiny deterministic PRNG (xorshift64*) so that every run sees the very same workload.
+struct Prng(u64);
+
+impl Prng {
+    fn next(&mut self) -> u64 {
+        self.0 ^= self.0 >> 12;
+        self.0 ^= self.0 << 25;
+        self.0 ^= self.0 >> 27;
+        self.0.wrapping_mul(0x2545_F491_4F6C_DD1D)
+    }
+}
+
+// Produces a database of the given number of records, and returns the
+// configuration to open it with the given mode, as well as its full path.
+fn produce(
+    compression: LsmCompressionLib,
+    handle_mode: LsmHandleMode,
+    num_writes: u64,
+) -> Result<(DbConf, String), Box<dyn std::error::Error>> {
+    let now = Utc::now();
+    let db_base_name = format!(
+        "{}-{:?}-{}",
+        "example-read-throughput",
+        compression,
+        now.timestamp_nanos_opt().unwrap()
+    );
+    let db_conf = |handle_mode| {
+        DbConf::new_with_parameters(
+            "/tmp".to_string(),
+            db_base_name.clone(),
+            LsmMode::LsmNoBackgroundThreads,
+            handle_mode,
+            None,
+            compression,
+        )
+    };
+    let mut db: LsmDb = Default::default();
+    db.initialize(db_conf(LsmHandleMode::ReadWrite))?;
+    db.connect()?;
+
+    // Values are half random and half a repeated pattern, so that they compress
+    // to roughly half their size.
+    let mut prng = Prng(0x9E37_79B9_7F4A_7C15);
+    let mut value = vec![b'x'; VALUE_SIZE_B];
+    for key in 0..num_writes {
+        for chunk in value[..VALUE_SIZE_B / 2].chunks_mut(8) {
+            chunk.copy_from_slice(&prng.next().to_be_bytes()[..chunk.len()]);
+        }
+        db.persist(&key.to_be_bytes(), &value)?;
+    }
+    // Merge everything into a single segment.
+    db.optimize()?;
+    let db_path = db.get_full_db_path()?;
+    db.disconnect()?;
+
+    Ok((db_conf(handle_mode), db_path))
+}
+
+fn run(
+    label: &str,
+    db_conf: DbConf,
+    num_writes: u64,
+    num_reads: usize,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let mut db: LsmDb = Default::default();
+    db.initialize(db_conf)?;
+    db.connect()?;
+
+    // Nine out of ten reads hit one of the hot keys.
+    let mut prng = Prng(0x2545_F491_4F6C_DD1D);
+    let start = Instant::now();
+    {
+        let mut cursor = db.cursor_open()?;
+        for _ in 0..num_reads {
+            let key = match prng.next() % 10 {
+                0 => prng.next() % num_writes,
+                _ => prng.next() % NUM_HOT_KEYS.min(num_writes),
+            };
+            cursor.seek(&key.to_be_bytes(), LsmCursorSeekOp::LsmCursorSeekEq)?;
+            assert_eq!(cursor.get_value()?.len(), VALUE_SIZE_B);
+        }
+        cursor.close()?;
+    }
+    let read_time = start.elapsed();
+
+    println!(
+        "{:<30} | point reads {:>9.0}/s | pages read from the file {:>9}",
+        label,
+        num_reads as f64 / read_time.as_secs_f64(),
+        db.get_num_pages_read()? - db.get_num_compressed_cache_hits()?,
+    );
+
+    db.disconnect()?;
+    Ok(())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let num_writes: u64 = std::env::args()
+        .nth(1)
+        .map(|n| n.parse())
+        .transpose()?
+        .unwrap_or(1_000_000);
+    let num_reads: usize = std::env::args()
+        .nth(2)
+        .map(|n| n.parse())
+        .transpose()?
+        .unwrap_or(1_000_000);
+
+    // A compressed database, read through the default (sizeable) cache of
+    // decompressed pages, through a tiny one, and through a tiny one backed
+    // by a cache of compressed pages.
+    let (db_conf, db_path) = produce(
+        LsmCompressionLib::ZStd,
+        LsmHandleMode::ReadWrite,
+        num_writes,
+    )?;
+    run(
+        "ZStd (default cache)",
+        db_conf.clone(),
+        num_writes,
+        num_reads,
+    )?;
+    run(
+        "ZStd (64 KiB cache)",
+        db_conf.clone().with_page_cache_size(64),
+        num_writes,
+        num_reads,
+    )?;
+    run(
+        "ZStd (64 KiB + 8 MiB zcache)",
+        db_conf
+            .clone()
+            .with_page_cache_size(64)
+            .with_compressed_page_cache_size(8 << 10),
+        num_writes,
+        num_reads,
+    )?;
+    let _ = std::fs::remove_file(&db_path);
+    let _ = std::fs::remove_file(format!("{db_path}-log"));
+
+    // A database without compression, read by read-only handles that read pages
+    // into their cache, or that map the file.
+    let (db_conf, db_path) = produce(
+        LsmCompressionLib::NoCompression,
+        LsmHandleMode::ReadOnly,
+        num_writes,
+    )?;
+    run(
+        "NoCompression (read-only)",
+        db_conf.clone(),
+        num_writes,
+        num_reads,
+    )?;
+    for advice in [LsmMmapAdvice::Normal, LsmMmapAdvice::Random] {
+        run(
+            &format!("NoCompression (mmap, {advice:?})"),
+            db_conf.clone().with_mmap(advice),
+            num_writes,
+            num_reads,
+        )?;
+    }
+    let _ = std::fs::remove_file(&db_path);
+    let _ = std::fs::remove_file(format!("{db_path}-log"));
+
+    Ok(())
+}
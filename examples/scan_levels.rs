@@ -0,0 +1,108 @@
+// You can execute this example with `cargo run --release --example scan_levels`
+// Optionally, the number of records can be given as an argument, e.g.
+// `cargo run --release --example scan_levels -- 1000000`.
+// The same records are bulk loaded into a database as a growing number of
+// segments, whose keys interleave (record `i` goes to segment `i % segments`).
+// A cursor scanning the whole database thus merges all segments, picking the
+// next record from a different segment every time. The records scanned per
+// second show what merging the segments costs as their number grows. This is
+// done once with 8-byte keys, and once with 32-byte keys that only differ in
+// their last 8 bytes, so that their first 8 bytes never tell them apart.
+
+use chrono::Utc;
+use lsmlite_rs::{Cursor, DbConf, Disk, LsmCompressionLib, LsmDb, LsmHandleMode, LsmMode};
+use std::time::Instant;
+
+// Size of every value persisted.
+const VALUE_SIZE_B: usize = 16;
+// Numbers of segments the records are spread over.
+const NUM_SEGMENTS: [u64; 6] = [1, 2, 4, 8, 16, 32];
+// Times every database is scanned, the fastest scan is reported.
+const NUM_SCANS: usize = 3;
+
+// The key of record `i`: `prefix_len` bytes all keys share, followed by `i`.
+fn key(prefix_len: usize, i: u64) -> Vec<u8> {
+    let mut key = vec![b'k'; prefix_len];
+    key.extend_from_slice(&i.to_be_bytes());
+    key
+}
+
+fn run(
+    prefix_len: usize,
+    num_segments: u64,
+    num_records: u64,
+) -> Result<(), Box<dyn std::error::Error>> {
+    let now = Utc::now();
+    let db_base_name = format!(
+        "{}-{}-{}-{}",
+        "example-scan-levels",
+        prefix_len,
+        num_segments,
+        now.timestamp_nanos_opt().unwrap()
+    );
+    let db_conf = DbConf::new_with_parameters(
+        "/tmp".to_string(),
+        db_base_name,
+        LsmMode::LsmNoBackgroundThreads,
+        LsmHandleMode::ReadWrite,
+        None,
+        LsmCompressionLib::NoCompression,
+    );
+    let mut db: LsmDb = Default::default();
+    db.initialize(db_conf)?;
+    db.connect()?;
+
+    // Every bulk load produces one more segment.
+    let value = vec![b'x'; VALUE_SIZE_B];
+    for segment in 0..num_segments {
+        let mut loader = db.bulk_loader()?;
+        for i in (segment..num_records).step_by(num_segments as usize) {
+            loader.insert(&key(prefix_len, i), &value)?;
+        }
+        loader.commit()?;
+    }
+
+    let mut best = f64::MAX;
+    for _ in 0..NUM_SCANS {
+        let mut cursor = db.cursor_open()?;
+        let start = Instant::now();
+        let mut scanned = 0_u64;
+        cursor.first()?;
+        while cursor.valid().is_ok() {
+            scanned += 1;
+            cursor.next()?;
+        }
+        best = best.min(start.elapsed().as_secs_f64());
+        assert_eq!(scanned, num_records);
+    }
+
+    println!(
+        "key bytes {:>2} | segments {:>2} | scan {:>10.0} records/s",
+        prefix_len + 8,
+        db.get_num_segments()?,
+        num_records as f64 / best,
+    );
+
+    let db_path = db.get_full_db_path()?;
+    db.disconnect()?;
+    let _ = std::fs::remove_file(&db_path);
+    let _ = std::fs::remove_file(format!("{db_path}-log"));
+    Ok(())
+}
+
+fn main() -> Result<(), Box<dyn std::error::Error>> {
+    let num_records: u64 = std::env::args()
+        .nth(1)
+        .map(|n| n.parse())
+        .transpose()?
+        .unwrap_or(1_000_000);
+
+    // Short keys, and long keys that only differ past their first 8 bytes.
+    for prefix_len in [0, 24] {
+        for num_segments in NUM_SEGMENTS {
+            run(prefix_len, num_segments, num_records)?;
+        }
+    }
+
+    Ok(())
+}
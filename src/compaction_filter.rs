@@ -0,0 +1,106 @@
+// Copyright 2023 Helsing GmbH
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+use std::ffi::c_void;
+use std::panic::{catch_unwind, AssertUnwindSafe};
+use std::slice::from_raw_parts;
+use std::sync::Arc;
+
+use crate::lsmdb::lsm_config_compaction_filter;
+use crate::{lsm_db, LsmCompactionDecision, LsmCompactionFilter};
+
+/// This is the context `lsm1` hands back to us every time it invokes the
+/// compaction filter. Besides the user's filter, it owns the buffer holding
+/// the last value produced by the filter, as `lsm1` expects that buffer
+/// to stay valid until the filter is invoked again.
+pub(crate) struct LsmCompactionFilterCtx {
+    filter: Arc<dyn LsmCompactionFilter>,
+    value: Vec<u8>,
+}
+
+impl LsmCompactionFilterCtx {
+    /// Configures the given filter on the given handle. The returned context
+    /// has to outlive the handle (or at least until the handle is closed).
+    pub(crate) fn register(
+        db_handle: *mut lsm_db,
+        filter: &Arc<dyn LsmCompactionFilter>,
+    ) -> Box<LsmCompactionFilterCtx> {
+        let mut ctx = Box::new(LsmCompactionFilterCtx {
+            filter: filter.clone(),
+            value: Vec::new(),
+        });
+        unsafe {
+            lsm_config_compaction_filter(
+                db_handle,
+                Some(LsmCompactionFilterCtx::filter_entry),
+                &mut *ctx as *mut LsmCompactionFilterCtx as *mut c_void,
+            );
+        }
+        ctx
+    }
+
+    unsafe extern "C" fn filter_entry(
+        ctx: *mut c_void,
+        key: *const c_void,
+        key_len: i32,
+        value: *const c_void,
+        value_len: i32,
+        new_value: *mut *mut c_void,
+        new_value_len: *mut i32,
+    ) -> i32 {
+        // If we cannot write the outcome, then we keep the entry as it is.
+        if ctx.is_null() || new_value.is_null() || new_value_len.is_null() {
+            // This is LSM_FILTER_KEEP.
+            return 0;
+        }
+        let ctx = &mut *(ctx as *mut LsmCompactionFilterCtx);
+
+        let key: &[u8] = if key.is_null() || key_len <= 0 {
+            &[]
+        } else {
+            from_raw_parts(key as *const u8, key_len as usize)
+        };
+        let value: &[u8] = if value.is_null() || value_len <= 0 {
+            &[]
+        } else {
+            from_raw_parts(value as *const u8, value_len as usize)
+        };
+
+        // A panic must not cross the FFI boundary. If the filter panics, the
+        // entry is kept (no data is lost because of a faulty filter).
+        match catch_unwind(AssertUnwindSafe(|| ctx.filter.filter(key, value))) {
+            // This is LSM_FILTER_KEEP.
+            Ok(LsmCompactionDecision::Keep) => 0,
+            // This is LSM_FILTER_DROP.
+            Ok(LsmCompactionDecision::Drop) => 1,
+            Ok(LsmCompactionDecision::Change(value)) => {
+                let Ok(len) = i32::try_from(value.len()) else {
+                    tracing::error!(
+                        len = value.len(),
+                        "Value produced by the compaction filter is too large, entry kept.",
+                    );
+                    return 0;
+                };
+                ctx.value = value;
+                *new_value = ctx.value.as_mut_ptr() as *mut c_void;
+                *new_value_len = len;
+                // This is LSM_FILTER_CHANGE.
+                2
+            }
+            Err(_) => {
+                tracing::error!("Compaction filter panicked, entry kept.");
+                0
+            }
+        }
+    }
+}
@@ -0,0 +1,280 @@
+// Copyright 2023 Helsing GmbH
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+use ring::aead::{
+    Aad, LessSafeKey, Nonce, UnboundKey, AES_256_GCM, CHACHA20_POLY1305, MAX_TAG_LEN, NONCE_LEN,
+};
+use ring::rand::{SecureRandom, SystemRandom};
+use std::ffi::{c_char, c_void};
+use std::ptr::copy_nonoverlapping;
+use std::slice::from_raw_parts_mut;
+use std::sync::atomic::{AtomicU64, Ordering};
+use std::sync::Mutex;
+
+use crate::compression::lsm_compress;
+use crate::{LsmCipher, LsmErrorCode};
+
+// Every encrypted page is prefixed by the nonce it was encrypted with, and
+// followed by its authentication tag. Both ciphers use tags of this size.
+const ENCRYPTION_OVERHEAD_B: i32 = (NONCE_LEN + MAX_TAG_LEN) as i32;
+
+// The compression id of encrypted pages is the one of the compression library
+// they are compressed with, offset by this much times the id of the cipher. The
+// ids of segments have to fit in 16 bits.
+const CIPHER_ID_OFFSET: u32 = 20000;
+
+/// The key pages are encrypted with. It is never printed.
+#[derive(Clone)]
+pub(crate) struct LsmEncryptionKey(pub(crate) [u8; 32]);
+
+impl std::fmt::Debug for LsmEncryptionKey {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str("LsmEncryptionKey(..)")
+    }
+}
+
+/// This is the context `lsm1` hands to the hooks. It owns the hooks of the
+/// compression library pages are compressed with before being encrypted (if
+/// any), and releases their context when released itself.
+struct LsmEncryptionCtx {
+    inner: Option<lsm_compress>,
+    key: LessSafeKey,
+    // Nonces are never derived from the page number, because in compressed
+    // databases it is only assigned once the page is encrypted, and the space
+    // of freed pages is reused. Instead, every handle draws a random nonce
+    // and counts up from it.
+    nonce_prefix: [u8; NONCE_LEN - size_of::<u64>()],
+    nonce_counter: AtomicU64,
+    // Pages are decrypted here before being decompressed. It is behind a lock
+    // because cursors of the same handle may be used from different threads.
+    buffer: Mutex<Vec<u8>>,
+}
+
+impl Drop for LsmEncryptionCtx {
+    fn drop(&mut self) {
+        if let Some(inner) = self.inner {
+            if let Some(free) = inner.free {
+                unsafe { free(inner.ctx) }
+            }
+        }
+    }
+}
+
+impl LsmEncryptionCtx {
+    fn next_nonce(&self) -> [u8; NONCE_LEN] {
+        let counter = self.nonce_counter.fetch_add(1, Ordering::Relaxed);
+        let mut nonce = [0; NONCE_LEN];
+        nonce[..self.nonce_prefix.len()].copy_from_slice(&self.nonce_prefix);
+        nonce[self.nonce_prefix.len()..].copy_from_slice(&counter.to_le_bytes());
+        nonce
+    }
+}
+
+/// This encloses the methods that encrypt pages after compressing them with
+/// the methods of a compression library (if any), and decrypt them before
+/// decompressing them. Both ciphers authenticate the pages, thus pages that
+/// were tampered with, or that are decrypted with the wrong key, are reported
+/// as [`LsmErrorCode::LsmCorrupt`]. `ring` uses the AES instructions of the
+/// CPU (if available) for [`LsmCipher::Aes256Gcm`].
+pub(crate) struct LsmEncryption {
+    cipher: LsmCipher,
+    key: LsmEncryptionKey,
+}
+
+impl LsmEncryption {
+    pub(crate) fn new(cipher: LsmCipher, key: LsmEncryptionKey) -> Self {
+        Self { cipher, key }
+    }
+
+    /// Produces the hooks that encrypt the pages compressed by the given hooks,
+    /// which are owned by the produced ones from then on (even if this fails).
+    /// If no hooks are given, pages are encrypted as they are.
+    pub(crate) fn wrap(&self, inner: Option<lsm_compress>) -> Result<lsm_compress, LsmErrorCode> {
+        let release_inner = |ec| {
+            if let Some(inner) = inner {
+                if let Some(free) = inner.free {
+                    unsafe { free(inner.ctx) }
+                }
+            }
+            ec
+        };
+        let algorithm = match self.cipher {
+            LsmCipher::Aes256Gcm => &AES_256_GCM,
+            LsmCipher::ChaCha20Poly1305 => &CHACHA20_POLY1305,
+        };
+        let key = UnboundKey::new(algorithm, &self.key.0)
+            .map_err(|_| release_inner(LsmErrorCode::LsmMisuse))?;
+        let mut nonce = [0; NONCE_LEN];
+        SystemRandom::new()
+            .fill(&mut nonce)
+            .map_err(|_| release_inner(LsmErrorCode::LsmError))?;
+        let (nonce_prefix, nonce_counter) = nonce.split_at(NONCE_LEN - size_of::<u64>());
+        let inner_id = inner.map_or(crate::LsmCompressionLib::NoCompression as u32, |inner| {
+            inner.id
+        });
+
+        let ctx = Box::new(LsmEncryptionCtx {
+            inner,
+            key: LessSafeKey::new(key),
+            // These conversions are infallible.
+            nonce_prefix: nonce_prefix.try_into().unwrap(),
+            nonce_counter: AtomicU64::new(u64::from_le_bytes(nonce_counter.try_into().unwrap())),
+            buffer: Mutex::new(Vec::new()),
+        });
+        Ok(lsm_compress {
+            ctx: Box::into_raw(ctx) as *mut c_void,
+            id: inner_id + CIPHER_ID_OFFSET * self.cipher as u32,
+            bound: Some(LsmEncryption::encrypt_bound_aead),
+            compress: Some(LsmEncryption::encrypt_aead),
+            uncompress: Some(LsmEncryption::decrypt_aead),
+            free: Some(LsmEncryption::free_encryption),
+        })
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn free_encryption(ctx: *const c_void) {
+        if !ctx.is_null() {
+            drop(Box::from_raw(ctx as *mut LsmEncryptionCtx));
+        }
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn encrypt_bound_aead(ctx: *const c_void, input_size: i32) -> i32 {
+        let ctx = &*(ctx as *const LsmEncryptionCtx);
+        let bound = match ctx.inner {
+            Some(lsm_compress {
+                bound: Some(bound),
+                ctx,
+                ..
+            }) => bound(ctx, input_size),
+            _ => input_size,
+        };
+        bound + ENCRYPTION_OVERHEAD_B
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn encrypt_aead(
+        ctx: *const c_void,
+        dst: *mut c_char,
+        written_bytes_p: *mut i32,
+        src: *const c_char,
+        src_size: i32,
+    ) -> i32 {
+        // If we cannot write to this address, then we get out signaling that
+        // we performed no work.
+        if written_bytes_p.is_null() || ctx.is_null() || *written_bytes_p < ENCRYPTION_OVERHEAD_B {
+            return LsmErrorCode::LsmError as i32;
+        }
+        let ctx = &*(ctx as *const LsmEncryptionCtx);
+
+        // Pages are compressed right after the space of the nonce.
+        let payload = dst.add(NONCE_LEN);
+        let mut payload_size = *written_bytes_p - ENCRYPTION_OVERHEAD_B;
+        match ctx.inner {
+            Some(lsm_compress {
+                compress: Some(compress),
+                ctx,
+                ..
+            }) => {
+                let rc = compress(ctx, payload, &mut payload_size, src, src_size);
+                if rc != 0 {
+                    return rc;
+                }
+            }
+            _ => {
+                if src_size > payload_size {
+                    return LsmErrorCode::LsmError as i32;
+                }
+                copy_nonoverlapping(src, payload, src_size as usize);
+                payload_size = src_size;
+            }
+        }
+
+        let nonce = ctx.next_nonce();
+        let payload = from_raw_parts_mut(payload as *mut u8, payload_size as usize);
+        let Ok(tag) = ctx.key.seal_in_place_separate_tag(
+            Nonce::assume_unique_for_key(nonce),
+            Aad::empty(),
+            payload,
+        ) else {
+            return LsmErrorCode::LsmError as i32;
+        };
+        let tag = tag.as_ref();
+        copy_nonoverlapping(nonce.as_ptr(), dst as *mut u8, NONCE_LEN);
+        copy_nonoverlapping(
+            tag.as_ptr(),
+            (dst as *mut u8).add(NONCE_LEN + payload.len()),
+            tag.len(),
+        );
+        *written_bytes_p = NONCE_LEN as i32 + payload_size + tag.len() as i32;
+        // This is LSM_OK.
+        0
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn decrypt_aead(
+        ctx: *const c_void,
+        dst: *mut c_char,
+        written_bytes_p: *mut i32,
+        src: *const c_char,
+        src_size: i32,
+    ) -> i32 {
+        // If we cannot write to this address, then we get out signaling that
+        // we performed no work.
+        if written_bytes_p.is_null() || ctx.is_null() {
+            return LsmErrorCode::LsmError as i32;
+        }
+        if src_size < ENCRYPTION_OVERHEAD_B {
+            return LsmErrorCode::LsmCorrupt as i32;
+        }
+        let ctx = &*(ctx as *const LsmEncryptionCtx);
+        let Ok(mut buffer) = ctx.buffer.lock() else {
+            return LsmErrorCode::LsmError as i32;
+        };
+
+        // The page is decrypted in place, thus it is copied off lsm1's buffer
+        // (which may be the cache of compressed pages) first.
+        let src = std::slice::from_raw_parts(src as *const u8, src_size as usize);
+        let (nonce, sealed) = src.split_at(NONCE_LEN);
+        buffer.clear();
+        buffer.extend_from_slice(sealed);
+        // This conversion is infallible.
+        let nonce = Nonce::assume_unique_for_key(nonce.try_into().unwrap());
+        let Ok(payload) = ctx.key.open_in_place(nonce, Aad::empty(), &mut buffer) else {
+            return LsmErrorCode::LsmCorrupt as i32;
+        };
+
+        match ctx.inner {
+            Some(lsm_compress {
+                uncompress: Some(uncompress),
+                ctx,
+                ..
+            }) => uncompress(
+                ctx,
+                dst,
+                written_bytes_p,
+                payload.as_ptr() as *const c_char,
+                payload.len() as i32,
+            ),
+            _ => {
+                if payload.len() > *written_bytes_p as usize {
+                    return LsmErrorCode::LsmCorrupt as i32;
+                }
+                copy_nonoverlapping(payload.as_ptr(), dst as *mut u8, payload.len());
+                *written_bytes_p = payload.len() as i32;
+                // This is LSM_OK.
+                0
+            }
+        }
+    }
+}
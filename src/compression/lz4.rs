@@ -11,33 +11,69 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
-use lz4_sys::{LZ4_compressBound, LZ4_compress_default, LZ4_decompress_safe};
-use std::ffi::{c_char, c_void};
+use lz4_sys::{LZ4_compressBound, LZ4_decompress_safe};
+use std::ffi::{c_char, c_int, c_void};
 use std::ptr::null_mut;
 
-use crate::compression::{lsm_compress, Compression};
+use crate::compression::{lsm_compress, Compression, ContextPool};
 use crate::{LsmCompressionLib, LsmErrorCode};
 
+// These are part of the lz4 library built by `lz4-sys`, but the crate
+// does not declare them.
+extern "C" {
+    fn LZ4_sizeofState() -> c_int;
+    fn LZ4_compress_fast_extState(
+        state: *mut c_void,
+        src: *const c_char,
+        dst: *mut c_char,
+        src_size: c_int,
+        dst_capacity: c_int,
+        acceleration: c_int,
+    ) -> c_int;
+}
+
+/// This is the context `lsm1` hands to the hooks. Every handle keeps its own
+/// compression states, so that they are not set up again for every page. Pages
+/// may be compressed by several threads at once, each with a state of its own.
+/// Decompression in lz4 needs no state at all.
+struct LsmLz4Ctx {
+    // lz4 requires the state to be 8-byte aligned.
+    states: ContextPool<Vec<u64>>,
+    state_size: usize,
+    acceleration: c_int,
+}
+
 /// This encloses the methods of the compression library.
 #[derive(Clone, Debug)]
 pub struct LsmLz4 {
     compression: lsm_compress,
+    acceleration: c_int,
 }
 
 impl LsmLz4 {
     /// This function produces a struct containing all relevant
-    /// function pointers set to lz4 functions.
-    pub fn new() -> Self {
+    /// function pointers set to lz4 functions. The given level is lz4's
+    /// acceleration: the higher, the faster but the worse compression ratio
+    /// is achieved. lz4's default (1) is used if none is given.
+    pub fn new(acceleration: Option<i32>) -> Self {
         Self {
             compression: lsm_compress {
                 ctx: null_mut(),
                 bound: Some(LsmLz4::compress_bound_lz4),
                 compress: Some(LsmLz4::compress_lz4),
                 uncompress: Some(LsmLz4::uncompress_lz4),
-                free: None,
+                free: Some(LsmLz4::free_lz4),
                 // This conversion is infallible.
                 id: u32::try_from(LsmCompressionLib::LZ4 as i32).unwrap(),
             },
+            acceleration: acceleration.unwrap_or(1),
+        }
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn free_lz4(ctx: *const c_void) {
+        if !ctx.is_null() {
+            drop(Box::from_raw(ctx as *mut LsmLz4Ctx));
         }
     }
 
@@ -48,7 +84,7 @@ impl LsmLz4 {
 
     #[no_mangle]
     unsafe extern "C" fn compress_lz4(
-        _: *const c_void,
+        ctx: *const c_void,
         dst: *mut c_char,
         written_bytes_p: *mut i32,
         src: *const c_char,
@@ -56,9 +92,14 @@ impl LsmLz4 {
     ) -> i32 {
         // If we cannot write to this address, then we get out signaling that
         // we performed no work.
-        if written_bytes_p.is_null() {
+        if written_bytes_p.is_null() || ctx.is_null() {
             return LsmErrorCode::LsmError as i32;
         }
+        let ctx = &*(ctx as *const LsmLz4Ctx);
+        let new_state = || Some(vec![0; ctx.state_size.div_ceil(size_of::<u64>())]);
+        let Some(mut state) = ctx.states.take(new_state) else {
+            return LsmErrorCode::LsmNoMem as i32;
+        };
 
         // Should be >= LZ4_compressBound(src_size).
         let buffer_size = *written_bytes_p;
@@ -66,7 +107,15 @@ impl LsmLz4 {
         // This will succeed if and only if `dst` has been allocated with
         // the proper size >= LZ4_compressBound(src_size), otherwise it will return
         // zero and the contents of the buffer can be considered trash.
-        let written_bytes = LZ4_compress_default(src, dst, src_size, buffer_size);
+        let written_bytes = LZ4_compress_fast_extState(
+            state.as_mut_ptr() as *mut c_void,
+            src,
+            dst,
+            src_size,
+            buffer_size,
+            ctx.acceleration,
+        );
+        ctx.states.put(state);
         if written_bytes <= 0 {
             LsmErrorCode::LsmError as i32
         } else {
@@ -106,9 +155,20 @@ impl LsmLz4 {
     }
 }
 
-/// This allows to get the methods that `lsm1` needs.
+/// This allows to get the methods that `lsm1` needs. Every call allocates
+/// a new context, which is released through the `free` hook.
 impl Compression for LsmLz4 {
     fn get_compression_methods(&self) -> Result<lsm_compress, LsmErrorCode> {
-        Ok(self.compression)
+        let state_size =
+            usize::try_from(unsafe { LZ4_sizeofState() }).map_err(|_| LsmErrorCode::LsmError)?;
+        let ctx = Box::new(LsmLz4Ctx {
+            states: ContextPool::new(),
+            state_size,
+            acceleration: self.acceleration,
+        });
+        Ok(lsm_compress {
+            ctx: Box::into_raw(ctx) as *mut c_void,
+            ..self.compression
+        })
     }
 }
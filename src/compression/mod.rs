@@ -11,13 +11,21 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+pub(crate) mod encryption;
 pub(crate) mod lz4;
 pub(crate) mod zlib;
 pub(crate) mod zstd;
 
-use crate::LsmErrorCode;
+use crate::compression::encryption::LsmEncryption;
+use crate::compression::lz4::LsmLz4;
+use crate::compression::zlib::LsmZLib;
+use crate::compression::zstd::LsmZStd;
+use crate::lsmdb::{lsm_config, lsm_config_age_compression};
+use crate::{lsm_db, DbConf, LsmCompressionLib, LsmErrorCode, LsmParam};
 
 use std::ffi::{c_char, c_void};
+use std::ptr::null_mut;
+use std::sync::Mutex;
 
 /// Unlike the other lsm structs. This cannot be opaque as its fields
 /// need to be set on our side, and not on lsm's side, see `lz4.rs`
@@ -50,6 +58,40 @@ pub struct lsm_compress {
     pub(crate) free: Option<unsafe extern "C" fn(ctx: *const c_void)>,
 }
 
+/// The contexts the hooks of a handle compress pages with. Pages may be compressed
+/// by several threads at once (see [`DbConf::with_compression_threads`]), thus
+/// every call takes a context out of the pool, or sets up a new one if there is
+/// none left, and puts it back once done. The lock is only held to do so. There
+/// are never more contexts than pages ever compressed at once.
+pub(crate) struct ContextPool<T> {
+    free: Mutex<Vec<T>>,
+}
+
+impl<T> ContextPool<T> {
+    pub(crate) fn new() -> Self {
+        Self {
+            free: Mutex::new(Vec::new()),
+        }
+    }
+
+    /// Takes a context out of the pool, or sets up a new one with `new`, which
+    /// returns `None` if it cannot.
+    pub(crate) fn take(&self, new: impl FnOnce() -> Option<T>) -> Option<T> {
+        self.free
+            .lock()
+            .ok()
+            .and_then(|mut free| free.pop())
+            .or_else(new)
+    }
+
+    /// Puts a context taken out of the pool back into it.
+    pub(crate) fn put(&self, ctx: T) {
+        if let Ok(mut free) = self.free.lock() {
+            free.push(ctx);
+        }
+    }
+}
+
 /// In the future there could be more compression/encryption libraries.
 /// We do not really care about their implementation, but in the end they
 /// have to produce an element of type `lms_compress`. So this trait
@@ -57,3 +99,163 @@ pub struct lsm_compress {
 pub trait Compression {
     fn get_compression_methods(&self) -> Result<lsm_compress, LsmErrorCode>;
 }
+
+// Bounds on the size of a compression dictionary (zstd cannot train smaller ones).
+pub(crate) const MIN_DICTIONARY_SIZE_B: usize = 256;
+pub(crate) const MAX_DICTIONARY_SIZE_B: usize = 1 << 20;
+
+/// Produces the hooks of the compression library configured (if any), using the
+/// level configured or the library's default one, to be configured on the given
+/// handle. The context of the hooks is allocated anew on every call, and it is
+/// owned by the handle the hooks are configured on, which releases it (through
+/// `free`) when closed. Only `ZStd` supports compression dictionaries, and only
+/// for databases that are not encrypted. If the database is encrypted, the hooks
+/// of the compression library (if any) are wrapped by those of the cipher.
+pub(crate) fn get_compression_methods(
+    db_handle: *mut lsm_db,
+    db_conf: &DbConf,
+) -> Result<Option<lsm_compress>, LsmErrorCode> {
+    if let Some(dictionary_size) = db_conf.compression_dictionary {
+        if db_conf.compression != LsmCompressionLib::ZStd
+            || db_conf.encryption.is_some()
+            || !(MIN_DICTIONARY_SIZE_B..=MAX_DICTIONARY_SIZE_B).contains(&dictionary_size)
+        {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+    }
+
+    let level = db_conf.compression_level;
+    let methods = match db_conf.compression {
+        LsmCompressionLib::NoCompression => None,
+        LsmCompressionLib::LZ4 => Some(LsmLz4::new(level).get_compression_methods()?),
+        LsmCompressionLib::ZLib => Some(LsmZLib::new(level).get_compression_methods()?),
+        LsmCompressionLib::ZStd => Some(
+            LsmZStd::new(level)
+                .for_handle(db_handle, db_conf.compression_dictionary)
+                .get_compression_methods()?,
+        ),
+    };
+    match &db_conf.encryption {
+        None => Ok(methods),
+        Some((cipher, key)) => LsmEncryption::new(*cipher, key.clone())
+            .wrap(methods)
+            .map(Some),
+    }
+}
+
+// The number of ages a compression library can be configured for.
+pub(crate) const MAX_AGE_COMPRESSION: usize = 8;
+
+// The largest saving (in percent) compressing a page can be required to achieve.
+pub(crate) const MAX_COMPRESSION_SAVING_PCT: u8 = 99;
+
+/// Configures, on the given handle, how much compressing a page has to save for
+/// it to be stored compressed (see [`DbConf::with_min_compression_saving`]), and
+/// the hooks of the compression libraries segments of certain ages are compressed
+/// with (see [`DbConf::with_age_compression`]). The hooks of the other libraries
+/// are configured as well, only to read segments written by handles configured
+/// otherwise. This has to be done after configuring the hooks of the database,
+/// and, as with those, the handle owns their context from then on. Pages of
+/// encrypted databases are never stored as they are, and the hooks of every
+/// library (even of no compression at all) are wrapped by those of the cipher.
+pub(crate) unsafe fn configure_compression_policy(
+    db_handle: *mut lsm_db,
+    db_conf: &DbConf,
+) -> Result<(), LsmErrorCode> {
+    if db_conf.encryption.is_some() {
+        if db_conf.min_compression_saving.is_some() {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+        let raw_pages: i32 = 0;
+        let rc = lsm_config(db_handle, LsmParam::RawPages as i32, &raw_pages);
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+    }
+    if db_conf.compression == LsmCompressionLib::NoCompression {
+        return match db_conf.age_compression.is_empty() && db_conf.min_compression_saving.is_none()
+        {
+            true => Ok(()),
+            false => Err(LsmErrorCode::LsmMisuse),
+        };
+    }
+    if let Some(saving) = db_conf.min_compression_saving {
+        if saving > MAX_COMPRESSION_SAVING_PCT {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+        let saving = i32::from(saving);
+        let rc = lsm_config(db_handle, LsmParam::MinCompressionSaving as i32, &saving);
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+    }
+    if db_conf.age_compression.len() > MAX_AGE_COMPRESSION {
+        return Err(LsmErrorCode::LsmMisuse);
+    }
+
+    // An age of -1 means that the hooks are only used to read segments.
+    let mut methods: Vec<(i32, LsmCompressionLib, Option<i32>)> = db_conf
+        .age_compression
+        .iter()
+        .map(|(age, compression, level)| (i32::from(*age), *compression, *level))
+        .collect();
+    for compression in [
+        LsmCompressionLib::LZ4,
+        LsmCompressionLib::ZLib,
+        LsmCompressionLib::ZStd,
+    ] {
+        if compression != db_conf.compression && !methods.iter().any(|(_, c, _)| *c == compression)
+        {
+            methods.push((-1, compression, None));
+        }
+    }
+
+    for (age, compression, level) in methods {
+        let lsm_compress = match compression {
+            // lsm1 stores pages as they are if there are no hooks.
+            LsmCompressionLib::NoCompression => None,
+            LsmCompressionLib::LZ4 => Some(LsmLz4::new(level).get_compression_methods()?),
+            LsmCompressionLib::ZLib => Some(LsmZLib::new(level).get_compression_methods()?),
+            LsmCompressionLib::ZStd => Some(
+                LsmZStd::new(level)
+                    .for_handle(db_handle, None)
+                    .get_compression_methods()?,
+            ),
+        };
+        let lsm_compress = match (&db_conf.encryption, lsm_compress) {
+            (Some((cipher, key)), lsm_compress) => {
+                LsmEncryption::new(*cipher, key.clone()).wrap(lsm_compress)?
+            }
+            (None, Some(lsm_compress)) => lsm_compress,
+            (None, None) => lsm_compress {
+                ctx: null_mut(),
+                id: LsmCompressionLib::NoCompression as u32,
+                bound: None,
+                compress: None,
+                uncompress: None,
+                free: None,
+            },
+        };
+        let rc = lsm_config_age_compression(db_handle, age, &lsm_compress);
+        if rc != 0 {
+            if let Some(free) = lsm_compress.free {
+                free(lsm_compress.ctx);
+            }
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+    }
+    Ok(())
+}
+
+/// Gives the given hooks (if any) the chance to train a compression dictionary
+/// from the pages they sampled and to store it in the database. This has to be
+/// done by the handle the hooks are configured on, while it is not working on
+/// the database. If `force` is set, the dictionary is trained from however many
+/// pages were sampled so far.
+pub(crate) fn store_compression_dictionary(db_compress: Option<&lsm_compress>, force: bool) {
+    if let Some(compression) = db_compress {
+        if compression.id == LsmCompressionLib::ZStd as u32 {
+            unsafe { LsmZStd::store_dictionary(compression, force) }
+        }
+    }
+}
@@ -11,23 +11,121 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
-use libz_sys::{compress, compressBound, uLong, uncompress, Bytef, Z_OK};
-use std::ffi::{c_char, c_int, c_ulong, c_void};
+use libz_sys::{
+    compressBound, deflate, deflateEnd, deflateInit_, deflateReset, inflate, inflateEnd,
+    inflateInit_, inflateReset, uInt, voidpf, z_stream, zlibVersion, Bytef, Z_DEFAULT_COMPRESSION,
+    Z_FINISH, Z_OK, Z_STREAM_END,
+};
+use std::alloc::{alloc, dealloc, Layout};
+use std::ffi::{c_char, c_int, c_void};
 use std::ptr::null_mut;
+use std::sync::Mutex;
 
-use crate::compression::{lsm_compress, Compression};
+use crate::compression::{lsm_compress, Compression, ContextPool};
 use crate::{LsmCompressionLib, LsmErrorCode};
 
+// zlib stores nothing about its allocations, so we keep their size
+// right before the memory handed out.
+const ALLOC_ALIGN: usize = align_of::<usize>();
+
+unsafe extern "C" fn zalloc(_: voidpf, items: uInt, size: uInt) -> voidpf {
+    let Some(size) = (items as usize)
+        .checked_mul(size as usize)
+        .and_then(|size| size.checked_add(ALLOC_ALIGN))
+    else {
+        return null_mut();
+    };
+    let Ok(layout) = Layout::from_size_align(size, ALLOC_ALIGN) else {
+        return null_mut();
+    };
+    let ptr = alloc(layout) as *mut usize;
+    if ptr.is_null() {
+        return null_mut();
+    }
+    *ptr = size;
+    ptr.add(1) as voidpf
+}
+
+unsafe extern "C" fn zfree(_: voidpf, address: voidpf) {
+    if address.is_null() {
+        return;
+    }
+    let ptr = (address as *mut usize).sub(1);
+    dealloc(
+        ptr as *mut u8,
+        Layout::from_size_align_unchecked(*ptr, ALLOC_ALIGN),
+    );
+}
+
+/// Produces a stream that is yet to be initialized. Once initialized, a stream
+/// must not be moved, as zlib keeps a pointer back to it, thus it is boxed.
+fn new_stream() -> Box<z_stream> {
+    Box::new(z_stream {
+        next_in: null_mut(),
+        avail_in: 0,
+        total_in: 0,
+        next_out: null_mut(),
+        avail_out: 0,
+        total_out: 0,
+        msg: null_mut(),
+        state: null_mut(),
+        zalloc,
+        zfree,
+        opaque: null_mut(),
+        data_type: 0,
+        adler: 0,
+        reserved: 0,
+    })
+}
+
+/// A deflate stream, which is ended when dropped.
+struct LsmZLibDeflate(Box<z_stream>);
+
+impl Drop for LsmZLibDeflate {
+    fn drop(&mut self) {
+        // Ending a stream that could not be initialized is a no-op.
+        unsafe {
+            deflateEnd(&mut *self.0);
+        }
+    }
+}
+
+/// This is the context `lsm1` hands to the hooks. Every handle keeps its own
+/// streams, which are reset (instead of being set up again) for every page.
+/// Pages may be compressed by several threads at once, each with a deflate
+/// stream of its own. The inflate stream is behind a lock because cursors of
+/// the same handle may be used from different threads. Deflate streams take
+/// far more memory than the inflate one, thus they are set up only once the
+/// handle compresses a page.
+struct LsmZLibCtx {
+    deflate: ContextPool<LsmZLibDeflate>,
+    inflate: Mutex<Box<z_stream>>,
+    level: c_int,
+}
+
+impl Drop for LsmZLibCtx {
+    fn drop(&mut self) {
+        // Ending a stream that could not be initialized is a no-op.
+        unsafe {
+            if let Ok(stream) = self.inflate.get_mut() {
+                inflateEnd(&mut **stream);
+            }
+        }
+    }
+}
+
 /// This encloses the methods of the compression library.
 #[derive(Clone, Debug)]
 pub struct LsmZLib {
     compression: lsm_compress,
+    level: c_int,
 }
 
 impl LsmZLib {
     /// This function produces a struct containing all relevant
-    /// function pointers set to zlib functions.
-    pub fn new() -> Self {
+    /// function pointers set to zlib functions. The given level is zlib's
+    /// compression level (0 to 9), its default level is used if none is given.
+    pub fn new(level: Option<i32>) -> Self {
         Self {
             compression: lsm_compress {
                 ctx: null_mut(),
@@ -36,8 +134,16 @@ impl LsmZLib {
                 bound: Some(LsmZLib::compress_bound_zlib),
                 compress: Some(LsmZLib::compress_zlib),
                 uncompress: Some(LsmZLib::uncompress_zlib),
-                free: None,
+                free: Some(LsmZLib::free_zlib),
             },
+            level: level.unwrap_or(Z_DEFAULT_COMPRESSION),
+        }
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn free_zlib(ctx: *const c_void) {
+        if !ctx.is_null() {
+            drop(Box::from_raw(ctx as *mut LsmZLibCtx));
         }
     }
 
@@ -50,7 +156,7 @@ impl LsmZLib {
 
     #[no_mangle]
     unsafe extern "C" fn compress_zlib(
-        _: *const c_void,
+        ctx: *const c_void,
         dst: *mut c_char,
         written_bytes_p: *mut i32,
         src: *const c_char,
@@ -58,31 +164,49 @@ impl LsmZLib {
     ) -> i32 {
         // If we cannot write to this address, then we get out signaling that
         // we performed no work.
-        if written_bytes_p.is_null() {
+        if written_bytes_p.is_null() || ctx.is_null() {
+            return LsmErrorCode::LsmError as i32;
+        }
+        let ctx = &*(ctx as *const LsmZLibCtx);
+        let new_deflate = || {
+            let mut deflate = LsmZLibDeflate(new_stream());
+            let rc = deflateInit_(
+                &mut *deflate.0,
+                ctx.level,
+                zlibVersion(),
+                size_of::<z_stream>() as c_int,
+            );
+            (rc == Z_OK).then_some(deflate)
+        };
+        let Some(mut deflate_stream) = ctx.deflate.take(new_deflate) else {
+            return LsmErrorCode::LsmNoMem as i32;
+        };
+        let stream = &mut deflate_stream.0;
+        if deflateReset(&mut **stream) != Z_OK {
             return LsmErrorCode::LsmError as i32;
         }
 
         // The buffer we write to is of this size.
-        let mut buffer_size: uLong = *written_bytes_p as uLong;
-
-        // Let's do it.
-        let rc: c_int = compress(
-            dst as *mut Bytef,
-            &mut buffer_size,
-            src as *const Bytef,
-            src_size as c_ulong,
-        );
-        if rc != Z_OK {
+        stream.next_in = src as *mut Bytef;
+        stream.avail_in = src_size as uInt;
+        stream.next_out = dst as *mut Bytef;
+        stream.avail_out = *written_bytes_p as uInt;
+
+        // Let's do it. The whole page has to be compressed in one go.
+        let rc: c_int = deflate(&mut **stream, Z_FINISH);
+        let rc = if rc != Z_STREAM_END {
             LsmErrorCode::LsmError as i32
         } else {
-            *written_bytes_p = buffer_size as i32;
+            *written_bytes_p = stream.total_out as i32;
             0
-        }
+        };
+        ctx.deflate.put(deflate_stream);
+        rc
     }
 
     #[no_mangle]
     unsafe extern "C" fn uncompress_zlib(
-        _: *const c_void,
+        ctx: *const c_void,
         dst: *mut c_char,
         written_bytes_p: *mut i32,
         src: *const c_char,
@@ -90,33 +214,62 @@ impl LsmZLib {
     ) -> i32 {
         // If we cannot write to this address, then we get out signaling that
         // we performed no work.
-        if written_bytes_p.is_null() {
+        if written_bytes_p.is_null() || ctx.is_null() {
+            return LsmErrorCode::LsmError as i32;
+        }
+        let ctx = &*(ctx as *const LsmZLibCtx);
+        let Ok(mut stream) = ctx.inflate.lock() else {
+            return LsmErrorCode::LsmError as i32;
+        };
+        if inflateReset(&mut **stream) != Z_OK {
             return LsmErrorCode::LsmError as i32;
         }
 
         // The buffer we write to is of this size.
-        let mut buffer_size: uLong = *written_bytes_p as uLong;
-
-        // Let's do it.
-        let rc: c_int = uncompress(
-            dst as *mut Bytef,
-            &mut buffer_size,
-            src as *const Bytef,
-            src_size.try_into().unwrap(),
-        );
+        stream.next_in = src as *mut Bytef;
+        stream.avail_in = src_size as uInt;
+        stream.next_out = dst as *mut Bytef;
+        stream.avail_out = *written_bytes_p as uInt;
 
-        if rc != Z_OK {
+        // Let's do it. The whole page has to be decompressed in one go.
+        let rc: c_int = inflate(&mut **stream, Z_FINISH);
+        if rc != Z_STREAM_END {
             LsmErrorCode::LsmError as i32
         } else {
-            *written_bytes_p = buffer_size as i32;
+            *written_bytes_p = stream.total_out as i32;
             0
         }
     }
 }
 
-/// This allows to get the methods that `lsm1` needs.
+/// This allows to get the methods that `lsm1` needs. Every call allocates
+/// new streams, which are released through the `free` hook.
 impl Compression for LsmZLib {
     fn get_compression_methods(&self) -> Result<lsm_compress, LsmErrorCode> {
-        Ok(self.compression)
+        // zlib would only complain about the level once a page is compressed.
+        if self.level != Z_DEFAULT_COMPRESSION && !(0..=9).contains(&self.level) {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+        let mut inflate_stream = new_stream();
+        let inflate_rc = unsafe {
+            inflateInit_(
+                &mut *inflate_stream,
+                zlibVersion(),
+                size_of::<z_stream>() as c_int,
+            )
+        };
+        let ctx = Box::new(LsmZLibCtx {
+            deflate: ContextPool::new(),
+            inflate: Mutex::new(inflate_stream),
+            level: self.level,
+        });
+        // Dropping the context releases the stream if it was initialized.
+        if inflate_rc != Z_OK {
+            return Err(LsmErrorCode::LsmNoMem);
+        }
+        Ok(lsm_compress {
+            ctx: Box::into_raw(ctx) as *mut c_void,
+            ..self.compression
+        })
     }
 }
@@ -11,25 +11,200 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
-use std::ffi::{c_char, c_int, c_void};
+use std::ffi::{c_char, c_int, c_uint, c_void, CStr};
 use std::ptr::null_mut;
+use std::sync::{Arc, Mutex};
 use zstd_sys::{
-    ZSTD_compress, ZSTD_compressBound, ZSTD_decompress, ZSTD_isError, ZSTD_CLEVEL_DEFAULT,
+    ZDICT_getErrorName, ZDICT_isError, ZDICT_trainFromBuffer, ZSTD_CCtx, ZSTD_CDict, ZSTD_DCtx,
+    ZSTD_DDict, ZSTD_compressBound, ZSTD_compressCCtx, ZSTD_compress_usingCDict, ZSTD_createCCtx,
+    ZSTD_createCDict, ZSTD_createDCtx, ZSTD_createDDict, ZSTD_decompressDCtx,
+    ZSTD_decompress_usingDDict, ZSTD_freeCCtx, ZSTD_freeCDict, ZSTD_freeDCtx, ZSTD_freeDDict,
+    ZSTD_getDictID_fromDict, ZSTD_getDictID_fromFrame, ZSTD_isError, ZSTD_CLEVEL_DEFAULT,
 };
 
-use crate::compression::{lsm_compress, Compression};
-use crate::{LsmCompressionLib, LsmErrorCode};
+use crate::compression::{lsm_compress, Compression, ContextPool};
+use crate::lsmdb::{lsm_dictionary_read, lsm_dictionary_write, lsm_free, lsm_get_env};
+use crate::{lsm_db, LsmCompressionLib, LsmErrorCode};
+
+// A dictionary is trained from (roughly) this many times its size worth of
+// sampled pages, as recommended by zstd...
+const DICTIONARY_SAMPLES_RATIO: usize = 100;
+// ...but never from more than this many bytes of pages.
+const MAX_DICTIONARY_SAMPLES_B: usize = 16 << 20;
+
+/// This is a dictionary stored in the database file, ready to be used to
+/// compress and decompress pages. Building it is as expensive as compressing
+/// many pages, thus every handle builds it only once. It is only read from
+/// once built, thus it may be used by several threads at once.
+struct LsmZStdDictionary {
+    id: u32,
+    cdict: *mut ZSTD_CDict,
+    ddict: *mut ZSTD_DDict,
+}
+
+impl Drop for LsmZStdDictionary {
+    fn drop(&mut self) {
+        unsafe {
+            ZSTD_freeCDict(self.cdict);
+            ZSTD_freeDDict(self.ddict);
+        }
+    }
+}
+
+impl LsmZStdDictionary {
+    /// Reads the dictionary stored in the database (if any) and prepares it
+    /// for compressing at the given level.
+    unsafe fn load(db_handle: *mut lsm_db, level: c_int) -> Result<Option<Self>, LsmErrorCode> {
+        let mut id: c_uint = 0;
+        let mut dict: *mut c_void = null_mut();
+        let mut dict_len: i32 = 0;
+        let rc = lsm_dictionary_read(db_handle, &mut id, &mut dict, &mut dict_len);
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        if id == 0 {
+            return Ok(None);
+        }
+
+        // Both zstd structures copy the dictionary, thus we can release it right away.
+        let dictionary = Self {
+            id,
+            cdict: ZSTD_createCDict(dict, dict_len as usize, level),
+            ddict: ZSTD_createDDict(dict, dict_len as usize),
+        };
+        lsm_free(lsm_get_env(db_handle), dict as *mut c_char);
+        if dictionary.cdict.is_null() || dictionary.ddict.is_null() {
+            return Err(LsmErrorCode::LsmNoMem);
+        }
+        Ok(Some(dictionary))
+    }
+}
+
+/// These are the pages sampled (while there is no dictionary in the database)
+/// to train a dictionary from. Once trained, the dictionary is kept here until
+/// it can be stored in the database.
+struct LsmZStdTraining {
+    dictionary_size: usize,
+    samples: Vec<u8>,
+    sample_sizes: Vec<usize>,
+    trained: Option<Vec<u8>>,
+}
+
+impl LsmZStdTraining {
+    fn samples_capacity(&self) -> usize {
+        (self.dictionary_size * DICTIONARY_SAMPLES_RATIO).min(MAX_DICTIONARY_SAMPLES_B)
+    }
+
+    fn is_full(&self) -> bool {
+        self.samples.len() >= self.samples_capacity()
+    }
+
+    fn sample(&mut self, page: &[u8]) {
+        if !self.is_full() {
+            self.samples.extend_from_slice(page);
+            self.sample_sizes.push(page.len());
+        }
+    }
+
+    unsafe fn train(&self) -> Result<Vec<u8>, String> {
+        let mut dictionary = vec![0u8; self.dictionary_size];
+        let dictionary_len = ZDICT_trainFromBuffer(
+            dictionary.as_mut_ptr() as *mut c_void,
+            dictionary.len(),
+            self.samples.as_ptr() as *const c_void,
+            self.sample_sizes.as_ptr(),
+            self.sample_sizes.len() as c_uint,
+        );
+        if ZDICT_isError(dictionary_len) != 0 {
+            let reason = CStr::from_ptr(ZDICT_getErrorName(dictionary_len));
+            return Err(reason.to_string_lossy().into_owned());
+        }
+        dictionary.truncate(dictionary_len);
+        Ok(dictionary)
+    }
+}
+
+/// A zstd compression context, which is released when dropped.
+struct LsmZStdCCtx(*mut ZSTD_CCtx);
+
+impl Drop for LsmZStdCCtx {
+    fn drop(&mut self) {
+        unsafe {
+            ZSTD_freeCCtx(self.0);
+        }
+    }
+}
+
+/// This is the context `lsm1` hands to the hooks. Setting up a zstd context
+/// is far more expensive than compressing a single page, thus every handle
+/// keeps its own contexts for its whole lifetime. Pages may be compressed by
+/// several threads at once, each with a compression context of its own. The
+/// decompression context is behind a lock because cursors of the same handle
+/// may be used from different threads. The handle is needed to look up the
+/// dictionary stored in the database.
+struct LsmZStdCtx {
+    db_handle: *mut lsm_db,
+    cctx: ContextPool<LsmZStdCCtx>,
+    dctx: Mutex<*mut ZSTD_DCtx>,
+    level: c_int,
+    dictionary: Mutex<Option<Arc<LsmZStdDictionary>>>,
+    training: Mutex<Option<LsmZStdTraining>>,
+}
+
+impl Drop for LsmZStdCtx {
+    fn drop(&mut self) {
+        unsafe {
+            if let Ok(dctx) = self.dctx.get_mut() {
+                ZSTD_freeDCtx(*dctx);
+            }
+        }
+    }
+}
+
+impl LsmZStdCtx {
+    /// Returns the dictionary with the given id, loading it from the database
+    /// if needed. Pages compressed with a dictionary other than the one stored
+    /// in the database cannot be decompressed. The lock is not held while the
+    /// dictionary is used.
+    unsafe fn get_dictionary(&self, id: u32) -> Result<Arc<LsmZStdDictionary>, LsmErrorCode> {
+        let Ok(mut slot) = self.dictionary.lock() else {
+            return Err(LsmErrorCode::LsmError);
+        };
+        if slot.as_ref().map(|dictionary| dictionary.id) != Some(id) {
+            *slot = LsmZStdDictionary::load(self.db_handle, self.level)?.map(Arc::new);
+        }
+        match slot.as_ref() {
+            Some(dictionary) if dictionary.id == id => Ok(Arc::clone(dictionary)),
+            _ => Err(LsmErrorCode::LsmCorrupt),
+        }
+    }
+
+    /// Pages are sampled only as long as there is no dictionary in the database.
+    fn sample(&self, page: &[u8], dictionary_id: u32) {
+        if let Ok(mut training) = self.training.lock() {
+            if dictionary_id != 0 {
+                *training = None;
+            } else if let Some(training) = training.as_mut() {
+                training.sample(page);
+            }
+        }
+    }
+}
 
 /// This encloses the methods of the compression library.
 #[derive(Clone, Debug)]
 pub struct LsmZStd {
     compression: lsm_compress,
+    level: c_int,
+    db_handle: *mut lsm_db,
+    dictionary_size: Option<usize>,
 }
 
 impl LsmZStd {
     /// This function produces a struct containing all relevant
-    /// function pointers set to zstd functions.
-    pub fn new() -> Self {
+    /// function pointers set to zstd functions. The given level is
+    /// zstd's compression level, its default level is used if none is given.
+    pub fn new(level: Option<i32>) -> Self {
         Self {
             compression: lsm_compress {
                 ctx: null_mut(),
@@ -38,8 +213,102 @@ impl LsmZStd {
                 bound: Some(LsmZStd::compress_bound_zstd),
                 compress: Some(LsmZStd::compress_zstd),
                 uncompress: Some(LsmZStd::uncompress_zstd),
-                free: None,
+                free: Some(LsmZStd::free_zstd),
             },
+            level: level.unwrap_or(ZSTD_CLEVEL_DEFAULT as c_int),
+            db_handle: null_mut(),
+            dictionary_size: None,
+        }
+    }
+
+    /// The hooks are to be configured on the given handle. Through it, they
+    /// use the dictionary stored in the database (if any). If a dictionary size
+    /// is given, the hooks sample the pages they compress until there are enough
+    /// of them to train a dictionary of (at most) that size from.
+    pub(crate) fn for_handle(
+        mut self,
+        db_handle: *mut lsm_db,
+        dictionary_size: Option<usize>,
+    ) -> Self {
+        self.db_handle = db_handle;
+        self.dictionary_size = dictionary_size;
+        self
+    }
+
+    /// If the given hooks sampled enough pages (or `force` is set and there is
+    /// at least a sample), a dictionary is trained from them and stored in the
+    /// database. This cannot be done from within the hooks, as they are invoked
+    /// while the database is being worked on. Failing to do so is not an error,
+    /// as pages can always be compressed without a dictionary.
+    pub(crate) unsafe fn store_dictionary(compression: &lsm_compress, force: bool) {
+        if compression.ctx.is_null() {
+            return;
+        }
+        let ctx = &*(compression.ctx as *const LsmZStdCtx);
+        let Ok(mut training) = ctx.training.lock() else {
+            return;
+        };
+        let Some(state) = training.as_mut() else {
+            return;
+        };
+
+        // Another handle might have stored a dictionary already.
+        let mut id: c_uint = 0;
+        if lsm_dictionary_read(ctx.db_handle, &mut id, null_mut(), null_mut()) != 0 || id != 0 {
+            *training = None;
+            return;
+        }
+
+        if state.trained.is_none() {
+            let enough_samples = state.is_full() || (force && !state.sample_sizes.is_empty());
+            if !enough_samples {
+                return;
+            }
+            match state.train() {
+                Ok(dictionary) => state.trained = Some(dictionary),
+                Err(reason) => {
+                    tracing::warn!(
+                        samples = state.sample_sizes.len(),
+                        reason,
+                        "Could not train a compression dictionary.",
+                    );
+                    // More samples will not make a difference.
+                    if state.is_full() {
+                        *training = None;
+                    }
+                    return;
+                }
+            }
+        }
+
+        let Some(dictionary) = state.trained.as_ref() else {
+            return;
+        };
+        let rc = lsm_dictionary_write(
+            ctx.db_handle,
+            ZSTD_getDictID_fromDict(dictionary.as_ptr() as *const c_void, dictionary.len()),
+            dictionary.as_ptr() as *const c_void,
+            dictionary.len() as i32,
+        );
+        match rc {
+            0 => *training = None,
+            // The database is being worked on by another handle (busy), or this
+            // handle has a transaction or cursor open (misuse), we try again later.
+            5 | 21 => {}
+            _ => {
+                tracing::warn!(
+                    rc = ?LsmErrorCode::try_from(rc),
+                    "Could not store a compression dictionary.",
+                );
+                *training = None;
+            }
+        }
+    }
+
+    #[no_mangle]
+    unsafe extern "C" fn free_zstd(ctx: *const c_void) {
+        if !ctx.is_null() {
+            drop(Box::from_raw(ctx as *mut LsmZStdCtx));
         }
     }
 
@@ -50,7 +319,7 @@ impl LsmZStd {
 
     #[no_mangle]
     unsafe extern "C" fn compress_zstd(
-        _: *const c_void,
+        ctx: *const c_void,
         dst: *mut c_char,
         written_bytes_p: *mut i32,
         src: *const c_char,
@@ -58,21 +327,59 @@ impl LsmZStd {
     ) -> i32 {
         // If we cannot write to this address, then we get out signaling that
         // we performed no work.
-        if written_bytes_p.is_null() {
+        if written_bytes_p.is_null() || ctx.is_null() {
+            return LsmErrorCode::LsmError as i32;
+        }
+        let ctx = &*(ctx as *const LsmZStdCtx);
+
+        // Pages are compressed with the dictionary stored in the database, if any.
+        // Only the identifier is read here, without touching the database file, as
+        // this runs on the threads compressing pages as long as there is none.
+        let mut dictionary_id: c_uint = 0;
+        if lsm_dictionary_read(ctx.db_handle, &mut dictionary_id, null_mut(), null_mut()) != 0 {
             return LsmErrorCode::LsmError as i32;
         }
+        ctx.sample(
+            std::slice::from_raw_parts(src as *const u8, src_size as usize),
+            dictionary_id,
+        );
+
+        let new_cctx = || {
+            let cctx = ZSTD_createCCtx();
+            (!cctx.is_null()).then_some(LsmZStdCCtx(cctx))
+        };
+        let Some(cctx) = ctx.cctx.take(new_cctx) else {
+            return LsmErrorCode::LsmNoMem as i32;
+        };
 
         // The buffer we write to is of this size.
         let buffer_size: usize = *written_bytes_p as usize;
 
         // Let's do it.
-        let written_bytes: usize = ZSTD_compress(
-            dst as *mut c_void,
-            buffer_size,
-            src as *const c_void,
-            src_size as usize,
-            ZSTD_CLEVEL_DEFAULT as c_int,
-        );
+        let written_bytes: usize = if dictionary_id == 0 {
+            ZSTD_compressCCtx(
+                cctx.0,
+                dst as *mut c_void,
+                buffer_size,
+                src as *const c_void,
+                src_size as usize,
+                ctx.level,
+            )
+        } else {
+            let dictionary = match ctx.get_dictionary(dictionary_id) {
+                Ok(dictionary) => dictionary,
+                Err(ec) => return ec as i32,
+            };
+            ZSTD_compress_usingCDict(
+                cctx.0,
+                dst as *mut c_void,
+                buffer_size,
+                src as *const c_void,
+                src_size as usize,
+                dictionary.cdict,
+            )
+        };
+        ctx.cctx.put(cctx);
 
         // Non-zero iff the code is an error.
         if ZSTD_isError(written_bytes) != 0 {
@@ -85,7 +392,7 @@ impl LsmZStd {
 
     #[no_mangle]
     unsafe extern "C" fn uncompress_zstd(
-        _: *const c_void,
+        ctx: *const c_void,
         dst: *mut c_char,
         written_bytes_p: *mut i32,
         src: *const c_char,
@@ -93,20 +400,41 @@ impl LsmZStd {
     ) -> i32 {
         // If we cannot write to this address, then we get out signaling that
         // we performed no work.
-        if written_bytes_p.is_null() {
+        if written_bytes_p.is_null() || ctx.is_null() {
             return LsmErrorCode::LsmError as i32;
         }
+        let ctx = &*(ctx as *const LsmZStdCtx);
+        let Ok(dctx) = ctx.dctx.lock() else {
+            return LsmErrorCode::LsmError as i32;
+        };
 
         // The buffer we write to is of this size.
         let buffer_size: usize = *written_bytes_p as usize;
 
-        // Let's do it.
-        let written_bytes: usize = ZSTD_decompress(
-            dst as *mut c_void,
-            buffer_size,
-            src as *const c_void,
-            src_size as usize,
-        );
+        // Let's do it. Pages compressed with a dictionary carry its id.
+        let dictionary_id = ZSTD_getDictID_fromFrame(src as *const c_void, src_size as usize);
+        let written_bytes: usize = if dictionary_id == 0 {
+            ZSTD_decompressDCtx(
+                *dctx,
+                dst as *mut c_void,
+                buffer_size,
+                src as *const c_void,
+                src_size as usize,
+            )
+        } else {
+            let dictionary = match ctx.get_dictionary(dictionary_id) {
+                Ok(dictionary) => dictionary,
+                Err(ec) => return ec as i32,
+            };
+            ZSTD_decompress_usingDDict(
+                *dctx,
+                dst as *mut c_void,
+                buffer_size,
+                src as *const c_void,
+                src_size as usize,
+                dictionary.ddict,
+            )
+        };
 
         // Non-zero iff the code is an error.
         if ZSTD_isError(written_bytes) != 0 {
@@ -118,9 +446,31 @@ impl LsmZStd {
     }
 }
 
-/// This allows to get the methods that `lsm1` needs.
+/// This allows to get the methods that `lsm1` needs. Every call allocates
+/// new contexts, which are released through the `free` hook.
 impl Compression for LsmZStd {
     fn get_compression_methods(&self) -> Result<lsm_compress, LsmErrorCode> {
-        Ok(self.compression)
+        let dctx = unsafe { ZSTD_createDCtx() };
+        if dctx.is_null() {
+            return Err(LsmErrorCode::LsmNoMem);
+        }
+        // Compression contexts are set up once the handle compresses a page.
+        let ctx = Box::new(LsmZStdCtx {
+            db_handle: self.db_handle,
+            cctx: ContextPool::new(),
+            dctx: Mutex::new(dctx),
+            level: self.level,
+            dictionary: Mutex::new(None),
+            training: Mutex::new(self.dictionary_size.map(|dictionary_size| LsmZStdTraining {
+                dictionary_size,
+                samples: Vec::new(),
+                sample_sizes: Vec::new(),
+                trained: None,
+            })),
+        });
+        Ok(lsm_compress {
+            ctx: Box::into_raw(ctx) as *mut c_void,
+            ..self.compression
+        })
     }
 }
@@ -0,0 +1,89 @@
+// Copyright 2023 Helsing GmbH
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+use std::cmp::Ordering;
+use std::ffi::c_void;
+use std::panic::catch_unwind;
+use std::slice::from_raw_parts;
+
+use crate::lsmdb::{lsm_config, lsm_config_compare};
+use crate::{lsm_db, DbConf, LsmKeyComparator, LsmParam};
+
+/// The comparison function `lsm1` calls back into.
+type LsmCompareFn = unsafe extern "C" fn(*mut c_void, i32, *mut c_void, i32) -> i32;
+
+/// A key comparator given by the user (see [`DbConf::with_key_comparator`]). As
+/// `lsm1` hands no context to its comparison function, the comparator is stateless,
+/// and is configured as an instance of [`LsmKeyComparatorFns::compare_entry`] for
+/// its type. The comparator itself is kept as well, to sort keys on the Rust side.
+#[derive(Copy, Clone, Debug)]
+pub(crate) struct LsmKeyComparatorFns {
+    pub(crate) compare: fn(&[u8], &[u8]) -> Ordering,
+    compare_entry: LsmCompareFn,
+}
+
+impl LsmKeyComparatorFns {
+    pub(crate) fn new<C: LsmKeyComparator>() -> Self {
+        Self {
+            compare: C::compare,
+            compare_entry: LsmKeyComparatorFns::compare_entry::<C>,
+        }
+    }
+
+    unsafe extern "C" fn compare_entry<C: LsmKeyComparator>(
+        lhs: *mut c_void,
+        lhs_len: i32,
+        rhs: *mut c_void,
+        rhs_len: i32,
+    ) -> i32 {
+        let lhs: &[u8] = if lhs.is_null() || lhs_len <= 0 {
+            &[]
+        } else {
+            from_raw_parts(lhs as *const u8, lhs_len as usize)
+        };
+        let rhs: &[u8] = if rhs.is_null() || rhs_len <= 0 {
+            &[]
+        } else {
+            from_raw_parts(rhs as *const u8, rhs_len as usize)
+        };
+
+        // A panic must not cross the FFI boundary. Unlike other callbacks, a
+        // comparison has no way to report an error, and the structures being
+        // searched or built in its order cannot be left as they are. Thus, we
+        // abort (as unwinding out of this function would do as well).
+        match catch_unwind(|| C::compare(lhs, rhs)) {
+            Ok(Ordering::Less) => -1,
+            Ok(Ordering::Equal) => 0,
+            Ok(Ordering::Greater) => 1,
+            Err(_) => {
+                tracing::error!("Key comparator panicked. Aborting.");
+                std::process::abort();
+            }
+        }
+    }
+}
+
+/// Configures the order of keys on the given handle, which must not be open yet.
+/// A key comparator, if given, takes precedence over the key format.
+pub(crate) fn configure_key_order(db_handle: *mut lsm_db, db_conf: &DbConf) -> i32 {
+    let key_format: i32 = db_conf.key_format as i32;
+    unsafe {
+        let mut rc = lsm_config(db_handle, LsmParam::KeyFormat as i32, &key_format);
+        if rc == 0 {
+            if let Some(comparator) = db_conf.key_comparator.as_ref() {
+                rc = lsm_config_compare(db_handle, Some(comparator.compare_entry));
+            }
+        }
+        rc
+    }
+}
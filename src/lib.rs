@@ -19,18 +19,27 @@ This documentation contains examples that show how to create a database, as well
 */
 
 // Private mods.
+mod compaction_filter;
 mod compression;
+mod key_comparator;
 mod lsmdb;
+mod merge_operator;
+mod sorting_loader;
 mod threads;
 
+use crate::compaction_filter::LsmCompactionFilterCtx;
+use crate::compression::encryption::LsmEncryptionKey;
 use crate::compression::lsm_compress;
+use crate::key_comparator::LsmKeyComparatorFns;
+use crate::merge_operator::LsmMergeOperatorCtx;
+use crate::sorting_loader::LsmSortRecord;
 use prometheus::Histogram;
 use serde::{Deserialize, Serialize};
 use std::cmp::Ordering;
 use std::ffi::CString;
 use std::marker::{PhantomData, PhantomPinned};
 use std::path::PathBuf;
-use std::sync::mpsc;
+use std::sync::{mpsc, Arc};
 use std::thread;
 
 /// This struct contains the configuration of a database.
@@ -42,6 +51,28 @@ pub struct DbConf {
     pub(crate) mode: LsmMode,
     pub(crate) metrics: Option<LsmMetrics>,
     pub(crate) compression: LsmCompressionLib,
+    pub(crate) compression_level: Option<i32>,
+    pub(crate) compression_dictionary: Option<usize>,
+    pub(crate) age_compression: Vec<(u16, LsmCompressionLib, Option<i32>)>,
+    pub(crate) min_compression_saving: Option<u8>,
+    pub(crate) compression_threads: Option<u32>,
+    pub(crate) encryption: Option<(LsmCipher, LsmEncryptionKey)>,
+    pub(crate) page_cache_size_kb: Option<u32>,
+    pub(crate) compressed_page_cache_size_kb: Option<u32>,
+    pub(crate) mmap_advice: Option<LsmMmapAdvice>,
+    pub(crate) readahead_kb: Option<u32>,
+    pub(crate) writeback: Option<(u32, bool)>,
+    pub(crate) preallocation_kb: Option<u32>,
+    pub(crate) punch_holes: bool,
+    pub(crate) value_log_threshold_b: Option<u32>,
+    pub(crate) prefix_keys: bool,
+    pub(crate) key_format: LsmKeyFormat,
+    pub(crate) key_comparator: Option<LsmKeyComparatorFns>,
+    pub(crate) compaction: LsmCompactionPolicy,
+    pub(crate) level_size_ratio: Option<u32>,
+    pub(crate) tombstone_ratio_pct: Option<u8>,
+    pub(crate) compaction_filter: Option<Arc<dyn LsmCompactionFilter>>,
+    pub(crate) merge_operator: Option<Arc<dyn LsmMergeOperator>>,
 }
 
 impl DbConf {
@@ -143,8 +174,739 @@ impl DbConf {
             mode,
             metrics,
             compression,
+            ..Default::default()
         }
     }
+
+    /// Sets the level the compression library (see [`LsmCompressionLib`]) compresses
+    /// data pages with. Its meaning depends on the library: for `ZStd` it is zstd's
+    /// compression level (1 to 22, negative levels trade ratio for speed), for `ZLib`
+    /// it is zlib's compression level (0 to 9), and for `LZ4` it is lz4's acceleration
+    /// (1 or higher, the higher the faster but the worse the ratio). By default, the
+    /// default level of the library is used. The level is not stored in the database
+    /// file, thus it can be changed between connections. An invalid `ZLib` level
+    /// makes connecting fail with [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_n".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::ZStd,
+    /// )
+    /// .with_compression_level(9);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_compression_level(mut self, level: i32) -> Self {
+        self.compression_level = Some(level);
+        self
+    }
+
+    /// Makes `ZStd` compress data pages using a dictionary of (at most) the given
+    /// size in bytes, which pays off when pages are small and their records are
+    /// alike. The dictionary is trained from the pages written by the first merges
+    /// (or by [`Disk::optimize`], whatever comes first), and it is then stored
+    /// in the database file. From then on, every handle compresses pages with it,
+    /// and loads it once to decompress them, whether it is configured or not.
+    /// Pages written before the dictionary was stored remain readable. A size
+    /// below 256 bytes or above 1 MiB, or a library other than `ZStd`, makes
+    /// connecting fail with [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_o".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::ZStd,
+    /// )
+    /// .with_compression_dictionary(16 << 10);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    ///
+    /// // No dictionary is stored until there are pages to train it from.
+    /// let rc = db.get_compression_dictionary_id();
+    /// assert_eq!(rc, Ok(None));
+    /// ```
+    pub fn with_compression_dictionary(mut self, size_b: usize) -> Self {
+        self.compression_dictionary = Some(size_b);
+        self
+    }
+
+    /// Sets the compression library (and its level, see
+    /// [`DbConf::with_compression_level`]) the segments of the given age or older
+    /// are compressed with, up to the next age configured. Segments start at age 0
+    /// when flushed from main memory, and get older every time they are merged
+    /// (see [`LsmCompactionPolicy`]). Thus, young segments, which are merged often,
+    /// can be compressed for speed (or not at all), and old ones, which make up
+    /// most of the database, for space. Segments younger than the first age
+    /// configured use the compression library of the database, which must not
+    /// be [`LsmCompressionLib::NoCompression`]. Every segment is read with the
+    /// library it was written with, thus the policy can change between
+    /// connections. Configuring more than 8 ages, or a database without
+    /// compression, makes connecting fail with [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_p".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::ZStd,
+    /// )
+    /// // Freshly flushed segments are not compressed...
+    /// .with_age_compression(0, LsmCompressionLib::NoCompression, None)
+    /// // ...once merged, they are compressed for speed...
+    /// .with_age_compression(1, LsmCompressionLib::LZ4, None)
+    /// // ...and from then on, for space.
+    /// .with_age_compression(3, LsmCompressionLib::ZStd, Some(19));
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_age_compression(
+        mut self,
+        age: u16,
+        compression: LsmCompressionLib,
+        level: Option<i32>,
+    ) -> Self {
+        self.age_compression
+            .retain(|(other_age, _, _)| *other_age != age);
+        self.age_compression.push((age, compression, level));
+        self
+    }
+
+    /// Sets how much (in percent of the page size) compressing a data page has to
+    /// save for the page to be stored compressed. Pages that do not shrink as much,
+    /// e.g. those holding random or already compressed values, are stored as they
+    /// are, and thus read back without decompressing them. By default, pages are
+    /// stored as they are only if compressing them does not save anything at all.
+    /// As with the level, the saving is not stored in the database file. A saving
+    /// above 99 percent, or a database without compression, makes connecting fail
+    /// with [`LsmErrorCode::LsmMisuse`]. See also
+    /// [`LsmDb::get_num_pages_written_raw`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_q".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::LZ4,
+    /// )
+    /// // Pages are stored compressed only if that saves at least 10% of space.
+    /// .with_min_compression_saving(10);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_min_compression_saving(mut self, saving_pct: u8) -> Self {
+        self.min_compression_saving = Some(saving_pct);
+        self
+    }
+
+    /// Makes every handle writing to the database (including background workers)
+    /// compress the pages of the segments it writes on the given number of threads
+    /// (at most 64), while it builds the following pages of the same segment. Pages
+    /// are written in the same order, and to the same place, as they are otherwise.
+    /// Thus, the database file is the same whichever the number of threads. This
+    /// pays off for expensive compression (or encryption) on machines with spare
+    /// cores. By default, pages are compressed by the thread writing them. Once
+    /// the database has a compression dictionary (see
+    /// [`DbConf::with_compression_dictionary`]), pages are compressed by the thread
+    /// writing them as well, as only that thread may look the dictionary up. A
+    /// database without compression (nor encryption), or a handle that is to train
+    /// a compression dictionary, makes connecting fail with
+    /// [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_al".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::ZStd,
+    /// )
+    /// .with_compression_threads(2);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_compression_threads(mut self, num_threads: u32) -> Self {
+        self.compression_threads = Some(num_threads);
+        self
+    }
+
+    /// Encrypts every data page with the given cipher and 256-bit key, after
+    /// compressing it with the compression library of the database (or of its
+    /// age, see [`DbConf::with_age_compression`]), if any. The key is not stored
+    /// anywhere: the database has to be opened with the same cipher and key every
+    /// time, reading it otherwise fails with [`LsmErrorCode::LsmMismatch`] (wrong
+    /// cipher, or none) or with [`LsmErrorCode::LsmCorrupt`] (wrong key). Pages
+    /// are always stored encrypted, thus configuring a minimum compression saving
+    /// (see [`DbConf::with_min_compression_saving`]) or a compression dictionary
+    /// (which is stored in the clear) makes connecting fail with
+    /// [`LsmErrorCode::LsmMisuse`]. Observe that only the database file is
+    /// encrypted: recent writes are kept in the clear in the log file until
+    /// they are checkpointed.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_u".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::ZStd,
+    /// )
+    /// .with_encryption(LsmCipher::Aes256Gcm, [42; 32]);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_encryption(mut self, cipher: LsmCipher, key: [u8; 32]) -> Self {
+        self.encryption = Some((cipher, LsmEncryptionKey(key)));
+        self
+    }
+
+    /// Whether data pages are transformed (compressed and/or encrypted) before
+    /// being written, in which case `lsm1` works in compressed database mode.
+    pub(crate) fn transforms_pages(&self) -> bool {
+        self.compression != LsmCompressionLib::NoCompression || self.encryption.is_some()
+    }
+
+    /// Sets the size, in KiB, of the cache of database pages each handle keeps in
+    /// main memory. Pages of compressed databases are cached once decompressed,
+    /// thus pages read often are not decompressed over and over again. By default,
+    /// handles of compressed databases cache up to 32 MiB worth of pages, and
+    /// handles of databases without compression up to 2 MiB. Sizes smaller than
+    /// 64 KiB are ignored. The cache of a handle is emptied every time the handle
+    /// observes that the database changed.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_r".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::ZStd,
+    /// )
+    /// .with_page_cache_size(128 << 10);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_page_cache_size(mut self, size_kb: u32) -> Self {
+        self.page_cache_size_kb = Some(size_kb);
+        self
+    }
+
+    /// Adds a second cache to handles of compressed databases, that holds up to the
+    /// given amount of KiBs worth of pages exactly as they are stored in the database
+    /// file, i.e., before they are decompressed. Pages that no longer fit in the page
+    /// cache (see [`DbConf::with_page_cache_size`]) are then only decompressed again
+    /// instead of being read from the file, and as compressed pages are smaller, the
+    /// same amount of memory holds more of them. Pages stored uncompressed (see
+    /// [`DbConf::with_min_compression_saving`]) are not held in this cache. This cache
+    /// is disabled by default, and is emptied together with the page cache. How
+    /// effective it is can be seen through [`LsmDb::get_num_compressed_cache_hits`]
+    /// and [`LsmDb::get_num_compressed_cache_misses`]. Configuring it for a database
+    /// without compression (nor encryption, see [`DbConf::with_encryption`]) makes
+    /// connecting fail with [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_t".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::ZStd,
+    /// )
+    /// .with_compressed_page_cache_size(64 << 10);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_compressed_page_cache_size(mut self, size_kb: u32) -> Self {
+        self.compressed_page_cache_size_kb = Some(size_kb);
+        self
+    }
+
+    /// Makes a read-only handle (see [`LsmHandleMode::ReadOnly`]) map the database
+    /// file into memory and read pages straight from the mapping instead of
+    /// copying them into its page cache, giving the operating system the given
+    /// hint about how the file is going to be read. Only databases without
+    /// compression (nor encryption) can be mapped. Thus, configuring a read-write
+    /// handle, or a compressed (or encrypted) database, makes connecting fail with
+    /// [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// // Let's produce the database first.
+    /// let db_conf = DbConf::new("/tmp/", "my_db_s".to_string());
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_s".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadOnly,
+    ///                                           None,
+    ///                                           LsmCompressionLib::NoCompression,
+    /// )
+    /// .with_mmap(LsmMmapAdvice::Random);
+    ///
+    /// let mut db_ro: LsmDb = Default::default();
+    /// let rc = db_ro.initialize(db_conf);
+    /// let rc = db_ro.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_mmap(mut self, advice: LsmMmapAdvice) -> Self {
+        self.mmap_advice = Some(advice);
+        self
+    }
+
+    /// Sets how many KiBs of the database file a handle asks the operating system
+    /// to read ahead of a cursor that scans a segment, either forward or backward.
+    /// Scans are detected by the handle from the order pages are read from the
+    /// file, also when several segments are scanned at the same time (e.g. by a
+    /// cursor, or while merging). The amount read ahead of a scan starts at a few
+    /// pages and doubles as the scan goes on, up to the given amount, but never
+    /// goes past the block the scan is in. By default, up to 1 MiB is read ahead,
+    /// and zero disables reading ahead altogether. Pages read from a mapping (see
+    /// [`DbConf::with_mmap`]) are not read ahead of. How often a handle read ahead
+    /// can be seen through [`LsmDb::get_num_readaheads`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_v".to_string(),
+    ///                                           LsmMode::LsmNoBackgroundThreads,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::ZStd,
+    /// )
+    /// .with_readahead(4 << 10);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_readahead(mut self, max_kb: u32) -> Self {
+        self.readahead_kb = Some(max_kb);
+        self
+    }
+
+    /// Makes a handle start writing pages back to disk every time it has written
+    /// the given amount of KiBs of them to the database file, instead of leaving
+    /// it all to the operating system until the next checkpoint syncs the file.
+    /// Thus, the output of merges is written back while they go, and checkpoints
+    /// do not stall on flushing all of it at once. If `drop_behind` is set, pages
+    /// that have been written back are additionally dropped from the cache of the
+    /// operating system, so that merges do not evict the pages readers need from
+    /// it. Pages are not written back early by default. Writing back is only
+    /// implemented on Linux, elsewhere this configuration has no effect. Setting
+    /// `drop_behind` with a size of zero makes connecting fail with
+    /// [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new_with_parameters(
+    ///                                           "/tmp/",
+    ///                                           "my_db_w".to_string(),
+    ///                                           LsmMode::LsmBackgroundMerger,
+    ///                                           LsmHandleMode::ReadWrite,
+    ///                                           None,
+    ///                                           LsmCompressionLib::ZStd,
+    /// )
+    /// .with_writeback(1 << 10, true);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_writeback(mut self, size_kb: u32, drop_behind: bool) -> Self {
+        self.writeback = Some((size_kb, drop_behind));
+        self
+    }
+
+    /// Makes a handle allocate disk space for (at least) the given amount of KiBs
+    /// at once every time it grows the database file, instead of one block (8 MiB)
+    /// at a time. Thus, the blocks merges write to are less fragmented on disk, and
+    /// writing them updates the metadata of the file less often. The file grows by
+    /// the preallocated amount right away, but the blocks that end up unused are
+    /// released when the last handle to the database disconnects. Space is not
+    /// preallocated by default. Preallocation is only implemented on Linux,
+    /// elsewhere this configuration has no effect.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_x".to_string())
+    ///     .with_preallocation(64 << 10);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_preallocation(mut self, size_kb: u32) -> Self {
+        self.preallocation_kb = Some(size_kb);
+        self
+    }
+
+    /// Makes a handle release the disk space of blocks that were freed (e.g. once
+    /// the segments they belonged to were merged) as soon as they could be reused,
+    /// by punching holes in the database file. Thus, the disk space used by the
+    /// file tracks the amount of live data, without waiting for the blocks to be
+    /// reused nor calling [`LsmDb::optimize`], even though the size of the file
+    /// itself does not shrink. Freed blocks keep their disk space by default. Hole
+    /// punching is only implemented on Linux (and file-systems that support it),
+    /// elsewhere this configuration has no effect.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_y".to_string())
+    ///     .with_hole_punching(true);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_hole_punching(mut self, punch_holes: bool) -> Self {
+        self.punch_holes = punch_holes;
+        self
+    }
+
+    /// Makes a handle separate values larger than `threshold_b` bytes from their
+    /// keys: they are appended to a value log file next to the database file (its
+    /// name ends in `-vlog`) once, as records are written to segments, and the
+    /// segments only store a pointer to them. Thus, merges do not rewrite large
+    /// values again and again, only their pointers. Reading a value follows its
+    /// pointer transparently. In compressed or encrypted databases, values are
+    /// compressed or encrypted as pages are. The space taken by values that were
+    /// overwritten or deleted is reclaimed by [`LsmDb::collect_value_log_garbage`].
+    /// Values are stored in the database file by default (no value log).
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_ab".to_string())
+    ///     .with_value_log(4 << 10);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_value_log(mut self, threshold_b: u32) -> Self {
+        self.value_log_threshold_b = Some(threshold_b);
+        self
+    }
+
+    /// Makes a handle write the pages of segments with prefix-compressed keys: every
+    /// key is stored as the number of leading bytes it shares with the key before it
+    /// on the page, followed by the remaining bytes only. Every 16th key on a page is
+    /// stored in full, so that a seek only decodes the few keys following one of them.
+    /// Thus, keys with long common prefixes (e.g. paths or composite keys) take much
+    /// less space, and more of them fit into every page read or cached. Pages written
+    /// either way are read regardless of this setting, but databases with compressed
+    /// keys cannot be read by earlier versions of this crate. Keys are stored in full
+    /// by default.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_ad".to_string())
+    ///     .with_key_prefix_compression(true);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_key_prefix_compression(mut self, prefix_keys: bool) -> Self {
+        self.prefix_keys = prefix_keys;
+        self
+    }
+
+    /// Declares the format of the keys of the database (see [`LsmKeyFormat`]), so
+    /// that a handle compares them (while seeking, and while merging segments) using
+    /// a comparison specialized for that format. Keys are ordered as byte strings
+    /// either way, thus handles to the same database may use different key formats.
+    /// By default, [`LsmKeyFormat::Bytes`] is used.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_ae".to_string())
+    ///     .with_key_format(LsmKeyFormat::U64);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    ///
+    /// // Big-endian integers are ordered as numbers.
+    /// let rc = db.persist(&256_u64.to_be_bytes(), b"b");
+    /// let rc = db.persist(&255_u64.to_be_bytes(), b"a");
+    /// let mut cursor = db.cursor_open().unwrap();
+    /// let rc = cursor.first();
+    /// assert_eq!(cursor.get_key(), Ok(255_u64.to_be_bytes().to_vec()));
+    /// ```
+    pub fn with_key_format(mut self, key_format: LsmKeyFormat) -> Self {
+        self.key_format = key_format;
+        self
+    }
+
+    /// Orders the keys of the database as the given comparator does, instead of as
+    /// byte strings (see [`LsmKeyComparator`]). This changes the order of the data
+    /// in the database file. Thus, every handle to the same database has to be
+    /// configured with the very same comparator, from the moment the database is
+    /// created. The comparator takes precedence over the key format (see
+    /// [`DbConf::with_key_format`]).
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    /// use std::cmp::Ordering;
+    ///
+    /// // Orders keys from the largest to the smallest.
+    /// struct Descending;
+    ///
+    /// impl LsmKeyComparator for Descending {
+    ///     fn compare(lhs: &[u8], rhs: &[u8]) -> Ordering {
+    ///         rhs.cmp(lhs)
+    ///     }
+    /// }
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_af".to_string())
+    ///     .with_key_comparator::<Descending>();
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_key_comparator<C: LsmKeyComparator>(mut self) -> Self {
+        self.key_comparator = Some(LsmKeyComparatorFns::new::<C>());
+        self
+    }
+
+    /// Sets the strategy used to select the segments that are merged together
+    /// (see [`LsmCompactionPolicy`]). By default [`LsmCompactionPolicy::Tiered`]
+    /// is used. The policy is a property of the handles working on the database,
+    /// not of the database file. Thus, it can be changed between connections.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_k".to_string())
+    ///     .with_compaction_policy(LsmCompactionPolicy::Leveled);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_compaction_policy(mut self, compaction: LsmCompactionPolicy) -> Self {
+        self.compaction = compaction;
+        self
+    }
+
+    /// Sets the size ratio between adjacent segments that
+    /// [`LsmCompactionPolicy::Leveled`] and [`LsmCompactionPolicy::Hybrid`] aim for.
+    /// A segment is merged into the next (older) one once it is larger than
+    /// the given fraction of it. A smaller ratio merges less often, at the cost
+    /// of more segments for reads to visit. A larger ratio keeps fewer segments
+    /// around, at the cost of rewriting data more often. By default it is 10.
+    /// A ratio smaller than 2 makes connecting fail with [`LsmErrorCode::LsmMisuse`].
+    /// [`LsmCompactionPolicy::Tiered`] ignores the ratio.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_ak".to_string())
+    ///     .with_compaction_policy(LsmCompactionPolicy::Leveled)
+    ///     .with_level_size_ratio(4);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_level_size_ratio(mut self, ratio: u32) -> Self {
+        self.level_size_ratio = Some(ratio);
+        self
+    }
+
+    /// Makes handles merge with priority any segment (other than the ones main
+    /// memory is flushed into) in which at least the given percentage of records
+    /// are delete markers, e.g. after deleting a range of keys. Such a segment is
+    /// merged into the next (older) one, or rewritten if it is the oldest one, so
+    /// that scans do not have to skip the markers for long, and the space of the
+    /// records they delete is reclaimed. Records dropped by a compaction filter
+    /// (see [`DbConf::with_compaction_filter`]) are not accounted for. By default
+    /// (or with a percentage of 0), segments are merged as the compaction policy
+    /// says only. A percentage above 100 makes connecting fail with
+    /// [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_am".to_string())
+    ///     .with_tombstone_ratio(50);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_tombstone_ratio(mut self, ratio_pct: u8) -> Self {
+        self.tombstone_ratio_pct = Some(ratio_pct);
+        self
+    }
+
+    /// Sets a filter that gets to decide, while segments are merged, whether each
+    /// record is kept, dropped, or rewritten (see [`LsmCompactionFilter`]). This
+    /// allows, for instance, to expire records without issuing deletes for them.
+    /// Observe that records are filtered only once they are merged. Thus, records
+    /// that ought to be dropped can still be read until then.
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// // Drops every record whose value starts with a zero byte.
+    /// struct DropZeroed;
+    ///
+    /// impl LsmCompactionFilter for DropZeroed {
+    ///     fn filter(&self, _key: &[u8], value: &[u8]) -> LsmCompactionDecision {
+    ///         match value.first() {
+    ///             Some(0) => LsmCompactionDecision::Drop,
+    ///             _ => LsmCompactionDecision::Keep,
+    ///         }
+    ///     }
+    /// }
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_l".to_string())
+    ///     .with_compaction_filter(DropZeroed);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    /// assert_eq!(rc, Ok(()));
+    /// ```
+    pub fn with_compaction_filter(mut self, filter: impl LsmCompactionFilter + 'static) -> Self {
+        self.compaction_filter = Some(Arc::new(filter));
+        self
+    }
+
+    /// Sets the operator that combines the operands written by [`LsmDb::merge`]
+    /// with the value they apply to (see [`LsmMergeOperator`]). Observe that every
+    /// handle to the same database has to be configured with the very same operator.
+    /// A handle without it cannot read keys whose values are still made of operands,
+    /// and fails with [`LsmErrorCode::LsmMismatch`] when trying. Observe as well
+    /// that the on-disk format is one-way: earlier versions of this crate read
+    /// operands as plain values, and thus return wrong values for such keys.
+    pub fn with_merge_operator(mut self, operator: impl LsmMergeOperator + 'static) -> Self {
+        self.merge_operator = Some(Arc::new(operator));
+        self
+    }
 }
 
 /// These are stubs that mirror LSM's types. They are define like this to
@@ -203,6 +965,8 @@ pub struct LsmDb {
     pub(crate) db_conf: DbConf,
     pub(crate) db_bg_threads: LsmBgWorkers,
     pub(crate) db_compress: Option<lsm_compress>,
+    pub(crate) db_filter: Option<Box<LsmCompactionFilterCtx>>,
+    pub(crate) db_merge: Option<Box<LsmMergeOperatorCtx>>,
     pub(crate) initialized: bool,
     pub(crate) connected: bool,
 }
@@ -213,6 +977,55 @@ pub struct LsmCursor<'a> {
     _marker: PhantomData<&'a ()>,
 }
 
+/// These are records read in one go from a [`LsmCursor`], see [`LsmCursor::next_batch`].
+/// Their keys and values are stored back to back in a single buffer, which is reused
+/// by every batch read into it. Thus, once the buffer has grown to the size of a
+/// batch, reading further batches does not allocate memory.
+#[derive(Clone, Debug, Default)]
+pub struct LsmCursorBatch {
+    pub(crate) arena: Vec<u8>,
+    pub(crate) num_records: usize,
+    pub(crate) num_bytes: usize,
+}
+
+/// This is an iterator over the keys and values of a [`LsmCursorBatch`],
+/// see [`LsmCursorBatch::iter`].
+pub struct LsmCursorBatchIter<'b> {
+    pub(crate) arena: &'b [u8],
+}
+
+/// This is an iterator over the records of a database, from the entry a cursor is
+/// positioned at onwards, see [`LsmCursor::records`]. Records are read from the
+/// cursor in batches.
+pub struct LsmCursorRecords<'c, 'a> {
+    pub(crate) cursor: &'c mut LsmCursor<'a>,
+    pub(crate) batch: LsmCursorBatch,
+    pub(crate) max_records: usize,
+    pub(crate) max_bytes: usize,
+    pub(crate) offset: usize,
+    pub(crate) finished: bool,
+}
+
+/// This is a bulk load in progress, see [`LsmDb::bulk_loader`]. It holds on to
+/// the database handle it loads records through until it is committed, rolled
+/// back, or dropped (which rolls it back).
+pub struct LsmBulkLoader<'a> {
+    pub(crate) db: &'a mut LsmDb,
+    pub(crate) finished: bool,
+}
+
+/// This is a load of records in arbitrary order in progress, see
+/// [`LsmDb::sorting_loader`]. Records are buffered in memory, and spilled to
+/// sorted runs in temporary files, until the load is committed.
+pub struct LsmSortingLoader<'a> {
+    pub(crate) db: &'a mut LsmDb,
+    pub(crate) memory_b: usize,
+    pub(crate) arena: Vec<u8>,
+    pub(crate) records: Vec<LsmSortRecord>,
+    pub(crate) runs: Vec<PathBuf>,
+    pub(crate) num_runs_written: usize,
+}
+
 /// These are the metrics exposed by the engine. This metrics are
 /// Prometheus histograms, see <https://docs.rs/prometheus/latest/prometheus/struct.Histogram.html>.
 #[derive(Clone, Debug)]
@@ -279,6 +1092,27 @@ pub enum LsmCursorSeekOp {
     LsmCursorSeekGe,
 }
 
+/// These are the ways a cursor can read the values of the records it visits,
+/// see [`LsmCursor::set_values`].
+#[repr(C)]
+#[derive(Copy, Clone, Debug, PartialEq, Eq, Default)]
+pub enum LsmCursorValues {
+    /// The value of each record is read as the cursor moves onto it.
+    /// This is the default.
+    #[default]
+    Eager = 0,
+    /// Values are only read from the database file once they are retrieved
+    /// (for instance through [`Cursor::get_value`]). Values that are not
+    /// retrieved cost nothing, which matters most for large values that span
+    /// several pages of the database file.
+    Lazy,
+    /// Values are never read, only keys are. Retrieving a value is considered
+    /// [`LsmErrorCode::LsmMisuse`], and batches (see [`LsmCursor::next_batch`])
+    /// hold empty values. This is meant for scans that check for the existence
+    /// of keys, or count them.
+    KeysOnly,
+}
+
 /// These are the different kind of errors that we can encounter.
 #[repr(C)]
 #[derive(Copy, Clone, Debug, PartialEq, Eq)]
@@ -378,6 +1212,89 @@ pub enum LsmCompressionLib {
     ZStd,
 }
 
+/// These are the hints a read-only handle that maps the database file into
+/// memory (see [`DbConf::with_mmap`]) gives the operating system about the way
+/// it is going to read the file.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq)]
+pub enum LsmMmapAdvice {
+    /// No particular pattern, the operating system reads ahead moderately.
+    #[default]
+    Normal = 0,
+    /// Mostly point reads. The operating system does not read ahead.
+    Random,
+    /// Mostly scans. The operating system reads ahead aggressively.
+    Sequential,
+    /// The whole file is going to be read soon. The operating system starts
+    /// reading it into memory right away.
+    WillNeed,
+}
+
+/// These are the ciphers data pages can be encrypted with (see
+/// [`DbConf::with_encryption`]). Both are authenticated ciphers with 256-bit keys.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, PartialEq, Eq)]
+pub enum LsmCipher {
+    /// AES-256 in Galois/Counter Mode. Fastest on CPUs with AES instructions.
+    Aes256Gcm = 1,
+    /// ChaCha20 with Poly1305. Fastest on CPUs without AES instructions.
+    ChaCha20Poly1305,
+}
+
+/// These are the strategies available to decide which segments get merged
+/// together as the database grows. The choice trades off how often data is
+/// rewritten (write amplification) against how many segments a read has to
+/// visit (read amplification) and how much space outdated records occupy
+/// (space amplification).
+#[repr(C)]
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq, Serialize, Deserialize)]
+pub enum LsmCompactionPolicy {
+    /// Default policy. Runs of segments of the same age are merged together
+    /// into a single, older, segment. Data is rewritten the least, but
+    /// the number of segments a read visits grows with the size of the database.
+    #[default]
+    Tiered = 0,
+    /// A segment is merged into the next (older) one as soon as it is no longer
+    /// much smaller than it. The size ratio between adjacent segments is thus
+    /// bounded, and so is the number of segments a read visits. Data is
+    /// rewritten more often than with [`LsmCompactionPolicy::Tiered`].
+    Leveled,
+    /// Segments freshly flushed from main memory are merged as in
+    /// [`LsmCompactionPolicy::Tiered`], older segments are merged as in
+    /// [`LsmCompactionPolicy::Leveled`].
+    Hybrid,
+}
+
+/// These are the formats of keys a handle can specialize its key comparisons for
+/// (see [`DbConf::with_key_format`]). Whatever the format, keys are ordered as byte
+/// strings (shorter keys first among keys with a common prefix). Keys of a size
+/// different from the one of the format are compared as byte strings as well.
+#[repr(C)]
+#[derive(Copy, Clone, Debug, Default, PartialEq, Eq, Serialize, Deserialize)]
+pub enum LsmKeyFormat {
+    /// Default format. Keys are arbitrary byte strings.
+    #[default]
+    Bytes = 0,
+    /// Keys are mostly 8-byte big-endian integers (e.g. `u64::to_be_bytes`), which
+    /// are compared as a single machine word.
+    U64,
+    /// Keys are mostly 16-byte big-endian integers (e.g. `u128::to_be_bytes`, or
+    /// UUIDs), which are compared as two machine words.
+    U128,
+}
+
+/// These are the possible outcomes of filtering a record while merging segments
+/// (see [`LsmCompactionFilter`]).
+#[derive(Clone, Debug, PartialEq, Eq)]
+pub enum LsmCompactionDecision {
+    /// The record is kept as it is.
+    Keep,
+    /// The record is removed from the database.
+    Drop,
+    /// The value of the record is replaced by the given one.
+    Change(Vec<u8>),
+}
+
 /// These are parameters that impact the behaviour of the engine.
 #[repr(C)]
 #[derive(Copy, Clone, Debug, PartialEq, Eq)]
@@ -397,6 +1314,23 @@ pub(crate) enum LsmParam {
     GetCompression = 14,
     SetCompressionFactory = 15,
     ReadOnly = 16,
+    Compaction = 17,
+    SizeRatio = 18,
+    TombstoneRatio = 19,
+    MinCompressionSaving = 20,
+    CacheSize = 21,
+    MmapAdvice = 22,
+    CompressedCacheSize = 23,
+    RawPages = 24,
+    Readahead = 25,
+    Writeback = 26,
+    DropBehind = 27,
+    Preallocate = 28,
+    PunchHoles = 29,
+    ValueLog = 30,
+    PrefixKeys = 31,
+    KeyFormat = 32,
+    CompressThreads = 33,
 }
 
 // This enum is most probably only relevant in this file. Thus we won't expose it to
@@ -413,6 +1347,10 @@ pub(crate) enum LsmInfo {
     LsmCheckpointSize = 10,
     LsmTreeSize = 11,
     LsmCompressionId = 13,
+    LsmPagesWrittenRaw = 14,
+    LsmCompressedCacheHits = 15,
+    LsmCompressedCacheMisses = 16,
+    LsmReadaheads = 17,
 }
 
 // This is the simplest implementation of the std::error:Error trait
@@ -497,6 +1435,23 @@ impl TryFrom<i32> for LsmParam {
             14 => Ok(LsmParam::GetCompression),
             15 => Ok(LsmParam::SetCompressionFactory),
             16 => Ok(LsmParam::ReadOnly),
+            17 => Ok(LsmParam::Compaction),
+            18 => Ok(LsmParam::SizeRatio),
+            19 => Ok(LsmParam::TombstoneRatio),
+            20 => Ok(LsmParam::MinCompressionSaving),
+            21 => Ok(LsmParam::CacheSize),
+            22 => Ok(LsmParam::MmapAdvice),
+            23 => Ok(LsmParam::CompressedCacheSize),
+            24 => Ok(LsmParam::RawPages),
+            25 => Ok(LsmParam::Readahead),
+            26 => Ok(LsmParam::Writeback),
+            27 => Ok(LsmParam::DropBehind),
+            28 => Ok(LsmParam::Preallocate),
+            29 => Ok(LsmParam::PunchHoles),
+            30 => Ok(LsmParam::ValueLog),
+            31 => Ok(LsmParam::PrefixKeys),
+            32 => Ok(LsmParam::KeyFormat),
+            33 => Ok(LsmParam::CompressThreads),
             _ => Err(LsmErrorCode::LsmUnknownCode),
         }
     }
@@ -528,6 +1483,30 @@ impl TryFrom<i32> for LsmCompressionLib {
     }
 }
 
+impl TryFrom<i32> for LsmCompactionPolicy {
+    type Error = LsmErrorCode;
+    fn try_from(value: i32) -> Result<Self, Self::Error> {
+        match value {
+            0 => Ok(LsmCompactionPolicy::Tiered),
+            1 => Ok(LsmCompactionPolicy::Leveled),
+            2 => Ok(LsmCompactionPolicy::Hybrid),
+            _ => Err(LsmErrorCode::LsmUnknownCode),
+        }
+    }
+}
+
+impl TryFrom<i32> for LsmKeyFormat {
+    type Error = LsmErrorCode;
+    fn try_from(value: i32) -> Result<Self, Self::Error> {
+        match value {
+            0 => Ok(LsmKeyFormat::Bytes),
+            1 => Ok(LsmKeyFormat::U64),
+            2 => Ok(LsmKeyFormat::U128),
+            _ => Err(LsmErrorCode::LsmUnknownCode),
+        }
+    }
+}
+
 impl TryFrom<i32> for LsmInfo {
     type Error = LsmErrorCode;
     fn try_from(value: i32) -> Result<Self, Self::Error> {
@@ -608,21 +1587,83 @@ pub trait Cursor {
     /// to (if valid).
     fn get_value(&self) -> Result<Vec<u8>, LsmErrorCode>;
     /// Compares the key the cursor is currently pointing to (if valid) with the
-    /// given `key` (as per `memcmp`). The result of the comparison (`< 0, == 0, > 0`)
-    /// is returned.
+    /// given `key` (as per the order of keys of the database, that is, `memcmp`
+    /// unless a key comparator is configured). The result of the comparison
+    /// (`< 0, == 0, > 0`) is returned.
     fn compare(&self, key: &[u8]) -> Result<Ordering, LsmErrorCode>;
 }
 
+/// A filter applied to the records of the database as segments get merged
+/// together (and as main memory gets flushed to disk). Every record that
+/// survives a merge is handed to the filter, which decides its fate
+/// ([`LsmCompactionDecision`]). Deleted records are not handed to the filter.
+///
+/// Merges happen either on the handle writing to the database, or on a
+/// background thread (see [`LsmMode`]). Thus, a filter has to be thread-safe,
+/// and it should be cheap and deterministic, as it can be invoked more than
+/// once for the same record. Dropping a record may leave a delete marker behind
+/// in the database until it reaches the oldest segment.
+pub trait LsmCompactionFilter: Send + Sync {
+    /// Decides what to do with the record given by `key` and `value`.
+    fn filter(&self, key: &[u8], value: &[u8]) -> LsmCompactionDecision;
+}
+
+impl std::fmt::Debug for dyn LsmCompactionFilter {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str("LsmCompactionFilter")
+    }
+}
+
+/// An operator that combines a merge operand (written using [`LsmDb::merge`]) with
+/// the value it applies to. Operands are not combined when they are written, but
+/// only once they are read, or once segments get merged together. Until then, all
+/// operands written under the same key are kept in the database.
+///
+/// Two operands may be combined with each other before the value they apply to is
+/// known. Thus, the operator has to be associative, that is,
+/// `merge(merge(a, b), c) == merge(a, merge(b, c))`. Like a compaction filter
+/// ([`LsmCompactionFilter`]), it has to be thread-safe and deterministic.
+pub trait LsmMergeOperator: Send + Sync {
+    /// Combines `existing` (the older value under `key`, or an older operand) with
+    /// the newer `operand`, and outputs the result. If `key` does not exist (or has
+    /// been deleted), the first operand written under it becomes its value without
+    /// invoking the operator.
+    fn merge(&self, key: &[u8], existing: &[u8], operand: &[u8]) -> Vec<u8>;
+}
+
+impl std::fmt::Debug for dyn LsmMergeOperator {
+    fn fmt(&self, f: &mut std::fmt::Formatter<'_>) -> std::fmt::Result {
+        f.write_str("LsmMergeOperator")
+    }
+}
+
+/// A comparator that defines the order of the keys of a database, replacing the
+/// default order of byte strings (see [`DbConf::with_key_comparator`]). Keys are
+/// stored, merged, and iterated in this order.
+///
+/// The comparator has to be a total order that never changes, as the database
+/// file is kept in that order. It is invoked on every key comparison (while
+/// seeking and merging), also on background threads, and thus it has to be cheap.
+/// It takes no state, as the engine hands none to it. A panicking comparator
+/// aborts the process, as there is no way to recover from a failed comparison.
+pub trait LsmKeyComparator {
+    /// Compares the keys `lhs` and `rhs`.
+    fn compare(lhs: &[u8], rhs: &[u8]) -> Ordering;
+}
+
 #[cfg(test)]
 mod tests {
     use std::cmp::Ordering;
     use std::ops::Not;
     use std::path::Path;
+    use std::sync::Arc;
     use std::thread;
 
     use crate::{
-        Cursor, DbConf, Disk, LsmCompressionLib, LsmCursorSeekOp, LsmDb, LsmErrorCode,
-        LsmHandleMode, LsmInfo, LsmMetrics, LsmMode, LsmParam, LsmSafety,
+        Cursor, DbConf, Disk, LsmCipher, LsmCompactionDecision, LsmCompactionFilter,
+        LsmCompactionPolicy, LsmCompressionLib, LsmCursor, LsmCursorBatch, LsmCursorSeekOp,
+        LsmCursorValues, LsmDb, LsmErrorCode, LsmHandleMode, LsmInfo, LsmKeyComparator,
+        LsmKeyFormat, LsmMergeOperator, LsmMetrics, LsmMmapAdvice, LsmMode, LsmParam, LsmSafety,
     };
 
     use chrono::Utc;
@@ -1004,69 +2045,225 @@ mod tests {
             // In the signature matches, we assume everything is ok.
             assert_eq!(current_key, signature);
 
-            rc = cursor_backward.prev();
+            rc = cursor_backward.prev();
+            assert_eq!(rc, Ok(()));
+
+            // Since we moved the cursor to the last element
+            // we can never move forward.
+            rc = cursor_backward.next();
+            assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        }
+        // The cursor is not valid any more because it's located at EOF.
+        rc = cursor_backward.valid();
+        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+
+        // Freeing up resources.
+        rc = cursor_backward.close();
+        assert_eq!(rc, Ok(()));
+    }
+
+    fn test_seek_cursor_forward_limited(
+        db: &mut LsmDb,
+        start_key: usize,
+        expected_num_blobs: usize,
+        size_blob: usize,
+        id: usize,
+    ) {
+        let cursor_res = Disk::cursor_open(db);
+        assert!(cursor_res.is_ok());
+
+        let mut cursor_seek_ge = cursor_res.unwrap();
+        let mut rc = cursor_seek_ge.next();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        rc = cursor_seek_ge.prev();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+        // This key is not found.
+        let no_key: usize = 0x7FFFFFFFFFFFFFFF;
+        rc = Cursor::seek(
+            &mut cursor_seek_ge,
+            &[id.to_be_bytes().as_ref(), no_key.to_be_bytes().as_ref()].concat(),
+            LsmCursorSeekOp::LsmCursorSeekGe,
+        );
+        assert_eq!(rc, Ok(()));
+        rc = cursor_seek_ge.valid();
+        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+
+        // We only traverse the number of blobs that we are told.
+        let key = start_key;
+        let upper_key = key + start_key;
+        let mut num_traversed_keys = 0;
+        let mut current_underlying_key = key;
+        rc = Cursor::seek(
+            &mut cursor_seek_ge,
+            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
+            LsmCursorSeekOp::LsmCursorSeekGe,
+        );
+        assert_eq!(rc, Ok(()));
+
+        let mut cmp = Ordering::Less;
+        // A cursor is valid as long as it's not positioned at the end of the file.
+        // In which case the cursor has been exhausted.
+        while cmp < Ordering::Equal {
+            let current_key_res = Cursor::get_key(&cursor_seek_ge);
+            assert!(current_key_res.is_ok());
+            let current_blob_res = Cursor::get_value(&cursor_seek_ge);
+            assert!(current_blob_res.is_ok());
+            let current_key = current_key_res.unwrap();
+            let current_blob = current_blob_res.unwrap();
+            // These were the values originally inserted.
+            let original_blob_key = [
+                id.to_be_bytes().as_ref(),
+                current_underlying_key.to_be_bytes().as_ref(),
+            ]
+            .concat();
+            assert_eq!(current_key, original_blob_key);
+            assert_eq!(current_blob[0], (current_underlying_key & 0xFF) as u8);
+            assert_eq!(current_blob.len(), size_blob);
+
+            // We compare the upper bound we got from the user to see if the blob is
+            // relevant for the result set. The moment the underlying key becomes larger,
+            // we get out of the loop.
+            let cmp_res = Cursor::compare(
+                &cursor_seek_ge,
+                &[id.to_be_bytes().as_ref(), upper_key.to_be_bytes().as_ref()].concat(),
+            );
+            assert!(cmp_res.is_ok());
+            cmp = cmp_res.unwrap();
+
+            num_traversed_keys += 1;
+            current_underlying_key += 1;
+
+            rc = cursor_seek_ge.next();
+            assert_eq!(rc, Ok(()));
+
+            // This one does not work.
+            rc = cursor_seek_ge.prev();
+            assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        }
+        assert_eq!(num_traversed_keys, expected_num_blobs);
+
+        rc = cursor_seek_ge.close();
+        assert_eq!(rc, Ok(()));
+    }
+
+    fn test_seek_cursor_forward_eof(
+        db: &mut LsmDb,
+        start_key: usize,
+        expected_num_blobs: usize,
+        size_blob: usize,
+        id: usize,
+    ) {
+        let cursor_res = Disk::cursor_open(db);
+        assert!(cursor_res.is_ok());
+
+        let mut cursor_seek_ge = cursor_res.unwrap();
+        let mut rc = cursor_seek_ge.next();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        rc = cursor_seek_ge.prev();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+        // This key is not found.
+        let no_key: usize = 0x7FFFFFFFFFFFFFFF;
+        rc = Cursor::seek(
+            &mut cursor_seek_ge,
+            &[id.to_be_bytes().as_ref(), no_key.to_be_bytes().as_ref()].concat(),
+            LsmCursorSeekOp::LsmCursorSeekGe,
+        );
+        assert_eq!(rc, Ok(()));
+        rc = cursor_seek_ge.valid();
+        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+
+        // We only traverse the number of blobs that we are told.
+        let mut num_traversed_keys = 0;
+        let mut current_underlying_key = start_key;
+        rc = Cursor::seek(
+            &mut cursor_seek_ge,
+            &[id.to_be_bytes().as_ref(), start_key.to_be_bytes().as_ref()].concat(),
+            LsmCursorSeekOp::LsmCursorSeekGe,
+        );
+        assert_eq!(rc, Ok(()));
+
+        // A cursor is valid as long as it's not positioned at the end of the file.
+        // In which case the cursor has been exhausted.
+        while cursor_seek_ge.valid() == Ok(()) {
+            let current_key_res = Cursor::get_key(&cursor_seek_ge);
+            assert!(current_key_res.is_ok());
+            let current_blob_res = Cursor::get_value(&cursor_seek_ge);
+            assert!(current_blob_res.is_ok());
+            let current_key = current_key_res.unwrap();
+            let current_blob = current_blob_res.unwrap();
+            // These were the values originally inserted.
+            let original_blob_key = [
+                id.to_be_bytes().as_ref(),
+                current_underlying_key.to_be_bytes().as_ref(),
+            ]
+            .concat();
+            assert_eq!(current_key, original_blob_key);
+            assert_eq!(current_blob[0], (current_underlying_key & 0xFF) as u8);
+            assert_eq!(current_blob.len(), size_blob);
+
+            num_traversed_keys += 1;
+            current_underlying_key += 1;
+
+            rc = cursor_seek_ge.next();
             assert_eq!(rc, Ok(()));
 
-            // Since we moved the cursor to the last element
-            // we can never move forward.
-            rc = cursor_backward.next();
+            // This one does not work.
+            rc = cursor_seek_ge.prev();
             assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
         }
-        // The cursor is not valid any more because it's located at EOF.
-        rc = cursor_backward.valid();
-        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+        assert_eq!(num_traversed_keys, expected_num_blobs);
 
-        // Freeing up resources.
-        rc = cursor_backward.close();
+        rc = cursor_seek_ge.close();
         assert_eq!(rc, Ok(()));
     }
 
-    fn test_seek_cursor_forward_limited(
+    fn test_seek_cursor_backward_limited(
         db: &mut LsmDb,
-        start_key: usize,
-        expected_num_blobs: usize,
+        num_blobs: usize,
         size_blob: usize,
         id: usize,
     ) {
         let cursor_res = Disk::cursor_open(db);
         assert!(cursor_res.is_ok());
 
-        let mut cursor_seek_ge = cursor_res.unwrap();
-        let mut rc = cursor_seek_ge.next();
+        let mut cursor_seek_le = cursor_res.unwrap();
+        let mut rc = cursor_seek_le.next();
         assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-        rc = cursor_seek_ge.prev();
+        rc = cursor_seek_le.prev();
         assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
 
         // This key is not found.
-        let no_key: usize = 0x7FFFFFFFFFFFFFFF;
+        let no_key: usize = 0x0;
         rc = Cursor::seek(
-            &mut cursor_seek_ge,
+            &mut cursor_seek_le,
             &[id.to_be_bytes().as_ref(), no_key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekGe,
+            LsmCursorSeekOp::LsmCursorSeekLe,
         );
         assert_eq!(rc, Ok(()));
-        rc = cursor_seek_ge.valid();
+        rc = cursor_seek_le.valid();
         assert_eq!(rc, Err(LsmErrorCode::LsmError));
 
         // We only traverse the number of blobs that we are told.
-        let key = start_key;
-        let upper_key = key + start_key;
+        let key = num_blobs << 1;
+        let lower_key = key - num_blobs;
         let mut num_traversed_keys = 0;
         let mut current_underlying_key = key;
         rc = Cursor::seek(
-            &mut cursor_seek_ge,
+            &mut cursor_seek_le,
             &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekGe,
+            LsmCursorSeekOp::LsmCursorSeekLe,
         );
         assert_eq!(rc, Ok(()));
 
-        let mut cmp = Ordering::Less;
+        let mut cmp = Ordering::Greater;
         // A cursor is valid as long as it's not positioned at the end of the file.
         // In which case the cursor has been exhausted.
-        while cmp < Ordering::Equal {
-            let current_key_res = Cursor::get_key(&cursor_seek_ge);
+        while cmp > Ordering::Equal {
+            let current_key_res = Cursor::get_key(&cursor_seek_le);
             assert!(current_key_res.is_ok());
-            let current_blob_res = Cursor::get_value(&cursor_seek_ge);
+            let current_blob_res = Cursor::get_value(&cursor_seek_le);
             assert!(current_blob_res.is_ok());
             let current_key = current_key_res.unwrap();
             let current_blob = current_blob_res.unwrap();
@@ -1084,71 +2281,71 @@ mod tests {
             // relevant for the result set. The moment the underlying key becomes larger,
             // we get out of the loop.
             let cmp_res = Cursor::compare(
-                &cursor_seek_ge,
-                &[id.to_be_bytes().as_ref(), upper_key.to_be_bytes().as_ref()].concat(),
+                &cursor_seek_le,
+                &[id.to_be_bytes().as_ref(), lower_key.to_be_bytes().as_ref()].concat(),
             );
             assert!(cmp_res.is_ok());
             cmp = cmp_res.unwrap();
 
             num_traversed_keys += 1;
-            current_underlying_key += 1;
+            current_underlying_key -= 1;
 
-            rc = cursor_seek_ge.next();
+            rc = cursor_seek_le.prev();
             assert_eq!(rc, Ok(()));
 
             // This one does not work.
-            rc = cursor_seek_ge.prev();
+            rc = cursor_seek_le.next();
             assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
         }
-        assert_eq!(num_traversed_keys, expected_num_blobs);
+        assert_eq!(num_traversed_keys, num_blobs + 1);
 
-        rc = cursor_seek_ge.close();
+        rc = cursor_seek_le.close();
         assert_eq!(rc, Ok(()));
     }
 
-    fn test_seek_cursor_forward_eof(
+    fn test_seek_cursor_backward_eof(
         db: &mut LsmDb,
         start_key: usize,
-        expected_num_blobs: usize,
+        expected_num_keys: usize,
         size_blob: usize,
         id: usize,
     ) {
         let cursor_res = Disk::cursor_open(db);
         assert!(cursor_res.is_ok());
 
-        let mut cursor_seek_ge = cursor_res.unwrap();
-        let mut rc = cursor_seek_ge.next();
+        let mut cursor_seek_le = cursor_res.unwrap();
+        let mut rc = cursor_seek_le.next();
         assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-        rc = cursor_seek_ge.prev();
+        rc = cursor_seek_le.prev();
         assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
 
         // This key is not found.
-        let no_key: usize = 0x7FFFFFFFFFFFFFFF;
+        let no_key: usize = 0x0;
         rc = Cursor::seek(
-            &mut cursor_seek_ge,
+            &mut cursor_seek_le,
             &[id.to_be_bytes().as_ref(), no_key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekGe,
+            LsmCursorSeekOp::LsmCursorSeekLe,
         );
         assert_eq!(rc, Ok(()));
-        rc = cursor_seek_ge.valid();
+        rc = cursor_seek_le.valid();
         assert_eq!(rc, Err(LsmErrorCode::LsmError));
 
         // We only traverse the number of blobs that we are told.
         let mut num_traversed_keys = 0;
         let mut current_underlying_key = start_key;
         rc = Cursor::seek(
-            &mut cursor_seek_ge,
+            &mut cursor_seek_le,
             &[id.to_be_bytes().as_ref(), start_key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekGe,
+            LsmCursorSeekOp::LsmCursorSeekLe,
         );
         assert_eq!(rc, Ok(()));
 
         // A cursor is valid as long as it's not positioned at the end of the file.
         // In which case the cursor has been exhausted.
-        while cursor_seek_ge.valid() == Ok(()) {
-            let current_key_res = Cursor::get_key(&cursor_seek_ge);
+        while cursor_seek_le.valid() == Ok(()) {
+            let current_key_res = Cursor::get_key(&cursor_seek_le);
             assert!(current_key_res.is_ok());
-            let current_blob_res = Cursor::get_value(&cursor_seek_ge);
+            let current_blob_res = Cursor::get_value(&cursor_seek_le);
             assert!(current_blob_res.is_ok());
             let current_key = current_key_res.unwrap();
             let current_blob = current_blob_res.unwrap();
@@ -1163,425 +2360,625 @@ mod tests {
             assert_eq!(current_blob.len(), size_blob);
 
             num_traversed_keys += 1;
-            current_underlying_key += 1;
+            current_underlying_key -= 1;
 
-            rc = cursor_seek_ge.next();
+            rc = cursor_seek_le.prev();
             assert_eq!(rc, Ok(()));
 
             // This one does not work.
-            rc = cursor_seek_ge.prev();
+            rc = cursor_seek_le.next();
+            assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        }
+        assert_eq!(num_traversed_keys, expected_num_keys);
+
+        rc = cursor_seek_le.close();
+        assert_eq!(rc, Ok(()));
+    }
+
+    fn test_seek_cursor_exact(db: &mut LsmDb, start_key: usize, size_blob: usize, id: usize) {
+        let cursor_res = Disk::cursor_open(db);
+        assert!(cursor_res.is_ok());
+
+        let mut cursor_seek_eq = cursor_res.unwrap();
+        let mut rc = cursor_seek_eq.next();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        rc = cursor_seek_eq.prev();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+        // This key is not found.
+        let no_key: usize = 0x7FFFFFFFFFFFFFFF;
+        rc = Cursor::seek(
+            &mut cursor_seek_eq,
+            &[id.to_be_bytes().as_ref(), no_key.to_be_bytes().as_ref()].concat(),
+            LsmCursorSeekOp::LsmCursorSeekEq,
+        );
+        assert_eq!(rc, Ok(()));
+        rc = cursor_seek_eq.valid();
+        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+
+        // We only traverse the number of blobs that we are told.
+        let key = start_key;
+        let current_underlying_key = key;
+        rc = Cursor::seek(
+            &mut cursor_seek_eq,
+            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
+            LsmCursorSeekOp::LsmCursorSeekEq,
+        );
+        assert_eq!(rc, Ok(()));
+
+        let current_key_res = Cursor::get_key(&cursor_seek_eq);
+        assert!(current_key_res.is_ok());
+        let current_blob_res = Cursor::get_value(&cursor_seek_eq);
+        assert!(current_blob_res.is_ok());
+        let current_key = current_key_res.unwrap();
+        let current_blob = current_blob_res.unwrap();
+        // These were the values originally inserted.
+        let original_blob_key = [
+            id.to_be_bytes().as_ref(),
+            current_underlying_key.to_be_bytes().as_ref(),
+        ]
+        .concat();
+        assert_eq!(current_key, original_blob_key);
+        assert_eq!(current_blob[0], (current_underlying_key & 0xFF) as u8);
+        assert_eq!(current_blob.len(), size_blob);
+
+        // We compare the upper bound we got from the user to see if the blob is
+        // relevant for the result set. The moment the underlying key becomes larger,
+        // we get out of the loop.
+        let cmp_res = Cursor::compare(
+            &cursor_seek_eq,
+            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
+        );
+        assert_eq!(cmp_res, Ok(Ordering::Equal));
+
+        rc = cursor_seek_eq.next();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+        // This one does not work.
+        rc = cursor_seek_eq.prev();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+        rc = cursor_seek_eq.close();
+        assert_eq!(rc, Ok(()));
+    }
+
+    fn test_num_blobs_are_in_file(db: &mut LsmDb, expected_num_blobs: usize) {
+        let cursor_res = Disk::cursor_open(db);
+        assert!(cursor_res.is_ok());
+
+        let mut cursor_seek_forward = cursor_res.unwrap();
+        let mut rc = cursor_seek_forward.next();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        rc = cursor_seek_forward.prev();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+        // Move the cursor to the very first key of the file.
+        rc = cursor_seek_forward.first();
+        assert_eq!(rc, Ok(()));
+
+        let mut num_traversed_keys = 0;
+        // A cursor is valid as long as it's not positioned at the end of the file.
+        // In which case the cursor has been exhausted.
+        while cursor_seek_forward.valid() == Ok(()) {
+            num_traversed_keys += 1;
+
+            rc = cursor_seek_forward.next();
+            assert_eq!(rc, Ok(()));
+
+            // This one does not work.
+            rc = cursor_seek_forward.prev();
             assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
         }
         assert_eq!(num_traversed_keys, expected_num_blobs);
+    }
 
-        rc = cursor_seek_ge.close();
+    fn test_single_deletion(db: &mut LsmDb, key: usize, total_num_blobs: usize, id: usize) {
+        let rc = Disk::delete(
+            db,
+            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
+        );
+        assert_eq!(rc, Ok(()));
+
+        // Now we verify that we have one element less,
+        // and that we cannot find the one we just deleted.
+        let cursor_res = Disk::cursor_open(db);
+        assert!(cursor_res.is_ok());
+
+        let mut cursor = cursor_res.unwrap();
+        let mut rc = cursor.next();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        rc = cursor.prev();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+        // We will now traverse the database forward.
+        rc = cursor.first();
+        assert_eq!(rc, Ok(()));
+
+        let mut num_traversed_keys = 0;
+        while cursor.valid() == Ok(()) {
+            num_traversed_keys += 1;
+
+            rc = cursor.next();
+            assert_eq!(rc, Ok(()));
+
+            // This one does not work.
+            rc = cursor.prev();
+            assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        }
+        assert_eq!(num_traversed_keys, total_num_blobs - 1);
+
+        // Now let us check that the key cannot be found.
+        rc = Cursor::seek(
+            &mut cursor,
+            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
+            LsmCursorSeekOp::LsmCursorSeekEq,
+        );
+        assert_eq!(rc, Ok(()));
+        rc = cursor.valid();
+        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+
+        rc = cursor.close();
         assert_eq!(rc, Ok(()));
     }
 
-    fn test_seek_cursor_backward_limited(
+    fn test_range_deletion(
         db: &mut LsmDb,
-        num_blobs: usize,
-        size_blob: usize,
+        starting_key: usize,
+        ending_key: usize,
+        total_num_blobs: usize,
         id: usize,
     ) {
-        let cursor_res = Disk::cursor_open(db);
-        assert!(cursor_res.is_ok());
-
-        let mut cursor_seek_le = cursor_res.unwrap();
-        let mut rc = cursor_seek_le.next();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-        rc = cursor_seek_le.prev();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        // Ending and starting keys are not deleted.
+        let num_deleted_keys = ending_key - starting_key - 1;
 
-        // This key is not found.
-        let no_key: usize = 0x0;
-        rc = Cursor::seek(
-            &mut cursor_seek_le,
-            &[id.to_be_bytes().as_ref(), no_key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekLe,
+        // If the interval extremes are swapped, nothing happens.
+        // If something gets deleted here, then the following tests
+        // will fail because cardinalities won't match any more.
+        let rc = Disk::delete_range(
+            db,
+            &[id.to_be_bytes().as_ref(), ending_key.to_be_bytes().as_ref()].concat(),
+            &[
+                id.to_be_bytes().as_ref(),
+                starting_key.to_be_bytes().as_ref(),
+            ]
+            .concat(),
         );
         assert_eq!(rc, Ok(()));
-        rc = cursor_seek_le.valid();
-        assert_eq!(rc, Err(LsmErrorCode::LsmError));
 
-        // We only traverse the number of blobs that we are told.
-        let key = num_blobs << 1;
-        let lower_key = key - num_blobs;
-        let mut num_traversed_keys = 0;
-        let mut current_underlying_key = key;
-        rc = Cursor::seek(
-            &mut cursor_seek_le,
-            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekLe,
+        // Range-delete deletes an open interval.
+        let rc = Disk::delete_range(
+            db,
+            &[
+                id.to_be_bytes().as_ref(),
+                starting_key.to_be_bytes().as_ref(),
+            ]
+            .concat(),
+            &[id.to_be_bytes().as_ref(), ending_key.to_be_bytes().as_ref()].concat(),
         );
         assert_eq!(rc, Ok(()));
 
-        let mut cmp = Ordering::Greater;
-        // A cursor is valid as long as it's not positioned at the end of the file.
-        // In which case the cursor has been exhausted.
-        while cmp > Ordering::Equal {
-            let current_key_res = Cursor::get_key(&cursor_seek_le);
-            assert!(current_key_res.is_ok());
-            let current_blob_res = Cursor::get_value(&cursor_seek_le);
-            assert!(current_blob_res.is_ok());
-            let current_key = current_key_res.unwrap();
-            let current_blob = current_blob_res.unwrap();
-            // These were the values originally inserted.
-            let original_blob_key = [
-                id.to_be_bytes().as_ref(),
-                current_underlying_key.to_be_bytes().as_ref(),
-            ]
-            .concat();
-            assert_eq!(current_key, original_blob_key);
-            assert_eq!(current_blob[0], (current_underlying_key & 0xFF) as u8);
-            assert_eq!(current_blob.len(), size_blob);
+        // Now we verify that we have much less entries,
+        // and that we cannot find the ones we just deleted.
+        let cursor_res = Disk::cursor_open(db);
+        assert!(cursor_res.is_ok());
 
-            // We compare the upper bound we got from the user to see if the blob is
-            // relevant for the result set. The moment the underlying key becomes larger,
-            // we get out of the loop.
-            let cmp_res = Cursor::compare(
-                &cursor_seek_le,
-                &[id.to_be_bytes().as_ref(), lower_key.to_be_bytes().as_ref()].concat(),
-            );
-            assert!(cmp_res.is_ok());
-            cmp = cmp_res.unwrap();
+        let mut cursor = cursor_res.unwrap();
+        let mut rc = cursor.next();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        rc = cursor.prev();
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+        // We will now traverse the database forward.
+        rc = cursor.first();
+        assert_eq!(rc, Ok(()));
 
+        let mut num_traversed_keys = 0;
+        while cursor.valid() == Ok(()) {
             num_traversed_keys += 1;
-            current_underlying_key -= 1;
 
-            rc = cursor_seek_le.prev();
+            rc = cursor.next();
             assert_eq!(rc, Ok(()));
 
             // This one does not work.
-            rc = cursor_seek_le.next();
+            rc = cursor.prev();
             assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
         }
-        assert_eq!(num_traversed_keys, num_blobs + 1);
+        // The - 1 it's because in a previous step outside, we deleted a single
+        // element, and thus it cannot be found any longer.
+        assert_eq!(num_traversed_keys, total_num_blobs - num_deleted_keys - 1);
 
-        rc = cursor_seek_le.close();
+        //  Remember that starting and ending keys are not deleted.
+        for key in (starting_key + 1)..ending_key {
+            // Now let us check that the key cannot be found.
+            rc = Cursor::seek(
+                &mut cursor,
+                &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
+                LsmCursorSeekOp::LsmCursorSeekEq,
+            );
+            assert_eq!(rc, Ok(()));
+            rc = cursor.valid();
+            assert_eq!(rc, Err(LsmErrorCode::LsmError));
+        }
+
+        rc = cursor.close();
         assert_eq!(rc, Ok(()));
     }
 
-    fn test_seek_cursor_backward_eof(
-        db: &mut LsmDb,
-        start_key: usize,
-        expected_num_keys: usize,
-        size_blob: usize,
-        id: usize,
-    ) {
-        let cursor_res = Disk::cursor_open(db);
-        assert!(cursor_res.is_ok());
+    #[test]
+    /// We test the whole api under different circumstances.
+    fn lsm_whole_rust_bindings_multiple_optimized_dbs() {
+        let num_dbs = 2;
+        let num_connection_cycles = 10;
+        let num_segments = 2;
+        let mut thread_handles = vec![];
+        let mut master_prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        for db_idx in 1..=num_dbs {
+            // Every thread will have a different seed, but each time it will be same,
+            // as the master prng is initialized with the same seed every time.
+            let thread_prng: Mt64 = SeedableRng::seed_from_u64(master_prng.next_u64());
+            let handle = thread::spawn(move || {
+                // Let's try to initialize a database per thread.
+                let mut db = test_initialize(
+                    db_idx,
+                    "test-insert-get-blobs-optimized".to_string(),
+                    LsmMode::LsmNoBackgroundThreads,
+                    LsmCompressionLib::NoCompression,
+                );
 
-        let mut cursor_seek_le = cursor_res.unwrap();
-        let mut rc = cursor_seek_le.next();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-        rc = cursor_seek_le.prev();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // Let's connect to it via a main memory handle.
+                test_connect(&mut db);
 
-        // This key is not found.
-        let no_key: usize = 0x0;
-        rc = Cursor::seek(
-            &mut cursor_seek_le,
-            &[id.to_be_bytes().as_ref(), no_key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekLe,
-        );
-        assert_eq!(rc, Ok(()));
-        rc = cursor_seek_le.valid();
-        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+                // We now produce certain amount of blobs and persist them.
+                let num_blobs = 10000_usize;
+                let size_blob = 1 << 10; // 1 KB
 
-        // We only traverse the number of blobs that we are told.
-        let mut num_traversed_keys = 0;
-        let mut current_underlying_key = start_key;
-        rc = Cursor::seek(
-            &mut cursor_seek_le,
-            &[id.to_be_bytes().as_ref(), start_key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekLe,
-        );
-        assert_eq!(rc, Ok(()));
+                // At most this many segment are created (depending on checkpointing for example).
+                for _ in 0..num_segments {
+                    // Let's persist some blobs.
+                    test_persist_blobs(
+                        &mut db,
+                        num_blobs,
+                        size_blob,
+                        Some(thread_prng.clone()),
+                        db_idx,
+                    );
+                }
 
-        // A cursor is valid as long as it's not positioned at the end of the file.
-        // In which case the cursor has been exhausted.
-        while cursor_seek_le.valid() == Ok(()) {
-            let current_key_res = Cursor::get_key(&cursor_seek_le);
-            assert!(current_key_res.is_ok());
-            let current_blob_res = Cursor::get_value(&cursor_seek_le);
-            assert!(current_blob_res.is_ok());
-            let current_key = current_key_res.unwrap();
-            let current_blob = current_blob_res.unwrap();
-            // These were the values originally inserted.
-            let original_blob_key = [
-                id.to_be_bytes().as_ref(),
-                current_underlying_key.to_be_bytes().as_ref(),
-            ]
-            .concat();
-            assert_eq!(current_key, original_blob_key);
-            assert_eq!(current_blob[0], (current_underlying_key & 0xFF) as u8);
-            assert_eq!(current_blob.len(), size_blob);
+                // Let's optimize the DB. No wasted data pages.
+                assert!(db.optimize().is_ok());
+
+                // Once some blobs have been persisted, we connect
+                // and disconnect multiple times and then we test that
+                // what we read is what we expect.
+                for _ in 0..num_connection_cycles {
+                    test_disconnect(&mut db);
+                    test_connect(&mut db);
+                }
+
+                // Let's test forward iterators on the whole database.
+                test_forward_cursor(&mut db, num_blobs, size_blob, db_idx);
+
+                // Now traverse the database backward.
+                test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
+
+                // Now using cursors via seeking a particular blob.
+                test_seek_cursor_forward_limited(
+                    &mut db,
+                    num_blobs >> 2,
+                    (num_blobs >> 2) + 1,
+                    size_blob,
+                    db_idx,
+                );
+
+                // Now until the very end of the database (EOF)
+                test_seek_cursor_forward_eof(
+                    &mut db,
+                    3 * (num_blobs >> 2),
+                    (num_blobs >> 2) + 1,
+                    size_blob,
+                    db_idx,
+                );
+
+                // Now using seeking going backwards.
+                test_seek_cursor_backward_limited(&mut db, num_blobs >> 2, size_blob, db_idx);
+
+                // Now until the beginning of the database (inverse EOF)
+                test_seek_cursor_backward_eof(
+                    &mut db,
+                    num_blobs >> 2,
+                    num_blobs >> 2,
+                    size_blob,
+                    db_idx,
+                );
+
+                // Now seek with exact match.
+                test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, db_idx);
 
-            num_traversed_keys += 1;
-            current_underlying_key -= 1;
+                // Now let's test deletions.
+                test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
 
-            rc = cursor_seek_le.prev();
-            assert_eq!(rc, Ok(()));
+                test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
 
-            // This one does not work.
-            rc = cursor_seek_le.next();
-            assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // Good bye
+                test_disconnect(&mut db);
+            });
+            thread_handles.push(handle);
+        }
+        for t in thread_handles {
+            t.join().unwrap();
         }
-        assert_eq!(num_traversed_keys, expected_num_keys);
-
-        rc = cursor_seek_le.close();
-        assert_eq!(rc, Ok(()));
     }
 
-    fn test_seek_cursor_exact(db: &mut LsmDb, start_key: usize, size_blob: usize, id: usize) {
-        let cursor_res = Disk::cursor_open(db);
-        assert!(cursor_res.is_ok());
+    #[test]
+    /// We test the whole api under different circumstances.
+    fn lsm_whole_rust_bindings_multiple_non_optimized_dbs() {
+        let num_dbs = 2;
+        let num_connection_cycles = 10;
+        let num_segments = 2;
+        let mut thread_handles = vec![];
+        let mut master_prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        for db_idx in 1..=num_dbs {
+            // Every thread will have a different seed, but each time it will be same,
+            // as the master prng is initialized with the same seed every time.
+            let thread_prng: Mt64 = SeedableRng::seed_from_u64(master_prng.next_u64());
+            let handle = thread::spawn(move || {
+                // Let's try to initialize a database per thread.
+                let mut db = test_initialize(
+                    db_idx,
+                    "test-insert-get-blobs-non-optimized".to_string(),
+                    LsmMode::LsmNoBackgroundThreads,
+                    LsmCompressionLib::NoCompression,
+                );
 
-        let mut cursor_seek_eq = cursor_res.unwrap();
-        let mut rc = cursor_seek_eq.next();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-        rc = cursor_seek_eq.prev();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // Let's connect to it via a main memory handle.
+                test_connect(&mut db);
 
-        // This key is not found.
-        let no_key: usize = 0x7FFFFFFFFFFFFFFF;
-        rc = Cursor::seek(
-            &mut cursor_seek_eq,
-            &[id.to_be_bytes().as_ref(), no_key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekEq,
-        );
-        assert_eq!(rc, Ok(()));
-        rc = cursor_seek_eq.valid();
-        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+                // We now produce certain amount of blobs and persist them.
+                let num_blobs = 10000_usize;
+                let size_blob = 1 << 10; // 1 KB
 
-        // We only traverse the number of blobs that we are told.
-        let key = start_key;
-        let current_underlying_key = key;
-        rc = Cursor::seek(
-            &mut cursor_seek_eq,
-            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekEq,
-        );
-        assert_eq!(rc, Ok(()));
+                // At most this many segment are created (depending on checkpointing for example).
+                for _ in 0..num_segments {
+                    // Let's persist some blobs.
+                    test_persist_blobs(
+                        &mut db,
+                        num_blobs,
+                        size_blob,
+                        Some(thread_prng.clone()),
+                        db_idx,
+                    );
+                }
 
-        let current_key_res = Cursor::get_key(&cursor_seek_eq);
-        assert!(current_key_res.is_ok());
-        let current_blob_res = Cursor::get_value(&cursor_seek_eq);
-        assert!(current_blob_res.is_ok());
-        let current_key = current_key_res.unwrap();
-        let current_blob = current_blob_res.unwrap();
-        // These were the values originally inserted.
-        let original_blob_key = [
-            id.to_be_bytes().as_ref(),
-            current_underlying_key.to_be_bytes().as_ref(),
-        ]
-        .concat();
-        assert_eq!(current_key, original_blob_key);
-        assert_eq!(current_blob[0], (current_underlying_key & 0xFF) as u8);
-        assert_eq!(current_blob.len(), size_blob);
+                // No optimization now. There will be wasted data pages.
 
-        // We compare the upper bound we got from the user to see if the blob is
-        // relevant for the result set. The moment the underlying key becomes larger,
-        // we get out of the loop.
-        let cmp_res = Cursor::compare(
-            &cursor_seek_eq,
-            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
-        );
-        assert_eq!(cmp_res, Ok(Ordering::Equal));
+                // Once some blobs have been persisted, we connect
+                // and disconnect multiple times and then we test that
+                // what we read is what we expect.
+                for _ in 0..num_connection_cycles {
+                    test_disconnect(&mut db);
+                    test_connect(&mut db);
+                }
 
-        rc = cursor_seek_eq.next();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // Let's test forward iterators on the whole database.
+                test_forward_cursor(&mut db, num_blobs, size_blob, db_idx);
 
-        // This one does not work.
-        rc = cursor_seek_eq.prev();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // Now traverse the database backward.
+                test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
 
-        rc = cursor_seek_eq.close();
-        assert_eq!(rc, Ok(()));
-    }
+                // Now until the very end of the database (EOF)
+                test_seek_cursor_forward_eof(
+                    &mut db,
+                    3 * (num_blobs >> 2),
+                    (num_blobs >> 2) + 1,
+                    size_blob,
+                    db_idx,
+                );
 
-    fn test_num_blobs_are_in_file(db: &mut LsmDb, expected_num_blobs: usize) {
-        let cursor_res = Disk::cursor_open(db);
-        assert!(cursor_res.is_ok());
+                // Now using seeking going backwards.
+                test_seek_cursor_backward_limited(&mut db, num_blobs >> 2, size_blob, db_idx);
 
-        let mut cursor_seek_forward = cursor_res.unwrap();
-        let mut rc = cursor_seek_forward.next();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-        rc = cursor_seek_forward.prev();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // Now until the beginning of the database (inverse EOF)
+                test_seek_cursor_backward_eof(
+                    &mut db,
+                    num_blobs >> 2,
+                    num_blobs >> 2,
+                    size_blob,
+                    db_idx,
+                );
 
-        // Move the cursor to the very first key of the file.
-        rc = cursor_seek_forward.first();
-        assert_eq!(rc, Ok(()));
+                // Now seek with exact match.
+                test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, db_idx);
 
-        let mut num_traversed_keys = 0;
-        // A cursor is valid as long as it's not positioned at the end of the file.
-        // In which case the cursor has been exhausted.
-        while cursor_seek_forward.valid() == Ok(()) {
-            num_traversed_keys += 1;
+                // Now let's test deletions.
+                test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
 
-            rc = cursor_seek_forward.next();
-            assert_eq!(rc, Ok(()));
+                test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
 
-            // This one does not work.
-            rc = cursor_seek_forward.prev();
-            assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // Good bye
+                test_disconnect(&mut db);
+            });
+            thread_handles.push(handle);
+        }
+        for t in thread_handles {
+            t.join().unwrap();
         }
-        assert_eq!(num_traversed_keys, expected_num_blobs);
     }
 
-    fn test_single_deletion(db: &mut LsmDb, key: usize, total_num_blobs: usize, id: usize) {
-        let rc = Disk::delete(
-            db,
-            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
-        );
-        assert_eq!(rc, Ok(()));
+    #[test]
+    /// We test the whole api under different circumstances.
+    fn lsm_whole_rust_bindings_multiple_empty_dbs() {
+        let num_dbs = 2;
+        let num_connection_cycles = 10;
+        let mut thread_handles = vec![];
+        for db_idx in 1..=num_dbs {
+            let handle = thread::spawn(move || {
+                // Let's try to initialize a database per thread.
+                let mut db = test_initialize(
+                    db_idx,
+                    "test-get-blobs-optimized-empty".to_string(),
+                    LsmMode::LsmNoBackgroundThreads,
+                    LsmCompressionLib::NoCompression,
+                );
 
-        // Now we verify that we have one element less,
-        // and that we cannot find the one we just deleted.
-        let cursor_res = Disk::cursor_open(db);
-        assert!(cursor_res.is_ok());
+                // Let's connect to it via a main memory handle.
+                test_connect(&mut db);
 
-        let mut cursor = cursor_res.unwrap();
-        let mut rc = cursor.next();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-        rc = cursor.prev();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // We now produce certain amount of blobs and persist them.
+                let num_blobs = 0;
+                let size_blob = 0;
+
+                // Let's optimize the DB. No wasted data pages.
+                assert!(db.optimize().is_ok());
+
+                // Once some blobs have been persisted, we connect
+                // and disconnect multiple times and then we test that
+                // what we read is what we expect.
+                for _ in 0..num_connection_cycles {
+                    test_disconnect(&mut db);
+                    test_connect(&mut db);
+                }
+
+                // Let's test forward iterators on the whole database.
+                test_forward_cursor(&mut db, num_blobs, size_blob, db_idx);
+
+                // Now traverse the database backward.
+                test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
+
+                // Now until the very end of the database (EOF)
+                test_seek_cursor_forward_eof(&mut db, 3 * (num_blobs >> 2), 0, size_blob, db_idx);
+
+                // Now until the beginning of the database (inverse EOF)
+                test_seek_cursor_backward_eof(
+                    &mut db,
+                    num_blobs >> 2,
+                    num_blobs >> 2,
+                    size_blob,
+                    db_idx,
+                );
+
+                // Good bye
+                test_disconnect(&mut db);
+            });
+            thread_handles.push(handle);
+        }
+        for t in thread_handles {
+            t.join().unwrap();
+        }
+    }
+
+    #[test]
+    /// We test the whole api under different circumstances.
+    fn lsm_whole_rust_bindings_multiple_compressed_lz4_optimized_dbs() {
+        let num_dbs = 2;
+        let num_connection_cycles = 10;
+        let num_segments = 2;
+        let mut thread_handles = vec![];
+        // Every database will be handled by a thread.
+        for db_idx in 1..=num_dbs {
+            let handle = thread::spawn(move || {
+                // Let's try to initialize a database per thread.
+                let mut db = test_initialize(
+                    db_idx,
+                    "test-insert-get-compressed-lz4-blobs".to_string(),
+                    LsmMode::LsmNoBackgroundThreads,
+                    LsmCompressionLib::LZ4,
+                );
 
-        // We will now traverse the database forward.
-        rc = cursor.first();
-        assert_eq!(rc, Ok(()));
+                // Let's connect to it via a main memory handle.
+                test_connect(&mut db);
 
-        let mut num_traversed_keys = 0;
-        while cursor.valid() == Ok(()) {
-            num_traversed_keys += 1;
+                // We now produce certain amount of blobs and persist them.
+                let num_blobs = 10000_usize;
+                let size_blob = 1 << 10; // 1 KB
 
-            rc = cursor.next();
-            assert_eq!(rc, Ok(()));
+                // At most this many segment are created (depending on checkpointing for example).
+                for _ in 0..num_segments {
+                    // Let's persist some blobs.
+                    test_persist_blobs(&mut db, num_blobs, size_blob, None, db_idx);
+                }
 
-            // This one does not work.
-            rc = cursor.prev();
-            assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-        }
-        assert_eq!(num_traversed_keys, total_num_blobs - 1);
+                // Let's optimize the DB. No wasted data pages.
+                assert!(db.optimize().is_ok());
 
-        // Now let us check that the key cannot be found.
-        rc = Cursor::seek(
-            &mut cursor,
-            &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
-            LsmCursorSeekOp::LsmCursorSeekEq,
-        );
-        assert_eq!(rc, Ok(()));
-        rc = cursor.valid();
-        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+                // Once some blobs have been persisted, we connect
+                // and disconnect multiple times and then we test that
+                // what we read is what we expect.
+                for _ in 0..num_connection_cycles {
+                    test_disconnect(&mut db);
+                    test_connect(&mut db);
+                }
 
-        rc = cursor.close();
-        assert_eq!(rc, Ok(()));
-    }
+                // Let's test forward iterators on the whole database.
+                test_forward_cursor(&mut db, num_blobs, size_blob, db_idx);
 
-    fn test_range_deletion(
-        db: &mut LsmDb,
-        starting_key: usize,
-        ending_key: usize,
-        total_num_blobs: usize,
-        id: usize,
-    ) {
-        // Ending and starting keys are not deleted.
-        let num_deleted_keys = ending_key - starting_key - 1;
+                // Now traverse the database backward.
+                test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
 
-        // If the interval extremes are swapped, nothing happens.
-        // If something gets deleted here, then the following tests
-        // will fail because cardinalities won't match any more.
-        let rc = Disk::delete_range(
-            db,
-            &[id.to_be_bytes().as_ref(), ending_key.to_be_bytes().as_ref()].concat(),
-            &[
-                id.to_be_bytes().as_ref(),
-                starting_key.to_be_bytes().as_ref(),
-            ]
-            .concat(),
-        );
-        assert_eq!(rc, Ok(()));
+                // Now using cursors via seeking a particular blob.
+                test_seek_cursor_forward_limited(
+                    &mut db,
+                    num_blobs >> 2,
+                    (num_blobs >> 2) + 1,
+                    size_blob,
+                    db_idx,
+                );
 
-        // Range-delete deletes an open interval.
-        let rc = Disk::delete_range(
-            db,
-            &[
-                id.to_be_bytes().as_ref(),
-                starting_key.to_be_bytes().as_ref(),
-            ]
-            .concat(),
-            &[id.to_be_bytes().as_ref(), ending_key.to_be_bytes().as_ref()].concat(),
-        );
-        assert_eq!(rc, Ok(()));
+                // Now until the very end of the database (EOF)
+                test_seek_cursor_forward_eof(
+                    &mut db,
+                    3 * (num_blobs >> 2),
+                    (num_blobs >> 2) + 1,
+                    size_blob,
+                    db_idx,
+                );
 
-        // Now we verify that we have much less entries,
-        // and that we cannot find the ones we just deleted.
-        let cursor_res = Disk::cursor_open(db);
-        assert!(cursor_res.is_ok());
+                // Now using seeking going backwards.
+                test_seek_cursor_backward_limited(&mut db, num_blobs >> 2, size_blob, db_idx);
 
-        let mut cursor = cursor_res.unwrap();
-        let mut rc = cursor.next();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-        rc = cursor.prev();
-        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // Now until the beginning of the database (inverse EOF)
+                test_seek_cursor_backward_eof(
+                    &mut db,
+                    num_blobs >> 2,
+                    num_blobs >> 2,
+                    size_blob,
+                    db_idx,
+                );
 
-        // We will now traverse the database forward.
-        rc = cursor.first();
-        assert_eq!(rc, Ok(()));
+                // Now seek with exact match.
+                test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, db_idx);
 
-        let mut num_traversed_keys = 0;
-        while cursor.valid() == Ok(()) {
-            num_traversed_keys += 1;
+                // Now let's test deletions.
+                test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
+                test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
 
-            rc = cursor.next();
-            assert_eq!(rc, Ok(()));
+                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::LZ4));
 
-            // This one does not work.
-            rc = cursor.prev();
-            assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                // Good bye
+                test_disconnect(&mut db);
+            });
+            thread_handles.push(handle);
         }
-        // The - 1 it's because in a previous step outside, we deleted a single
-        // element, and thus it cannot be found any longer.
-        assert_eq!(num_traversed_keys, total_num_blobs - num_deleted_keys - 1);
-
-        //  Remember that starting and ending keys are not deleted.
-        for key in (starting_key + 1)..ending_key {
-            // Now let us check that the key cannot be found.
-            rc = Cursor::seek(
-                &mut cursor,
-                &[id.to_be_bytes().as_ref(), key.to_be_bytes().as_ref()].concat(),
-                LsmCursorSeekOp::LsmCursorSeekEq,
-            );
-            assert_eq!(rc, Ok(()));
-            rc = cursor.valid();
-            assert_eq!(rc, Err(LsmErrorCode::LsmError));
+        for t in thread_handles {
+            t.join().unwrap();
         }
-
-        rc = cursor.close();
-        assert_eq!(rc, Ok(()));
     }
 
     #[test]
     /// We test the whole api under different circumstances.
-    fn lsm_whole_rust_bindings_multiple_optimized_dbs() {
+    fn lsm_whole_rust_bindings_multiple_compressed_lz4_non_optimized_dbs() {
         let num_dbs = 2;
         let num_connection_cycles = 10;
         let num_segments = 2;
         let mut thread_handles = vec![];
-        let mut master_prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        // Every database will be handled by a thread.
         for db_idx in 1..=num_dbs {
-            // Every thread will have a different seed, but each time it will be same,
-            // as the master prng is initialized with the same seed every time.
-            let thread_prng: Mt64 = SeedableRng::seed_from_u64(master_prng.next_u64());
             let handle = thread::spawn(move || {
                 // Let's try to initialize a database per thread.
                 let mut db = test_initialize(
                     db_idx,
-                    "test-insert-get-blobs-optimized".to_string(),
+                    "test-insert-get-compressed-lz4-blobs".to_string(),
                     LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::NoCompression,
+                    LsmCompressionLib::LZ4,
                 );
 
                 // Let's connect to it via a main memory handle.
@@ -1594,17 +2991,10 @@ mod tests {
                 // At most this many segment are created (depending on checkpointing for example).
                 for _ in 0..num_segments {
                     // Let's persist some blobs.
-                    test_persist_blobs(
-                        &mut db,
-                        num_blobs,
-                        size_blob,
-                        Some(thread_prng.clone()),
-                        db_idx,
-                    );
+                    test_persist_blobs(&mut db, num_blobs, size_blob, None, db_idx);
                 }
 
-                // Let's optimize the DB. No wasted data pages.
-                assert!(db.optimize().is_ok());
+                // No optimization now. There will be wasted data pages.
 
                 // Once some blobs have been persisted, we connect
                 // and disconnect multiple times and then we test that
@@ -1655,9 +3045,10 @@ mod tests {
 
                 // Now let's test deletions.
                 test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
-
                 test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
 
+                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::LZ4));
+
                 // Good bye
                 test_disconnect(&mut db);
             });
@@ -1670,23 +3061,20 @@ mod tests {
 
     #[test]
     /// We test the whole api under different circumstances.
-    fn lsm_whole_rust_bindings_multiple_non_optimized_dbs() {
+    fn lsm_whole_rust_bindings_multiple_compressed_zlib_optimized_dbs() {
         let num_dbs = 2;
         let num_connection_cycles = 10;
         let num_segments = 2;
         let mut thread_handles = vec![];
-        let mut master_prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        // Every database will be handled by a thread.
         for db_idx in 1..=num_dbs {
-            // Every thread will have a different seed, but each time it will be same,
-            // as the master prng is initialized with the same seed every time.
-            let thread_prng: Mt64 = SeedableRng::seed_from_u64(master_prng.next_u64());
             let handle = thread::spawn(move || {
                 // Let's try to initialize a database per thread.
                 let mut db = test_initialize(
                     db_idx,
-                    "test-insert-get-blobs-non-optimized".to_string(),
+                    "test-insert-get-compressed-zlib-blobs".to_string(),
                     LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::NoCompression,
+                    LsmCompressionLib::ZLib,
                 );
 
                 // Let's connect to it via a main memory handle.
@@ -1699,16 +3087,11 @@ mod tests {
                 // At most this many segment are created (depending on checkpointing for example).
                 for _ in 0..num_segments {
                     // Let's persist some blobs.
-                    test_persist_blobs(
-                        &mut db,
-                        num_blobs,
-                        size_blob,
-                        Some(thread_prng.clone()),
-                        db_idx,
-                    );
+                    test_persist_blobs(&mut db, num_blobs, size_blob, None, db_idx);
                 }
 
-                // No optimization now. There will be wasted data pages.
+                // Let's optimize the DB. No wasted data pages.
+                assert!(db.optimize().is_ok());
 
                 // Once some blobs have been persisted, we connect
                 // and disconnect multiple times and then we test that
@@ -1724,6 +3107,15 @@ mod tests {
                 // Now traverse the database backward.
                 test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
 
+                // Now using cursors via seeking a particular blob.
+                test_seek_cursor_forward_limited(
+                    &mut db,
+                    num_blobs >> 2,
+                    (num_blobs >> 2) + 1,
+                    size_blob,
+                    db_idx,
+                );
+
                 // Now until the very end of the database (EOF)
                 test_seek_cursor_forward_eof(
                     &mut db,
@@ -1750,9 +3142,10 @@ mod tests {
 
                 // Now let's test deletions.
                 test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
-
                 test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
 
+                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::ZLib));
+
                 // Good bye
                 test_disconnect(&mut db);
             });
@@ -1765,29 +3158,36 @@ mod tests {
 
     #[test]
     /// We test the whole api under different circumstances.
-    fn lsm_whole_rust_bindings_multiple_empty_dbs() {
+    fn lsm_whole_rust_bindings_multiple_compressed_zlib_non_optimized_dbs() {
         let num_dbs = 2;
         let num_connection_cycles = 10;
+        let num_segments = 2;
         let mut thread_handles = vec![];
+        // Every database will be handled by a thread.
         for db_idx in 1..=num_dbs {
             let handle = thread::spawn(move || {
                 // Let's try to initialize a database per thread.
                 let mut db = test_initialize(
                     db_idx,
-                    "test-get-blobs-optimized-empty".to_string(),
+                    "test-insert-get-compressed-zlib-blobs".to_string(),
                     LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::NoCompression,
+                    LsmCompressionLib::ZLib,
                 );
 
                 // Let's connect to it via a main memory handle.
                 test_connect(&mut db);
 
                 // We now produce certain amount of blobs and persist them.
-                let num_blobs = 0;
-                let size_blob = 0;
+                let num_blobs = 10000_usize;
+                let size_blob = 1 << 10; // 1 KB
 
-                // Let's optimize the DB. No wasted data pages.
-                assert!(db.optimize().is_ok());
+                // At most this many segment are created (depending on checkpointing for example).
+                for _ in 0..num_segments {
+                    // Let's persist some blobs.
+                    test_persist_blobs(&mut db, num_blobs, size_blob, None, db_idx);
+                }
+
+                // No optimization now. There will be wasted data pages.
 
                 // Once some blobs have been persisted, we connect
                 // and disconnect multiple times and then we test that
@@ -1803,8 +3203,26 @@ mod tests {
                 // Now traverse the database backward.
                 test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
 
+                // Now using cursors via seeking a particular blob.
+                test_seek_cursor_forward_limited(
+                    &mut db,
+                    num_blobs >> 2,
+                    (num_blobs >> 2) + 1,
+                    size_blob,
+                    db_idx,
+                );
+
                 // Now until the very end of the database (EOF)
-                test_seek_cursor_forward_eof(&mut db, 3 * (num_blobs >> 2), 0, size_blob, db_idx);
+                test_seek_cursor_forward_eof(
+                    &mut db,
+                    3 * (num_blobs >> 2),
+                    (num_blobs >> 2) + 1,
+                    size_blob,
+                    db_idx,
+                );
+
+                // Now using seeking going backwards.
+                test_seek_cursor_backward_limited(&mut db, num_blobs >> 2, size_blob, db_idx);
 
                 // Now until the beginning of the database (inverse EOF)
                 test_seek_cursor_backward_eof(
@@ -1815,6 +3233,15 @@ mod tests {
                     db_idx,
                 );
 
+                // Now seek with exact match.
+                test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, db_idx);
+
+                // Now let's test deletions.
+                test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
+                test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
+
+                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::ZLib));
+
                 // Good bye
                 test_disconnect(&mut db);
             });
@@ -1827,7 +3254,7 @@ mod tests {
 
     #[test]
     /// We test the whole api under different circumstances.
-    fn lsm_whole_rust_bindings_multiple_compressed_lz4_optimized_dbs() {
+    fn lsm_whole_rust_bindings_multiple_compressed_zstd_optimized_dbs() {
         let num_dbs = 2;
         let num_connection_cycles = 10;
         let num_segments = 2;
@@ -1838,9 +3265,9 @@ mod tests {
                 // Let's try to initialize a database per thread.
                 let mut db = test_initialize(
                     db_idx,
-                    "test-insert-get-compressed-lz4-blobs".to_string(),
+                    "test-insert-get-compressed-zstd-blobs-optimized".to_string(),
                     LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::LZ4,
+                    LsmCompressionLib::ZStd,
                 );
 
                 // Let's connect to it via a main memory handle.
@@ -1910,7 +3337,7 @@ mod tests {
                 test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
                 test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
 
-                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::LZ4));
+                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::ZStd));
 
                 // Good bye
                 test_disconnect(&mut db);
@@ -1924,7 +3351,7 @@ mod tests {
 
     #[test]
     /// We test the whole api under different circumstances.
-    fn lsm_whole_rust_bindings_multiple_compressed_lz4_non_optimized_dbs() {
+    fn lsm_whole_rust_bindings_multiple_compressed_zstd_non_optimized_dbs() {
         let num_dbs = 2;
         let num_connection_cycles = 10;
         let num_segments = 2;
@@ -1935,9 +3362,9 @@ mod tests {
                 // Let's try to initialize a database per thread.
                 let mut db = test_initialize(
                     db_idx,
-                    "test-insert-get-compressed-lz4-blobs".to_string(),
+                    "test-insert-get-compressed-zstd-blobs-non-optimized".to_string(),
                     LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::LZ4,
+                    LsmCompressionLib::ZStd,
                 );
 
                 // Let's connect to it via a main memory handle.
@@ -2006,7 +3433,7 @@ mod tests {
                 test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
                 test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
 
-                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::LZ4));
+                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::ZStd));
 
                 // Good bye
                 test_disconnect(&mut db);
@@ -2019,382 +3446,553 @@ mod tests {
     }
 
     #[test]
-    /// We test the whole api under different circumstances.
-    fn lsm_whole_rust_bindings_multiple_compressed_zlib_optimized_dbs() {
+    /// Let's test that a non-initialized database behaves well.
+    fn lsm_rust_bindings_with_not_yet_initialized_db() {
+        let num_dbs = 2;
+        let mut thread_handles = vec![];
+        let mut master_prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        for _ in 1..=num_dbs {
+            // Every thread will have a different seed, but each time it will be same,
+            // as the master prng is initialized with the same seed every time.
+            let mut thread_prng: Mt64 = SeedableRng::seed_from_u64(master_prng.next_u64());
+            let handle = thread::spawn(move || {
+                let mut db: LsmDb = Default::default();
+
+                // We now produce certain amount of blobs and persist them.
+                let size_blob = 1 << 10; // 1 KB
+                let blob = construct_random_blob(size_blob, &mut thread_prng);
+
+                let mut rc = db.connect();
+                assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+                rc = Disk::persist(&mut db, &Vec::from(1usize.to_be_bytes()), &blob);
+                assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+                let key = Vec::from(1usize.to_be_bytes());
+                rc = Disk::delete(&mut db, &key);
+                assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+                // let cursor_res = Disk::cursor_open(&mut db);
+                // assert!(cursor_res.is_err());
+
+                let starting_key = Vec::from(1usize.to_be_bytes());
+                let ending_key = Vec::from(0usize.not().to_be_bytes());
+                rc = Disk::delete_range(&mut db, &starting_key, &ending_key);
+                assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+
+                rc = db.disconnect();
+                assert_eq!(rc, Ok(()));
+            });
+            thread_handles.push(handle);
+        }
+        for t in thread_handles {
+            t.join().unwrap();
+        }
+    }
+
+    #[test]
+    /// To see whether we can open and close the same file over and over again.
+    fn lsm_open_close_multiple_times() {
+        let num_connection_cycles = 100;
+        let mut db = test_initialize(
+            0,
+            "test-open-close".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
+        test_connect(&mut db);
+
+        for _ in 0..num_connection_cycles {
+            test_disconnect(&mut db);
+            test_connect(&mut db);
+        }
+
+        test_disconnect(&mut db);
+    }
+
+    #[test]
+    fn lsm_rust_bindings_multiple_dbs_grpc_blobs() {
         let num_dbs = 2;
         let num_connection_cycles = 10;
-        let num_segments = 2;
         let mut thread_handles = vec![];
-        // Every database will be handled by a thread.
+        let mut master_prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
         for db_idx in 1..=num_dbs {
+            // Every thread will have a different seed, but each time it will be same,
+            // as the master prng is initialized with the same seed every time.
+            let thread_prng: Mt64 = SeedableRng::seed_from_u64(master_prng.next_u64());
             let handle = thread::spawn(move || {
                 // Let's try to initialize a database per thread.
                 let mut db = test_initialize(
                     db_idx,
-                    "test-insert-get-compressed-zlib-blobs".to_string(),
+                    "test-insert-get-grpc-blobs".to_string(),
                     LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::ZLib,
+                    LsmCompressionLib::NoCompression,
                 );
 
                 // Let's connect to it via a main memory handle.
                 test_connect(&mut db);
 
                 // We now produce certain amount of blobs and persist them.
-                let num_blobs = 10000_usize;
+                let num_blobs = 100_usize;
                 let size_blob = 1 << 10; // 1 KB
 
-                // At most this many segment are created (depending on checkpointing for example).
-                for _ in 0..num_segments {
-                    // Let's persist some blobs.
-                    test_persist_blobs(&mut db, num_blobs, size_blob, None, db_idx);
-                }
+                // Let's persist some blobs.
+                test_persist_grpc_blobs(&mut db, num_blobs, size_blob, thread_prng);
+
+                // Let's optimize the DB.
+                assert!(db.optimize().is_ok());
+
+                // Once some blobs have been persisted, we connect
+                // and disconnect multiple times and then we test that
+                // what we read is what we expect.
+                for _ in 0..num_connection_cycles {
+                    test_disconnect(&mut db);
+                    test_connect(&mut db);
+                }
+
+                // Let's test forward iterators on the whole database.
+                test_forward_cursor_grpc(&mut db, num_blobs);
+
+                // Now traverse the database backward.
+                test_backward_cursor_grpc(&mut db, num_blobs);
+
+                // Good bye
+                test_disconnect(&mut db);
+            });
+            thread_handles.push(handle);
+        }
+        for t in thread_handles {
+            t.join().unwrap();
+        }
+    }
+
+    #[test]
+    fn lsm_cursor_automatic_drop() {
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        // Let's try to initialize a database per thread.
+        let mut db = test_initialize(
+            1,
+            "test-cursor-automatic-drop".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
+
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
+
+        // We now produce certain amount of blobs and persist them.
+        let num_blobs = 100_usize;
+        let size_blob = 1 << 10; // 1 KB
+
+        // Let's persist some blobs.
+        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
+
+        {
+            // Let's open a cursor (which will produce a snapshot) within a scope.
+            let cursor_res = db.cursor_open();
+            assert!(cursor_res.is_ok());
+        }
+
+        // We should now be able to close the database cleanly as the cursor has been
+        // dropped automatically.
+        test_disconnect(&mut db);
+    }
+
+    #[test]
+    fn lsm_handle_automatic_drop() {
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        let db_fqn: String;
+
+        // The database is opened within a scope. Thus the `db` handle will
+        // be valid inside it. When going out of scope, the handle is freed, and
+        // thus the database will be cleanly close.
+        {
+            // Let's try to initialize a database per thread.
+            let mut db = test_initialize(
+                1,
+                "test-handle-automatic-drop".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                LsmCompressionLib::NoCompression,
+            );
+
+            // We copy the whole path of the database. Observe that we cannot use db_fq_name
+            // as that's a c-string (and thus nul-terminated).
+            db_fqn = format!(
+                "{}/{}.lsm",
+                db.db_conf.db_path.display(),
+                db.db_conf.db_base_name
+            );
+
+            // Let's connect to it via a main memory handle.
+            test_connect(&mut db);
+
+            // We now produce certain amount of blobs and persist them.
+            let num_blobs = 100_usize;
+            let size_blob = 1 << 10; // 1 KB
+
+            // Let's persist some blobs.
+            test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
+
+            // We don't disconnect explicitly from the database. This will be done
+            // by going out of scope.
+        }
+        // The only way we can test whether the database was closed cleanly is that
+        // no database files other than the main database file exist in the filesystem.
+        let db_file = Path::new(&db_fqn);
+        let db_wal_fqn = format!("{}-{}", db_fqn.clone(), "log");
+        let db_wal = Path::new(&db_wal_fqn);
+
+        // The following file should exist.
+        assert!(db_file.exists());
+        // The following files shouldn't exist.
+        assert!(!db_wal.exists());
+    }
+
+    #[test]
+    fn lsm_multiple_writers_interlaced() {
+        let num_writers = 5;
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        let now = Utc::now();
+        let db_path: String = "/tmp".to_string();
+        let db_base_name: String = format!(
+            "{}-{}",
+            "test-multiple-writers-interlaced",
+            now.timestamp_nanos_opt().unwrap()
+        );
+        // We now produce certain amount of blobs and persist them.
+        let num_blobs = 10000_usize;
+        let size_blob = 1 << 10; // 1 KB
+
+        // Let's produce the handles for every writer.
+        let mut db_handles = vec![];
+        for _ in 1..=num_writers {
+            // Let's try to initialize a database per thread.
+            let db_conf = DbConf {
+                db_path: db_path.clone().into(),
+                db_base_name: db_base_name.clone(),
+                mode: LsmMode::LsmNoBackgroundThreads,
+                handle_mode: LsmHandleMode::ReadWrite,
+                metrics: None,
+                compression: LsmCompressionLib::NoCompression,
+                ..Default::default()
+            };
+
+            let mut db: LsmDb = Default::default();
 
-                // Let's optimize the DB. No wasted data pages.
-                assert!(db.optimize().is_ok());
+            let rc = db.initialize(db_conf);
+            assert_eq!(rc, Ok(()));
 
-                // Once some blobs have been persisted, we connect
-                // and disconnect multiple times and then we test that
-                // what we read is what we expect.
-                for _ in 0..num_connection_cycles {
-                    test_disconnect(&mut db);
-                    test_connect(&mut db);
-                }
+            let rc = db.connect();
+            assert_eq!(rc, Ok(()));
 
-                // Let's test forward iterators on the whole database.
-                test_forward_cursor(&mut db, num_blobs, size_blob, db_idx);
+            db_handles.push(db);
+        }
 
-                // Now traverse the database backward.
-                test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
+        // Now let's use the handles to write to the same file one writer at a time.
+        // This works because each time the writer lock is obtained by the corresponding
+        // writer.
+        for (db_handle_id, db_handle) in db_handles.iter_mut().enumerate().take(num_writers) {
+            // Let's persist some more blobs (which can only be written on a clean database).
+            test_persist_blobs(
+                db_handle,
+                num_blobs,
+                size_blob,
+                Some(prng.clone()),
+                db_handle_id,
+            );
+        }
+    }
 
-                // Now using cursors via seeking a particular blob.
-                test_seek_cursor_forward_limited(
-                    &mut db,
-                    num_blobs >> 2,
-                    (num_blobs >> 2) + 1,
-                    size_blob,
-                    db_idx,
-                );
+    #[test]
+    fn lsm_bg_checkpointer_and_merger_in_one() {
+        // Let's try to initialize a database. The connection will issue one background
+        // thread that will merge and checkpoint the database file at certain intervals.
+        let mut db = test_initialize(
+            1,
+            "test-bg-checkpointer-and-merger-in-one".to_string(),
+            LsmMode::LsmBackgroundMerger,
+            LsmCompressionLib::NoCompression,
+        );
 
-                // Now until the very end of the database (EOF)
-                test_seek_cursor_forward_eof(
-                    &mut db,
-                    3 * (num_blobs >> 2),
-                    (num_blobs >> 2) + 1,
-                    size_blob,
-                    db_idx,
-                );
+        // We now produce certain amount of blobs and persist them.
+        let num_blobs = 100_usize;
+        let size_blob = 1 << 20; // 1 MB
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
 
-                // Now using seeking going backwards.
-                test_seek_cursor_backward_limited(&mut db, num_blobs >> 2, size_blob, db_idx);
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
 
-                // Now until the beginning of the database (inverse EOF)
-                test_seek_cursor_backward_eof(
-                    &mut db,
-                    num_blobs >> 2,
-                    num_blobs >> 2,
-                    size_blob,
-                    db_idx,
-                );
+        // Let's persist some blobs.
+        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
 
-                // Now seek with exact match.
-                test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, db_idx);
+        // Checkpointing increases the size of the data file. Thus, in the end,
+        // the file size should be something between 88 and 92 MiBs (for this particular test).
+        let db_path = db.db_conf.db_path.clone();
+        let db_base_name = db.db_conf.db_base_name.clone();
+        let db_fqn = format!("{}/{db_base_name}.lsm", db_path.display());
+        let db_file = Path::new(&db_fqn);
+        let db_wal_fqn = format!("{}-{}", db_fqn.clone(), "log");
+        let db_wal = Path::new(&db_wal_fqn);
+        assert!(db_file.exists());
+        assert!(db_wal.exists());
 
-                // Now let's test deletions.
-                test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
-                test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
+        let datafile_size_res = db_file.metadata();
+        assert!(datafile_size_res.is_ok());
 
-                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::ZLib));
+        let datafile_size = datafile_size_res.unwrap().len();
+        let expected_datafile_min_size: u64 = 67_000_000;
+        let expected_datafile_max_size: u64 = 125_000_000;
+        // The size of the data file might vary from platform to platform, but for this
+        // particular test it should be about 68 MiBs
+        assert!(datafile_size > expected_datafile_min_size);
+        assert!(datafile_size < expected_datafile_max_size);
 
-                // Good bye
-                test_disconnect(&mut db);
-            });
-            thread_handles.push(handle);
-        }
-        for t in thread_handles {
-            t.join().unwrap();
-        }
+        // We should now be able to close the database cleanly as the cursor has been
+        // dropped automatically.
+        test_disconnect(&mut db)
     }
 
     #[test]
-    /// We test the whole api under different circumstances.
-    fn lsm_whole_rust_bindings_multiple_compressed_zlib_non_optimized_dbs() {
-        let num_dbs = 2;
-        let num_connection_cycles = 10;
-        let num_segments = 2;
-        let mut thread_handles = vec![];
-        // Every database will be handled by a thread.
-        for db_idx in 1..=num_dbs {
-            let handle = thread::spawn(move || {
-                // Let's try to initialize a database per thread.
-                let mut db = test_initialize(
-                    db_idx,
-                    "test-insert-get-compressed-zlib-blobs".to_string(),
-                    LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::ZLib,
-                );
-
-                // Let's connect to it via a main memory handle.
-                test_connect(&mut db);
+    fn lsm_bg_checkpointer_only() {
+        // Let's try to initialize a database. The connection will issue one background
+        // thread that will checkpoint the database file at certain intervals.
+        let mut db = test_initialize(
+            1,
+            "test-bg-checkpointer-only".to_string(),
+            LsmMode::LsmBackgroundCheckpointer,
+            LsmCompressionLib::NoCompression,
+        );
 
-                // We now produce certain amount of blobs and persist them.
-                let num_blobs = 10000_usize;
-                let size_blob = 1 << 10; // 1 KB
+        // We now produce certain amount of blobs and persist them.
+        let num_blobs = 100_usize;
+        let size_blob = 1 << 20; // 1 MB
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
 
-                // At most this many segment are created (depending on checkpointing for example).
-                for _ in 0..num_segments {
-                    // Let's persist some blobs.
-                    test_persist_blobs(&mut db, num_blobs, size_blob, None, db_idx);
-                }
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
 
-                // No optimization now. There will be wasted data pages.
+        // Let's persist some blobs.
+        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
 
-                // Once some blobs have been persisted, we connect
-                // and disconnect multiple times and then we test that
-                // what we read is what we expect.
-                for _ in 0..num_connection_cycles {
-                    test_disconnect(&mut db);
-                    test_connect(&mut db);
-                }
+        // Checkpointing increases the size of the data file. Thus, in the end,
+        // the file size should be around 160 MiBs (for this particular test).
+        let db_path = db.db_conf.db_path.clone();
+        let db_base_name = db.db_conf.db_base_name.clone();
+        let db_fqn = format!("{}/{db_base_name}.lsm", db_path.display());
+        let db_file = Path::new(&db_fqn);
+        let db_wal_fqn = format!("{}-{}", db_fqn.clone(), "log");
+        let db_wal = Path::new(&db_wal_fqn);
+        assert!(db_file.exists());
+        assert!(db_wal.exists());
 
-                // Let's test forward iterators on the whole database.
-                test_forward_cursor(&mut db, num_blobs, size_blob, db_idx);
+        let datafile_size_res = db_file.metadata();
+        assert!(datafile_size_res.is_ok());
 
-                // Now traverse the database backward.
-                test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
+        let datafile_size = datafile_size_res.unwrap().len();
+        let expected_datafile_min_size: u64 = 160_000_000;
+        let expected_datafile_max_size: u64 = 170_000_000;
+        // The size of the data file might vary from platform to platform, but for this
+        // particular test it should be about 68 MiBs
+        assert!(datafile_size > expected_datafile_min_size);
+        assert!(datafile_size < expected_datafile_max_size);
 
-                // Now using cursors via seeking a particular blob.
-                test_seek_cursor_forward_limited(
-                    &mut db,
-                    num_blobs >> 2,
-                    (num_blobs >> 2) + 1,
-                    size_blob,
-                    db_idx,
-                );
+        // We should now be able to close the database cleanly as the cursor has been
+        // dropped automatically.
+        test_disconnect(&mut db);
+    }
 
-                // Now until the very end of the database (EOF)
-                test_seek_cursor_forward_eof(
-                    &mut db,
-                    3 * (num_blobs >> 2),
-                    (num_blobs >> 2) + 1,
-                    size_blob,
-                    db_idx,
-                );
+    #[test]
+    fn lsm_initialization_fails_with_non_c_string() {
+        let bad_filename = "test-no-null\0in-the-middle".to_string();
+        let now = Utc::now();
+        let db_conf = DbConf {
+            db_path: "/tmp".into(),
+            db_base_name: format!("{}-{}", bad_filename, now.timestamp_nanos_opt().unwrap(),),
+            mode: LsmMode::LsmNoBackgroundThreads,
+            handle_mode: LsmHandleMode::ReadWrite,
+            metrics: None,
+            compression: LsmCompressionLib::NoCompression,
+            ..Default::default()
+        };
 
-                // Now using seeking going backwards.
-                test_seek_cursor_backward_limited(&mut db, num_blobs >> 2, size_blob, db_idx);
+        let mut db: LsmDb = Default::default();
 
-                // Now until the beginning of the database (inverse EOF)
-                test_seek_cursor_backward_eof(
-                    &mut db,
-                    num_blobs >> 2,
-                    num_blobs >> 2,
-                    size_blob,
-                    db_idx,
-                );
+        let rc = db.initialize(db_conf);
+        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+    }
 
-                // Now seek with exact match.
-                test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, db_idx);
+    #[test]
+    fn transactions_rollback() {
+        // Let's initialize a handle.
+        let mut db = test_initialize(
+            1,
+            "test-transactions-rollback".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
 
-                // Now let's test deletions.
-                test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
-                test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
+        // We now produce certain amount of blobs and persist them.
+        let num_blobs = 10000_usize;
+        let size_blob = 1 << 10; // 1 KB
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
 
-                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::ZLib));
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
 
-                // Good bye
-                test_disconnect(&mut db);
-            });
-            thread_handles.push(handle);
-        }
-        for t in thread_handles {
-            t.join().unwrap();
-        }
-    }
+        // Let's open a transaction
+        let mut rc = db.begin_transaction();
+        assert_eq!(rc, Ok(()));
 
-    #[test]
-    /// We test the whole api under different circumstances.
-    fn lsm_whole_rust_bindings_multiple_compressed_zstd_optimized_dbs() {
-        let num_dbs = 2;
-        let num_connection_cycles = 10;
-        let num_segments = 2;
-        let mut thread_handles = vec![];
-        // Every database will be handled by a thread.
-        for db_idx in 1..=num_dbs {
-            let handle = thread::spawn(move || {
-                // Let's try to initialize a database per thread.
-                let mut db = test_initialize(
-                    db_idx,
-                    "test-insert-get-compressed-zstd-blobs-optimized".to_string(),
-                    LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::ZStd,
-                );
+        // Let's persist some blobs within the opened transactions.
+        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
 
-                // Let's connect to it via a main memory handle.
-                test_connect(&mut db);
+        // Let's rollback the transaction (making all persisted blobs disappear).
+        rc = db.rollback_transaction();
+        assert_eq!(rc, Ok(()));
 
-                // We now produce certain amount of blobs and persist them.
-                let num_blobs = 10000_usize;
-                let size_blob = 1 << 10; // 1 KB
+        // We now test that no blob is found in the database although some were "persisted".
+        test_num_blobs_are_in_file(&mut db, 0);
+    }
 
-                // At most this many segment are created (depending on checkpointing for example).
-                for _ in 0..num_segments {
-                    // Let's persist some blobs.
-                    test_persist_blobs(&mut db, num_blobs, size_blob, None, db_idx);
-                }
+    #[test]
+    fn transactions_commit() {
+        // Let's initialize a handle.
+        let mut db = test_initialize(
+            1,
+            "test-transactions-rollback".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
 
-                // Let's optimize the DB. No wasted data pages.
-                assert!(db.optimize().is_ok());
+        // We now produce certain amount of blobs and persist them.
+        let num_blobs = 10000_usize;
+        let size_blob = 1 << 10; // 1 KB
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
 
-                // Once some blobs have been persisted, we connect
-                // and disconnect multiple times and then we test that
-                // what we read is what we expect.
-                for _ in 0..num_connection_cycles {
-                    test_disconnect(&mut db);
-                    test_connect(&mut db);
-                }
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
 
-                // Let's test forward iterators on the whole database.
-                test_forward_cursor(&mut db, num_blobs, size_blob, db_idx);
+        // Let's open a transaction
+        let mut rc = db.begin_transaction();
+        assert_eq!(rc, Ok(()));
 
-                // Now traverse the database backward.
-                test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
+        // Let's persist some blobs within the opened transactions.
+        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
 
-                // Now using cursors via seeking a particular blob.
-                test_seek_cursor_forward_limited(
-                    &mut db,
-                    num_blobs >> 2,
-                    (num_blobs >> 2) + 1,
-                    size_blob,
-                    db_idx,
-                );
+        // Let's commit the transaction; making all blobs truly persisted blobs.
+        rc = db.commit_transaction();
+        assert_eq!(rc, Ok(()));
 
-                // Now until the very end of the database (EOF)
-                test_seek_cursor_forward_eof(
-                    &mut db,
-                    3 * (num_blobs >> 2),
-                    (num_blobs >> 2) + 1,
-                    size_blob,
-                    db_idx,
-                );
+        // We now test that no blob is found in the database although some were "persisted".
+        test_num_blobs_are_in_file(&mut db, num_blobs);
+    }
 
-                // Now using seeking going backwards.
-                test_seek_cursor_backward_limited(&mut db, num_blobs >> 2, size_blob, db_idx);
+    #[test]
+    fn can_work_with_empty_metrics_no_background_threads() {
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-empty-metrics-no-background-threads".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
+        // This is the interesting bit.
+        db.db_conf.metrics = None;
 
-                // Now until the beginning of the database (inverse EOF)
-                test_seek_cursor_backward_eof(
-                    &mut db,
-                    num_blobs >> 2,
-                    num_blobs >> 2,
-                    size_blob,
-                    db_idx,
-                );
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
 
-                // Now seek with exact match.
-                test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, db_idx);
+        // We now produce certain amount of blobs and persist them.
+        let num_blobs = 10000_usize;
+        let size_blob = 1 << 10; // 1 KB
 
-                // Now let's test deletions.
-                test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
-                test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        // Let's persist some blobs.
+        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
 
-                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::ZStd));
+        // Let's test forward iterators on the whole database.
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
 
-                // Good bye
-                test_disconnect(&mut db);
-            });
-            thread_handles.push(handle);
-        }
-        for t in thread_handles {
-            t.join().unwrap();
-        }
+        test_disconnect(&mut db);
     }
 
     #[test]
-    /// We test the whole api under different circumstances.
-    fn lsm_whole_rust_bindings_multiple_compressed_zstd_non_optimized_dbs() {
-        let num_dbs = 2;
-        let num_connection_cycles = 10;
-        let num_segments = 2;
-        let mut thread_handles = vec![];
-        // Every database will be handled by a thread.
-        for db_idx in 1..=num_dbs {
-            let handle = thread::spawn(move || {
-                // Let's try to initialize a database per thread.
-                let mut db = test_initialize(
-                    db_idx,
-                    "test-insert-get-compressed-zstd-blobs-non-optimized".to_string(),
-                    LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::ZStd,
-                );
-
-                // Let's connect to it via a main memory handle.
-                test_connect(&mut db);
-
-                // We now produce certain amount of blobs and persist them.
-                let num_blobs = 10000_usize;
-                let size_blob = 1 << 10; // 1 KB
+    fn can_work_with_empty_metrics_with_background_merger() {
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-empty-metrics-with-background-merger".to_string(),
+            LsmMode::LsmBackgroundMerger,
+            LsmCompressionLib::NoCompression,
+        );
+        // This is the interesting bit.
+        db.db_conf.metrics = None;
 
-                // At most this many segment are created (depending on checkpointing for example).
-                for _ in 0..num_segments {
-                    // Let's persist some blobs.
-                    test_persist_blobs(&mut db, num_blobs, size_blob, None, db_idx);
-                }
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
 
-                // No optimization now. There will be wasted data pages.
+        // We now produce certain amount of blobs and persist them.
+        let num_blobs = 10000_usize;
+        let size_blob = 1 << 10; // 1 KB
 
-                // Once some blobs have been persisted, we connect
-                // and disconnect multiple times and then we test that
-                // what we read is what we expect.
-                for _ in 0..num_connection_cycles {
-                    test_disconnect(&mut db);
-                    test_connect(&mut db);
-                }
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        // Let's persist some blobs.
+        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
 
-                // Let's test forward iterators on the whole database.
-                test_forward_cursor(&mut db, num_blobs, size_blob, db_idx);
+        // We disconnect to be able to finish all background work, before
+        // continuing.
+        test_disconnect(&mut db);
+        test_connect(&mut db);
 
-                // Now traverse the database backward.
-                test_backward_cursor(&mut db, num_blobs, size_blob, db_idx);
+        // Let's test forward iterators on the whole database.
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
 
-                // Now using cursors via seeking a particular blob.
-                test_seek_cursor_forward_limited(
-                    &mut db,
-                    num_blobs >> 2,
-                    (num_blobs >> 2) + 1,
-                    size_blob,
-                    db_idx,
-                );
+        test_disconnect(&mut db);
+    }
 
-                // Now until the very end of the database (EOF)
-                test_seek_cursor_forward_eof(
-                    &mut db,
-                    3 * (num_blobs >> 2),
-                    (num_blobs >> 2) + 1,
-                    size_blob,
-                    db_idx,
-                );
+    #[test]
+    fn can_work_with_compressed_db_with_background_merger() {
+        let mut dbs = vec![];
+        let db_lz4 = test_initialize(
+            1,
+            "test-can-work-with-compressed-db-lz4-with-background-merger".to_string(),
+            LsmMode::LsmBackgroundMerger,
+            LsmCompressionLib::LZ4,
+        );
+        let db_zlib = test_initialize(
+            1,
+            "test-can-work-with-compressed-db-zlib-with-background-merger".to_string(),
+            LsmMode::LsmBackgroundMerger,
+            LsmCompressionLib::ZLib,
+        );
+        let db_zstd = test_initialize(
+            1,
+            "test-can-work-with-compressed-db-zstd-with-background-merger".to_string(),
+            LsmMode::LsmBackgroundMerger,
+            LsmCompressionLib::ZStd,
+        );
+        dbs.push(db_lz4);
+        dbs.push(db_zstd);
+        dbs.push(db_zlib);
 
-                // Now using seeking going backwards.
-                test_seek_cursor_backward_limited(&mut db, num_blobs >> 2, size_blob, db_idx);
+        // We now produce certain amount of blobs and persist them.
+        let num_blobs = 10000_usize;
+        let size_blob = 1 << 10; // 1 KB
 
-                // Now until the beginning of the database (inverse EOF)
-                test_seek_cursor_backward_eof(
-                    &mut db,
-                    num_blobs >> 2,
-                    num_blobs >> 2,
-                    size_blob,
-                    db_idx,
-                );
+        let mut thread_handles = vec![];
+        for mut db in dbs {
+            let handle = thread::spawn(move || {
+                // Let's connect to it via a main memory handle.
+                test_connect(&mut db);
 
-                // Now seek with exact match.
-                test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, db_idx);
+                // Let's persist some blobs.
+                test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
 
-                // Now let's test deletions.
-                test_single_deletion(&mut db, num_blobs >> 2, num_blobs, db_idx);
-                test_range_deletion(&mut db, num_blobs >> 1, num_blobs, num_blobs, db_idx);
+                // We disconnect to be able to finish all background work, before
+                // continuing.
+                test_disconnect(&mut db);
+                test_connect(&mut db);
 
-                assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::ZStd));
+                // Let's test forward iterators on the whole database.
+                test_forward_cursor(&mut db, num_blobs, size_blob, 0);
 
-                // Good bye
                 test_disconnect(&mut db);
             });
             thread_handles.push(handle);
@@ -2405,558 +4003,1472 @@ mod tests {
     }
 
     #[test]
-    /// Let's test that a non-initialized database behaves well.
-    fn lsm_rust_bindings_with_not_yet_initialized_db() {
-        let num_dbs = 2;
-        let mut thread_handles = vec![];
-        let mut master_prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
-        for _ in 1..=num_dbs {
-            // Every thread will have a different seed, but each time it will be same,
-            // as the master prng is initialized with the same seed every time.
-            let mut thread_prng: Mt64 = SeedableRng::seed_from_u64(master_prng.next_u64());
-            let handle = thread::spawn(move || {
-                let mut db: LsmDb = Default::default();
+    fn can_work_with_compression_levels() {
+        // Every library is used with a level (or acceleration) other than
+        // its default, and then with yet another one when connecting again.
+        for (compression, level, other_level) in [
+            (LsmCompressionLib::LZ4, 8, 1),
+            (LsmCompressionLib::ZLib, 1, 9),
+            (LsmCompressionLib::ZStd, 19, -5),
+        ] {
+            let mut db = test_initialize(
+                1,
+                format!("test-can-work-with-compression-level-{compression:?}"),
+                LsmMode::LsmBackgroundMerger,
+                compression,
+            );
+            db.db_conf.compression_level = Some(level);
 
-                // We now produce certain amount of blobs and persist them.
-                let size_blob = 1 << 10; // 1 KB
-                let blob = construct_random_blob(size_blob, &mut thread_prng);
+            // Let's connect to it via a main memory handle.
+            test_connect(&mut db);
 
-                let mut rc = db.connect();
-                assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
-                rc = Disk::persist(&mut db, &Vec::from(1usize.to_be_bytes()), &blob);
-                assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+            // We now produce certain amount of blobs and persist them.
+            let num_blobs = 10000_usize;
+            let size_blob = 1 << 10; // 1 KB
+            test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            assert!(db.optimize().is_ok());
 
-                let key = Vec::from(1usize.to_be_bytes());
-                rc = Disk::delete(&mut db, &key);
-                assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+            // The level is not part of the database, thus it can change.
+            test_disconnect(&mut db);
+            db.db_conf.compression_level = Some(other_level);
+            test_connect(&mut db);
 
-                // let cursor_res = Disk::cursor_open(&mut db);
-                // assert!(cursor_res.is_err());
+            // Let's test forward iterators on the whole database.
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            assert_eq!(db.get_compression_id(), Ok(compression));
 
-                let starting_key = Vec::from(1usize.to_be_bytes());
-                let ending_key = Vec::from(0usize.not().to_be_bytes());
-                rc = Disk::delete_range(&mut db, &starting_key, &ending_key);
-                assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+            test_disconnect(&mut db);
+        }
 
-                rc = db.disconnect();
-                assert_eq!(rc, Ok(()));
-            });
-            thread_handles.push(handle);
+        // zlib refuses levels it does not know about.
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-compression-level-invalid".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::ZLib,
+        );
+        db.db_conf.compression_level = Some(42);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+        assert!(!db.is_connected());
+    }
+
+    #[test]
+    fn can_work_with_compression_dictionaries() {
+        for mode in [
+            LsmMode::LsmNoBackgroundThreads,
+            LsmMode::LsmBackgroundMerger,
+        ] {
+            let mut db = test_initialize(
+                1,
+                format!("test-can-work-with-compression-dictionaries-{mode:?}"),
+                mode,
+                LsmCompressionLib::ZStd,
+            );
+            db.db_conf.compression_dictionary = Some(4 << 10);
+
+            // Let's connect to it via a main memory handle.
+            test_connect(&mut db);
+            assert_eq!(db.get_compression_dictionary_id(), Ok(None));
+
+            // Enough blobs so that the main-memory tree is flushed, and then merged.
+            let num_blobs = 20000_usize;
+            let size_blob = 1 << 10; // 1 KB
+            test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            assert!(db.optimize().is_ok());
+            let dictionary_id = db.get_compression_dictionary_id();
+            assert!(matches!(dictionary_id, Ok(Some(_))));
+
+            // From now on, pages are compressed using the dictionary.
+            test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            assert!(db.optimize().is_ok());
+            test_disconnect(&mut db);
+
+            // The dictionary is part of the database, thus handles that do not
+            // train one use it as well.
+            db.db_conf.compression_dictionary = None;
+            test_connect(&mut db);
+            assert_eq!(db.get_compression_dictionary_id(), dictionary_id);
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+
+            test_disconnect(&mut db);
         }
-        for t in thread_handles {
-            t.join().unwrap();
+
+        // Only zstd supports dictionaries, and only of reasonable sizes.
+        for (compression, size_b) in [
+            (LsmCompressionLib::LZ4, 4 << 10),
+            (LsmCompressionLib::ZStd, 16),
+        ] {
+            let mut db = test_initialize(
+                1,
+                format!("test-can-work-with-compression-dictionaries-invalid-{compression:?}"),
+                LsmMode::LsmNoBackgroundThreads,
+                compression,
+            );
+            db.db_conf.compression_dictionary = Some(size_b);
+            assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+            assert!(!db.is_connected());
         }
     }
 
     #[test]
-    /// To see whether we can open and close the same file over and over again.
-    fn lsm_open_close_multiple_times() {
-        let num_connection_cycles = 100;
+    fn can_work_with_age_compression() {
+        for mode in [
+            LsmMode::LsmNoBackgroundThreads,
+            LsmMode::LsmBackgroundMerger,
+        ] {
+            let mut db = test_initialize(
+                1,
+                format!("test-can-work-with-age-compression-{mode:?}"),
+                mode,
+                LsmCompressionLib::ZStd,
+            );
+            db.db_conf = db
+                .db_conf
+                .clone()
+                .with_age_compression(0, LsmCompressionLib::NoCompression, None)
+                .with_age_compression(1, LsmCompressionLib::LZ4, None);
+
+            // Let's connect to it via a main memory handle.
+            test_connect(&mut db);
+
+            // Enough blobs so that segments of both ages are written.
+            let num_blobs = 20000_usize;
+            let size_blob = 1 << 10; // 1 KB
+            for _ in 0..3 {
+                test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            }
+            assert!(db.optimize().is_ok());
+            test_disconnect(&mut db);
+
+            // Every segment is read with the library it was written with,
+            // whatever libraries the handle is configured with.
+            db.db_conf.age_compression.clear();
+            test_connect(&mut db);
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            assert_eq!(db.get_compression_id(), Ok(LsmCompressionLib::ZStd));
+
+            test_disconnect(&mut db);
+        }
+
+        // Databases without compression cannot compress segments of some ages.
         let mut db = test_initialize(
-            0,
-            "test-open-close".to_string(),
+            1,
+            "test-can-work-with-age-compression-invalid".to_string(),
             LsmMode::LsmNoBackgroundThreads,
             LsmCompressionLib::NoCompression,
         );
+        db.db_conf = db
+            .db_conf
+            .clone()
+            .with_age_compression(1, LsmCompressionLib::LZ4, None);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+        assert!(!db.is_connected());
+    }
+
+    #[test]
+    fn can_work_with_incompressible_pages() {
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-incompressible-pages".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::LZ4,
+        );
+
+        // Let's connect to it via a main memory handle.
         test_connect(&mut db);
 
-        for _ in 0..num_connection_cycles {
-            test_disconnect(&mut db);
-            test_connect(&mut db);
-        }
+        // Random blobs do not compress, thus the pages holding them are
+        // stored as they are.
+        let num_blobs = 20000_usize;
+        let size_blob = 1 << 10; // 1 KB
+        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        test_persist_grpc_blobs(&mut db, num_blobs, size_blob, prng);
+        assert!(db.optimize().is_ok());
+
+        let pages_written = db.get_num_pages_written().unwrap();
+        let pages_written_raw = db.get_num_pages_written_raw().unwrap();
+        assert!(pages_written_raw > 0);
+        assert!(pages_written_raw <= pages_written);
+        test_disconnect(&mut db);
 
+        // Raw pages are read back (by a fresh handle) as any other.
+        test_connect(&mut db);
+        test_forward_cursor_grpc(&mut db, num_blobs);
+        test_disconnect(&mut db);
+
+        // Compressible blobs are always worth compressing.
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-incompressible-pages-compressible".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::LZ4,
+        );
+        db.db_conf = db.db_conf.clone().with_min_compression_saving(10);
+        test_connect(&mut db);
+        test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+        assert!(db.optimize().is_ok());
+        assert!(db.get_num_pages_written().unwrap() > 0);
+        assert_eq!(db.get_num_pages_written_raw(), Ok(0));
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
         test_disconnect(&mut db);
+
+        // Savings above 99%, or databases without compression, are not allowed.
+        db.db_conf = db.db_conf.clone().with_min_compression_saving(100);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+        assert!(!db.is_connected());
+
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-incompressible-pages-invalid".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
+        db.db_conf = db.db_conf.clone().with_min_compression_saving(10);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+        assert!(!db.is_connected());
     }
 
     #[test]
-    fn lsm_rust_bindings_multiple_dbs_grpc_blobs() {
-        let num_dbs = 2;
-        let num_connection_cycles = 10;
-        let mut thread_handles = vec![];
-        let mut master_prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
-        for db_idx in 1..=num_dbs {
-            // Every thread will have a different seed, but each time it will be same,
-            // as the master prng is initialized with the same seed every time.
-            let thread_prng: Mt64 = SeedableRng::seed_from_u64(master_prng.next_u64());
-            let handle = thread::spawn(move || {
-                // Let's try to initialize a database per thread.
-                let mut db = test_initialize(
-                    db_idx,
-                    "test-insert-get-grpc-blobs".to_string(),
-                    LsmMode::LsmNoBackgroundThreads,
-                    LsmCompressionLib::NoCompression,
-                );
+    fn can_work_with_page_cache() {
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-page-cache".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::ZStd,
+        );
 
-                // Let's connect to it via a main memory handle.
-                test_connect(&mut db);
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
 
-                // We now produce certain amount of blobs and persist them.
-                let num_blobs = 100_usize;
-                let size_blob = 1 << 10; // 1 KB
+        // Enough blobs so that pages are written to the file.
+        let num_blobs = 20000_usize;
+        let size_blob = 1 << 10; // 1 KB
+        test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+        assert!(db.optimize().is_ok());
+        test_disconnect(&mut db);
 
-                // Let's persist some blobs.
-                test_persist_grpc_blobs(&mut db, num_blobs, size_blob, thread_prng);
+        // By default, the whole database fits in the cache of decompressed pages,
+        // thus traversing it again reads (next to) no page from the file.
+        test_connect(&mut db);
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        let pages_read = db.get_num_pages_read().unwrap();
+        assert!(pages_read > 0);
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        let pages_read_again = db.get_num_pages_read().unwrap() - pages_read;
+        assert!(pages_read_again < pages_read / 100);
+        test_disconnect(&mut db);
 
-                // Let's optimize the DB.
-                assert!(db.optimize().is_ok());
+        // With a small cache, pages are read (and decompressed) again.
+        db.db_conf = db.db_conf.clone().with_page_cache_size(64);
+        test_connect(&mut db);
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        let pages_read = db.get_num_pages_read().unwrap();
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        let pages_read_again = db.get_num_pages_read().unwrap() - pages_read;
+        assert!(pages_read_again > pages_read / 2);
+        test_disconnect(&mut db);
+    }
 
-                // Once some blobs have been persisted, we connect
-                // and disconnect multiple times and then we test that
-                // what we read is what we expect.
-                for _ in 0..num_connection_cycles {
-                    test_disconnect(&mut db);
-                    test_connect(&mut db);
-                }
+    #[test]
+    fn can_work_with_compressed_page_cache() {
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-compressed-page-cache".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::ZStd,
+        );
+
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
+
+        // Enough blobs so that pages are written to the file.
+        let num_blobs = 20000_usize;
+        let size_blob = 1 << 10; // 1 KB
+        test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+        assert!(db.optimize().is_ok());
+        assert_eq!(db.get_num_compressed_cache_hits(), Ok(0));
+        assert_eq!(db.get_num_compressed_cache_misses(), Ok(0));
+        test_disconnect(&mut db);
+
+        // With a small page cache, but a sizeable cache of compressed pages, pages
+        // are decompressed again but (next to) none is read from the file again.
+        db.db_conf = db
+            .db_conf
+            .clone()
+            .with_page_cache_size(64)
+            .with_compressed_page_cache_size(32 << 10);
+        test_connect(&mut db);
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        let pages_read = db.get_num_pages_read().unwrap();
+        let misses = db.get_num_compressed_cache_misses().unwrap();
+        assert!(misses > 0 && misses <= pages_read);
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        let pages_read_again = db.get_num_pages_read().unwrap() - pages_read;
+        let misses_again = db.get_num_compressed_cache_misses().unwrap() - misses;
+        assert!(pages_read_again > pages_read / 2);
+        assert!(misses_again < misses / 100);
+        // Pages found in the cache count as read as well.
+        let hits = db.get_num_compressed_cache_hits().unwrap();
+        assert!(hits > pages_read / 2);
+        assert!(hits + misses + misses_again <= pages_read + pages_read_again);
+        test_disconnect(&mut db);
+
+        // A cache that cannot hold the database makes pages be read again.
+        db.db_conf = db.db_conf.clone().with_compressed_page_cache_size(64);
+        test_connect(&mut db);
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        let misses = db.get_num_compressed_cache_misses().unwrap();
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        let misses_again = db.get_num_compressed_cache_misses().unwrap() - misses;
+        assert!(misses_again > misses / 2);
+        test_disconnect(&mut db);
+
+        // Databases without compression have no compressed pages to cache.
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-compressed-page-cache-no-compression".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
+        db.db_conf = db.db_conf.clone().with_compressed_page_cache_size(64);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+    }
 
-                // Let's test forward iterators on the whole database.
-                test_forward_cursor_grpc(&mut db, num_blobs);
+    #[test]
+    fn can_compress_pages_on_threads() {
+        // Pages are written the same way whichever the number of threads
+        // compressing them (encrypted pages differ in their nonces only).
+        for (compression, encryption) in [
+            (LsmCompressionLib::LZ4, false),
+            (LsmCompressionLib::ZLib, false),
+            (LsmCompressionLib::ZStd, false),
+            (LsmCompressionLib::ZStd, true),
+        ] {
+            let mut pages_written = Vec::new();
+            for num_threads in [None, Some(1), Some(4)] {
+                let mut db = test_initialize(
+                    1,
+                    format!("test-can-compress-pages-on-threads-{compression:?}-{encryption}"),
+                    LsmMode::LsmNoBackgroundThreads,
+                    compression,
+                );
+                if let Some(num_threads) = num_threads {
+                    db.db_conf = db.db_conf.clone().with_compression_threads(num_threads);
+                }
+                if encryption {
+                    db.db_conf = db
+                        .db_conf
+                        .clone()
+                        .with_encryption(LsmCipher::Aes256Gcm, [42; 32]);
+                }
 
-                // Now traverse the database backward.
-                test_backward_cursor_grpc(&mut db, num_blobs);
+                // Enough blobs so that the main-memory tree is flushed, and then merged.
+                test_connect(&mut db);
+                let num_blobs = 20000_usize;
+                let size_blob = 1 << 10; // 1 KB
+                test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+                assert!(db.optimize().is_ok());
+                test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+                pages_written.push(db.get_num_pages_written().unwrap());
+                test_disconnect(&mut db);
 
-                // Good bye
+                // The pages are read back by handles without threads as well.
+                db.db_conf.compression_threads = None;
+                test_connect(&mut db);
+                test_forward_cursor(&mut db, num_blobs, size_blob, 0);
                 test_disconnect(&mut db);
-            });
-            thread_handles.push(handle);
-        }
-        for t in thread_handles {
-            t.join().unwrap();
+            }
+            assert!(pages_written[0] > 0);
+            assert!(pages_written.iter().all(|&pages| pages == pages_written[0]));
         }
-    }
 
-    #[test]
-    fn lsm_cursor_automatic_drop() {
-        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
-        // Let's try to initialize a database per thread.
+        // Background workers compress pages on threads as well.
         let mut db = test_initialize(
             1,
-            "test-cursor-automatic-drop".to_string(),
+            "test-can-compress-pages-on-threads-background".to_string(),
+            LsmMode::LsmBackgroundMerger,
+            LsmCompressionLib::ZStd,
+        );
+        db.db_conf = db.db_conf.clone().with_compression_threads(2);
+        test_connect(&mut db);
+        let num_blobs = 20000_usize;
+        let size_blob = 1 << 10; // 1 KB
+        test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+        assert!(db.optimize().is_ok());
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        test_disconnect(&mut db);
+
+        // Databases without compression have no pages to compress.
+        let mut db = test_initialize(
+            1,
+            "test-can-compress-pages-on-threads-no-compression".to_string(),
             LsmMode::LsmNoBackgroundThreads,
             LsmCompressionLib::NoCompression,
         );
+        db.db_conf = db.db_conf.clone().with_compression_threads(2);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
 
-        // Let's connect to it via a main memory handle.
+        // Nor can threads be combined with training a compression dictionary.
+        let mut db = test_initialize(
+            1,
+            "test-can-compress-pages-on-threads-dictionary".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::ZStd,
+        );
+        db.db_conf = db
+            .db_conf
+            .clone()
+            .with_compression_threads(2)
+            .with_compression_dictionary(4 << 10);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+
+        // A dictionary stored by another handle makes pages be compressed by the
+        // thread writing them, and the database stays readable.
+        db.db_conf.compression_threads = None;
         test_connect(&mut db);
-
-        // We now produce certain amount of blobs and persist them.
-        let num_blobs = 100_usize;
+        let num_blobs = 20000_usize;
         let size_blob = 1 << 10; // 1 KB
+        test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+        assert!(db.optimize().is_ok());
+        assert!(matches!(db.get_compression_dictionary_id(), Ok(Some(_))));
+        test_disconnect(&mut db);
 
-        // Let's persist some blobs.
-        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
-
-        {
-            // Let's open a cursor (which will produce a snapshot) within a scope.
-            let cursor_res = db.cursor_open();
-            assert!(cursor_res.is_ok());
-        }
-
-        // We should now be able to close the database cleanly as the cursor has been
-        // dropped automatically.
+        db.db_conf.compression_dictionary = None;
+        db.db_conf.compression_threads = Some(2);
+        test_connect(&mut db);
+        test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+        assert!(db.optimize().is_ok());
+        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
         test_disconnect(&mut db);
     }
 
     #[test]
-    fn lsm_handle_automatic_drop() {
-        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
-        let db_fqn: String;
-
-        // The database is opened within a scope. Thus the `db` handle will
-        // be valid inside it. When going out of scope, the handle is freed, and
-        // thus the database will be cleanly close.
-        {
-            // Let's try to initialize a database per thread.
+    fn can_scan_with_readahead() {
+        for compression in [LsmCompressionLib::NoCompression, LsmCompressionLib::ZStd] {
             let mut db = test_initialize(
                 1,
-                "test-handle-automatic-drop".to_string(),
+                "test-can-scan-with-readahead".to_string(),
                 LsmMode::LsmNoBackgroundThreads,
-                LsmCompressionLib::NoCompression,
-            );
-
-            // We copy the whole path of the database. Observe that we cannot use db_fq_name
-            // as that's a c-string (and thus nul-terminated).
-            db_fqn = format!(
-                "{}/{}.lsm",
-                db.db_conf.db_path.display(),
-                db.db_conf.db_base_name
+                compression,
             );
 
             // Let's connect to it via a main memory handle.
             test_connect(&mut db);
 
-            // We now produce certain amount of blobs and persist them.
-            let num_blobs = 100_usize;
+            // Enough blobs so that pages are written to the file.
+            let num_blobs = 20000_usize;
             let size_blob = 1 << 10; // 1 KB
+            test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            assert!(db.optimize().is_ok());
+            test_disconnect(&mut db);
 
-            // Let's persist some blobs.
-            test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
+            // Scans read ahead, in either direction, and still see every record.
+            test_connect(&mut db);
+            assert_eq!(db.get_num_readaheads(), Ok(0));
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            assert!(db.get_num_readaheads().unwrap() > 0);
+            test_disconnect(&mut db);
 
-            // We don't disconnect explicitly from the database. This will be done
-            // by going out of scope.
-        }
-        // The only way we can test whether the database was closed cleanly is that
-        // no database files other than the main database file exist in the filesystem.
-        let db_file = Path::new(&db_fqn);
-        let db_wal_fqn = format!("{}-{}", db_fqn.clone(), "log");
-        let db_wal = Path::new(&db_wal_fqn);
+            test_connect(&mut db);
+            test_backward_cursor(&mut db, num_blobs, size_blob, 0);
+            assert!(db.get_num_readaheads().unwrap() > 0);
+            test_disconnect(&mut db);
 
-        // The following file should exist.
-        assert!(db_file.exists());
-        // The following files shouldn't exist.
-        assert!(!db_wal.exists());
+            // Unless reading ahead is disabled.
+            db.db_conf = db.db_conf.clone().with_readahead(0);
+            test_connect(&mut db);
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_backward_cursor(&mut db, num_blobs, size_blob, 0);
+            assert_eq!(db.get_num_readaheads(), Ok(0));
+            test_disconnect(&mut db);
+        }
     }
 
     #[test]
-    fn lsm_multiple_writers_interlaced() {
-        let num_writers = 5;
-        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
-        let now = Utc::now();
-        let db_path: String = "/tmp".to_string();
-        let db_base_name: String = format!(
-            "{}-{}",
-            "test-multiple-writers-interlaced",
-            now.timestamp_nanos_opt().unwrap()
-        );
-        // We now produce certain amount of blobs and persist them.
-        let num_blobs = 10000_usize;
-        let size_blob = 1 << 10; // 1 KB
+    fn can_work_with_writeback() {
+        for (mode, compression) in [
+            (
+                LsmMode::LsmNoBackgroundThreads,
+                LsmCompressionLib::NoCompression,
+            ),
+            (LsmMode::LsmNoBackgroundThreads, LsmCompressionLib::ZStd),
+            (LsmMode::LsmBackgroundMerger, LsmCompressionLib::LZ4),
+        ] {
+            let mut db = test_initialize(
+                1,
+                "test-can-work-with-writeback".to_string(),
+                mode,
+                compression,
+            );
+            db.db_conf = db.db_conf.clone().with_writeback(64, true);
 
-        // Let's produce the handles for every writer.
-        let mut db_handles = vec![];
-        for _ in 1..=num_writers {
-            // Let's try to initialize a database per thread.
-            let db_conf = DbConf {
-                db_path: db_path.clone().into(),
-                db_base_name: db_base_name.clone(),
-                mode: LsmMode::LsmNoBackgroundThreads,
-                handle_mode: LsmHandleMode::ReadWrite,
-                metrics: None,
-                compression: LsmCompressionLib::NoCompression,
-            };
+            // Let's connect to it via a main memory handle.
+            test_connect(&mut db);
 
-            let mut db: LsmDb = Default::default();
+            // Enough blobs so that many ranges of the file are written back, and
+            // dropped from the cache of the operating system.
+            let num_blobs = 20000_usize;
+            let size_blob = 1 << 10; // 1 KB
+            test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            assert!(db.optimize().is_ok());
+            test_disconnect(&mut db);
 
-            let rc = db.initialize(db_conf);
-            assert_eq!(rc, Ok(()));
+            // Everything is read back just fine.
+            db.db_conf = db.db_conf.clone().with_writeback(0, false);
+            test_connect(&mut db);
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_disconnect(&mut db);
+        }
 
-            let rc = db.connect();
-            assert_eq!(rc, Ok(()));
+        // Pages can only be dropped once written back.
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-writeback-invalid".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
+        db.db_conf = db.db_conf.clone().with_writeback(0, true);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+        assert!(!db.is_connected());
+    }
 
-            db_handles.push(db);
-        }
+    #[test]
+    #[cfg(target_os = "linux")]
+    fn can_manage_disk_space() {
+        use std::os::unix::fs::MetadataExt;
+
+        // How much disk space the file uses, and how large it is.
+        let disk_usage = |db: &LsmDb| {
+            let metadata = std::fs::metadata(db.get_full_db_path().unwrap()).unwrap();
+            (metadata.blocks() * 512, metadata.len())
+        };
 
-        // Now let's use the handles to write to the same file one writer at a time.
-        // This works because each time the writer lock is obtained by the corresponding
-        // writer.
-        for (db_handle_id, db_handle) in db_handles.iter_mut().enumerate().take(num_writers) {
-            // Let's persist some more blobs (which can only be written on a clean database).
-            test_persist_blobs(
-                db_handle,
-                num_blobs,
-                size_blob,
-                Some(prng.clone()),
-                db_handle_id,
+        let mut usages = vec![];
+        for punch_holes in [false, true] {
+            let mut db = test_initialize(
+                1,
+                "test-can-manage-disk-space".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                LsmCompressionLib::NoCompression,
             );
+            db.db_conf = db.db_conf.clone().with_hole_punching(punch_holes);
+
+            // Let's connect to it via a main memory handle.
+            test_connect(&mut db);
+
+            // The same records are written over and over again, thus the blocks
+            // of the previous version are freed every time.
+            let num_blobs = 20000_usize;
+            let size_blob = 1 << 10; // 1 KB
+            for _ in 0..4 {
+                test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+                assert!(db.optimize().is_ok());
+            }
+            usages.push(disk_usage(&db));
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_disconnect(&mut db);
         }
-    }
+        // Punching holes does not shrink the file, but most of its disk space
+        // is released.
+        assert_eq!(usages[0].1, usages[1].1);
+        assert!(usages[1].0 < usages[0].0 / 2);
 
-    #[test]
-    fn lsm_bg_checkpointer_and_merger_in_one() {
-        // Let's try to initialize a database. The connection will issue one background
-        // thread that will merge and checkpoint the database file at certain intervals.
+        // Space is preallocated in large chunks, and the unused part of the last
+        // one is released once the last handle disconnects.
         let mut db = test_initialize(
             1,
-            "test-bg-checkpointer-and-merger-in-one".to_string(),
-            LsmMode::LsmBackgroundMerger,
+            "test-can-manage-disk-space-preallocation".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
             LsmCompressionLib::NoCompression,
         );
-
-        // We now produce certain amount of blobs and persist them.
-        let num_blobs = 100_usize;
-        let size_blob = 1 << 20; // 1 MB
-        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
-
-        // Let's connect to it via a main memory handle.
+        db.db_conf = db.db_conf.clone().with_preallocation(64 << 10);
         test_connect(&mut db);
+        test_persist_blobs(&mut db, 20000, 1 << 10, None, 0);
+        assert!(db.optimize().is_ok());
+        assert!(disk_usage(&db).1 >= 64 << 20);
+        test_disconnect(&mut db);
+        let metadata = std::fs::metadata(db.get_full_db_path().unwrap()).unwrap();
+        assert!(metadata.len() < 64 << 20);
+    }
 
-        // Let's persist some blobs.
-        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
+    #[test]
+    fn can_separate_large_values() {
+        for compression in [LsmCompressionLib::NoCompression, LsmCompressionLib::ZStd] {
+            let mut db = test_initialize(
+                1,
+                "test-can-separate-large-values".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                compression,
+            );
+            db.db_conf = db.db_conf.clone().with_value_log(1 << 10);
+            let db_path = db.get_full_db_path().unwrap();
+            let file_size = |suffix: &str| {
+                std::fs::metadata(format!("{db_path}{suffix}")).map_or(0, |m| m.len() as usize)
+            };
 
-        // Checkpointing increases the size of the data file. Thus, in the end,
-        // the file size should be something between 88 and 92 MiBs (for this particular test).
-        let db_path = db.db_conf.db_path.clone();
-        let db_base_name = db.db_conf.db_base_name.clone();
-        let db_fqn = format!("{}/{db_base_name}.lsm", db_path.display());
-        let db_file = Path::new(&db_fqn);
-        let db_wal_fqn = format!("{}-{}", db_fqn.clone(), "log");
-        let db_wal = Path::new(&db_wal_fqn);
-        assert!(db_file.exists());
-        assert!(db_wal.exists());
+            // Values above the threshold only leave a pointer in the database file
+            // once the main-memory tree is flushed (at the latest when the handle
+            // disconnects).
+            let num_blobs = 2000_usize;
+            let size_blob = 8 << 10; // 8 KB
+            test_connect(&mut db);
+            test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            test_disconnect(&mut db);
+            if compression == LsmCompressionLib::NoCompression {
+                assert!(file_size("-vlog") >= num_blobs * size_blob);
+                assert!(file_size("") < num_blobs * size_blob / 4);
+            }
+            test_connect(&mut db);
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
 
-        let datafile_size_res = db_file.metadata();
-        assert!(datafile_size_res.is_ok());
+            // Once the records are overwritten, the space of their first values
+            // (the oldest part of the value log) is released.
+            test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            test_disconnect(&mut db);
+            test_connect(&mut db);
+            let vlog_kb = (file_size("-vlog") / 2 / 1024) as u32;
+            let released_kb = db.collect_value_log_garbage(vlog_kb).unwrap();
+            assert!(released_kb >= vlog_kb);
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
 
-        let datafile_size = datafile_size_res.unwrap().len();
-        let expected_datafile_min_size: u64 = 67_000_000;
-        let expected_datafile_max_size: u64 = 125_000_000;
-        // The size of the data file might vary from platform to platform, but for this
-        // particular test it should be about 68 MiBs
-        assert!(datafile_size > expected_datafile_min_size);
-        assert!(datafile_size < expected_datafile_max_size);
+            // Collecting garbage with an open transaction is a misuse.
+            assert!(db.begin_transaction().is_ok());
+            assert_eq!(
+                db.collect_value_log_garbage(u32::MAX),
+                Err(LsmErrorCode::LsmMisuse)
+            );
+            assert!(db.rollback_transaction().is_ok());
+            test_disconnect(&mut db);
 
-        // We should now be able to close the database cleanly as the cursor has been
-        // dropped automatically.
-        test_disconnect(&mut db)
+            // Values are found without the threshold configured as well.
+            db.db_conf.value_log_threshold_b = None;
+            test_connect(&mut db);
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_disconnect(&mut db);
+        }
     }
 
     #[test]
-    fn lsm_bg_checkpointer_only() {
-        // Let's try to initialize a database. The connection will issue one background
-        // thread that will checkpoint the database file at certain intervals.
-        let mut db = test_initialize(
-            1,
-            "test-bg-checkpointer-only".to_string(),
-            LsmMode::LsmBackgroundCheckpointer,
-            LsmCompressionLib::NoCompression,
-        );
+    fn can_compress_key_prefixes() {
+        let mut pages_written = vec![];
+        for prefix_keys in [false, true] {
+            let mut db = test_initialize(
+                1,
+                "test-can-compress-key-prefixes".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                LsmCompressionLib::NoCompression,
+            );
+            db.db_conf = db.db_conf.clone().with_key_prefix_compression(prefix_keys);
+            test_connect(&mut db);
 
-        // We now produce certain amount of blobs and persist them.
-        let num_blobs = 100_usize;
-        let size_blob = 1 << 20; // 1 MB
-        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+            // Keys (16 bytes) share most of their bytes with the keys next to them,
+            // and are larger than their values. The records loaded are the very same
+            // ones test_persist_blobs() writes.
+            let num_blobs = 20000_usize;
+            let size_blob = 8;
+            let master_blob = construct_compressible_blob(size_blob);
+            let mut loader = db.bulk_loader().unwrap();
+            for b in 1..=num_blobs {
+                let current_blob_key = [0_usize.to_be_bytes(), b.to_be_bytes()].concat();
+                let mut current_blob = master_blob.clone();
+                current_blob[0] = (b & 0xFF) as u8;
+                assert_eq!(loader.insert(&current_blob_key, &current_blob), Ok(()));
+            }
+            assert_eq!(loader.commit(), Ok(()));
+            pages_written.push(db.get_num_pages_written().unwrap());
+
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_backward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_seek_cursor_forward_limited(
+                &mut db,
+                num_blobs >> 2,
+                (num_blobs >> 2) + 1,
+                size_blob,
+                0,
+            );
+            test_seek_cursor_forward_eof(
+                &mut db,
+                3 * (num_blobs >> 2),
+                (num_blobs >> 2) + 1,
+                size_blob,
+                0,
+            );
+            test_seek_cursor_backward_limited(&mut db, num_blobs >> 2, size_blob, 0);
+            test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, 0);
 
-        // Let's connect to it via a main memory handle.
-        test_connect(&mut db);
+            // The same records written through the main-memory tree are merged with
+            // the ones loaded.
+            test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            test_disconnect(&mut db);
+            test_connect(&mut db);
+            assert!(db.optimize().is_ok());
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_backward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_disconnect(&mut db);
 
-        // Let's persist some blobs.
-        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
+            // Pages are read the same regardless of the setting of the handle.
+            db.db_conf = db.db_conf.clone().with_key_prefix_compression(!prefix_keys);
+            test_connect(&mut db);
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_seek_cursor_exact(&mut db, num_blobs >> 2, size_blob, 0);
+            test_disconnect(&mut db);
+        }
+        assert!(pages_written[1] < pages_written[0] * 3 / 4);
+    }
 
-        // Checkpointing increases the size of the data file. Thus, in the end,
-        // the file size should be around 160 MiBs (for this particular test).
-        let db_path = db.db_conf.db_path.clone();
-        let db_base_name = db.db_conf.db_base_name.clone();
-        let db_fqn = format!("{}/{db_base_name}.lsm", db_path.display());
-        let db_file = Path::new(&db_fqn);
-        let db_wal_fqn = format!("{}-{}", db_fqn.clone(), "log");
-        let db_wal = Path::new(&db_wal_fqn);
-        assert!(db_file.exists());
-        assert!(db_wal.exists());
+    // Orders keys from the largest to the smallest.
+    struct DescendingKeys;
 
-        let datafile_size_res = db_file.metadata();
-        assert!(datafile_size_res.is_ok());
+    impl LsmKeyComparator for DescendingKeys {
+        fn compare(lhs: &[u8], rhs: &[u8]) -> Ordering {
+            rhs.cmp(lhs)
+        }
+    }
 
-        let datafile_size = datafile_size_res.unwrap().len();
-        let expected_datafile_min_size: u64 = 160_000_000;
-        let expected_datafile_max_size: u64 = 170_000_000;
-        // The size of the data file might vary from platform to platform, but for this
-        // particular test it should be about 68 MiBs
-        assert!(datafile_size > expected_datafile_min_size);
-        assert!(datafile_size < expected_datafile_max_size);
+    #[test]
+    fn can_order_keys() {
+        let num_keys = 20000_u128;
+        // (key format, size of keys, whether keys are ordered descending)
+        for (key_format, key_size, descending) in [
+            (LsmKeyFormat::Bytes, 8, false),
+            (LsmKeyFormat::U64, 8, false),
+            (LsmKeyFormat::U128, 16, false),
+            (LsmKeyFormat::U64, 8, true),
+        ] {
+            let mut db = test_initialize(
+                1,
+                "test-can-order-keys".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                LsmCompressionLib::NoCompression,
+            );
+            db.db_conf = db.db_conf.clone().with_key_format(key_format);
+            if descending {
+                db.db_conf = db.db_conf.clone().with_key_comparator::<DescendingKeys>();
+            }
+            let key = |k: u128| k.to_be_bytes()[16 - key_size..].to_vec();
+            test_connect(&mut db);
 
-        // We should now be able to close the database cleanly as the cursor has been
-        // dropped automatically.
-        test_disconnect(&mut db);
+            // Even keys are loaded (in random order) through the sorting loader,
+            // which sorts them in the order of the database. Odd keys are written
+            // through main memory, and merged with the even ones.
+            let mut keys: Vec<u128> = (0..num_keys).step_by(2).collect();
+            keys.sort_by_key(|k| k.wrapping_mul(0x9E37_79B9_7F4A_7C15) as u64);
+            let mut loader = db.sorting_loader(64).unwrap();
+            for k in &keys {
+                assert_eq!(loader.insert(&key(*k), &key(*k)), Ok(()));
+            }
+            assert_eq!(loader.commit(), Ok(()));
+            for k in (1..num_keys).step_by(2) {
+                assert_eq!(db.persist(&key(k), &key(k)), Ok(()));
+            }
+            test_disconnect(&mut db);
+            test_connect(&mut db);
+            assert!(db.optimize().is_ok());
+
+            let expected: Vec<u128> = if descending {
+                (0..num_keys).rev().collect()
+            } else {
+                (0..num_keys).collect()
+            };
+            let mut cursor = db.cursor_open().unwrap();
+            assert_eq!(cursor.first(), Ok(()));
+            for k in &expected {
+                assert_eq!(cursor.get_key(), Ok(key(*k)));
+                assert_eq!(cursor.next(), Ok(()));
+            }
+            assert!(cursor.valid().is_err());
+            assert_eq!(cursor.last(), Ok(()));
+            assert_eq!(cursor.get_key(), Ok(key(*expected.last().unwrap())));
+
+            // Seeks, and comparisons, follow the order of the database as well.
+            let missing = key(num_keys + 10);
+            assert_eq!(
+                cursor.seek(&missing, LsmCursorSeekOp::LsmCursorSeekGe),
+                Ok(())
+            );
+            if descending {
+                assert_eq!(cursor.get_key(), Ok(key(num_keys - 1)));
+                assert_eq!(cursor.compare(&missing), Ok(Ordering::Greater));
+            } else {
+                assert!(cursor.valid().is_err());
+            }
+            assert_eq!(
+                cursor.seek(&key(101), LsmCursorSeekOp::LsmCursorSeekGe),
+                Ok(())
+            );
+            assert_eq!(cursor.get_value(), Ok(key(101)));
+            assert_eq!(cursor.next(), Ok(()));
+            let next = if descending { 100 } else { 102 };
+            assert_eq!(cursor.get_key(), Ok(key(next)));
+            drop(cursor);
+            test_disconnect(&mut db);
+        }
     }
 
     #[test]
-    fn lsm_initialization_fails_with_non_c_string() {
-        let bad_filename = "test-no-null\0in-the-middle".to_string();
-        let now = Utc::now();
-        let db_conf = DbConf {
-            db_path: "/tmp".into(),
-            db_base_name: format!("{}-{}", bad_filename, now.timestamp_nanos_opt().unwrap(),),
-            mode: LsmMode::LsmNoBackgroundThreads,
-            handle_mode: LsmHandleMode::ReadWrite,
-            metrics: None,
-            compression: LsmCompressionLib::NoCompression,
+    fn can_scan_many_segments() {
+        let num_segments = 48_u64;
+        let num_keys = 4800_u64;
+        // Even keys have 8 bytes, odd ones have 16 and share their first 8 bytes.
+        let key = |k: u64| match k % 2 {
+            0 => k.to_be_bytes().to_vec(),
+            _ => [b"segments".as_ref(), &k.to_be_bytes()].concat(),
         };
+        for descending in [false, true] {
+            let mut db = test_initialize(
+                1,
+                "test-can-scan-many-segments".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                LsmCompressionLib::NoCompression,
+            );
+            if descending {
+                db.db_conf = db.db_conf.clone().with_key_comparator::<DescendingKeys>();
+            }
+            test_connect(&mut db);
 
-        let mut db: LsmDb = Default::default();
-
-        let rc = db.initialize(db_conf);
-        assert_eq!(rc, Err(LsmErrorCode::LsmError));
+            // Every bulk load adds a segment whose keys interleave with those of
+            // all others. The record written before each bulk load is flushed as a
+            // segment of its own, which is not merged with the bulk loaded ones
+            // until the database runs out of room for segments.
+            let mut expected: Vec<Vec<u8>> = vec![];
+            for segment in 0..num_segments {
+                let written = [b"written".as_ref(), &segment.to_be_bytes()].concat();
+                assert_eq!(db.persist(&written, &written), Ok(()));
+                expected.push(written);
+                let mut keys: Vec<Vec<u8>> = (segment..num_keys)
+                    .step_by(num_segments as usize)
+                    .map(key)
+                    .collect();
+                keys.sort();
+                let mut loader = db.bulk_loader().unwrap();
+                if descending {
+                    keys.reverse();
+                }
+                for k in &keys {
+                    assert_eq!(loader.insert(k, k), Ok(()));
+                }
+                assert_eq!(loader.commit(), Ok(()));
+                expected.extend(keys);
+            }
+            assert!(db.get_num_segments().unwrap() > 1);
+            expected.sort();
+            if descending {
+                expected.reverse();
+            }
+
+            let mut cursor = db.cursor_open().unwrap();
+            assert_eq!(cursor.first(), Ok(()));
+            for k in &expected {
+                assert_eq!(cursor.get_key(), Ok(k.clone()));
+                assert_eq!(cursor.get_value(), Ok(k.clone()));
+                assert_eq!(cursor.next(), Ok(()));
+            }
+            assert!(cursor.valid().is_err());
+            assert_eq!(cursor.last(), Ok(()));
+            for k in expected.iter().rev() {
+                assert_eq!(cursor.get_key(), Ok(k.clone()));
+                assert_eq!(cursor.prev(), Ok(()));
+            }
+            assert!(cursor.valid().is_err());
+            drop(cursor);
+            test_disconnect(&mut db);
+        }
     }
 
     #[test]
-    fn transactions_rollback() {
-        // Let's initialize a handle.
+    fn can_seek_forward() {
+        let num_segments = 8_u64;
+        let num_keys = 20000_u64;
         let mut db = test_initialize(
             1,
-            "test-transactions-rollback".to_string(),
+            "test-can-seek-forward".to_string(),
             LsmMode::LsmNoBackgroundThreads,
             LsmCompressionLib::NoCompression,
         );
-
-        // We now produce certain amount of blobs and persist them.
-        let num_blobs = 10000_usize;
-        let size_blob = 1 << 10; // 1 KB
-        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
-
-        // Let's connect to it via a main memory handle.
         test_connect(&mut db);
 
-        // Let's open a transaction
-        let mut rc = db.begin_transaction();
-        assert_eq!(rc, Ok(()));
+        // Even keys are spread over interleaving segments, of which every third
+        // one is deleted in main memory, and multiples of five are written there.
+        let mut expected = std::collections::BTreeSet::new();
+        for segment in 0..num_segments {
+            let mut loader = db.bulk_loader().unwrap();
+            for k in (2 * segment..num_keys).step_by(2 * num_segments as usize) {
+                assert_eq!(loader.insert(&k.to_be_bytes(), &k.to_be_bytes()), Ok(()));
+                expected.insert(k);
+            }
+            assert_eq!(loader.commit(), Ok(()));
+        }
+        for k in (0..num_keys).step_by(6) {
+            assert_eq!(db.delete(&k.to_be_bytes()), Ok(()));
+            expected.remove(&k);
+        }
+        for k in (0..num_keys).step_by(5) {
+            assert_eq!(db.persist(&k.to_be_bytes(), &k.to_be_bytes()), Ok(()));
+            expected.insert(k);
+        }
 
-        // Let's persist some blobs within the opened transactions.
-        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
+        // Jumps of growing length land on the same keys as regular seeks, be it
+        // within a page, a few pages ahead, or after moving backwards.
+        let last = *expected.last().unwrap();
+        let mut cursor = db.cursor_open().unwrap();
+        for stride in [1, 3, 7, 50, 333, 4000] {
+            assert_eq!(cursor.first(), Ok(()));
+            let mut target = 0;
+            while target <= last {
+                assert_eq!(cursor.seek_forward(&target.to_be_bytes()), Ok(()));
+                let k = expected.range(target..).next().unwrap();
+                assert_eq!(cursor.get_key(), Ok(k.to_be_bytes().to_vec()));
+                assert_eq!(cursor.get_value(), Ok(k.to_be_bytes().to_vec()));
+                if target % 7 == 0 {
+                    assert_eq!(cursor.next(), Ok(()));
+                } else if target % 11 == 0 {
+                    let rc = cursor.seek(&target.to_be_bytes(), LsmCursorSeekOp::LsmCursorSeekLe);
+                    assert_eq!(rc, Ok(()));
+                }
+                target += stride;
+            }
+            assert_eq!(cursor.seek_forward(&num_keys.to_be_bytes()), Ok(()));
+            assert!(cursor.valid().is_err());
+        }
 
-        // Let's rollback the transaction (making all persisted blobs disappear).
-        rc = db.rollback_transaction();
-        assert_eq!(rc, Ok(()));
+        // Seeking backwards is a regular seek.
+        assert_eq!(cursor.seek_forward(&10_u64.to_be_bytes()), Ok(()));
+        assert_eq!(cursor.get_key(), Ok(10_u64.to_be_bytes().to_vec()));
+        drop(cursor);
+        test_disconnect(&mut db);
 
-        // We now test that no blob is found in the database although some were "persisted".
-        test_num_blobs_are_in_file(&mut db, 0);
+        let mut cursor: LsmCursor = Default::default();
+        assert_eq!(cursor.seek_forward(b"key"), Err(LsmErrorCode::LsmMisuse));
     }
 
     #[test]
-    fn transactions_commit() {
-        // Let's initialize a handle.
+    fn can_read_batches() {
+        let num_keys = 6000_u64;
         let mut db = test_initialize(
             1,
-            "test-transactions-rollback".to_string(),
+            "test-can-read-batches".to_string(),
             LsmMode::LsmNoBackgroundThreads,
             LsmCompressionLib::NoCompression,
         );
+        db.db_conf = db.db_conf.clone().with_value_log(4 << 10);
+        test_connect(&mut db);
 
-        // We now produce certain amount of blobs and persist them.
-        let num_blobs = 10000_usize;
-        let size_blob = 1 << 10; // 1 KB
-        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+        // Small values, values overflowing their page, and values in the value
+        // log, spread over segments and main memory, with some keys deleted.
+        let value = |k: u64| match k % 100 {
+            0 => vec![(k % 251) as u8; 64 << 10],
+            1 => vec![(k % 251) as u8; 2 << 10],
+            _ => k.to_be_bytes().to_vec(),
+        };
+        let mut expected = std::collections::BTreeMap::new();
+        for segment in 0..4 {
+            let mut loader = db.bulk_loader().unwrap();
+            for k in (segment..num_keys).step_by(4) {
+                assert_eq!(loader.insert(&k.to_be_bytes(), &value(k)), Ok(()));
+                expected.insert(k, value(k));
+            }
+            assert_eq!(loader.commit(), Ok(()));
+        }
+        for k in (0..num_keys).step_by(9) {
+            assert_eq!(db.delete(&k.to_be_bytes()), Ok(()));
+            expected.remove(&k);
+        }
+        for k in (num_keys..num_keys + 500).chain((3..num_keys).step_by(50)) {
+            assert_eq!(db.persist(&k.to_be_bytes(), &value(k)), Ok(()));
+            expected.insert(k, value(k));
+        }
 
-        // Let's connect to it via a main memory handle.
-        test_connect(&mut db);
+        // Batches hold the same records a scan visits, no matter their limits.
+        let mut cursor = db.cursor_open().unwrap();
+        let mut batch = LsmCursorBatch::default();
+        for (max_records, max_bytes) in [(1, 1 << 20), (64, 1 << 20), (1000, 4 << 10), (8, 0)] {
+            assert_eq!(cursor.first(), Ok(()));
+            let mut records = expected.iter();
+            loop {
+                let num_records = cursor.next_batch(max_records, max_bytes, &mut batch);
+                let num_records = num_records.unwrap();
+                assert_eq!(num_records, batch.len());
+                if batch.is_empty() {
+                    break;
+                }
+                assert!(num_records <= max_records);
+                let mut batch_b = 0;
+                for (key, value) in &batch {
+                    let (k, v) = records.next().unwrap();
+                    assert_eq!(key, k.to_be_bytes());
+                    assert_eq!(value, v.as_slice());
+                    batch_b += key.len() + value.len() + 8;
+                }
+                assert!(batch_b <= max_bytes || num_records == 1);
+            }
+            assert!(records.next().is_none());
+            assert!(cursor.valid().is_err());
+        }
 
-        // Let's open a transaction
-        let mut rc = db.begin_transaction();
+        // The iterator starts where the cursor is positioned.
+        let start = 4242_u64;
+        let rc = cursor.seek(&start.to_be_bytes(), LsmCursorSeekOp::LsmCursorSeekGe);
         assert_eq!(rc, Ok(()));
+        let records: Vec<(Vec<u8>, Vec<u8>)> = cursor
+            .records(100, 16 << 10)
+            .collect::<Result<_, _>>()
+            .unwrap();
+        let expected_records: Vec<(Vec<u8>, Vec<u8>)> = expected
+            .range(start..)
+            .map(|(k, v)| (k.to_be_bytes().to_vec(), v.clone()))
+            .collect();
+        assert_eq!(records, expected_records);
+
+        // A cursor moving backwards cannot be read in batches.
+        assert_eq!(cursor.last(), Ok(()));
+        let rc = cursor.next_batch(10, 1 << 10, &mut batch);
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+        let mut records = cursor.records(10, 1 << 10);
+        assert_eq!(records.next(), Some(Err(LsmErrorCode::LsmMisuse)));
+        assert_eq!(records.next(), None);
+        drop(cursor);
+        test_disconnect(&mut db);
 
-        // Let's persist some blobs within the opened transactions.
-        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
+        let mut cursor: LsmCursor = Default::default();
+        let rc = cursor.next_batch(10, 1 << 10, &mut batch);
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+    }
 
-        // Let's commit the transaction; making all blobs truly persisted blobs.
-        rc = db.commit_transaction();
-        assert_eq!(rc, Ok(()));
+    #[test]
+    fn can_read_values_lazily() {
+        let num_keys = 3000_u64;
+        for compression in [LsmCompressionLib::NoCompression, LsmCompressionLib::ZStd] {
+            let mut db = test_initialize(
+                1,
+                "test-can-read-values-lazily".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                compression,
+            );
+            db.db_conf = db.db_conf.clone().with_value_log(32 << 10);
+            test_connect(&mut db);
 
-        // We now test that no blob is found in the database although some were "persisted".
-        test_num_blobs_are_in_file(&mut db, num_blobs);
+            // Small values, values overflowing their page, and values in the value
+            // log, spread over segments and main memory, with some keys deleted.
+            let value = |k: u64| match k % 10 {
+                0 => vec![(k % 251) as u8; 64 << 10],
+                1 => vec![(k % 251) as u8; 8 << 10],
+                _ => k.to_be_bytes().to_vec(),
+            };
+            let mut expected = std::collections::BTreeMap::new();
+            for segment in 0..3 {
+                let mut loader = db.bulk_loader().unwrap();
+                for k in (segment..num_keys).step_by(3) {
+                    assert_eq!(loader.insert(&k.to_be_bytes(), &value(k)), Ok(()));
+                    expected.insert(k, value(k));
+                }
+                assert_eq!(loader.commit(), Ok(()));
+            }
+            for k in (0..num_keys).step_by(7) {
+                assert_eq!(db.delete(&k.to_be_bytes()), Ok(()));
+                expected.remove(&k);
+            }
+            for k in (5..num_keys).step_by(40) {
+                assert_eq!(db.persist(&k.to_be_bytes(), &value(k)), Ok(()));
+                expected.insert(k, value(k));
+            }
+
+            let mut cursor = db.cursor_open().unwrap();
+            for values in [
+                LsmCursorValues::Lazy,
+                LsmCursorValues::KeysOnly,
+                LsmCursorValues::Eager,
+            ] {
+                assert_eq!(cursor.set_values(values), Ok(()));
+
+                // Scans in both directions visit every key, and values that are
+                // retrieved are the right ones.
+                assert_eq!(cursor.first(), Ok(()));
+                for (i, (k, v)) in expected.iter().enumerate() {
+                    assert_eq!(cursor.get_key(), Ok(k.to_be_bytes().to_vec()));
+                    if values == LsmCursorValues::KeysOnly {
+                        assert_eq!(cursor.get_value(), Err(LsmErrorCode::LsmMisuse));
+                    } else if i % 3 == 0 {
+                        assert_eq!(cursor.get_value(), Ok(v.clone()));
+                    }
+                    assert_eq!(cursor.next(), Ok(()));
+                }
+                assert!(cursor.valid().is_err());
+                assert_eq!(cursor.last(), Ok(()));
+                for (k, v) in expected.iter().rev() {
+                    assert_eq!(cursor.get_key(), Ok(k.to_be_bytes().to_vec()));
+                    if values != LsmCursorValues::KeysOnly && k % 5 == 1 {
+                        assert_eq!(cursor.get_value(), Ok(v.clone()));
+                    }
+                    assert_eq!(cursor.prev(), Ok(()));
+                }
+                assert!(cursor.valid().is_err());
+
+                // Point reads find the same keys.
+                for k in (0..num_keys).step_by(13) {
+                    let rc = cursor.seek(&k.to_be_bytes(), LsmCursorSeekOp::LsmCursorSeekEq);
+                    assert_eq!(rc, Ok(()));
+                    assert_eq!(cursor.valid().is_ok(), expected.contains_key(&k));
+                    if let (Some(v), false) =
+                        (expected.get(&k), values == LsmCursorValues::KeysOnly)
+                    {
+                        assert_eq!(cursor.get_value(), Ok(v.clone()));
+                    }
+                }
+
+                // Batches hold empty values if values are not read.
+                assert_eq!(cursor.first(), Ok(()));
+                let records: Vec<(Vec<u8>, Vec<u8>)> = cursor
+                    .records(100, 256 << 10)
+                    .collect::<Result<_, _>>()
+                    .unwrap();
+                let expected_records: Vec<(Vec<u8>, Vec<u8>)> = expected
+                    .iter()
+                    .map(|(k, v)| match values {
+                        LsmCursorValues::KeysOnly => (k.to_be_bytes().to_vec(), vec![]),
+                        _ => (k.to_be_bytes().to_vec(), v.clone()),
+                    })
+                    .collect();
+                assert_eq!(records, expected_records);
+            }
+
+            // A cursor that is reused does not inherit how values were read.
+            assert_eq!(cursor.set_values(LsmCursorValues::KeysOnly), Ok(()));
+            drop(cursor);
+            let mut cursor = db.cursor_open().unwrap();
+            assert_eq!(cursor.first(), Ok(()));
+            assert_eq!(cursor.get_value(), Ok(expected[&1].clone()));
+            drop(cursor);
+            test_disconnect(&mut db);
+        }
+
+        let mut cursor: LsmCursor = Default::default();
+        let rc = cursor.set_values(LsmCursorValues::Lazy);
+        assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
     }
 
     #[test]
-    fn can_work_with_empty_metrics_no_background_threads() {
+    fn can_bulk_load() {
+        // Loads the very same records as test_persist_blobs().
+        let bulk_load = |db: &mut LsmDb, num_blobs: usize, size_blob: usize, id: usize| {
+            let master_blob = construct_compressible_blob(size_blob);
+            let mut loader = db.bulk_loader().unwrap();
+            for b in 1..=num_blobs {
+                let current_blob_key =
+                    [id.to_be_bytes().as_ref(), b.to_be_bytes().as_ref()].concat();
+                let mut current_blob = master_blob.clone();
+                current_blob[0] = (b & 0xFF) as u8;
+                assert_eq!(loader.insert(&current_blob_key, &current_blob), Ok(()));
+            }
+            assert_eq!(loader.commit(), Ok(()));
+        };
+
+        for compression in [LsmCompressionLib::NoCompression, LsmCompressionLib::ZStd] {
+            let mut db = test_initialize(
+                1,
+                "test-can-bulk-load".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                compression,
+            );
+
+            // Let's connect to it via a main memory handle.
+            test_connect(&mut db);
+
+            // The records end up in a single segment, and are found by scans and seeks.
+            let num_blobs = 20000_usize;
+            let size_blob = 1 << 10; // 1 KB
+            bulk_load(&mut db, num_blobs, size_blob, 0);
+            assert_eq!(db.get_num_segments(), Ok(1));
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_backward_cursor(&mut db, num_blobs, size_blob, 0);
+            for key in [1, 4242, num_blobs] {
+                test_seek_cursor_exact(&mut db, key, size_blob, 0);
+            }
+            test_disconnect(&mut db);
+
+            // They were checkpointed, and nothing went through the log.
+            let db_path = db.get_full_db_path().unwrap();
+            let log_size = std::fs::metadata(format!("{db_path}-log")).map_or(0, |m| m.len());
+            assert!(log_size < 1 << 20);
+            test_connect(&mut db);
+            test_num_blobs_are_in_file(&mut db, num_blobs);
+
+            // Records loaded on top of existing ones replace them, no matter whether
+            // the existing ones are in main memory or in the file.
+            test_persist_blobs(&mut db, 10, size_blob, None, 1);
+            let id_key = |b: usize| [0_usize.to_be_bytes(), b.to_be_bytes()].concat();
+            let mut loader = db.bulk_loader().unwrap();
+            for b in [2, 3] {
+                assert_eq!(loader.insert(&id_key(b), b"new"), Ok(()));
+            }
+            for key in [b"a".as_ref(), b"b".as_ref()] {
+                assert_eq!(loader.insert(key, key), Ok(()));
+            }
+            for key in [b"a".as_ref(), b"b".as_ref(), &id_key(5)] {
+                assert_eq!(loader.insert(key, key), Err(LsmErrorCode::LsmMisuse));
+            }
+            assert_eq!(loader.commit(), Ok(()));
+            assert_eq!(db.get_num_segments(), Ok(3));
+
+            let mut cursor = db.cursor_open().unwrap();
+            for (key, value) in [
+                (id_key(1), None),
+                (id_key(2), Some(b"new".to_vec())),
+                (id_key(3), Some(b"new".to_vec())),
+                (id_key(4), None),
+                (
+                    [1_usize.to_be_bytes(), 10_usize.to_be_bytes()].concat(),
+                    None,
+                ),
+                (b"a".to_vec(), Some(b"a".to_vec())),
+            ] {
+                assert_eq!(cursor.seek(&key, LsmCursorSeekOp::LsmCursorSeekEq), Ok(()));
+                assert_eq!(cursor.get_key(), Ok(key));
+                match value {
+                    Some(value) => assert_eq!(cursor.get_value(), Ok(value)),
+                    None => assert_eq!(cursor.get_value().unwrap().len(), size_blob),
+                }
+            }
+            assert_eq!(cursor.close(), Ok(()));
+            drop(cursor);
+
+            // Records of a bulk load that is rolled back (or dropped) are not visible,
+            // and the database can be written to right after.
+            let mut loader = db.bulk_loader().unwrap();
+            assert_eq!(loader.insert(b"c", b"c"), Ok(()));
+            assert_eq!(loader.rollback(), Ok(()));
+            let mut loader = db.bulk_loader().unwrap();
+            assert_eq!(loader.insert(b"d", b"d"), Ok(()));
+            drop(loader);
+            assert_eq!(db.get_num_segments(), Ok(3));
+            assert_eq!(db.persist(b"e", b"e"), Ok(()));
+            let mut cursor = db.cursor_open().unwrap();
+            for key in [b"c", b"d"] {
+                assert_eq!(cursor.seek(key, LsmCursorSeekOp::LsmCursorSeekEq), Ok(()));
+                assert_eq!(cursor.valid(), Err(LsmErrorCode::LsmError));
+            }
+            assert_eq!(cursor.close(), Ok(()));
+            drop(cursor);
+
+            // The database merges bulk loaded segments as any other.
+            assert!(db.optimize().is_ok());
+            assert_eq!(db.get_num_segments(), Ok(1));
+            test_disconnect(&mut db);
+        }
+
+        // A handle has to be connected, and free of transactions, to bulk load.
         let mut db = test_initialize(
             1,
-            "test-can-work-with-empty-metrics-no-background-threads".to_string(),
+            "test-can-bulk-load-misuse".to_string(),
             LsmMode::LsmNoBackgroundThreads,
             LsmCompressionLib::NoCompression,
         );
-        // This is the interesting bit.
-        db.db_conf.metrics = None;
-
-        // Let's connect to it via a main memory handle.
+        assert!(db.bulk_loader().is_err());
         test_connect(&mut db);
-
-        // We now produce certain amount of blobs and persist them.
-        let num_blobs = 10000_usize;
-        let size_blob = 1 << 10; // 1 KB
-
-        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
-        // Let's persist some blobs.
-        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
-
-        // Let's test forward iterators on the whole database.
-        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
-
+        assert_eq!(db.begin_transaction(), Ok(()));
+        assert!(db.bulk_loader().is_err());
+        assert_eq!(db.rollback_transaction(), Ok(()));
+        assert!(db.bulk_loader().is_ok());
         test_disconnect(&mut db);
     }
 
     #[test]
-    fn can_work_with_empty_metrics_with_background_merger() {
+    fn can_bulk_load_repeatedly() {
+        let num_loads = 48_u64;
+        let num_keys = 4800_u64;
         let mut db = test_initialize(
             1,
-            "test-can-work-with-empty-metrics-with-background-merger".to_string(),
-            LsmMode::LsmBackgroundMerger,
+            "test-can-bulk-load-repeatedly".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
             LsmCompressionLib::NoCompression,
         );
-        // This is the interesting bit.
-        db.db_conf.metrics = None;
-
-        // Let's connect to it via a main memory handle.
-        test_connect(&mut db);
-
-        // We now produce certain amount of blobs and persist them.
-        let num_blobs = 10000_usize;
-        let size_blob = 1 << 10; // 1 KB
-
-        let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
-        // Let's persist some blobs.
-        test_persist_blobs(&mut db, num_blobs, size_blob, Some(prng), 0);
-
-        // We disconnect to be able to finish all background work, before
-        // continuing.
-        test_disconnect(&mut db);
         test_connect(&mut db);
 
-        // Let's test forward iterators on the whole database.
-        test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+        // Every bulk load adds a segment whose keys interleave with those of
+        // all others, and the record written before it is flushed as a segment
+        // of its own. Bulk loads keep succeeding once the database runs out of
+        // room for segments, as they are merged to make room.
+        let mut expected: Vec<Vec<u8>> = vec![];
+        for load in 0..num_loads {
+            let written = [b"written".as_ref(), &load.to_be_bytes()].concat();
+            assert_eq!(db.persist(&written, &written), Ok(()));
+            expected.push(written);
+            let mut loader = db.bulk_loader().unwrap();
+            for k in (load..num_keys).step_by(num_loads as usize) {
+                assert_eq!(loader.insert(&k.to_be_bytes(), &k.to_be_bytes()), Ok(()));
+                expected.push(k.to_be_bytes().to_vec());
+            }
+            assert_eq!(loader.commit(), Ok(()));
+        }
+        expected.sort();
 
+        let mut cursor = db.cursor_open().unwrap();
+        assert_eq!(cursor.first(), Ok(()));
+        for k in &expected {
+            assert_eq!(cursor.get_key(), Ok(k.clone()));
+            assert_eq!(cursor.next(), Ok(()));
+        }
+        assert!(cursor.valid().is_err());
+        drop(cursor);
         test_disconnect(&mut db);
     }
 
     #[test]
-    fn can_work_with_compressed_db_with_background_merger() {
-        let mut dbs = vec![];
-        let db_lz4 = test_initialize(
-            1,
-            "test-can-work-with-compressed-db-lz4-with-background-merger".to_string(),
-            LsmMode::LsmBackgroundMerger,
-            LsmCompressionLib::LZ4,
-        );
-        let db_zlib = test_initialize(
-            1,
-            "test-can-work-with-compressed-db-zlib-with-background-merger".to_string(),
-            LsmMode::LsmBackgroundMerger,
-            LsmCompressionLib::ZLib,
-        );
-        let db_zstd = test_initialize(
-            1,
-            "test-can-work-with-compressed-db-zstd-with-background-merger".to_string(),
-            LsmMode::LsmBackgroundMerger,
-            LsmCompressionLib::ZStd,
-        );
-        dbs.push(db_lz4);
-        dbs.push(db_zstd);
-        dbs.push(db_zlib);
+    fn can_load_unsorted_records() {
+        let num_blobs = 20000_usize;
+        let size_blob = 1 << 10; // 1 KB
+
+        // Little memory makes the loader spill (many) sorted runs, and plenty of it
+        // makes it sort everything in memory.
+        for memory_kb in [256, 64 << 10] {
+            let mut db = test_initialize(
+                1,
+                "test-can-load-unsorted-records".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                LsmCompressionLib::ZStd,
+            );
+            test_connect(&mut db);
+            let db_path = db.get_full_db_path().unwrap();
+
+            // Every key is inserted twice, in different orders. The records inserted
+            // last are the ones of test_persist_blobs().
+            let master_blob = construct_compressible_blob(size_blob);
+            let mut loader = db.sorting_loader(memory_kb).unwrap();
+            for (step, marker) in [(7919, None), (4801, Some(()))] {
+                for i in 0..num_blobs {
+                    let b = (i * step) % num_blobs + 1;
+                    let key = [0_usize.to_be_bytes(), b.to_be_bytes()].concat();
+                    let mut current_blob = master_blob.clone();
+                    current_blob[0] = (b & 0xFF) as u8;
+                    if marker.is_none() {
+                        current_blob.truncate(1);
+                    }
+                    assert_eq!(loader.insert(&key, &current_blob), Ok(()));
+                }
+            }
+            assert_eq!(loader.commit(), Ok(()));
+
+            // The records end up in a single segment, and no temporary file is left.
+            assert_eq!(db.get_num_segments(), Ok(1));
+            test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            test_backward_cursor(&mut db, num_blobs, size_blob, 0);
+            for key in [1, 4242, num_blobs] {
+                test_seek_cursor_exact(&mut db, key, size_blob, 0);
+            }
+            for run in 1..=1000 {
+                assert!(!std::path::Path::new(&format!("{db_path}-sort-{run}")).exists());
+            }
+
+            // Records that are not committed are not loaded.
+            let mut loader = db.sorting_loader(memory_kb).unwrap();
+            for b in (1..=num_blobs).rev() {
+                let key = [1_usize.to_be_bytes(), b.to_be_bytes()].concat();
+                assert_eq!(loader.insert(&key, &master_blob), Ok(()));
+            }
+            drop(loader);
+            assert_eq!(db.get_num_segments(), Ok(1));
+            for run in 1..=1000 {
+                assert!(!std::path::Path::new(&format!("{db_path}-sort-{run}")).exists());
+            }
+            test_disconnect(&mut db);
+            test_connect(&mut db);
+            test_num_blobs_are_in_file(&mut db, num_blobs);
+            test_disconnect(&mut db);
+        }
+    }
 
-        // We now produce certain amount of blobs and persist them.
-        let num_blobs = 10000_usize;
-        let size_blob = 1 << 10; // 1 KB
+    #[test]
+    fn can_work_with_encryption() {
+        let secret = b"lsmlite-rs-secret-value";
+        let key = [0x5a; 32];
+        for (cipher, compression) in [
+            (None, LsmCompressionLib::NoCompression),
+            (Some(LsmCipher::Aes256Gcm), LsmCompressionLib::NoCompression),
+            (Some(LsmCipher::Aes256Gcm), LsmCompressionLib::ZStd),
+            (Some(LsmCipher::ChaCha20Poly1305), LsmCompressionLib::LZ4),
+        ] {
+            let mut db = test_initialize(
+                1,
+                "test-can-work-with-encryption".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                compression,
+            );
+            let db_conf = db.db_conf.clone();
+            if let Some(cipher) = cipher {
+                db.db_conf = db_conf.clone().with_encryption(cipher, key);
+            }
+            test_connect(&mut db);
 
-        let mut thread_handles = vec![];
-        for mut db in dbs {
-            let handle = thread::spawn(move || {
-                // Let's connect to it via a main memory handle.
-                test_connect(&mut db);
+            // The secret records are written first, so that they are flushed to the
+            // file before the blobs are. Random blobs would be stored as they are if
+            // pages were only compressed.
+            for k in 0..100_u32 {
+                assert_eq!(db.persist(&k.to_be_bytes(), secret), Ok(()));
+            }
+            let num_blobs = 20000_usize;
+            let size_blob = 1 << 10; // 1 KB
+            let prng: Mt64 = SeedableRng::seed_from_u64(0x41bd56915d5c7804);
+            test_persist_grpc_blobs(&mut db, num_blobs, size_blob, prng);
+            assert!(db.optimize().is_ok());
+            assert_eq!(db.get_num_pages_written_raw(), Ok(0));
+            let db_path = db.get_full_db_path().unwrap();
+            test_disconnect(&mut db);
 
-                // Let's persist some blobs.
-                test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+            // Nothing of the records can be found in the database file, unless it
+            // is not encrypted.
+            let file = std::fs::read(db_path).unwrap();
+            assert_eq!(
+                file.windows(secret.len()).any(|w| w == secret),
+                cipher.is_none()
+            );
+            let Some(cipher) = cipher else {
+                continue;
+            };
 
-                // We disconnect to be able to finish all background work, before
-                // continuing.
-                test_disconnect(&mut db);
-                test_connect(&mut db);
+            // Records are read back by a handle with the same cipher and key.
+            test_connect(&mut db);
+            assert_eq!(db.cursor_open().unwrap().first(), Ok(()));
+            test_disconnect(&mut db);
 
-                // Let's test forward iterators on the whole database.
-                test_forward_cursor(&mut db, num_blobs, size_blob, 0);
+            // But not by a handle with another key, cipher, or none at all.
+            db.db_conf = db_conf.clone().with_encryption(cipher, [0xa5; 32]);
+            test_connect(&mut db);
+            assert_eq!(
+                db.cursor_open().unwrap().first(),
+                Err(LsmErrorCode::LsmCorrupt)
+            );
+            test_disconnect(&mut db);
 
-                test_disconnect(&mut db);
-            });
-            thread_handles.push(handle);
-        }
-        for t in thread_handles {
-            t.join().unwrap();
+            let other_cipher = match cipher {
+                LsmCipher::Aes256Gcm => LsmCipher::ChaCha20Poly1305,
+                LsmCipher::ChaCha20Poly1305 => LsmCipher::Aes256Gcm,
+            };
+            db.db_conf = db_conf.clone().with_encryption(other_cipher, key);
+            test_connect(&mut db);
+            assert_eq!(db.cursor_open().err(), Some(LsmErrorCode::LsmMismatch));
+            test_disconnect(&mut db);
+
+            db.db_conf = db_conf.clone();
+            test_connect(&mut db);
+            assert_eq!(db.cursor_open().err(), Some(LsmErrorCode::LsmMismatch));
+            test_disconnect(&mut db);
         }
+
+        // Pages of encrypted databases are never stored in the clear.
+        let mut db = test_initialize(
+            1,
+            "test-can-work-with-encryption-invalid".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::ZStd,
+        );
+        let db_conf = db
+            .db_conf
+            .clone()
+            .with_encryption(LsmCipher::Aes256Gcm, key);
+        db.db_conf = db_conf.clone().with_min_compression_saving(10);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+        db.db_conf = db_conf.clone().with_compression_dictionary(16 << 10);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+        assert!(!db.is_connected());
     }
 
     #[test]
@@ -3065,6 +5577,7 @@ mod tests {
                     handle_mode: LsmHandleMode::ReadWrite,
                     metrics: None,
                     compression: LsmCompressionLib::NoCompression,
+                    ..Default::default()
                 };
 
                 let mut db: LsmDb = Default::default();
@@ -3116,6 +5629,7 @@ mod tests {
             handle_mode: LsmHandleMode::ReadWrite,
             metrics: None,
             compression: LsmCompressionLib::NoCompression,
+            ..Default::default()
         };
 
         let mut db: LsmDb = Default::default();
@@ -3189,6 +5703,65 @@ mod tests {
         test_forward_cursor(&mut db_ro, num_blobs, size_blob, 0);
     }
 
+    #[test]
+    fn open_file_in_read_only_mode_with_mmap() {
+        let mut db = test_initialize(
+            1,
+            "test-read-only-mode-with-mmap".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
+
+        // Let's connect to it via a main memory handle.
+        test_connect(&mut db);
+
+        // Enough blobs so that pages are written to the file.
+        let num_blobs = 20000_usize;
+        let size_blob = 1 << 10; // 1 KB
+        test_persist_blobs(&mut db, num_blobs, size_blob, None, 0);
+        assert!(db.optimize().is_ok());
+        test_disconnect(&mut db);
+
+        for advice in [
+            LsmMmapAdvice::Normal,
+            LsmMmapAdvice::Random,
+            LsmMmapAdvice::Sequential,
+            LsmMmapAdvice::WillNeed,
+        ] {
+            let mut db_conf = db.db_conf.clone().with_mmap(advice);
+            db_conf.handle_mode = LsmHandleMode::ReadOnly;
+            let mut db_ro: LsmDb = Default::default();
+            assert_eq!(db_ro.initialize(db_conf), Ok(()));
+            assert_eq!(db_ro.connect(), Ok(()));
+
+            // Pages are read straight from the mapping.
+            test_forward_cursor(&mut db_ro, num_blobs, size_blob, 0);
+            assert_eq!(db_ro.get_num_pages_read(), Ok(0));
+            test_disconnect(&mut db_ro);
+        }
+
+        // Only read-only handles may map the file...
+        db.db_conf = db.db_conf.clone().with_mmap(LsmMmapAdvice::Random);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+        assert!(!db.is_connected());
+
+        // ...of databases without compression.
+        let mut db = test_initialize(
+            1,
+            "test-read-only-mode-with-mmap-compressed".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::LZ4,
+        );
+        test_connect(&mut db);
+        test_disconnect(&mut db);
+        let mut db_conf = db.db_conf.clone().with_mmap(LsmMmapAdvice::Random);
+        db_conf.handle_mode = LsmHandleMode::ReadOnly;
+        let mut db_ro: LsmDb = Default::default();
+        assert_eq!(db_ro.initialize(db_conf), Ok(()));
+        assert_eq!(db_ro.connect(), Err(LsmErrorCode::LsmMisuse));
+        assert!(!db_ro.is_connected());
+    }
+
     #[test]
     fn open_compressed_file_in_read_only_mode() {
         // We first produce a file we can work on
@@ -3344,6 +5917,406 @@ mod tests {
         assert_eq!(cursor, LsmErrorCode::LsmMismatch);
     }
 
+    #[test]
+    fn sequential_ingest_with_all_compaction_policies() {
+        for policy in [
+            LsmCompactionPolicy::Tiered,
+            LsmCompactionPolicy::Leveled,
+            LsmCompactionPolicy::Hybrid,
+        ] {
+            let mut db = test_initialize(
+                1,
+                "test-sequential-ingest-with-all-compaction-policies".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                LsmCompressionLib::NoCompression,
+            );
+            db.db_conf.compaction = policy;
+
+            test_connect(&mut db);
+
+            // Keys are written in ascending order, so that segments do not overlap
+            // and merging them can be deferred.
+            let num_blobs = 300000_usize;
+            for id in 0..num_blobs {
+                let rc = db.persist(&id.to_be_bytes(), &[0; 128]);
+                assert_eq!(rc, Ok(()));
+            }
+
+            // Then a tenth of them gets overwritten, which produces segments that
+            // do overlap with the ones above.
+            for id in (0..num_blobs).step_by(10) {
+                let rc = db.persist(&id.to_be_bytes(), &[1; 128]);
+                assert_eq!(rc, Ok(()));
+            }
+
+            {
+                let mut cursor = db.cursor_open().unwrap();
+                let mut rc = cursor.first();
+                assert_eq!(rc, Ok(()));
+                let mut num_records = 0;
+                while cursor.valid().is_ok() {
+                    let key = cursor.get_key().unwrap();
+                    let id = usize::from_be_bytes(key.try_into().unwrap());
+                    assert_eq!(id, num_records);
+                    let value = cursor.get_value().unwrap();
+                    assert_eq!(value, vec![u8::from(id % 10 == 0); 128]);
+                    num_records += 1;
+                    rc = cursor.next();
+                    assert_eq!(rc, Ok(()));
+                }
+                assert_eq!(num_records, num_blobs);
+                rc = cursor.close();
+                assert_eq!(rc, Ok(()));
+            }
+
+            test_disconnect(&mut db);
+        }
+    }
+
+    #[test]
+    fn can_configure_level_size_ratio() {
+        for policy in [LsmCompactionPolicy::Leveled, LsmCompactionPolicy::Hybrid] {
+            for ratio in [4, 16] {
+                let mut db = test_initialize(
+                    ratio as usize,
+                    "test-can-configure-level-size-ratio".to_string(),
+                    LsmMode::LsmNoBackgroundThreads,
+                    LsmCompressionLib::NoCompression,
+                );
+                db.db_conf.compaction = policy;
+                db.db_conf.level_size_ratio = Some(ratio);
+
+                test_connect(&mut db);
+
+                // Two segments are loaded, the more recent one being an eighth of
+                // the size of the older one. Their keys are interleaved, so that
+                // merging them cannot be deferred.
+                let num_blobs = 40000_u64;
+                for step in [1, 8] {
+                    let mut loader = db.bulk_loader().unwrap();
+                    for id in (0..num_blobs).step_by(step) {
+                        let rc = loader.insert(&id.to_be_bytes(), &[step as u8; 128]);
+                        assert_eq!(rc, Ok(()));
+                    }
+                    assert_eq!(loader.commit(), Ok(()));
+                }
+                assert_eq!(db.get_num_segments(), Ok(2));
+
+                // Writing records gets the segments merged, as long as the recent one
+                // is larger than the configured fraction of the older one.
+                for id in 0..8000_u64 {
+                    let rc = db.persist(&(num_blobs + id).to_be_bytes(), &[0; 1024]);
+                    assert_eq!(rc, Ok(()));
+                }
+                let expected_segments = if ratio > 8 { 1 } else { 2 };
+                assert_eq!(db.get_num_segments(), Ok(expected_segments));
+                test_disconnect(&mut db);
+            }
+        }
+
+        // A ratio that would keep no segment smaller than the next one is refused.
+        let mut db = test_initialize(
+            1,
+            "test-can-configure-level-size-ratio".to_string(),
+            LsmMode::LsmNoBackgroundThreads,
+            LsmCompressionLib::NoCompression,
+        );
+        db.db_conf.level_size_ratio = Some(1);
+        assert_eq!(db.connect(), Err(LsmErrorCode::LsmMisuse));
+    }
+
+    #[test]
+    fn can_merge_delete_markers_first() {
+        for (id, delete, ratio_pct) in [(0, false, Some(50)), (1, true, Some(50)), (2, true, None)]
+        {
+            let mut db = test_initialize(
+                id,
+                "test-can-merge-delete-markers-first".to_string(),
+                LsmMode::LsmNoBackgroundThreads,
+                LsmCompressionLib::NoCompression,
+            );
+            if let Some(ratio_pct) = ratio_pct {
+                db.db_conf = db.db_conf.clone().with_tombstone_ratio(ratio_pct);
+            }
+
+            test_connect(&mut db);
+
+            // An old segment is loaded.
+            let num_blobs = 40000_u64;
+            let mut loader = db.bulk_loader().unwrap();
+            for id in 0..num_blobs {
+                let rc = loader.insert(&id.to_be_bytes(), &[0; 128]);
+                assert_eq!(rc, Ok(()));
+            }
+            assert_eq!(loader.commit(), Ok(()));
+
+            // Then its records are either deleted or overwritten, a quarter at a time.
+            // Every quarter is flushed on its own (starting a bulk load flushes main
+            // memory).
+            for quarter in 0..4 {
+                for id in (quarter..num_blobs).step_by(4) {
+                    let rc = if delete {
+                        db.delete(&id.to_be_bytes())
+                    } else {
+                        db.persist(&id.to_be_bytes(), &[1; 8])
+                    };
+                    assert_eq!(rc, Ok(()));
+                }
+                assert_eq!(db.bulk_loader().unwrap().rollback(), Ok(()));
+            }
+
+            // Writing records gets segments merged.
+            for id in 0..2000_u64 {
+                let rc = db.persist(&(num_blobs + id).to_be_bytes(), &[0; 1024]);
+                assert_eq!(rc, Ok(()));
+            }
+            // The segment the delete markers were merged into is merged into the old
+            // one right away, which discards both the markers and the records they
+            // delete. Segments with as many records that are overwritten instead (or
+            // deleted, if delete markers are not prioritized) are left apart, as
+            // there are too few of them to merge.
+            let expected_segments = if delete && ratio_pct.is_some() { 0 } else { 2 };
+            assert_eq!(db.get_num_segments(), Ok(expected_segments));
+            let mut cursor = db.cursor_open().unwrap();
+            assert_eq!(cursor.first(), Ok(()));
+            let mut num_records = 0;
+            while cursor.valid().is_ok() {
+                num_records += 1;
+                assert_eq!(cursor.next(), Ok(()));
+            }
+            assert_eq!(cursor.close(), Ok(()));
+            drop(cursor);
+            let expected_records = if delete { 2000 } else { num_blobs + 2000 };
+            assert_eq!(num_records, expected_records);
+
+            test_disconnect(&mut db);
+        }
+    }
+
+    // Drops records whose value starts with 1, and rewrites those starting with 2.
+    struct TestCompactionFilter;
+
+    impl LsmCompactionFilter for TestCompactionFilter {
+        fn filter(&self, _key: &[u8], value: &[u8]) -> LsmCompactionDecision {
+            match value.first() {
+                Some(1) => LsmCompactionDecision::Drop,
+                Some(2) => LsmCompactionDecision::Change(b"changed".to_vec()),
+                _ => LsmCompactionDecision::Keep,
+            }
+        }
+    }
+
+    #[test]
+    fn compaction_filter_drops_and_changes_records() {
+        for mode in [
+            LsmMode::LsmNoBackgroundThreads,
+            LsmMode::LsmBackgroundMerger,
+            LsmMode::LsmBackgroundCheckpointer,
+        ] {
+            let mut db = test_initialize(
+                1,
+                "test-compaction-filter-drops-and-changes-records".to_string(),
+                mode,
+                LsmCompressionLib::NoCompression,
+            );
+            db.db_conf.compaction_filter = Some(Arc::new(TestCompactionFilter));
+
+            test_connect(&mut db);
+
+            // A third of the records is kept, dropped, and changed, respectively.
+            let num_blobs = 10000_usize;
+            for id in 0..num_blobs {
+                let rc = db.persist(&id.to_be_bytes(), &[(id % 3) as u8; 16]);
+                assert_eq!(rc, Ok(()));
+            }
+
+            // Disconnecting flushes the in-memory tree to disk, which is where
+            // the filter gets applied.
+            test_disconnect(&mut db);
+            test_connect(&mut db);
+
+            {
+                let mut cursor = db.cursor_open().unwrap();
+                let mut rc = cursor.first();
+                assert_eq!(rc, Ok(()));
+                let mut num_records = 0;
+                while cursor.valid().is_ok() {
+                    let key = cursor.get_key().unwrap();
+                    let id = usize::from_be_bytes(key.try_into().unwrap());
+                    let value = cursor.get_value().unwrap();
+                    match id % 3 {
+                        0 => assert_eq!(value, vec![0; 16]),
+                        2 => assert_eq!(value, b"changed".to_vec()),
+                        _ => panic!("Record {id} should have been dropped."),
+                    }
+                    num_records += 1;
+                    rc = cursor.next();
+                    assert_eq!(rc, Ok(()));
+                }
+                assert_eq!(num_records, 2 * num_blobs / 3 + 1);
+                rc = cursor.close();
+                assert_eq!(rc, Ok(()));
+            }
+
+            test_disconnect(&mut db);
+        }
+    }
+
+    struct TestMergeOperator;
+
+    impl LsmMergeOperator for TestMergeOperator {
+        fn merge(&self, _key: &[u8], existing: &[u8], operand: &[u8]) -> Vec<u8> {
+            let existing = u64::from_be_bytes(existing.try_into().unwrap());
+            let operand = u64::from_be_bytes(operand.try_into().unwrap());
+            (existing + operand).to_be_bytes().to_vec()
+        }
+    }
+
+    fn test_check_counters(db: &LsmDb, expected: &[Option<u64>]) {
+        // Point reads.
+        let mut cursor = db.cursor_open().unwrap();
+        for (id, counter) in expected.iter().enumerate() {
+            let rc = cursor.seek(&id.to_be_bytes(), LsmCursorSeekOp::LsmCursorSeekEq);
+            assert_eq!(rc, Ok(()));
+            match counter {
+                Some(counter) => {
+                    let value = cursor.get_value().unwrap();
+                    assert_eq!(value, counter.to_be_bytes().to_vec());
+                }
+                None => assert!(cursor.valid().is_err()),
+            }
+        }
+
+        // Full scan.
+        let mut rc = cursor.first();
+        assert_eq!(rc, Ok(()));
+        let mut num_records = 0;
+        while cursor.valid().is_ok() {
+            let key = cursor.get_key().unwrap();
+            let id = usize::from_be_bytes(key.try_into().unwrap());
+            let value = cursor.get_value().unwrap();
+            assert_eq!(Some(value), expected[id].map(|c| c.to_be_bytes().to_vec()));
+            // Reading again returns the very same combined value.
+            let value = cursor.get_value().unwrap();
+            assert_eq!(Some(value), expected[id].map(|c| c.to_be_bytes().to_vec()));
+            num_records += 1;
+            rc = cursor.next();
+            assert_eq!(rc, Ok(()));
+        }
+        assert_eq!(num_records, expected.iter().flatten().count());
+
+        // Scan reading only some values, and point reads not reading values.
+        for values in [LsmCursorValues::Lazy, LsmCursorValues::KeysOnly] {
+            assert_eq!(cursor.set_values(values), Ok(()));
+            let mut rc = cursor.first();
+            assert_eq!(rc, Ok(()));
+            let mut num_records = 0;
+            while cursor.valid().is_ok() {
+                let key = cursor.get_key().unwrap();
+                let id = usize::from_be_bytes(key.try_into().unwrap());
+                if values == LsmCursorValues::Lazy && id % 3 == 0 {
+                    let value = cursor.get_value().unwrap();
+                    assert_eq!(Some(value), expected[id].map(|c| c.to_be_bytes().to_vec()));
+                }
+                num_records += 1;
+                rc = cursor.next();
+                assert_eq!(rc, Ok(()));
+            }
+            assert_eq!(num_records, expected.iter().flatten().count());
+        }
+        for (id, counter) in expected.iter().enumerate() {
+            let rc = cursor.seek(&id.to_be_bytes(), LsmCursorSeekOp::LsmCursorSeekEq);
+            assert_eq!(rc, Ok(()));
+            assert_eq!(cursor.valid().is_ok(), counter.is_some());
+        }
+        assert_eq!(cursor.set_values(LsmCursorValues::Eager), Ok(()));
+
+        // Batched scan.
+        assert_eq!(cursor.first(), Ok(()));
+        let mut num_records = 0;
+        for record in cursor.records(7, 1 << 10) {
+            let (key, value) = record.unwrap();
+            let id = usize::from_be_bytes(key.try_into().unwrap());
+            assert_eq!(Some(value), expected[id].map(|c| c.to_be_bytes().to_vec()));
+            num_records += 1;
+        }
+        assert_eq!(num_records, expected.iter().flatten().count());
+        rc = cursor.close();
+        assert_eq!(rc, Ok(()));
+    }
+
+    #[test]
+    fn merge_operator_combines_operands() {
+        for mode in [
+            LsmMode::LsmNoBackgroundThreads,
+            LsmMode::LsmBackgroundMerger,
+            LsmMode::LsmBackgroundCheckpointer,
+        ] {
+            let mut db = test_initialize(
+                1,
+                "test-merge-operator-combines-operands".to_string(),
+                mode,
+                LsmCompressionLib::NoCompression,
+            );
+
+            // Without a merge operator, operands cannot be written.
+            test_connect(&mut db);
+            let rc = db.merge(&0_usize.to_be_bytes(), &1_u64.to_be_bytes());
+            assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+            test_disconnect(&mut db);
+
+            db.db_conf.merge_operator = Some(Arc::new(TestMergeOperator));
+            test_connect(&mut db);
+
+            // Half of the counters start from a regular value, the other half
+            // from nothing.
+            let num_blobs = 5000_usize;
+            let mut expected: Vec<Option<u64>> = vec![None; num_blobs];
+            for (id, counter) in expected.iter_mut().enumerate().step_by(2) {
+                let rc = db.persist(&id.to_be_bytes(), &100_u64.to_be_bytes());
+                assert_eq!(rc, Ok(()));
+                *counter = Some(100);
+            }
+
+            // Operands end up spread over several segments, as disconnecting
+            // flushes the in-memory tree to disk. Some counters are deleted
+            // in-between.
+            for round in 0..3_u64 {
+                for (id, counter) in expected.iter_mut().enumerate() {
+                    let rc = db.merge(&id.to_be_bytes(), &(round + 1).to_be_bytes());
+                    assert_eq!(rc, Ok(()));
+                    *counter = Some(counter.unwrap_or_default() + round + 1);
+                }
+                if round == 0 {
+                    for (id, counter) in expected.iter_mut().enumerate().step_by(5) {
+                        let rc = db.delete(&id.to_be_bytes());
+                        assert_eq!(rc, Ok(()));
+                        *counter = None;
+                    }
+                }
+                test_check_counters(&db, &expected);
+                test_disconnect(&mut db);
+                test_connect(&mut db);
+                test_check_counters(&db, &expected);
+            }
+
+            // These counters are gone for good.
+            for (id, counter) in expected.iter_mut().enumerate().step_by(7) {
+                let rc = db.delete(&id.to_be_bytes());
+                assert_eq!(rc, Ok(()));
+                *counter = None;
+            }
+            test_check_counters(&db, &expected);
+
+            // Once everything is merged into a single segment, operands are gone.
+            let rc = db.optimize();
+            assert_eq!(rc, Ok(()));
+            test_check_counters(&db, &expected);
+
+            test_disconnect(&mut db);
+        }
+    }
+
     #[test]
     fn test_try_from_error_code() {
         assert_eq!(LsmErrorCode::LsmError, LsmErrorCode::try_from(1).unwrap());
@@ -3449,6 +6422,29 @@ mod tests {
             LsmParam::try_from(15).unwrap()
         );
         assert_eq!(LsmParam::ReadOnly, LsmParam::try_from(16).unwrap());
+        assert_eq!(LsmParam::Compaction, LsmParam::try_from(17).unwrap());
+        assert_eq!(LsmParam::SizeRatio, LsmParam::try_from(18).unwrap());
+        assert_eq!(LsmParam::TombstoneRatio, LsmParam::try_from(19).unwrap());
+        assert_eq!(
+            LsmParam::MinCompressionSaving,
+            LsmParam::try_from(20).unwrap()
+        );
+        assert_eq!(LsmParam::CacheSize, LsmParam::try_from(21).unwrap());
+        assert_eq!(LsmParam::MmapAdvice, LsmParam::try_from(22).unwrap());
+        assert_eq!(
+            LsmParam::CompressedCacheSize,
+            LsmParam::try_from(23).unwrap()
+        );
+        assert_eq!(LsmParam::RawPages, LsmParam::try_from(24).unwrap());
+        assert_eq!(LsmParam::Readahead, LsmParam::try_from(25).unwrap());
+        assert_eq!(LsmParam::Writeback, LsmParam::try_from(26).unwrap());
+        assert_eq!(LsmParam::DropBehind, LsmParam::try_from(27).unwrap());
+        assert_eq!(LsmParam::Preallocate, LsmParam::try_from(28).unwrap());
+        assert_eq!(LsmParam::PunchHoles, LsmParam::try_from(29).unwrap());
+        assert_eq!(LsmParam::ValueLog, LsmParam::try_from(30).unwrap());
+        assert_eq!(LsmParam::PrefixKeys, LsmParam::try_from(31).unwrap());
+        assert_eq!(LsmParam::KeyFormat, LsmParam::try_from(32).unwrap());
+        assert_eq!(LsmParam::CompressThreads, LsmParam::try_from(33).unwrap());
         assert_eq!(
             LsmParam::try_from(6).unwrap_err(),
             LsmErrorCode::LsmUnknownCode
@@ -3472,6 +6468,38 @@ mod tests {
         );
     }
 
+    #[test]
+    fn test_try_from_compaction_policy() {
+        assert_eq!(
+            LsmCompactionPolicy::Tiered,
+            LsmCompactionPolicy::try_from(0).unwrap()
+        );
+        assert_eq!(
+            LsmCompactionPolicy::Leveled,
+            LsmCompactionPolicy::try_from(1).unwrap()
+        );
+        assert_eq!(
+            LsmCompactionPolicy::Hybrid,
+            LsmCompactionPolicy::try_from(2).unwrap()
+        );
+        assert_eq!(
+            LsmCompactionPolicy::try_from(3).unwrap_err(),
+            LsmErrorCode::LsmUnknownCode
+        );
+    }
+
+    #[test]
+    fn test_try_from_key_format() {
+        assert_eq!(LsmKeyFormat::Bytes, LsmKeyFormat::try_from(0).unwrap());
+        assert_eq!(LsmKeyFormat::U64, LsmKeyFormat::try_from(1).unwrap());
+        assert_eq!(LsmKeyFormat::U128, LsmKeyFormat::try_from(2).unwrap());
+        // This is LSM_KEY_FORMAT_CUSTOM, reported when a key comparator is set.
+        assert_eq!(
+            LsmKeyFormat::try_from(3).unwrap_err(),
+            LsmErrorCode::LsmUnknownCode
+        );
+    }
+
     #[test]
     fn test_try_from_compression_lib() {
         assert_eq!(
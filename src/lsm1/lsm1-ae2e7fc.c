@@ -9,6 +9,12 @@
 # undef NDEBUG
 #endif
 
+/* sync_file_range() and fallocate() are only declared if _GNU_SOURCE is
+** defined.  */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE 1
+#endif
+
 #line 1 "lsm.h"
 /*
 ** 2011-08-10
@@ -41,6 +47,8 @@ typedef struct lsm_db lsm_db;               /* Database connection handle */
 typedef struct lsm_env lsm_env;             /* Runtime environment */
 typedef struct lsm_file lsm_file;           /* OS file handle */
 typedef struct lsm_mutex lsm_mutex;         /* Mutex handle */
+typedef struct lsm_thread lsm_thread;       /* Thread handle */
+typedef struct lsm_cond lsm_cond;           /* Condition variable handle */
 
 /* 64-bit integer type used for file offsets. */
 typedef long long int lsm_i64;              /* 64-bit signed integer type */
@@ -97,11 +105,62 @@ struct lsm_env {
   int (*xMutexNotHeld)(lsm_mutex *);        /* Return true if mutex not held */
   /****** other ****************************************************/
   int (*xSleep)(lsm_env*, int microseconds);
+  /****** version 2 and later ****************************************/
+  int (*xAdvise)(lsm_file*, lsm_i64 iOff, lsm_i64 nByte, int eAdvice);
+  /****** version 3 and later ****************************************/
+  int (*xSyncRange)(lsm_file*, lsm_i64 iOff, lsm_i64 nByte, int bWait);
+  int (*xFallocate)(lsm_file*, lsm_i64 iOff, lsm_i64 nByte, int bPunch);
+  /****** version 4 and later ****************************************/
+  int (*xThreadNew)(lsm_env*, void (*)(void *), void *, lsm_thread**);
+  void (*xThreadJoin)(lsm_thread *);        /* Wait for thread to exit */
+  int (*xCondNew)(lsm_env*, lsm_cond**);    /* Get a new condition variable */
+  void (*xCondDel)(lsm_cond *);             /* Delete a condition variable */
+  void (*xCondWait)(lsm_cond *, lsm_mutex *);
+  void (*xCondBroadcast)(lsm_cond *);       /* Wake all waiting threads */
 
   /* New fields may be added in future releases, in which case the
   ** iVersion value will increase. */
 };
 
+/*
+** Values that may be passed as the last argument to xAdvise, and set using
+** LSM_CONFIG_MMAP_ADVICE. They correspond to the POSIX_MADV_XXX hints given
+** for the memory mapped part of the database file, and to the 
+** POSIX_FADV_XXX hints given for the rest of it. LSM_ADVISE_WILLNEED is
+** also passed to xAdvise to read ahead of sequential scans (see
+** LSM_CONFIG_READAHEAD), and LSM_ADVISE_DONTNEED (which may not be set
+** using LSM_CONFIG_MMAP_ADVICE) to drop written data from the cache of the
+** operating system (see LSM_CONFIG_DROP_BEHIND).
+**
+** The xSyncRange method starts writing back the modified part of the range
+** of the file (if bWait is false), or waits until the modified part of the
+** range has been written back (if bWait is true). Unlike xSync, it does not
+** make any guarantee about durability; it only spreads the work of a later
+** xSync over time (see LSM_CONFIG_WRITEBACK). Environments may implement it
+** as a no-op.
+**
+** The xFallocate method allocates disk space for the range of the file,
+** growing the file if required (if bPunch is false), or deallocates the
+** disk space of the range without changing the size of the file, after 
+** which the range reads as zeroes (if bPunch is true). See 
+** LSM_CONFIG_PREALLOCATE and LSM_CONFIG_PUNCH_HOLES. Environments may 
+** implement it as a no-op, e.g. if the file-system does not support it.
+**
+** The xThreadNew method starts a thread that invokes its second argument,
+** passing it the third. xThreadJoin waits for such a thread to return and
+** frees its handle. xCondWait atomically leaves the mutex (which the caller
+** has entered exactly once) and waits until xCondBroadcast is invoked on 
+** the condition variable, then enters the mutex again. It may also return
+** spuriously. These are only used to compress pages on other threads (see
+** LSM_CONFIG_COMPRESS_THREADS). Environments that do not support threads
+** set xThreadNew to NULL.
+*/
+#define LSM_ADVISE_NORMAL     0
+#define LSM_ADVISE_RANDOM     1
+#define LSM_ADVISE_SEQUENTIAL 2
+#define LSM_ADVISE_WILLNEED   3
+#define LSM_ADVISE_DONTNEED   4
+
 /* 
 ** Values that may be passed as the second argument to xMutexStatic. 
 */
@@ -292,6 +351,181 @@ int lsm_config(lsm_db *, int, ...);
 ** LSM_CONFIG_READONLY:
 **   A read/write boolean parameter. This parameter may only be set before
 **   lsm_open() is called.
+**
+** LSM_CONFIG_COMPACTION:
+**   A read/write integer parameter. The strategy used to select the levels
+**   merged together by lsm_work() and auto-work. One of:
+**
+**     LSM_COMPACTION_TIERED (the default): Runs of LSM_CONFIG_AUTOMERGE
+**     or more levels of the same age are merged together. This minimizes
+**     the number of times each key is rewritten.
+**
+**     LSM_COMPACTION_LEVELED: A level is merged into the level below it
+**     as soon as it is larger than 1/N of that level, where N is the
+**     value of LSM_CONFIG_SIZE_RATIO. This bounds the number of segments
+**     a read has to visit at the cost of rewriting keys more often.
+**
+**     LSM_COMPACTION_HYBRID: Levels produced by flushing the in-memory 
+**     tree (age 0) are merged as for LSM_COMPACTION_TIERED. All older
+**     levels are merged as for LSM_COMPACTION_LEVELED.
+**
+**   Merges requested with nMerge==1 (i.e. "optimize" the database) are 
+**   not affected by this parameter.
+**
+** LSM_CONFIG_SIZE_RATIO:
+**   A read/write integer parameter. The target size ratio between adjacent
+**   levels used by the LSM_COMPACTION_LEVELED and LSM_COMPACTION_HYBRID
+**   strategies. Values smaller than 2 are ignored. Default value 10.
+**
+** LSM_CONFIG_TOMBSTONE_RATIO:
+**   A read/write integer parameter. If set to a value N between 1 and 100,
+**   lsm_work() and auto-work prioritize merging any level (other than the
+**   levels produced by flushing the in-memory tree) in which N percent or 
+**   more of the entries written are delete markers. Such a level is merged
+**   into the level below it, or, if it is the oldest level, rewritten so 
+**   that the delete markers are discarded. Zero (the default) disables
+**   this.
+**
+** LSM_CONFIG_MIN_COMPRESS_SAVING:
+**   A read/write integer parameter. Only meaningful for compressed databases.
+**   If compressing a page does not shrink it by at least N percent, where N
+**   is the value of this parameter (between 0 and 99), the page is stored
+**   uncompressed instead. Such pages are read back without calling the
+**   xUncompress() method. Default value 0 (pages are stored uncompressed
+**   only if compressing them does not shrink them at all). Ignored if
+**   LSM_CONFIG_RAW_PAGES is false.
+**
+** LSM_CONFIG_RAW_PAGES:
+**   A read/write boolean parameter. Only meaningful for compressed 
+**   databases. If false, pages are never stored uncompressed (see 
+**   LSM_CONFIG_MIN_COMPRESS_SAVING): the output of the xCompress() method 
+**   is always stored, even if it is larger than the page. This is required
+**   if the compression methods do more than compressing, e.g. if they 
+**   encrypt pages. Default value 1.
+**
+** LSM_CONFIG_CACHE_SIZE:
+**   A read/write integer parameter. The maximum amount of memory, in KB,
+**   used to cache database pages read using ordinary read IO functions
+**   (i.e. not memory mapped). For compressed databases, pages are cached 
+**   after they have been uncompressed. Values smaller than 64 are ignored.
+**   The cache is emptied every time a connection observes the database has
+**   been modified. Default value 2048 (2MB).
+**
+** LSM_CONFIG_MMAP_ADVICE:
+**   A read/write integer parameter. One of the LSM_ADVISE_XXX values, which
+**   describes the expected pattern of accesses to the memory mapped part of
+**   the database file (see LSM_CONFIG_MMAP). It is passed to the xAdvise 
+**   method of the environment every time the file is mapped. Default value
+**   LSM_ADVISE_NORMAL, in which case xAdvise is not called at all.
+**
+** LSM_CONFIG_COMPRESSED_CACHE_SIZE:
+**   A read/write integer parameter. Only meaningful for compressed 
+**   databases. The maximum amount of memory, in KB, used to cache page 
+**   records exactly as they are stored in the database file, i.e. before 
+**   they are uncompressed. A page evicted from the cache configured by
+**   LSM_CONFIG_CACHE_SIZE that is read again is then uncompressed from 
+**   this cache instead of being read from the file. Pages stored 
+**   uncompressed are not cached here. Like the other cache, it is emptied 
+**   every time a connection observes the database has been modified. 
+**   Default value 0 (no such cache).
+**
+** LSM_CONFIG_READAHEAD:
+**   A read/write integer parameter. The maximum amount of the database 
+**   file, in KB, that is read ahead of a sequential scan. Pages read using
+**   ordinary read IO functions (i.e. not memory mapped) in ascending or 
+**   descending order of their offsets are detected as a scan, and the 
+**   pages that follow them in the same block are passed to the xAdvise 
+**   method of the environment as LSM_ADVISE_WILLNEED. The amount read 
+**   ahead starts small and doubles every time the scan goes on, up to this
+**   value. Default value 0 (nothing is read ahead).
+**
+** LSM_CONFIG_WRITEBACK:
+**   A read/write integer parameter. If greater than zero, every time the 
+**   connection has written this many KB of pages to a contiguous range of
+**   the database file (or writes to a different part of it), it starts
+**   writing the range back to disk using the xSyncRange method of the 
+**   environment, without waiting for it. Thus, merges write their output 
+**   back as they go, and the next checkpoint does not have to flush all of
+**   it at once. Default value 0 (nothing is written back before the file
+**   is synced).
+**
+** LSM_CONFIG_DROP_BEHIND:
+**   A read/write boolean parameter. Ignored unless LSM_CONFIG_WRITEBACK is
+**   greater than zero. If true, once the writeback of a range started as
+**   described above has completed (which the connection waits for before 
+**   starting the writeback of the next range), the range is dropped from 
+**   the cache of the operating system by passing LSM_ADVISE_DONTNEED to 
+**   the xAdvise method of the environment. Thus, merges do not evict the 
+**   pages readers need from that cache. Default value 0.
+**
+** LSM_CONFIG_PREALLOCATE:
+**   A read/write integer parameter. If greater than zero, every time the 
+**   connection grows the database file by a block, it allocates disk space
+**   for this many KB (rounded up to whole blocks) at once, using the 
+**   xFallocate method of the environment. Thus, the blocks merges write to
+**   are less fragmented, and writing them does not update the metadata of
+**   the file as often. The space of the blocks that end up unused is 
+**   released when the last connection to the database disconnects. Default
+**   value 0 (the file grows by one block at a time).
+**
+** LSM_CONFIG_PUNCH_HOLES:
+**   A read/write boolean parameter. If true, the disk space of the blocks
+**   in the free block list is deallocated using the xFallocate method of 
+**   the environment, as soon as the blocks could be reused (i.e. once no 
+**   snapshot in use, nor the last checkpoint, refers to them). Thus, the 
+**   disk space used by the database file tracks the amount of live data, 
+**   even if the file itself does not shrink. Default value 0.
+**
+** LSM_CONFIG_VALUE_LOG:
+**   A read/write integer parameter. If greater than zero, values larger
+**   than this many bytes are appended to a separate value log file (the
+**   name of the database file with "-vlog" appended) as records are 
+**   written to the database file (by flushes of the in-memory tree, merges
+**   and bulk loads, as configured on the connection doing so). The records
+**   only store a pointer to them. Thus, merges rewrite the pointers of 
+**   such values, but not the values themselves. In compressed databases,
+**   values are compressed using the same methods as database pages. 
+**   Reading a value through a cursor follows its pointer transparently.
+**   The space of values that are no longer referenced is reclaimed by
+**   lsm_vlog_gc(). Default value 0 (values are stored in the database file).
+**
+** LSM_CONFIG_PREFIX_KEYS:
+**   A read/write boolean parameter. If true, the pages of sorted runs 
+**   written by the connection (by flushes of the in-memory tree, merges and
+**   bulk loads) store each key as the number of leading bytes it shares 
+**   with the key before it, followed by the remaining bytes only. Every 
+**   16th key on a page is stored in full, so that a seek only decodes the 
+**   few keys between two of these. Thus, keys with long common prefixes 
+**   take less space, so that more of them fit on each page. Pages written
+**   either way can be read regardless of this setting, but not by versions
+**   of this library that do not support the format. Default value 0.
+**
+** LSM_CONFIG_KEY_FORMAT:
+**   A read/write integer parameter that may only be set before lsm_open()
+**   has been called. One of LSM_KEY_FORMAT_BYTES, LSM_KEY_FORMAT_U64 or
+**   LSM_KEY_FORMAT_U128. Keys are ordered as byte strings in any case (as
+**   by memcmp(), with the shorter key first if one is a prefix of the
+**   other). With LSM_KEY_FORMAT_U64 (or U128), keys of exactly 8 (or 16)
+**   bytes are compared as big-endian integers instead. This orders them
+**   the same way, but takes one comparison of machine words (or two) rather
+**   than a call to memcmp(). Keys of other sizes are compared as byte 
+**   strings, so connections to the same database may use different key
+**   formats. Setting the key format replaces a comparison function set by
+**   lsm_config_compare(). While one is set, LSM_KEY_FORMAT_CUSTOM is 
+**   reported. Default value LSM_KEY_FORMAT_BYTES.
+**
+** LSM_CONFIG_COMPRESS_THREADS:
+**   A read/write integer parameter. Only meaningful for compressed 
+**   databases. If greater than zero, the connection starts this many 
+**   threads (at most 64) using the xThreadNew method of the environment, 
+**   to compress the pages of sorted runs it writes (by flushes of the 
+**   in-memory tree, merges and bulk loads). Each page is handed to them 
+**   once it is full, and written once compressed, in the same order and 
+**   to the same place as it would have been otherwise. Thus, the thread 
+**   writing the run builds the following pages in the meantime. The 
+**   xCompress method of the compression methods must then be safe to call
+**   from several threads at once. Default value 0 (pages are compressed 
+**   by the thread writing them).
 */
 #define LSM_CONFIG_AUTOFLUSH                1
 #define LSM_CONFIG_PAGE_SIZE                2
@@ -308,11 +542,37 @@ int lsm_config(lsm_db *, int, ...);
 #define LSM_CONFIG_GET_COMPRESSION         14
 #define LSM_CONFIG_SET_COMPRESSION_FACTORY 15
 #define LSM_CONFIG_READONLY                16
+#define LSM_CONFIG_COMPACTION              17
+#define LSM_CONFIG_SIZE_RATIO              18
+#define LSM_CONFIG_TOMBSTONE_RATIO         19
+#define LSM_CONFIG_MIN_COMPRESS_SAVING     20
+#define LSM_CONFIG_CACHE_SIZE              21
+#define LSM_CONFIG_MMAP_ADVICE             22
+#define LSM_CONFIG_COMPRESSED_CACHE_SIZE   23
+#define LSM_CONFIG_RAW_PAGES               24
+#define LSM_CONFIG_READAHEAD               25
+#define LSM_CONFIG_WRITEBACK               26
+#define LSM_CONFIG_DROP_BEHIND             27
+#define LSM_CONFIG_PREALLOCATE             28
+#define LSM_CONFIG_PUNCH_HOLES             29
+#define LSM_CONFIG_VALUE_LOG               30
+#define LSM_CONFIG_PREFIX_KEYS             31
+#define LSM_CONFIG_KEY_FORMAT              32
+#define LSM_CONFIG_COMPRESS_THREADS        33
 
 #define LSM_SAFETY_OFF    0
 #define LSM_SAFETY_NORMAL 1
 #define LSM_SAFETY_FULL   2
 
+#define LSM_COMPACTION_TIERED  0
+#define LSM_COMPACTION_LEVELED 1
+#define LSM_COMPACTION_HYBRID  2
+
+#define LSM_KEY_FORMAT_BYTES   0
+#define LSM_KEY_FORMAT_U64     1
+#define LSM_KEY_FORMAT_U128    2
+#define LSM_KEY_FORMAT_CUSTOM  3
+
 /*
 ** CAPI: Compression and/or Encryption Hooks
 */
@@ -366,7 +626,10 @@ int lsm_set_user_version(lsm_db *, unsigned int);
 ** LSM_INFO_NREAD:
 **   The third parameter should be of type (int *). The location pointed
 **   to by the third parameter is set to the number of 4KB pages read from
-**   the database file during the lifetime of this connection.
+**   the database file during the lifetime of this connection. In compressed
+**   database mode, pages found in the cache configured by 
+**   LSM_CONFIG_COMPRESSED_CACHE_SIZE are counted as well (see 
+**   LSM_INFO_COMPRESSED_CACHE_HIT and LSM_INFO_COMPRESSED_CACHE_MISS).
 **
 ** LSM_INFO_DB_STRUCTURE:
 **   The third argument should be of type (char **). The location pointed
@@ -471,6 +734,33 @@ int lsm_set_user_version(lsm_db *, unsigned int);
 **   This value should be followed by a single argument of type 
 **   (unsigned int *). If successful, the location pointed to is populated 
 **   with the database compression id before returning.
+**
+** LSM_INFO_NWRITE_RAW:
+**   The third parameter should be of type (int *). Only meaningful for
+**   compressed databases. The location pointed to by the third parameter is
+**   set to the number of pages written to the database file during the
+**   lifetime of this connection that were stored uncompressed, as 
+**   compressing them did not pay off (see LSM_CONFIG_MIN_COMPRESS_SAVING).
+**   These pages are included in the LSM_INFO_NWRITE count.
+**
+** LSM_INFO_COMPRESSED_CACHE_HIT:
+**   The third parameter should be of type (int *). The location pointed to
+**   by the third parameter is set to the number of pages read during the
+**   lifetime of this connection that were found in the cache configured by
+**   LSM_CONFIG_COMPRESSED_CACHE_SIZE. These pages are included in the
+**   LSM_INFO_NREAD count.
+**
+** LSM_INFO_COMPRESSED_CACHE_MISS:
+**   The third parameter should be of type (int *). The location pointed to
+**   by the third parameter is set to the number of compressed pages read 
+**   from the database file during the lifetime of this connection while 
+**   the cache configured by LSM_CONFIG_COMPRESSED_CACHE_SIZE was enabled.
+**
+** LSM_INFO_NREADAHEAD:
+**   The third parameter should be of type (int *). The location pointed to
+**   by the third parameter is set to the number of times the connection 
+**   asked the environment to read ahead of a sequential scan during its 
+**   lifetime (see LSM_CONFIG_READAHEAD).
 */
 #define LSM_INFO_NWRITE           1
 #define LSM_INFO_NREAD            2
@@ -485,6 +775,10 @@ int lsm_set_user_version(lsm_db *, unsigned int);
 #define LSM_INFO_TREE_SIZE       11
 #define LSM_INFO_FREELIST_SIZE   12
 #define LSM_INFO_COMPRESSION_ID  13
+#define LSM_INFO_NWRITE_RAW      14
+#define LSM_INFO_COMPRESSED_CACHE_HIT  15
+#define LSM_INFO_COMPRESSED_CACHE_MISS 16
+#define LSM_INFO_NREADAHEAD      17
 
 
 /* 
@@ -542,6 +836,66 @@ int lsm_delete_range(lsm_db *,
     const void *pKey1, int nKey1, const void *pKey2, int nKey2
 );
 
+/*
+** Write a merge operand into the database. Instead of replacing the current
+** value of the key, the operand is combined with it using the merge function
+** configured by lsm_config_merge_operator(). This is done lazily, when the
+** key is read or when the records are merged, so that no read is required
+** to write the operand. If the key does not exist (or has been deleted), the
+** operand becomes its value.
+**
+** LSM_MISUSE is returned if no merge function has been configured.
+*/
+int lsm_merge(lsm_db*, const void *pKey, int nKey, const void *pVal, int nVal);
+
+/*
+** CAPI: Bulk Loading
+**
+** These functions are used to load records into the database without
+** writing them to the log file and the in-memory tree first. Instead, the
+** records are written straight into a new segment, which is added to the
+** database as its most recent level by lsm_bulk_end().
+**
+** lsm_bulk_begin() flushes the contents of the in-memory tree to disk and
+** takes the locks required to write the new level. It is an error to call
+** it while a transaction or cursor is open. Until lsm_bulk_end() is
+** called, no other connection may write to or work on the database, and
+** transactions, cursors and calls to lsm_work() are not allowed on this
+** connection.
+**
+** Each call to lsm_bulk_insert() appends a record to the new segment. The
+** key passed must be larger than that of the previous call, otherwise
+** LSM_MISUSE is returned and nothing is written. Records with the same
+** key as older ones in the database replace them.
+**
+** lsm_bulk_end() finishes the new segment and publishes it in a single
+** checkpoint if bCommit is true, or discards it otherwise.
+*/
+int lsm_bulk_begin(lsm_db *pDb);
+int lsm_bulk_insert(lsm_db*, const void *pKey, int nKey, const void *pVal, int nVal);
+int lsm_bulk_end(lsm_db *pDb, int bCommit);
+
+/*
+** CAPI: Value Log Garbage Collection
+**
+** Reclaim the disk space of the values in the oldest nKB KB of the value
+** log (see LSM_CONFIG_VALUE_LOG) that are no longer referenced by the
+** database. The values in that range that are still referenced are
+** written to the database again (and thereby to the end of the value log,
+** if they are still large enough). Then, the in-memory tree is flushed to
+** disk and checkpointed, and the range is deallocated using the
+** xFallocate method of the environment. It is an error to call this
+** function while a transaction or cursor is open.
+**
+** If the range cannot be deallocated yet, because an older snapshot is
+** still in use by a reader, or because another connection is working on
+** the database, the values are rewritten anyway, and a later call
+** deallocates the range. If nKB is negative, the whole value log is
+** considered. If pnKB is not NULL, *pnKB is set to the number of KB 
+** deallocated by this call.
+*/
+int lsm_vlog_gc(lsm_db *pDb, int nKB, int *pnKB);
+
 /*
 ** CAPI: Explicit Database Work and Checkpointing
 **
@@ -616,6 +970,20 @@ int lsm_csr_close(lsm_cursor *pCsr);
 */
 int lsm_csr_seek(lsm_cursor *pCsr, const void *pKey, int nKey, int eSeek);
 
+/*
+** Move the cursor to the smallest key in the database that is larger than
+** or equal to (pKey/nKey), exactly as lsm_csr_seek() with LSM_SEEK_GE does.
+**
+** If the cursor is iterating forwards (it was last positioned by an 
+** LSM_SEEK_GE seek, lsm_csr_first() or lsm_csr_next()) and (pKey/nKey) is 
+** not smaller than its current key, the key is first looked for on the
+** pages the cursor currently points to (and the pages right after them),
+** which is much cheaper than searching each segment from its root. Only if
+** the key lies further ahead is a regular seek done. This is intended for
+** cursors skipping forward over short distances.
+*/
+int lsm_csr_seek_forward(lsm_cursor *pCsr, const void *pKey, int nKey);
+
 int lsm_csr_first(lsm_cursor *pCsr);
 int lsm_csr_last(lsm_cursor *pCsr);
 
@@ -662,6 +1030,58 @@ int lsm_csr_valid(lsm_cursor *pCsr);
 int lsm_csr_key(lsm_cursor *pCsr, const void **ppKey, int *pnKey);
 int lsm_csr_value(lsm_cursor *pCsr, const void **ppVal, int *pnVal);
 
+/*
+** Configure how the cursor reads the values of the entries it visits. The
+** second argument must be one of the following:
+**
+** LSM_CURSOR_VALUES_EAGER:
+**   The value of each entry is read as the cursor moves onto it. This is 
+**   the default.
+**
+** LSM_CURSOR_VALUES_LAZY:
+**   Values are only read from the database file when lsm_csr_value() is
+**   called. Values that span pages, and the pages they overflow onto, are
+**   skipped by cursors that do not request them.
+**
+** LSM_CURSOR_VALUES_NONE:
+**   Values are never read. lsm_csr_value() returns LSM_MISUSE, and
+**   lsm_csr_next_batch() copies empty values. This is intended for scans 
+**   that only require keys.
+**
+** The new configuration applies from the next entry the cursor moves to.
+** LSM_MISUSE is returned if the second argument is not one of the above.
+*/
+int lsm_csr_values(lsm_cursor *pCsr, int eValues);
+
+#define LSM_CURSOR_VALUES_EAGER 0
+#define LSM_CURSOR_VALUES_LAZY  1
+#define LSM_CURSOR_VALUES_NONE  2
+
+/*
+** Copy the entry the cursor points to, and the entries following it, into
+** buffer aBuf (nBuf bytes in size), advancing the cursor past each entry
+** copied, as lsm_csr_next() does. Each entry is stored as the size of its 
+** key and the size of its value (4 bytes each, big-endian), followed by the
+** key and the value themselves.
+**
+** Entries are copied until the cursor reaches EOF, nMaxRecord entries have
+** been copied, or the next entry does not fit into what is left of aBuf.
+** On return, *pnRecord is set to the number of entries copied, and *pnByte
+** to the number of bytes of aBuf they take. If not even the first entry
+** fits, *pnRecord is set to 0 and *pnByte to the size of the buffer it 
+** requires, and the cursor is not moved.
+**
+** As with lsm_csr_next(), the cursor must be iterating forwards. Otherwise,
+** LSM_MISUSE is returned.
+*/
+int lsm_csr_next_batch(
+  lsm_cursor *pCsr, 
+  int nMaxRecord, 
+  void *aBuf, int nBuf, 
+  int *pnRecord, 
+  int *pnByte
+);
+
 /*
 ** If no error occurs, this function compares the database key passed via
 ** the pKey/nKey arguments with the key that the cursor passed as the first
@@ -689,6 +1109,119 @@ void lsm_config_log(lsm_db *, void (*)(void *, int, const char *), void *);
 */
 void lsm_config_work_hook(lsm_db *, void (*)(lsm_db *, void *), void *);
 
+/*
+** Configure a callback that is invoked for each key/value pair written
+** to the database file by a merge (including the flush of an in-memory
+** tree) that is performed by this connection. The arguments passed to
+** the callback are the context pointer, the key and the value. It returns
+** one of the LSM_FILTER_XXX values below:
+**
+**   LSM_FILTER_KEEP:
+**     The entry is written unchanged.
+**
+**   LSM_FILTER_DROP:
+**     The entry is removed. If older versions of the key may exist in the
+**     levels below the merge output, a delete marker is written instead,
+**     so that they do not resurface. Otherwise, nothing is written.
+**
+**   LSM_FILTER_CHANGE:
+**     The value written is replaced by the buffer that the callback has 
+**     stored in the last two arguments. The buffer must remain valid until
+**     the callback is next invoked, or the connection is closed.
+**
+** Delete markers, and keys written by the library itself, are not passed
+** to the callback. As merges may be performed by any connection to the
+** database, the same callback should usually be configured on all of them.
+*/
+void lsm_config_compaction_filter(
+  lsm_db *,
+  int (*)(void *, const void *, int, const void *, int, void **, int *),
+  void *
+);
+
+#define LSM_FILTER_KEEP   0
+#define LSM_FILTER_DROP   1
+#define LSM_FILTER_CHANGE 2
+
+/*
+** Configure the function used to combine the merge operands written by
+** lsm_merge() with older values of the same key. The arguments passed to
+** the callback are the context pointer, the key, the older value and the
+** newer value (which is always a merge operand). The combined value is
+** returned by storing a buffer in the last two arguments. The buffer must
+** remain valid until the callback is next invoked, or the connection is
+** closed. The callback returns LSM_OK, or an LSM error code that is then 
+** returned to the caller.
+**
+** Two merge operands may be combined before the older value they apply to
+** is known, so the function must be associative. As operands are combined
+** by all connections reading or merging the database, the same function 
+** must be configured on all of them. Reading a key whose value requires 
+** merge operands to be combined fails with LSM_MISMATCH on a connection 
+** without a merge function.
+*/
+void lsm_config_merge_operator(
+  lsm_db *,
+  int (*)(void *, const void *, int, const void *, int, const void *, int, 
+          void **, int *),
+  void *
+);
+
+/*
+** Configure the function used to order keys. It is passed two keys (each
+** as a pointer and a size in bytes), and returns a value less than, equal
+** to, or greater than zero if the first key is smaller than, equal to, or
+** larger than the second one. The function must define a total order over
+** all byte strings that does not change, as both the database file and the
+** in-memory tree are kept in this order. Thus, every connection to the 
+** database (in every process) must be configured with the same function 
+** before lsm_open() is called. LSM_MISUSE is returned if lsm_open() has 
+** already been called. See also LSM_CONFIG_KEY_FORMAT.
+*/
+int lsm_config_compare(lsm_db *, int (*)(void *, int, void *, int));
+
+/*
+** Store a compression dictionary in the database file, so that every
+** connection is able to load it (see lsm_dictionary_read()). The dictionary
+** is stored verbatim, in a block of its own, and it is identified by iDict,
+** which must not be zero. A database stores at most one dictionary, once
+** stored it cannot be replaced.
+**
+** LSM_MISUSE is returned if the database is not compressed, if it already
+** stores a dictionary, or if the connection has an open transaction or
+** cursor. LSM_FULL is returned if the dictionary does not fit in a block.
+*/
+int lsm_dictionary_write(lsm_db *, unsigned int iDict, const void *, int);
+
+/*
+** Query the compression dictionary stored in the database file. If there is
+** none, *piDict is set to zero. Otherwise, *piDict is set to its id and, if
+** ppDict is not NULL, *ppDict to a buffer holding it and *pnDict to its
+** size in bytes. The buffer is freed by the caller using lsm_free().
+**
+** This function may be invoked from within the compression functions. In
+** that case, the snapshot being read or written is the one queried.
+*/
+int lsm_dictionary_read(lsm_db *, unsigned int *piDict, void **ppDict, int *pnDict);
+
+/*
+** Configure the compression methods used for the segments written to levels
+** of age iAge or older (up to the next age configured). Segments of younger
+** levels are compressed using the methods configured with 
+** LSM_CONFIG_SET_COMPRESSION, which also determine the compression id of the
+** database. The id of the methods, which must fit in 16 bits, is stored with
+** every segment, so that each segment is read using the methods it was 
+** written with. Methods configured with a negative age are only used to 
+** read segments. If the xBound member is NULL, segments are stored 
+** uncompressed (their id is LSM_COMPRESSION_NONE).
+**
+** This may only be called after LSM_CONFIG_SET_COMPRESSION and before 
+** lsm_open(), up to 16 times. From then on, the connection owns the methods
+** and invokes xFree when closed. Otherwise LSM_MISUSE is returned, and the
+** caller remains responsible for the methods.
+*/
+int lsm_config_age_compression(lsm_db *, int iAge, lsm_compress *);
+
 /* ENDOFAPI */
 #ifdef __cplusplus
 }  /* End of the 'extern "C"' block */
@@ -755,6 +1288,22 @@ void lsm_config_work_hook(lsm_db *, void (*)(lsm_db *, void *), void *);
 #define LSM_DFLT_AUTOWORK           1
 #define LSM_DFLT_LOG_SIZE           (128*1024)
 #define LSM_DFLT_AUTOMERGE          4
+#define LSM_DFLT_COMPACTION         LSM_COMPACTION_TIERED
+#define LSM_DFLT_SIZE_RATIO         10
+#define LSM_DFLT_TOMBSTONE_RATIO    0
+#define LSM_DFLT_MIN_COMPRESS_SAVING 0
+#define LSM_DFLT_RAW_PAGES          1
+#define LSM_DFLT_CACHE_SIZE         (2 * 1024)
+#define LSM_DFLT_MMAP_ADVICE        LSM_ADVISE_NORMAL
+#define LSM_DFLT_COMPRESSED_CACHE_SIZE 0
+#define LSM_DFLT_READAHEAD          0
+#define LSM_DFLT_WRITEBACK          0
+#define LSM_DFLT_DROP_BEHIND        0
+#define LSM_DFLT_PREALLOCATE        0
+#define LSM_DFLT_PUNCH_HOLES        0
+#define LSM_DFLT_PREFIX_KEYS        0
+#define LSM_DFLT_COMPRESS_THREADS   0
+#define LSM_MAX_COMPRESS_THREADS    64
 #define LSM_DFLT_SAFETY             LSM_SAFETY_NORMAL
 #define LSM_DFLT_MMAP               (LSM_IS_64_BIT ? 1 : 32768)
 #define LSM_DFLT_MULTIPLE_PROCESSES 1
@@ -771,12 +1320,19 @@ void lsm_config_work_hook(lsm_db *, void (*)(lsm_db *, void *), void *);
 
 #define LSM_AUTOWORK_QUANT 32
 
+typedef struct BulkLoad BulkLoad;
+typedef struct CompressedPage CompressedPage;
+typedef struct CompressJob CompressJob;
+typedef struct CompressPool CompressPool;
+typedef struct ReadStream ReadStream;
 typedef struct Database Database;
 typedef struct DbLog DbLog;
 typedef struct FileSystem FileSystem;
+typedef struct AgeCompress AgeCompress;
 typedef struct Freelist Freelist;
 typedef struct FreelistEntry FreelistEntry;
 typedef struct Level Level;
+typedef struct LevelBounds LevelBounds;
 typedef struct LogMark LogMark;
 typedef struct LogRegion LogRegion;
 typedef struct LogWriter LogWriter;
@@ -885,6 +1441,28 @@ static int lsmErrorBkpt(int);
 #define LSM_SYSTEMKEY    0x20     /* True if entry is a system key (FREELIST) */
 
 #define LSM_CONTIGUOUS   0x40     /* Used in lsm_tree.c */
+#define LSM_VALUE_PTR    0x40     /* Value is in value log (segments only) */
+
+#define LSM_OPERAND      0x80     /* LSM_INSERT value is a merge operand */
+
+/*
+** LSM_OPERAND is not known to versions of this library that predate merge
+** operators. Those read a merge operand as a plain LSM_INSERT, so a database
+** that contains operands cannot be read correctly by them. There is no 
+** format version to guard against this: the change is one-way.
+*/
+
+/*
+** Records with the LSM_VALUE_PTR flag set store this many bytes instead of
+** their value (see LSM_CONFIG_VALUE_LOG): the offset of the value log entry
+** that contains the value (64 bits), followed by the size of the entry as
+** stored and the size of the value (32 bits each), all big-endian.
+**
+** The in-memory tree uses the same bit for LSM_CONTIGUOUS, which used to be
+** copied into segments too. Thus, the flag is only valid in segments with
+** Segment.bVlog set, which is the case for all segments started since.
+*/
+#define LSM_VLOG_PTR_SIZE 16
 
 /*
 ** A string that can grow by appending.
@@ -1002,6 +1580,16 @@ struct TreeHeader {
   u32 aCksum[2];                  /* Checksums 1 and 2. */
 };
 
+/*
+** Compression methods used for the segments of levels of age iAge or older.
+** See lsm_config_age_compression().
+*/
+#define LSM_MAX_AGE_COMPRESS 16
+struct AgeCompress {
+  int iAge;                       /* Youngest age (or -1 to only read) */
+  lsm_compress compress;          /* Compression callbacks */
+};
+
 /*
 ** Database handle structure.
 **
@@ -1044,16 +1632,35 @@ struct lsm_db {
   int bAutowork;                  /* Configured by LSM_CONFIG_AUTOWORK */
   int nTreeLimit;                 /* Configured by LSM_CONFIG_AUTOFLUSH */
   int nMerge;                     /* Configured by LSM_CONFIG_AUTOMERGE */
+  int eCompaction;                /* Configured by LSM_CONFIG_COMPACTION */
+  int nSizeRatio;                 /* Configured by LSM_CONFIG_SIZE_RATIO */
+  int nTombstoneRatio;            /* Configured by LSM_CONFIG_TOMBSTONE_RATIO */
+  int nMinCompressSaving;         /* Configured by LSM_CONFIG_MIN_COMPRESS_SAVING */
+  int bRawPages;                  /* Configured by LSM_CONFIG_RAW_PAGES */
   int bUseLog;                    /* Configured by LSM_CONFIG_USE_LOG */
   int nDfltPgsz;                  /* Configured by LSM_CONFIG_PAGE_SIZE */
   int nDfltBlksz;                 /* Configured by LSM_CONFIG_BLOCK_SIZE */
   int nMaxFreelist;               /* Configured by LSM_CONFIG_MAX_FREELIST */
   int iMmap;                      /* Configured by LSM_CONFIG_MMAP */
+  int eMmapAdvice;                /* Configured by LSM_CONFIG_MMAP_ADVICE */
+  int nCacheKB;                   /* Configured by LSM_CONFIG_CACHE_SIZE */
+  int nCompressedCacheKB;         /* Configured by L_C_COMPRESSED_CACHE_SIZE */
+  int nReadaheadKB;               /* Configured by LSM_CONFIG_READAHEAD */
+  int nWritebackKB;               /* Configured by LSM_CONFIG_WRITEBACK */
+  int bDropBehind;                /* Configured by LSM_CONFIG_DROP_BEHIND */
+  int nPreallocKB;                /* Configured by LSM_CONFIG_PREALLOCATE */
+  int bPunchHoles;                /* Configured by LSM_CONFIG_PUNCH_HOLES */
+  int nVlogThreshold;             /* Configured by LSM_CONFIG_VALUE_LOG */
+  int bPrefixKeys;                /* Configured by LSM_CONFIG_PREFIX_KEYS */
+  int eKeyFormat;                 /* Configured by LSM_CONFIG_KEY_FORMAT */
+  int nCompressThread;            /* Configured by L_C_COMPRESS_THREADS */
   i64 nAutockpt;                  /* Configured by LSM_CONFIG_AUTOCHECKPOINT */
   int bMultiProc;                 /* Configured by L_C_MULTIPLE_PROCESSES */
   int bReadonly;                  /* Configured by LSM_CONFIG_READONLY */
   lsm_compress compress;          /* Compression callbacks */
   lsm_compress_factory factory;   /* Compression callback factory */
+  AgeCompress aAgeCompress[LSM_MAX_AGE_COMPRESS]; /* Compression by age */
+  int nAgeCompress;               /* Number of valid aAgeCompress[] entries */
 
   /* Sub-system handles */
   FileSystem *pFS;                /* On-disk portion of database */
@@ -1080,6 +1687,10 @@ struct lsm_db {
   Freelist *pFreelist;            /* See sortedNewToplevel() */
   int bUseFreelist;               /* True to use pFreelist */
   int bIncrMerge;                 /* True if currently doing a merge */
+  i64 iPunched;                   /* Blocks freed before this are punched */
+  BulkLoad *pBulk;                /* Bulk load in progress (or NULL) */
+  int nBounds;                    /* Number of valid aBounds[] entries */
+  LevelBounds *aBounds;           /* Cached key ranges of levels */
 
   int bInFactory;                 /* True if within factory.xFactory() */
 
@@ -1091,6 +1702,15 @@ struct lsm_db {
   void (*xWork)(lsm_db *, void *);
   void *pWorkCtx;
 
+  /* Compaction filter callback */
+  int (*xFilter)(void *, const void *, int, const void *, int, void **, int *);
+  void *pFilterCtx;
+
+  /* Merge operator callback */
+  int (*xMerge)(void *, const void *, int, const void *, int, const void *, int,
+                void **, int *);
+  void *pMergeCtx;
+
   u64 mLock;                      /* Mask of current locks. See lsmShmLock(). */
   lsm_db *pNext;                  /* Next connection to same database */
 
@@ -1106,6 +1726,8 @@ struct Segment {
   LsmPgno iLastPg;                 /* Last page of this run */
   LsmPgno iRoot;                   /* Root page number (if any) */
   LsmPgno nSize;                   /* Size of this run in pages */
+  u32 iCmpId;                      /* Compression id (0 for the database's) */
+  int bVlog;                       /* True if LSM_VALUE_PTR flags are valid */
 
   Redirect *pRedirect;             /* Block redirects (or NULL) */
 };
@@ -1138,9 +1760,19 @@ struct Level {
 ** LEVEL_INCOMPLETE:
 **   This is set while a new toplevel level is being constructed. It is
 **   never set for any level other than a new toplevel.
+**
+** LEVEL_TOMBSTONE_MASK:
+**   These bits are not a flag. They store the fraction of the entries 
+**   written to the lhs segment of the level that are delete markers, in
+**   units of 1/255. Since they are stored in the checkpoint along with the
+**   other flags, the value survives across connections. Databases written 
+**   before this field existed simply report no delete markers. See
+**   sortedLevelTombstones() and mergeWorkerShutdown().
 */
 #define LEVEL_FREELIST_ONLY      0x0001
 #define LEVEL_INCOMPLETE         0x0002
+#define LEVEL_TOMBSTONE_MASK     0xFF00
+#define LEVEL_TOMBSTONE_SHIFT    8
 
 
 /*
@@ -1273,6 +1905,9 @@ struct FreelistEntry {
 struct Snapshot {
   Database *pDatabase;            /* Database this snapshot belongs to */
   u32 iCmpId;                     /* Id of compression scheme */
+  u32 iDictId;                    /* Id of compression dictionary (or 0) */
+  int iDictBlk;                   /* Block the dictionary is stored on */
+  int nDict;                      /* Size of the dictionary in bytes */
   Level *pLevel;                  /* Pointer to level 0 of snapshot (or NULL) */
   i64 iId;                        /* Snapshot id */
   i64 iLogOff;                    /* Log file offset */
@@ -1338,6 +1973,8 @@ static int lsmTreeLoadHeader(lsm_db *pDb, int *);
 static int lsmTreeLoadHeaderOk(lsm_db *, int);
 
 static int lsmTreeInsert(lsm_db *pDb, void *pKey, int nKey, void *pVal, int nVal);
+static int lsmTreeInsertOperand(lsm_db *, void *, int, void *, int);
+static int lsmTreeMergeOperand(lsm_db *, void *, int, void **, int *, int *);
 static int lsmTreeDelete(lsm_db *db, void *pKey1, int nKey1, void *pKey2, int nKey2);
 static void lsmTreeRollback(lsm_db *pDb, TreeMark *pMark);
 static void lsmTreeMark(lsm_db *pDb, TreeMark *pMark);
@@ -1388,6 +2025,13 @@ static int lsmMutexHeld(lsm_env *, lsm_mutex *);
 static int lsmMutexNotHeld(lsm_env *, lsm_mutex *);
 #endif
 
+static int lsmThreadNew(lsm_env*, void (*)(void *), void *, lsm_thread **);
+static void lsmThreadJoin(lsm_env*, lsm_thread *);
+static int lsmCondNew(lsm_env*, lsm_cond **);
+static void lsmCondDel(lsm_env*, lsm_cond *);
+static void lsmCondWait(lsm_env*, lsm_cond *, lsm_mutex *);
+static void lsmCondBroadcast(lsm_env*, lsm_cond *);
+
 /**************************************************************************
 ** Start of functions from "lsm_file.c".
 */
@@ -1406,6 +2050,8 @@ static int lsmFsMoveBlock(FileSystem *pFS, Segment *pSeg, int iTo, int iFrom);
 
 static int lsmFsPageSize(FileSystem *);
 static void lsmFsSetPageSize(FileSystem *, int);
+static void lsmFsSetCacheSize(FileSystem *, int);
+static void lsmFsSetCompressedCacheSize(FileSystem *, int);
 
 static int lsmFsFileid(lsm_db *pDb, void **ppId, int *pnId);
 
@@ -1433,11 +2079,17 @@ static int lsmFsDbPageNext(Segment *, Page *, int eDir, Page **);
 static u8 *lsmFsPageData(Page *, int *);
 static int lsmFsPageRelease(Page *);
 static int lsmFsPagePersist(Page *);
+static int lsmFsCompressThreads(FileSystem *);
+static void lsmFsPageCompress(Page *);
 static void lsmFsPageRef(Page *);
 static LsmPgno lsmFsPageNumber(Page *);
 
 static int lsmFsNRead(FileSystem *);
 static int lsmFsNWrite(FileSystem *);
+static int lsmFsNWriteRaw(FileSystem *);
+static int lsmFsNCompressedHit(FileSystem *);
+static int lsmFsNCompressedMiss(FileSystem *);
+static int lsmFsNReadahead(FileSystem *);
 
 static int lsmFsMetaPageGet(FileSystem *, int, int, MetaPage **);
 static int lsmFsMetaPageRelease(MetaPage *);
@@ -1458,8 +2110,18 @@ static int lsmFsSyncLog(FileSystem *pFS);
 static int lsmFsReadLog(FileSystem *pFS, i64 iOff, int nRead, LsmString *pStr);
 static int lsmFsTruncateLog(FileSystem *pFS, i64 nByte);
 static int lsmFsTruncateDb(FileSystem *pFS, i64 nByte);
+static int lsmFsPreallocate(FileSystem *pFS, int iBlk);
+static int lsmFsPunchBlock(FileSystem *pFS, int iBlk);
 static int lsmFsCloseAndDeleteLog(FileSystem *pFS);
 
+/* Functions to append to, read and maintain the value log file. */
+static int lsmFsVlogAppend(FileSystem *, void *, int, void *, int, u8 *);
+static int lsmFsVlogRead(FileSystem *, i64, int *, u8 **, int *, int *);
+static int lsmFsVlogRange(FileSystem *, i64 *, i64 *);
+static int lsmFsVlogReclaim(FileSystem *, i64, i64);
+static int lsmFsVlogSync(FileSystem *, int);
+static int lsmFsVlogRecover(FileSystem *);
+
 static LsmFile *lsmFsDeferClose(FileSystem *pFS);
 
 /* And to sync the db file */
@@ -1489,6 +2151,10 @@ static int lsmFsSegmentContainsPg(FileSystem *pFS, Segment *, LsmPgno, int *);
 
 static void lsmFsPurgeCache(FileSystem *);
 
+static int lsmFsWriteDictionary(FileSystem *, int, const void *, int);
+static void lsmFsNoCompression(lsm_compress *);
+static int lsmFsReadDictionary(FileSystem *, int, int, void **);
+
 /*
 ** End of functions from "lsm_file.c".
 **************************************************************************/
@@ -1506,9 +2172,14 @@ static int lsmSaveWorker(lsm_db *, int);
 
 static int lsmFlushTreeToDisk(lsm_db *pDb);
 
+static int lsmSortedBulkBegin(lsm_db *pDb);
+static int lsmSortedBulkInsert(lsm_db *, void *, int, void *, int);
+static int lsmSortedBulkEnd(lsm_db *pDb, int bCommit);
+
 static void lsmSortedRemap(lsm_db *pDb);
 
 static void lsmSortedFreeLevel(lsm_env *pEnv, Level *);
+static void lsmSortedFreeBounds(lsm_db *);
 
 static int lsmSortedAdvanceAll(lsm_db *pDb);
 
@@ -1522,6 +2193,9 @@ static void lsmSortedSaveTreeCursors(lsm_db *);
 static int lsmMCursorNew(lsm_db *, MultiCursor **);
 static void lsmMCursorClose(MultiCursor *, int);
 static int lsmMCursorSeek(MultiCursor *, int, void *, int , int);
+static int lsmMCursorSeekForward(MultiCursor *, void *, int);
+static int lsmMCursorNextBatch(MultiCursor *, int, u8 *, int, int *, int *);
+static void lsmMCursorValues(MultiCursor *, int);
 static int lsmMCursorFirst(MultiCursor *);
 static int lsmMCursorPrev(MultiCursor *);
 static int lsmMCursorLast(MultiCursor *);
@@ -1530,6 +2204,7 @@ static int lsmMCursorNext(MultiCursor *);
 static int lsmMCursorKey(MultiCursor *, void **, int *);
 static int lsmMCursorValue(MultiCursor *, void **, int *);
 static int lsmMCursorType(MultiCursor *, int *);
+static int lsmSortedVlogRef(MultiCursor *, void *, int, i64, int *);
 lsm_db *lsmMCursorDb(MultiCursor *);
 static void lsmMCursorFreeCache(lsm_db *);
 
@@ -1544,6 +2219,7 @@ static void lsmSortedExpandBtreePage(Page *pPg, int nOrig);
 static void lsmPutU32(u8 *, u32);
 static u32 lsmGetU32(u8 *);
 static u64 lsmGetU64(u8 *);
+static void lsmPutU64(u8 *, u64);
 
 /*
 ** Functions from "lsm_varint.c".
@@ -1582,6 +2258,7 @@ static int lsmInfoLogStructure(lsm_db *pDb, char **pzVal);
 #define LSM_WRITE        0x06
 #define LSM_DELETE       0x08
 #define LSM_DRANGE       0x0A
+#define LSM_MERGE        0x0C
 
 /**************************************************************************
 ** Functions from file "lsm_shared.c".
@@ -1772,6 +2449,12 @@ static int lsmStrlen(const char *zName);
 **     8. Cell within page containing current split-key.
 **     9. Current pointer value (64-bits - 2 integers).
 **
+**   A segment record consists of four 64-bit values: the first page, the
+**   last page, the root page and the size of the segment. The 16 most 
+**   significant bits of the size hold the compression id of the segment, 
+**   or 0 if it is the compression id of the database (see 
+**   lsm_config_age_compression()).
+**
 **   The block redirect array:
 **
 **     1. Number of redirections (maximum LSM_MAX_BLOCK_REDIRECTS).
@@ -1791,6 +2474,13 @@ static int lsmStrlen(const char *zName);
 **        2b. A 64-bit integer (MSW followed by LSW). -1 for a delete entry,
 **            or the associated checkpoint id for an insert.
 **
+**   The compression dictionary. Only present if one has been stored using
+**   lsm_dictionary_write(), so that older checkpoints remain valid:
+**
+**     1. Id of the dictionary.
+**     2. Block the dictionary is stored on.
+**     3. Size of the dictionary in bytes.
+**
 **   The checksum:
 **
 **     1. Checksum value 1.
@@ -1898,6 +2588,13 @@ static const int one = 1;
 #define CKPT_HDR_LO_CKSUM1 11
 #define CKPT_HDR_LO_CKSUM2 12
 
+/* Segment sizes are stored with the compression id above this bit. */
+#define CKPT_CMPID_SHIFT 48
+
+/* And with this bit set if the LSM_VALUE_PTR flags of the segment are 
+** valid (see Segment.bVlog). */
+#define CKPT_VLOG_SHIFT 47
+
 typedef struct CkptBuffer CkptBuffer;
 
 /*
@@ -2010,7 +2707,10 @@ static void ckptExportSegment(
   ckptAppend64(p, piOut, pSeg->iFirst, pRc);
   ckptAppend64(p, piOut, pSeg->iLastPg, pRc);
   ckptAppend64(p, piOut, pSeg->iRoot, pRc);
-  ckptAppend64(p, piOut, pSeg->nSize, pRc);
+  ckptAppend64(p, piOut, pSeg->nSize 
+      | ((i64)pSeg->iCmpId << CKPT_CMPID_SHIFT) 
+      | ((i64)pSeg->bVlog << CKPT_VLOG_SHIFT), pRc
+  );
 }
 
 static void ckptExportLevel(
@@ -2152,6 +2852,13 @@ static int ckptExportSnapshot(
     }
   }
 
+  /* Write the compression dictionary, if any */
+  if( pSnap->iDictId ){
+    ckptSetValue(&ckpt, iOut++, pSnap->iDictId, &rc);
+    ckptSetValue(&ckpt, iOut++, pSnap->iDictBlk, &rc);
+    ckptSetValue(&ckpt, iOut++, pSnap->nDict, &rc);
+  }
+
   /* Write the checkpoint header */
   assert( iId>=0 );
   assert( pSnap->iCmpId==pDb->compress.iId
@@ -2209,6 +2916,9 @@ static void ckptNewSegment(
   pSegment->iLastPg = ckptGobble64(aIn, piIn);
   pSegment->iRoot = ckptGobble64(aIn, piIn);
   pSegment->nSize = ckptGobble64(aIn, piIn);
+  pSegment->iCmpId = (u32)((u64)pSegment->nSize >> CKPT_CMPID_SHIFT);
+  pSegment->bVlog = (int)((pSegment->nSize >> CKPT_VLOG_SHIFT) & 1);
+  pSegment->nSize &= (((i64)1 << CKPT_VLOG_SHIFT) - 1);
   assert( pSegment->iFirst );
 }
 
@@ -2553,6 +3263,13 @@ static int lsmCheckpointStore(lsm_db *pDb, int iMeta){
     aData = lsmFsMetaPageData(pPg, &nData);
     memcpy(aData, pDb->aSnapshot, nCkpt*sizeof(u32));
     ckptChangeEndianness((u32 *)aData, nCkpt);
+
+    /* The buffer is not initialized. Zero the rest of it, so that whatever
+    ** the memory held before (e.g. records of a database whose pages are 
+    ** encrypted) is not written to the file.  */
+    if( nCkpt*(int)sizeof(u32)<nData ){
+      memset(&aData[nCkpt*sizeof(u32)], 0, nData - nCkpt*sizeof(u32));
+    }
     rc = lsmFsMetaPageRelease(pPg);
   }
       
@@ -2707,7 +3424,10 @@ static int lsmCheckpointDeserialize(
     }
 
     /* Copy the free-list */
-    if( rc==LSM_OK && bInclFreelist ){
+    if( rc==LSM_OK && bInclFreelist==0 ){
+      nFree = aCkpt[iIn++];
+      iIn += nFree*3;
+    }else if( rc==LSM_OK ){
       nFree = aCkpt[iIn++];
       if( nFree ){
         pNew->freelist.aEntry = (FreelistEntry *)lsmMallocZeroRc(
@@ -2725,6 +3445,14 @@ static int lsmCheckpointDeserialize(
         }
       }
     }
+
+    /* Read the compression dictionary. Checkpoints written before it was 
+    ** stored end with the free-list (followed by the checksum).  */
+    if( rc==LSM_OK && iIn+3+2<=(int)aCkpt[CKPT_HDR_NCKPT] ){
+      pNew->iDictId = aCkpt[iIn++];
+      pNew->iDictBlk = (int)aCkpt[iIn++];
+      pNew->nDict = (int)aCkpt[iIn++];
+    }
   }
 
   if( rc!=LSM_OK ){
@@ -3091,6 +3819,25 @@ static int lsmCheckpointSize(lsm_db *db, int *pnKB){
 #include <sys/stat.h>
 #include <fcntl.h>
 
+/*
+** Number of sequential scans a connection reads ahead of at the same time 
+** (see LSM_CONFIG_READAHEAD). A merge or a cursor reads several segments, 
+** each of them sequentially, in interleaved order.
+*/
+#define LSM_READAHEAD_STREAMS 8
+
+/*
+** A sequence of reads of the database file, each of which starts right 
+** after (or ends right before) the previous one. Offsets are in bytes.
+*/
+struct ReadStream {
+  i64 iFirst;                     /* Offset of the last read */
+  i64 iLast;                      /* Offset right after the last read */
+  i64 iAhead;                     /* Read ahead up to (or down to) here */
+  i64 nWindow;                    /* Bytes to read ahead next time */
+  int eDir;                       /* +1 ascending, -1 descending, 0 unknown */
+};
+
 /*
 ** File-system object. Each database connection allocates a single instance
 ** of the following structure. It is used for all access to the database and
@@ -3151,6 +3898,7 @@ struct FileSystem {
   lsm_env *pEnv;                  /* Environment pointer */
   char *zDb;                      /* Database file name */
   char *zLog;                     /* Database file name */
+  char *zVlog;                    /* Value log file name */
   int nMetasize;                  /* Size of meta pages in bytes */
   int nMetaRwSize;                /* Read/written size of meta pages in bytes */
   i64 nPagesize;                  /* Database page-size in bytes */
@@ -3168,6 +3916,7 @@ struct FileSystem {
   u8 *aIBuffer;                   /* Buffer to compress to */
   u8 *aOBuffer;                   /* Buffer to uncompress from */
   int nBuffer;                    /* Allocated size of above buffers in bytes */
+  CompressPool *pPool;            /* Threads compressing pages (or NULL) */
 
   /* mmap() page related things */
   i64 nMapLimit;                  /* Maximum bytes of file to map */
@@ -3185,10 +3934,42 @@ struct FileSystem {
   Page **apHash;                  /* nHash Hash slots */
   Page *pWaiting;                 /* b-tree pages waiting to be written */
 
+  /* Cache of compressed page records (see LSM_CONFIG_COMPRESSED_CACHE_SIZE) */
+  i64 nCCacheMax;                 /* Configured cache size (in bytes) */
+  i64 nCCacheAlloc;               /* Current cache size (in bytes) */
+  CompressedPage *pCLruFirst;     /* Head of the LRU list */
+  CompressedPage *pCLruLast;      /* Tail of the LRU list */
+  int nCHash;                     /* Number of hash slots in hash table */
+  CompressedPage **apCHash;       /* nCHash Hash slots (allocated lazily) */
+
+  /* Sequential scans detected (see LSM_CONFIG_READAHEAD) */
+  ReadStream aStream[LSM_READAHEAD_STREAMS];
+  int iStreamNext;                /* Slot of aStream[] to replace next */
+
+  /* Ranges of the file written back (see LSM_CONFIG_WRITEBACK) */
+  i64 iWbFirst;                   /* Start of range not yet written back */
+  i64 iWbLast;                    /* End of range not yet written back */
+  i64 iDropFirst;                 /* Start of range to drop from OS cache */
+  i64 iDropLast;                  /* End of range to drop from OS cache */
+
+  /* See LSM_CONFIG_PREALLOCATE */
+  i64 nReserved;                  /* Disk space allocated up to here */
+
+  /* Value log (see LSM_CONFIG_VALUE_LOG) */
+  lsm_file *fdVlog;               /* Value log file, if open */
+  u8 *aVlogIn;                    /* Buffer for entries as stored */
+  int nVlogIn;                    /* Allocated size of aVlogIn[] */
+  u8 *aVlogOut;                   /* Buffer for uncompressed entries */
+  int nVlogOut;                   /* Allocated size of aVlogOut[] */
+
   /* Statistics */
   int nOut;                       /* Number of outstanding pages */
   int nWrite;                     /* Total number of pages written */
+  int nWriteRaw;                  /* Pages of nWrite stored uncompressed */
   int nRead;                      /* Total number of pages read */
+  int nCHit;                      /* Pages found in compressed page cache */
+  int nCMiss;                     /* Pages missing from compressed page cache */
+  int nReadahead;                 /* Number of times read ahead */
 };
 
 /*
@@ -3219,6 +4000,8 @@ struct Page {
   int nCompress;                  /* Compressed size (or 0 for uncomp. db) */
   int nCompressPrev;              /* Compressed size of prev page */
   Segment *pSeg;                  /* Segment this page will be written to */
+  lsm_compress *pCompress;        /* Methods to compress the page with */
+  CompressJob *pJob;              /* Set while compressed by pFS->pPool */
 
   /* Pointers for singly linked lists */
   Page *pWaitingNext;             /* Next page in FileSystem.pWaiting list */
@@ -3226,6 +4009,69 @@ struct Page {
   Page *pMappedNext;              /* Next page in FileSystem.pMapped list */
 };
 
+/*
+** A page record of a compressed database, cached exactly as it is stored in
+** the database file (minus the size fields). The data is stored in the same
+** allocation, immediately after the structure itself.
+*/
+struct CompressedPage {
+  u8 *aData;                      /* Compressed page data */
+  int nData;                      /* Bytes of data at aData[] */
+  i64 iOff;                       /* Offset of the page record in the file */
+  CompressedPage *pHashNext;      /* Next entry in hash table slot */
+  CompressedPage *pLruNext;       /* Next entry in LRU list */
+  CompressedPage *pLruPrev;       /* Previous entry in LRU list */
+};
+
+/*
+** A page of a sorted run handed to the threads of a CompressPool by
+** lsmFsPageCompress(). The buffer the page is compressed into, of
+** FileSystem.nBuffer bytes, is allocated immediately after the structure.
+**
+** Field eState is one of the COMPRESS_JOB_XXX values below, and is
+** protected by CompressPool.pMutex. The thread that compresses the page
+** sets nOut and rc before it sets eState to COMPRESS_JOB_DONE.
+*/
+struct CompressJob {
+  const u8 *aIn;                  /* Page image to compress */
+  int nIn;                        /* Size of aIn[] in bytes */
+  lsm_compress *p;                /* Methods to compress the page with */
+  u8 *aOut;                       /* Buffer to compress the page into */
+  int nOut;                       /* Compressed size of the page */
+  int rc;                         /* Return code of xCompress() */
+  int eState;                     /* COMPRESS_JOB_XXX value */
+  CompressJob *pNext;             /* Next job in queue or free list */
+};
+
+#define COMPRESS_JOB_QUEUED  0    /* Not yet picked up by a thread */
+#define COMPRESS_JOB_RUNNING 1    /* Being compressed by a thread */
+#define COMPRESS_JOB_DONE    2    /* Compressed, nOut and rc are valid */
+
+/*
+** Threads that compress pages of sorted runs for a FileSystem (see
+** LSM_CONFIG_COMPRESS_THREADS). Jobs not yet picked up by a thread are
+** queued in the list headed by pFirst. This list, bShutdown and the 
+** counters of threads waiting on the condition variables are protected 
+** by pMutex. The condition variables are only signalled if a thread is
+** waiting on them. The other fields are only used by the thread that owns
+** the FileSystem.
+*/
+struct CompressPool {
+  lsm_env *pEnv;                  /* Environment handle */
+  lsm_mutex *pMutex;              /* Mutex protecting the queue */
+  lsm_cond *pWork;                /* Signalled when a job is queued */
+  lsm_cond *pDone;                /* Signalled when a job is compressed */
+  int nWorkWait;                  /* Threads waiting on pWork */
+  int nDoneWait;                  /* Threads waiting on pDone */
+  CompressJob *pFirst;            /* First job in queue */
+  CompressJob *pLast;             /* Last job in queue */
+  int bShutdown;                  /* Set to tell the threads to return */
+  CompressJob *pFree;             /* Unused CompressJob objects */
+  int nJob;                       /* Jobs submitted and not yet finished */
+  int nThread;                    /* Size of apThread[] array */
+  lsm_thread **apThread;          /* Threads compressing pages */
+};
+
 /*
 ** Meta-data page handle. There are two meta-data pages at the start of
 ** the database file, each FileSystem.nMetasize bytes in size.
@@ -3305,6 +4151,9 @@ static void assert_lists_are_ok(FileSystem *pFS){
 **     lsmEnvTruncate()
 **     lsmEnvUnlink()
 **     lsmEnvRemap()
+**     lsmEnvAdvise()
+**     lsmEnvSyncRange()
+**     lsmEnvFallocate()
 */
 static int lsmEnvOpen(lsm_env *pEnv, const char *zFile, int flags, lsm_file **ppNew){
   return pEnv->xOpen(pEnv, zFile, flags, ppNew);
@@ -3360,6 +4209,52 @@ static int lsmEnvRemap(
   return pEnv->xRemap(pFile, szMin, ppMap, pszMap);
 }
 
+/*
+** Environments older than version 2 do not implement xAdvise. As advice is
+** only a hint, it is silently dropped in that case.
+*/
+static int lsmEnvAdvise(
+  lsm_env *pEnv, 
+  lsm_file *pFile, 
+  i64 iOff, 
+  i64 nByte, 
+  int eAdvice
+){
+  if( pEnv->iVersion<2 || pEnv->xAdvise==0 ) return LSM_OK;
+  return IOERR_WRAPPER( pEnv->xAdvise(pFile, iOff, nByte, eAdvice) );
+}
+
+/*
+** Environments older than version 3 do not implement xSyncRange. As it
+** only spreads the work of xSync over time, it is skipped in that case.
+*/
+static int lsmEnvSyncRange(
+  lsm_env *pEnv, 
+  lsm_file *pFile, 
+  i64 iOff, 
+  i64 nByte, 
+  int bWait
+){
+  if( pEnv->iVersion<3 || pEnv->xSyncRange==0 ) return LSM_OK;
+  return IOERR_WRAPPER( pEnv->xSyncRange(pFile, iOff, nByte, bWait) );
+}
+
+/*
+** Environments older than version 3 do not implement xFallocate either. As
+** the file is grown by writes and space is still reused through the free
+** block list, it is skipped in that case.
+*/
+static int lsmEnvFallocate(
+  lsm_env *pEnv, 
+  lsm_file *pFile, 
+  i64 iOff, 
+  i64 nByte, 
+  int bPunch
+){
+  if( pEnv->iVersion<3 || pEnv->xFallocate==0 ) return LSM_OK;
+  return IOERR_WRAPPER( pEnv->xFallocate(pFile, iOff, nByte, bPunch) );
+}
+
 static int lsmEnvLock(lsm_env *pEnv, lsm_file *pFile, int iLock, int eLock){
   if( pFile==0 ) return LSM_OK;
   return pEnv->xLock(pFile, iLock, eLock);
@@ -3446,6 +4341,37 @@ static int lsmFsTruncateDb(FileSystem *pFS, i64 nByte){
   return lsmEnvTruncate(pFS->pEnv, pFS->fdDb, nByte);
 }
 
+/*
+** This is called when block iBlk is appended to the db file. If disk space
+** is to be preallocated (see LSM_CONFIG_PREALLOCATE) and none was for block
+** iBlk yet, allocate it for the configured number of blocks starting with 
+** iBlk.
+*/
+static int lsmFsPreallocate(FileSystem *pFS, int iBlk){
+  i64 nKB = pFS->pDb->nPreallocKB;
+  i64 iFirst = (i64)(iBlk-1) * pFS->nBlocksize;
+  i64 nByte;
+  int rc;
+
+  if( nKB<=0 || iFirst+pFS->nBlocksize<=pFS->nReserved ) return LSM_OK;
+  nByte = ((nKB*1024 + pFS->nBlocksize - 1) / pFS->nBlocksize) * pFS->nBlocksize;
+  rc = lsmEnvFallocate(pFS->pEnv, pFS->fdDb, iFirst, nByte, 0);
+  if( rc==LSM_OK ) pFS->nReserved = iFirst + nByte;
+  return rc;
+}
+
+/*
+** Deallocate the disk space of block iBlk, which is free and may be reused
+** (see LSM_CONFIG_PUNCH_HOLES). The first block is never deallocated, as 
+** it also contains the meta pages.
+*/
+static int lsmFsPunchBlock(FileSystem *pFS, int iBlk){
+  if( iBlk<=1 ) return LSM_OK;
+  return lsmEnvFallocate(pFS->pEnv, pFS->fdDb, 
+      (i64)(iBlk-1) * pFS->nBlocksize, pFS->nBlocksize, 1
+  );
+}
+
 /*
 ** Close the log file. Then delete it from the file-system. This function
 ** is called during database shutdown only.
@@ -3482,6 +4408,139 @@ static int fsHashKey(int nHash, LsmPgno iPg){
   return (iPg % nHash);
 }
 
+/*
+** Remove entry p from the LRU list of the compressed page cache.
+*/
+static void fsCPageRemoveFromLru(FileSystem *pFS, CompressedPage *p){
+  if( p->pLruNext ){
+    p->pLruNext->pLruPrev = p->pLruPrev;
+  }else{
+    pFS->pCLruLast = p->pLruPrev;
+  }
+  if( p->pLruPrev ){
+    p->pLruPrev->pLruNext = p->pLruNext;
+  }else{
+    pFS->pCLruFirst = p->pLruNext;
+  }
+  p->pLruPrev = 0;
+  p->pLruNext = 0;
+}
+
+/*
+** Add entry p to the end (most recently used) of the LRU list of the 
+** compressed page cache.
+*/
+static void fsCPageAddToLru(FileSystem *pFS, CompressedPage *p){
+  assert( p->pLruNext==0 && p->pLruPrev==0 );
+  p->pLruPrev = pFS->pCLruLast;
+  if( p->pLruPrev ){
+    p->pLruPrev->pLruNext = p;
+  }else{
+    pFS->pCLruFirst = p;
+  }
+  pFS->pCLruLast = p;
+}
+
+/*
+** Remove entry p from the compressed page cache and free it.
+*/
+static void fsCPageFree(FileSystem *pFS, CompressedPage *p){
+  CompressedPage **pp;
+  int iHash = fsHashKey(pFS->nCHash, p->iOff);
+
+  for(pp=&pFS->apCHash[iHash]; *pp!=p; pp=&(*pp)->pHashNext);
+  *pp = p->pHashNext;
+  fsCPageRemoveFromLru(pFS, p);
+  pFS->nCCacheAlloc -= sizeof(CompressedPage) + p->nData;
+  lsmFree(pFS->pEnv, p);
+}
+
+/*
+** Empty the compressed page cache.
+*/
+static void fsCPagePurge(FileSystem *pFS){
+  CompressedPage *p = pFS->pCLruFirst;
+  while( p ){
+    CompressedPage *pNext = p->pLruNext;
+    lsmFree(pFS->pEnv, p);
+    p = pNext;
+  }
+  pFS->pCLruFirst = 0;
+  pFS->pCLruLast = 0;
+  pFS->nCCacheAlloc = 0;
+  if( pFS->apCHash ){
+    memset(pFS->apCHash, 0, pFS->nCHash*sizeof(pFS->apCHash[0]));
+  }
+}
+
+/*
+** Search the compressed page cache for the page record at offset iOff of
+** the database file. If it is found, mark it as the most recently used 
+** entry and return a pointer to it. Otherwise, return NULL.
+*/
+static CompressedPage *fsCPageFind(FileSystem *pFS, i64 iOff){
+  CompressedPage *p = 0;
+  if( pFS->apCHash ){
+    p = pFS->apCHash[fsHashKey(pFS->nCHash, iOff)];
+    while( p && p->iOff!=iOff ) p = p->pHashNext;
+    if( p ){
+      fsCPageRemoveFromLru(pFS, p);
+      fsCPageAddToLru(pFS, p);
+    }
+  }
+  return p;
+}
+
+/*
+** Add a copy of the nData bytes of compressed data at aData[], read from 
+** the page record at offset iOff of the database file, to the compressed 
+** page cache. Least recently used entries are evicted to make room for it
+** if required. The cache is an optimization only, so if a memory allocation
+** fails the data is simply not cached.
+*/
+static void fsCPageAdd(FileSystem *pFS, i64 iOff, const u8 *aData, int nData){
+  i64 nByte = sizeof(CompressedPage) + nData;
+  CompressedPage *p;
+  int iHash;
+
+  if( nByte>pFS->nCCacheMax ) return;
+  if( pFS->apCHash==0 ){
+    pFS->apCHash = lsmMallocZero(pFS->pEnv, 
+        sizeof(CompressedPage *) * pFS->nCHash
+    );
+    if( pFS->apCHash==0 ) return;
+  }
+  while( pFS->nCCacheAlloc+nByte>pFS->nCCacheMax ){
+    fsCPageFree(pFS, pFS->pCLruFirst);
+  }
+
+  p = (CompressedPage *)lsmMalloc(pFS->pEnv, nByte);
+  if( p==0 ) return;
+  memset(p, 0, sizeof(CompressedPage));
+  p->aData = (u8 *)&p[1];
+  p->nData = nData;
+  p->iOff = iOff;
+  memcpy(p->aData, aData, nData);
+
+  iHash = fsHashKey(pFS->nCHash, iOff);
+  p->pHashNext = pFS->apCHash[iHash];
+  pFS->apCHash[iHash] = p;
+  fsCPageAddToLru(pFS, p);
+  pFS->nCCacheAlloc += nByte;
+}
+
+/*
+** Configure the maximum size of the compressed page cache in KB. The cache
+** is emptied, and its hash table sized for the new configuration.
+*/
+static void lsmFsSetCompressedCacheSize(FileSystem *pFS, int nKB){
+  fsCPagePurge(pFS);
+  lsmFree(pFS->pEnv, pFS->apCHash);
+  pFS->apCHash = 0;
+  pFS->nCCacheMax = (i64)nKB * 1024;
+  pFS->nCHash = (int)LSM_MAX(1024, pFS->nCCacheMax / 1024);
+}
+
 /*
 ** This is a helper function for lsmFsOpen(). It opens a single file on
 ** disk (either the database or log file).
@@ -3566,12 +4625,13 @@ static int lsmFsOpen(
   assert( pDb->pFS==0 );
   assert( pDb->pWorker==0 && pDb->pClient==0 );
 
-  nByte = sizeof(FileSystem) + nDb+1 + nDb+4+1;
+  nByte = sizeof(FileSystem) + nDb+1 + nDb+4+1 + nDb+5+1;
   pFS = (FileSystem *)lsmMallocZeroRc(pDb->pEnv, nByte, &rc);
   if( pFS ){
     LsmFile *pLsmFile;
     pFS->zDb = (char *)&pFS[1];
     pFS->zLog = &pFS->zDb[nDb+1];
+    pFS->zVlog = &pFS->zLog[nDb+4+1];
     pFS->nPagesize = LSM_DFLT_PAGE_SIZE;
     pFS->nBlocksize = LSM_DFLT_BLOCK_SIZE;
     pFS->nMetasize = LSM_META_PAGE_SIZE;
@@ -3583,11 +4643,15 @@ static int lsmFsOpen(
     memcpy(pFS->zDb, zDb, nDb+1);
     memcpy(pFS->zLog, zDb, nDb);
     memcpy(&pFS->zLog[nDb], "-log", 5);
+    memcpy(pFS->zVlog, zDb, nDb);
+    memcpy(&pFS->zVlog[nDb], "-vlog", 6);
 
     /* Allocate the hash-table here. At some point, it should be changed
-    ** so that it can grow dynamicly. */
-    pFS->nCacheMax = 2048*1024 / pFS->nPagesize;
-    pFS->nHash = 4096;
+    ** so that it can grow dynamicly. Until then, it is sized for the
+    ** cache configured when the connection is opened.  */
+    lsmFsSetCacheSize(pFS, pDb->nCacheKB);
+    pFS->nHash = LSM_MAX(4096, pFS->nCacheMax);
+    lsmFsSetCompressedCacheSize(pFS, pDb->nCompressedCacheKB);
     pFS->apHash = lsmMallocZeroRc(pDb->pEnv, sizeof(Page *) * pFS->nHash, &rc);
 
     /* Open the database file */
@@ -3633,6 +4697,7 @@ static int lsmFsConfigure(lsm_db *db){
     lsmFree(pEnv, pFS->aIBuffer);
     lsmFree(pEnv, pFS->aOBuffer);
     pFS->nBuffer = 0;
+    fsCPagePurge(pFS);
 
     /* Unmap the file, if it is currently mapped */
     if( pFS->pMap ){
@@ -3685,6 +4750,8 @@ static int lsmFsConfigure(lsm_db *db){
   return LSM_OK;
 }
 
+static void fsCompressPoolFree(FileSystem *pFS);
+
 /*
 ** Close and destroy a FileSystem object.
 */
@@ -3710,12 +4777,18 @@ static void lsmFsClose(FileSystem *pFS){
       pPg = pNext;
     }
 
+    fsCompressPoolFree(pFS);
     if( pFS->fdDb ) lsmEnvClose(pFS->pEnv, pFS->fdDb );
     if( pFS->fdLog ) lsmEnvClose(pFS->pEnv, pFS->fdLog );
+    if( pFS->fdVlog ) lsmEnvClose(pFS->pEnv, pFS->fdVlog );
     lsmFree(pEnv, pFS->pLsmFile);
+    fsCPagePurge(pFS);
     lsmFree(pEnv, pFS->apHash);
+    lsmFree(pEnv, pFS->apCHash);
     lsmFree(pEnv, pFS->aIBuffer);
     lsmFree(pEnv, pFS->aOBuffer);
+    lsmFree(pEnv, pFS->aVlogIn);
+    lsmFree(pEnv, pFS->aVlogOut);
     lsmFree(pEnv, pFS);
   }
 }
@@ -3800,7 +4873,16 @@ static int lsmFsBlockSize(FileSystem *pFS){
 */
 static void lsmFsSetPageSize(FileSystem *pFS, int nPgsz){
   pFS->nPagesize = nPgsz;
-  pFS->nCacheMax = 2048*1024 / pFS->nPagesize;
+  lsmFsSetCacheSize(pFS, pFS->pDb->nCacheKB);
+}
+
+/*
+** Configure the maximum size of the cache of non-mmap pages in KB. If more
+** pages than that are already cached, they are recycled instead of new 
+** ones allocated until the cache is purged.
+*/
+static void lsmFsSetCacheSize(FileSystem *pFS, int nKB){
+  pFS->nCacheMax = (int)(((i64)nKB * 1024) / pFS->nPagesize);
 }
 
 /*
@@ -3970,11 +5052,14 @@ static void fsPageBufferFree(Page *pPg){
 
 
 /*
-** Purge the cache of all non-mmap pages with nRef==0.
+** Purge the cache of all non-mmap pages with nRef==0, as well as the cache
+** of compressed page records.
 */
 static void lsmFsPurgeCache(FileSystem *pFS){
   Page *pPg;
 
+  fsCPagePurge(pFS);
+
   pPg = pFS->pLruFirst;
   while( pPg ){
     Page *pNext = pPg->pLruNext;
@@ -3989,6 +5074,51 @@ static void lsmFsPurgeCache(FileSystem *pFS){
   assert( pFS->nCacheAlloc<=pFS->nOut && pFS->nCacheAlloc>=0 );
 }
 
+/*
+** Write the nDict byte compression dictionary at the start of block iBlk.
+** The dictionary is not compressed, so that it can be read before the
+** compression functions are able to use it. LSM_FULL is returned if the
+** dictionary does not fit in the block.
+*/
+static int lsmFsWriteDictionary(
+  FileSystem *pFS, 
+  int iBlk, 
+  const void *pDict, 
+  int nDict
+){
+  LsmPgno iFirst;
+  if( pFS->pCompress==0 ) return LSM_MISUSE_BKPT;
+  iFirst = fsFirstPageOnBlock(pFS, iBlk);
+  if( nDict>(fsLastPageOnBlock(pFS, iBlk) - iFirst + 1) ) return LSM_FULL;
+  return lsmEnvWrite(pFS->pEnv, pFS->fdDb, iFirst, pDict, nDict);
+}
+
+/*
+** Read the nDict byte compression dictionary written to block iBlk by
+** lsmFsWriteDictionary() into a buffer allocated with lsmMalloc().
+*/
+static int lsmFsReadDictionary(
+  FileSystem *pFS, 
+  int iBlk, 
+  int nDict, 
+  void **ppDict
+){
+  int rc = LSM_OK;
+  void *pDict;
+
+  pDict = lsmMallocRc(pFS->pEnv, nDict, &rc);
+  if( rc==LSM_OK ){
+    LsmPgno iFirst = fsFirstPageOnBlock(pFS, iBlk);
+    rc = lsmEnvRead(pFS->pEnv, pFS->fdDb, iFirst, pDict, nDict);
+  }
+  if( rc!=LSM_OK ){
+    lsmFree(pFS->pEnv, pDict);
+    pDict = 0;
+  }
+  *ppDict = pDict;
+  return rc;
+}
+
 /*
 ** Search the hash-table for page iPg. If an entry is round, return a pointer
 ** to it. Otherwise, return NULL.
@@ -4075,6 +5205,11 @@ static void fsGrowMapping(
     int rc;
     u8 *aOld = pFS->pMap;
     rc = lsmEnvRemap(pFS->pEnv, pFS->fdDb, iSz, &pFS->pMap, &pFS->nMap);
+    if( rc==LSM_OK && pFS->pDb->eMmapAdvice!=LSM_ADVISE_NORMAL ){
+      rc = lsmEnvAdvise(pFS->pEnv, pFS->fdDb, 
+          0, pFS->nMap, pFS->pDb->eMmapAdvice
+      );
+    }
     if( rc==LSM_OK && pFS->pMap!=aOld ){
       Page *pFix;
       i64 iOff = (u8 *)pFS->pMap - aOld;
@@ -4099,10 +5234,38 @@ static int lsmFsUnmap(FileSystem *pFS){
 }
 
 /*
-** fsync() the database file.
+** Drop the range of the database file between byte offsets iFirst and iLast
+** from the cache of the operating system, once it has been written back.
+** Only whole pages of the operating system (assumed to be 4KB) are dropped,
+** as the next write to a page that was only partially written would have to
+** read the page back first. As this is only a hint, errors are ignored.
+*/
+static void fsDropBehind(FileSystem *pFS, i64 iFirst, i64 iLast){
+  i64 iDropFirst = (iFirst + 4095) & ~(i64)4095;
+  i64 iDropLast = iLast & ~(i64)4095;
+  if( iDropLast>iDropFirst ){
+    lsmEnvAdvise(pFS->pEnv, pFS->fdDb, 
+        iDropFirst, iDropLast - iDropFirst, LSM_ADVISE_DONTNEED
+    );
+  }
+}
+
+/*
+** fsync() the database file. As this writes back everything written so far,
+** the ranges this connection would otherwise write back later are forgotten
+** (and dropped from the cache of the operating system, if configured).
 */
 static int lsmFsSyncDb(FileSystem *pFS, int nBlock){
-  return lsmEnvSync(pFS->pEnv, pFS->fdDb);
+  int rc = lsmEnvSync(pFS->pEnv, pFS->fdDb);
+  if( rc==LSM_OK ){
+    if( pFS->pDb->bDropBehind && pFS->pDb->nWritebackKB>0 ){
+      fsDropBehind(pFS, pFS->iDropFirst, pFS->iDropLast);
+      fsDropBehind(pFS, pFS->iWbFirst, pFS->iWbLast);
+    }
+    pFS->iWbFirst = pFS->iWbLast = 0;
+    pFS->iDropFirst = pFS->iDropLast = 0;
+  }
+  return rc;
 }
 
 /*
@@ -4283,18 +5446,26 @@ static int fsBlockPrev(
 
 /*
 ** Encode and decode routines for record size fields.
+**
+** The size is stored as a 20-bit value. The remaining bit (0x40 of the
+** first byte) is set for page records that hold the page image itself
+** instead of its compressed form. See LSM_CONFIG_MIN_COMPRESS_SAVING.
 */
-static void putRecordSize(u8 *aBuf, int nByte, int bFree){
-  aBuf[0] = (u8)(nByte >> 14) | 0x80;
+#define LSM_RECORD_RAW (1 << 20)
+
+static void putRecordSize(u8 *aBuf, int nByte, int bFree, int bRaw){
+  assert( nByte<LSM_RECORD_RAW );
+  aBuf[0] = (u8)(nByte >> 14) | 0x80 | (bRaw ? 0x40 : 0x00);
   aBuf[1] = ((u8)(nByte >>  7) & 0x7F) | (bFree ? 0x00 : 0x80);
   aBuf[2] = (u8)nByte | 0x80;
 }
-static int getRecordSize(u8 *aBuf, int *pbFree){
+static int getRecordSize(u8 *aBuf, int *pbFree, int *pbRaw){
   int nByte;
-  nByte  = (aBuf[0] & 0x7F) << 14;
+  nByte  = (aBuf[0] & 0x3F) << 14;
   nByte += (aBuf[1] & 0x7F) << 7;
   nByte += (aBuf[2] & 0x7F);
   *pbFree = !(aBuf[1] & 0x80);
+  if( pbRaw ) *pbRaw = (aBuf[0] & 0x40) ? 1 : 0;
   return nByte;
 }
 
@@ -4367,20 +5538,489 @@ static int fsAddOffset(
 }
 
 /*
-** If it is not already allocated, allocate either the FileSystem.aOBuffer (if
-** bWrite is true) or the FileSystem.aIBuffer (if bWrite is false). Return
-** LSM_OK if successful if the attempt to allocate memory fails.
+** Compression methods of segments stored uncompressed in a compressed 
+** database (LSM_COMPRESSION_NONE). Pages are copied as they are.
 */
-static int fsAllocateBuffer(FileSystem *pFS, int bWrite){
-  u8 **pp;                        /* Pointer to either aIBuffer or aOBuffer */
+static int fsNoCompressBound(void *pCtx, int nSrc){
+  (void)pCtx;
+  return nSrc;
+}
+static int fsNoCompressCopy(
+  void *pCtx, 
+  char *aOut, 
+  int *pnOut, 
+  const char *aIn, 
+  int nIn
+){
+  (void)pCtx;
+  if( *pnOut<nIn ) return LSM_CORRUPT_BKPT;
+  memcpy(aOut, aIn, nIn);
+  *pnOut = nIn;
+  return LSM_OK;
+}
+static void lsmFsNoCompression(lsm_compress *p){
+  memset(p, 0, sizeof(lsm_compress));
+  p->iId = LSM_COMPRESSION_NONE;
+  p->xBound = fsNoCompressBound;
+  p->xCompress = fsNoCompressCopy;
+  p->xUncompress = fsNoCompressCopy;
+}
+
+/*
+** Return the compression methods with compression id iCmpId (0 for those
+** of the database), or NULL if none of the methods configured on the 
+** connection has that id.
+*/
+static lsm_compress *fsCompressMethods(FileSystem *pFS, u32 iCmpId){
+  static lsm_compress none = {
+    0, LSM_COMPRESSION_NONE, 
+    fsNoCompressBound, fsNoCompressCopy, fsNoCompressCopy, 0
+  };
+  lsm_db *pDb = pFS->pDb;
+  int i;
+
+  if( iCmpId==0 || iCmpId==pFS->pCompress->iId ) return pFS->pCompress;
+  for(i=0; i<pDb->nAgeCompress; i++){
+    if( pDb->aAgeCompress[i].compress.iId==iCmpId ){
+      return &pDb->aAgeCompress[i].compress;
+    }
+  }
+  return (iCmpId==LSM_COMPRESSION_NONE ? &none : 0);
+}
+
+/*
+** Return the compression methods the pages of segment pSeg (which may be 
+** NULL) were compressed with, or NULL if none of the methods configured
+** on the connection has its compression id. Any methods with the right 
+** id are able to uncompress the pages.
+*/
+static lsm_compress *fsSegmentCompress(FileSystem *pFS, Segment *pSeg){
+  return fsCompressMethods(pFS, pSeg ? pSeg->iCmpId : 0);
+}
+
+/*
+** Return the compression methods to compress the pages of segment pSeg,
+** which is the left-hand segment of a level of age iAge, with. If pSeg is
+** still empty, its compression id is set to that of the methods configured
+** for the age. Otherwise the methods must match its compression id, as
+** the segment might have been started by another connection. NULL is 
+** returned if no methods configured do.
+*/
+static lsm_compress *fsAppendCompress(FileSystem *pFS, Segment *pSeg, int iAge){
+  lsm_db *pDb = pFS->pDb;
+  lsm_compress *p = pFS->pCompress;
+  int iBest = -1;
+  int i;
+
+  for(i=0; i<pDb->nAgeCompress; i++){
+    AgeCompress *pAge = &pDb->aAgeCompress[i];
+    if( pAge->iAge>=0 && pAge->iAge<=iAge && pAge->iAge>iBest ){
+      iBest = pAge->iAge;
+      p = &pAge->compress;
+    }
+  }
+
+  if( pSeg->iFirst==0 ){
+    pSeg->iCmpId = (p==pFS->pCompress ? 0 : p->iId);
+  }else if( p->iId!=(pSeg->iCmpId ? pSeg->iCmpId : pFS->pCompress->iId) ){
+    p = fsSegmentCompress(pFS, pSeg);
+  }
+  return p;
+}
+
+/*
+** VALUE LOG FILE FORMAT
+**
+** The value log (see LSM_CONFIG_VALUE_LOG) begins with a header of
+** LSM_VLOG_HDR_SIZE bytes. The first 8 bytes of the header are set to
+** LSM_VLOG_MAGIC. Following them are three 64-bit big-endian offsets:
+**
+**   head: The offset the next entry is appended at. Entries are only 
+**         appended by the connection holding the WORKER lock.
+**
+**   sync: All entries before this offset have been synced to disk. It is
+**         advanced by the checkpointer before it syncs the database file, 
+**         so entries after it are not referenced by the last checkpoint. 
+**         When the system is recovered, the head is reset to it.
+**
+**   tail: The disk space before this offset has been deallocated by 
+**         lsm_vlog_gc(), which holds the WRITER lock while doing so.
+**
+** Each offset is read and written on its own, as the connections that 
+** update them hold different locks.
+**
+** Each entry is made up of a header of LSM_VLOG_ENTRY_HDR bytes followed
+** by the key and value of the record, as stored. The header consists of 
+** five 32-bit big-endian integers: LSM_VLOG_ENTRY_MAGIC, the compression id
+** the key and value were compressed with (0 if they are stored as they 
+** are), the size of the key, the size of the value and the size of the
+** key and value as stored. In compressed databases, the key and value are
+** compressed together, using the compression methods of the database. The
+** key is stored so that lsm_vlog_gc() can look up the record that refers
+** to the entry.
+*/
+#define LSM_VLOG_MAGIC       "lsm-vlog"
+#define LSM_VLOG_HDR_SIZE    512
+#define LSM_VLOG_HEAD        8
+#define LSM_VLOG_SYNC        16
+#define LSM_VLOG_TAIL        24
+#define LSM_VLOG_ENTRY_MAGIC 0x766C6F67
+#define LSM_VLOG_ENTRY_HDR   20
+
+/*
+** Open the value log file, if it is not already open. If it does not exist
+** and bCreate is true, it is created. Otherwise, FileSystem.fdVlog is left
+** set to NULL and LSM_OK returned.
+*/
+static int fsVlogOpen(FileSystem *pFS, int bCreate){
+  int rc = LSM_OK;
+  if( pFS->fdVlog==0 ){
+    lsm_env *pEnv = pFS->pEnv;
+    lsm_file *pFile = 0;
+
+    rc = lsmEnvOpen(pEnv, pFS->zVlog, LSM_OPEN_READONLY, &pFile);
+    if( rc==LSM_OK && pFS->pDb->bReadonly==0 ){
+      lsmEnvClose(pEnv, pFile);
+      pFile = 0;
+      rc = lsmEnvOpen(pEnv, pFS->zVlog, 0, &pFile);
+    }else if( rc==LSM_IOERR_NOENT ){
+      rc = LSM_OK;
+      pFile = 0;
+      if( bCreate ) rc = lsmEnvOpen(pEnv, pFS->zVlog, 0, &pFile);
+    }
+    pFS->fdVlog = (rc==LSM_OK ? pFile : 0);
+  }
+  return rc;
+}
+
+/*
+** Read the offset stored at byte iField of the value log header.
+*/
+static int fsVlogGetField(FileSystem *pFS, int iField, i64 *piVal){
+  u8 aBuf[8];
+  int rc = lsmEnvRead(pFS->pEnv, pFS->fdVlog, iField, aBuf, sizeof(aBuf));
+  *piVal = (rc==LSM_OK ? (i64)lsmGetU64(aBuf) : 0);
+  return rc;
+}
+
+/*
+** Write offset iVal to byte iField of the value log header.
+*/
+static int fsVlogPutField(FileSystem *pFS, int iField, i64 iVal){
+  u8 aBuf[8];
+  lsmPutU64(aBuf, (u64)iVal);
+  return lsmEnvWrite(pFS->pEnv, pFS->fdVlog, iField, aBuf, sizeof(aBuf));
+}
+
+/*
+** Make sure buffer *paBuf, currently *pnBuf bytes in size, is at least 
+** nReq bytes in size.
+*/
+static int fsVlogBuffer(lsm_env *pEnv, u8 **paBuf, int *pnBuf, int nReq){
+  if( *pnBuf<nReq ){
+    u8 *aNew = (u8 *)lsmRealloc(pEnv, *paBuf, nReq);
+    if( aNew==0 ) return LSM_NOMEM_BKPT;
+    *paBuf = aNew;
+    *pnBuf = nReq;
+  }
+  return LSM_OK;
+}
+
+/*
+** Append an entry with the key and value passed to the value log, creating
+** the value log file if required. The caller holds the WORKER lock. If 
+** successful, the pointer to the new entry (LSM_VLOG_PTR_SIZE bytes) is
+** written to aPtr[].
+*/
+static int lsmFsVlogAppend(
+  FileSystem *pFS,
+  void *pKey, int nKey,           /* Key of the record */
+  void *pVal, int nVal,           /* Value of the record */
+  u8 *aPtr                        /* OUT: Pointer to the new entry */
+){
+  lsm_compress *p = pFS->pCompress;
+  lsm_env *pEnv = pFS->pEnv;
+  int nData = nKey + nVal;        /* Size of key and value */
+  int nStored = nData;            /* Size of key and value as stored */
+  i64 iHead = 0;                  /* Offset the entry is appended at */
+  u8 *aEntry;
+  int rc;
+
+  /* Assemble the entry in the aVlogIn[] buffer. In compressed databases, 
+  ** the key and value are first copied to aVlogOut[], to be compressed 
+  ** from there.  */
+  if( p ){
+    nStored = p->xBound(p->pCtx, nData);
+    rc = fsVlogBuffer(pEnv, &pFS->aVlogOut, &pFS->nVlogOut, nData);
+    if( rc==LSM_OK ){
+      rc = fsVlogBuffer(
+          pEnv, &pFS->aVlogIn, &pFS->nVlogIn, LSM_VLOG_ENTRY_HDR+nStored
+      );
+    }
+    if( rc==LSM_OK ){
+      memcpy(pFS->aVlogOut, pKey, nKey);
+      memcpy(&pFS->aVlogOut[nKey], pVal, nVal);
+      rc = p->xCompress(p->pCtx, 
+          (char *)&pFS->aVlogIn[LSM_VLOG_ENTRY_HDR], &nStored, 
+          (const char *)pFS->aVlogOut, nData
+      );
+    }
+  }else{
+    rc = fsVlogBuffer(pEnv, &pFS->aVlogIn, &pFS->nVlogIn, LSM_VLOG_ENTRY_HDR+nData);
+    if( rc==LSM_OK ){
+      memcpy(&pFS->aVlogIn[LSM_VLOG_ENTRY_HDR], pKey, nKey);
+      memcpy(&pFS->aVlogIn[LSM_VLOG_ENTRY_HDR+nKey], pVal, nVal);
+    }
+  }
+  if( rc!=LSM_OK ) return rc;
+
+  aEntry = pFS->aVlogIn;
+  lsmPutU32(&aEntry[0], LSM_VLOG_ENTRY_MAGIC);
+  lsmPutU32(&aEntry[4], p ? p->iId : 0);
+  lsmPutU32(&aEntry[8], (u32)nKey);
+  lsmPutU32(&aEntry[12], (u32)nVal);
+  lsmPutU32(&aEntry[16], (u32)nStored);
+
+  rc = fsVlogOpen(pFS, 1);
+  if( rc==LSM_OK ) rc = fsVlogGetField(pFS, LSM_VLOG_HEAD, &iHead);
+  if( rc==LSM_OK && iHead==0 ){
+    /* The value log file is new. Write its header. */
+    u8 aHdr[LSM_VLOG_TAIL+8];
+    iHead = LSM_VLOG_HDR_SIZE;
+    memcpy(aHdr, LSM_VLOG_MAGIC, 8);
+    lsmPutU64(&aHdr[LSM_VLOG_HEAD], (u64)iHead);
+    lsmPutU64(&aHdr[LSM_VLOG_SYNC], (u64)iHead);
+    lsmPutU64(&aHdr[LSM_VLOG_TAIL], (u64)iHead);
+    rc = lsmEnvWrite(pEnv, pFS->fdVlog, 0, aHdr, sizeof(aHdr));
+  }
+  if( rc==LSM_OK ){
+    rc = lsmEnvWrite(
+        pEnv, pFS->fdVlog, iHead, aEntry, LSM_VLOG_ENTRY_HDR+nStored
+    );
+  }
+  if( rc==LSM_OK ){
+    rc = fsVlogPutField(
+        pFS, LSM_VLOG_HEAD, iHead + LSM_VLOG_ENTRY_HDR + nStored
+    );
+  }
+  if( rc==LSM_OK ){
+    lsmPutU64(&aPtr[0], (u64)iHead);
+    lsmPutU32(&aPtr[8], (u32)nStored);
+    lsmPutU32(&aPtr[12], (u32)nVal);
+  }
+  return rc;
+}
+
+/*
+** This is called when the entry at offset iOff of the value log does not
+** start with LSM_VLOG_ENTRY_MAGIC. If it is before the tail of the value
+** log, it has been reclaimed by lsm_vlog_gc(). In this case, the entry is
+** reported as empty (*paData is set to NULL). Otherwise, the value log is
+** corrupt.
+*/
+static int fsVlogReclaimed(
+  FileSystem *pFS, 
+  i64 iOff, 
+  u8 **paData, 
+  int *pnKey, 
+  int *pnVal
+){
+  i64 iTail = 0;
+  int rc = fsVlogGetField(pFS, LSM_VLOG_TAIL, &iTail);
+  if( rc==LSM_OK ){
+    if( iOff>=iTail ) return LSM_CORRUPT_BKPT;
+    *paData = 0;
+    *pnKey = 0;
+    *pnVal = 0;
+  }
+  return rc;
+}
+
+/*
+** Read the value log entry at offset iOff. If *pnStored is not negative,
+** it is the size of the key and value of the entry as stored (as recorded
+** in pointers to the entry). Otherwise, it is read from the header of the
+** entry and *pnStored set to it.
+**
+** If successful, *paData is set to point to a buffer containing the key 
+** of the entry (*pnKey bytes) followed by its value (*pnVal bytes). The 
+** buffer remains valid until the next call to a value log function. If 
+** the entry has been reclaimed, *paData is set to NULL instead.
+*/
+static int lsmFsVlogRead(
+  FileSystem *pFS,
+  i64 iOff,                       /* Offset of the entry */
+  int *pnStored,                  /* IN/OUT: Size of entry as stored */
+  u8 **paData,                    /* OUT: Key and value of the entry */
+  int *pnKey,                     /* OUT: Size of key */
+  int *pnVal                      /* OUT: Size of value */
+){
+  lsm_env *pEnv = pFS->pEnv;
+  int nStored = *pnStored;
+  u8 *aEntry;
+  u32 iCmpId;
+  int nKey;
+  int nVal;
+  int rc;
+
+  rc = fsVlogOpen(pFS, 0);
+  if( rc==LSM_OK && pFS->fdVlog==0 ) rc = LSM_CORRUPT_BKPT;
+  if( rc==LSM_OK && nStored<0 ){
+    u8 aHdr[LSM_VLOG_ENTRY_HDR];
+    rc = lsmEnvRead(pEnv, pFS->fdVlog, iOff, aHdr, sizeof(aHdr));
+    if( rc==LSM_OK ){
+      if( lsmGetU32(aHdr)!=LSM_VLOG_ENTRY_MAGIC ){
+        return fsVlogReclaimed(pFS, iOff, paData, pnKey, pnVal);
+      }
+      nStored = (int)lsmGetU32(&aHdr[16]);
+      if( nStored<0 ) return LSM_CORRUPT_BKPT;
+      *pnStored = nStored;
+    }
+  }
+  if( rc==LSM_OK ){
+    rc = fsVlogBuffer(
+        pEnv, &pFS->aVlogIn, &pFS->nVlogIn, LSM_VLOG_ENTRY_HDR+nStored
+    );
+  }
+  if( rc==LSM_OK ){
+    rc = lsmEnvRead(
+        pEnv, pFS->fdVlog, iOff, pFS->aVlogIn, LSM_VLOG_ENTRY_HDR+nStored
+    );
+  }
+  if( rc!=LSM_OK ) return rc;
+
+  aEntry = pFS->aVlogIn;
+  if( lsmGetU32(&aEntry[0])!=LSM_VLOG_ENTRY_MAGIC ){
+    return fsVlogReclaimed(pFS, iOff, paData, pnKey, pnVal);
+  }
+  iCmpId = lsmGetU32(&aEntry[4]);
+  nKey = (int)lsmGetU32(&aEntry[8]);
+  nVal = (int)lsmGetU32(&aEntry[12]);
+  if( lsmGetU32(&aEntry[16])!=(u32)nStored
+   || nKey<0 || nVal<0 || (i64)nKey+nVal>0x7FFFFFFF
+  ){
+    return LSM_CORRUPT_BKPT;
+  }
+
+  if( iCmpId==0 ){
+    if( nKey+nVal!=nStored ) return LSM_CORRUPT_BKPT;
+    *paData = &aEntry[LSM_VLOG_ENTRY_HDR];
+  }else{
+    lsm_compress *p = (pFS->pCompress ? fsCompressMethods(pFS, iCmpId) : 0);
+    int nData = nKey + nVal;
+    if( p==0 ) return LSM_MISMATCH;
+    rc = fsVlogBuffer(pEnv, &pFS->aVlogOut, &pFS->nVlogOut, nData);
+    if( rc==LSM_OK ){
+      rc = p->xUncompress(p->pCtx, (char *)pFS->aVlogOut, &nData, 
+          (const char *)&aEntry[LSM_VLOG_ENTRY_HDR], nStored
+      );
+    }
+    if( rc==LSM_OK && nData!=nKey+nVal ) rc = LSM_CORRUPT_BKPT;
+    *paData = pFS->aVlogOut;
+  }
+  *pnKey = nKey;
+  *pnVal = nVal;
+  return rc;
+}
+
+/*
+** Set *piTail to the offset of the first entry of the value log that has
+** not been deallocated, and *piHead to the offset the next entry is to be
+** appended at. If there is no value log, both are set to 0.
+*/
+static int lsmFsVlogRange(FileSystem *pFS, i64 *piTail, i64 *piHead){
+  int rc = fsVlogOpen(pFS, 0);
+  *piTail = *piHead = 0;
+  if( rc==LSM_OK && pFS->fdVlog ){
+    rc = fsVlogGetField(pFS, LSM_VLOG_TAIL, piTail);
+    if( rc==LSM_OK ) rc = fsVlogGetField(pFS, LSM_VLOG_HEAD, piHead);
+  }
+  return rc;
+}
+
+/*
+** Deallocate the disk space taken by the value log from its tail, iTail, 
+** up to offset iEnd, and make iEnd the new tail. The caller holds the 
+** WRITER lock.
+*/
+static int lsmFsVlogReclaim(FileSystem *pFS, i64 iTail, i64 iEnd){
+  int rc;
+  assert( pFS->fdVlog && iTail>=LSM_VLOG_HDR_SIZE && iEnd>=iTail );
+  rc = lsmEnvFallocate(pFS->pEnv, pFS->fdVlog, iTail, iEnd-iTail, 1);
+  if( rc==LSM_OK ) rc = fsVlogPutField(pFS, LSM_VLOG_TAIL, iEnd);
+  return rc;
+}
+
+/*
+** This is called by the checkpointer before it syncs the database file. 
+** Sync the entries appended to the value log so far (if bSync is true),
+** then advance the sync offset past them.
+*/
+static int lsmFsVlogSync(FileSystem *pFS, int bSync){
+  int rc = fsVlogOpen(pFS, 0);
+  if( rc==LSM_OK && pFS->fdVlog ){
+    i64 iHead = 0;
+    i64 iSync = 0;
+    rc = fsVlogGetField(pFS, LSM_VLOG_HEAD, &iHead);
+    if( rc==LSM_OK ) rc = fsVlogGetField(pFS, LSM_VLOG_SYNC, &iSync);
+    if( rc==LSM_OK && iHead!=iSync ){
+      if( bSync ) rc = lsmEnvSync(pFS->pEnv, pFS->fdVlog);
+      if( rc==LSM_OK ) rc = fsVlogPutField(pFS, LSM_VLOG_SYNC, iHead);
+      if( rc==LSM_OK && bSync ) rc = lsmEnvSync(pFS->pEnv, pFS->fdVlog);
+    }
+  }
+  return rc;
+}
+
+/*
+** This is called by the first connection to the database, as it recovers
+** the system from the last checkpoint. Entries appended to the value log
+** after it was last synced are not referenced by the checkpoint, and may 
+** not have made it to disk in full. Reset the head of the value log so 
+** that they are overwritten.
+*/
+static int lsmFsVlogRecover(FileSystem *pFS){
+  int rc = LSM_OK;
+  if( pFS->pDb->bReadonly==0 ){
+    rc = fsVlogOpen(pFS, 0);
+    if( rc==LSM_OK && pFS->fdVlog ){
+      i64 iHead = 0;
+      i64 iSync = 0;
+      i64 iTail = 0;
+      rc = fsVlogGetField(pFS, LSM_VLOG_HEAD, &iHead);
+      if( rc==LSM_OK ) rc = fsVlogGetField(pFS, LSM_VLOG_SYNC, &iSync);
+      if( rc==LSM_OK ) rc = fsVlogGetField(pFS, LSM_VLOG_TAIL, &iTail);
+      if( rc==LSM_OK && iHead>LSM_MAX(iSync, iTail) ){
+        rc = fsVlogPutField(pFS, LSM_VLOG_HEAD, LSM_MAX(iSync, iTail));
+      }
+    }
+  }
+  return rc;
+}
+
+/*
+** If it is not already allocated, allocate either the FileSystem.aOBuffer (if
+** bWrite is true) or the FileSystem.aIBuffer (if bWrite is false). Return
+** LSM_OK if successful if the attempt to allocate memory fails.
+*/
+static int fsAllocateBuffer(FileSystem *pFS, int bWrite){
+  u8 **pp;                        /* Pointer to either aIBuffer or aOBuffer */
 
   assert( pFS->pCompress );
 
   /* If neither buffer has been allocated, figure out how large they
-  ** should be. Store this value in FileSystem.nBuffer.  */
+  ** should be. Store this value in FileSystem.nBuffer. They must be large
+  ** enough for any of the compression methods configured. Uncompressed 
+  ** pages take nPagesize bytes.  */
   if( pFS->nBuffer==0 ){
+    int i;
     assert( pFS->aIBuffer==0 && pFS->aOBuffer==0 );
     pFS->nBuffer = pFS->pCompress->xBound(pFS->pCompress->pCtx, pFS->nPagesize);
+    for(i=0; i<pFS->pDb->nAgeCompress; i++){
+      lsm_compress *p = &pFS->pDb->aAgeCompress[i].compress;
+      pFS->nBuffer = LSM_MAX(pFS->nBuffer, p->xBound(p->pCtx, pFS->nPagesize));
+    }
+    pFS->nBuffer = LSM_MAX(pFS->nBuffer, pFS->nPagesize);
     if( pFS->nBuffer<(pFS->szSector+6) ){
       pFS->nBuffer = pFS->szSector+6;
     }
@@ -4395,11 +6035,97 @@ static int fsAllocateBuffer(FileSystem *pFS, int bWrite){
   return LSM_OK;
 }
 
+/*
+** Record that nByte bytes were just read from offset iOff of the database
+** file. If this read continues one of the sequential scans tracked in 
+** FileSystem.aStream[], in either direction, and less than half of what
+** was read ahead of that scan is left, ask the environment to read ahead 
+** of it some more. Readahead stops at the end (or start) of the current 
+** block, as the block a segment continues on is only known once the last
+** page of this one is read. Otherwise, the read starts a new scan, which 
+** replaces the one that was started the longest time ago.
+**
+** As readahead is only a hint, errors are ignored.
+*/
+static void fsReadahead(FileSystem *pFS, i64 iOff, int nByte){
+  i64 nMax = (i64)pFS->pDb->nReadaheadKB * 1024;
+  i64 iEnd = iOff + nByte;
+  ReadStream *p = 0;
+  int i;
+
+  if( nMax<=0 ) return;
+
+  for(i=0; p==0 && i<LSM_READAHEAD_STREAMS; i++){
+    ReadStream *pStream = &pFS->aStream[i];
+    if( pStream->eDir>=0 
+     && iOff>=pStream->iLast && iOff-pStream->iLast<pFS->nPagesize 
+    ){
+      pStream->eDir = 1;
+      p = pStream;
+    }else if( pStream->eDir<=0 
+     && iEnd<=pStream->iFirst && pStream->iFirst-iEnd<pFS->nPagesize
+    ){
+      if( pStream->eDir==0 ) pStream->iAhead = iOff;
+      pStream->eDir = -1;
+      p = pStream;
+    }
+  }
+
+  if( p==0 ){
+    p = &pFS->aStream[pFS->iStreamNext];
+    pFS->iStreamNext = (pFS->iStreamNext + 1) % LSM_READAHEAD_STREAMS;
+    p->iFirst = iOff;
+    p->iLast = iEnd;
+    p->iAhead = iEnd;
+    p->nWindow = 4 * (i64)pFS->nPagesize;
+    p->eDir = 0;
+    return;
+  }
+
+  p->iFirst = iOff;
+  p->iLast = iEnd;
+  p->nWindow = LSM_MIN(p->nWindow, nMax);
+  if( p->eDir>0 ){
+    i64 iBlkEnd = ((iEnd-1) / pFS->nBlocksize + 1) * pFS->nBlocksize;
+    if( p->iAhead<iEnd ) p->iAhead = iEnd;
+    if( p->iAhead-iEnd<p->nWindow/2 ){
+      i64 iTo = LSM_MIN(p->iAhead + p->nWindow, iBlkEnd);
+      if( iTo>p->iAhead ){
+        lsmEnvAdvise(pFS->pEnv, pFS->fdDb, 
+            p->iAhead, iTo - p->iAhead, LSM_ADVISE_WILLNEED
+        );
+        pFS->nReadahead++;
+        p->iAhead = iTo;
+        p->nWindow = LSM_MIN(p->nWindow*2, nMax);
+      }
+    }
+  }else{
+    i64 iBlkStart = (iOff / pFS->nBlocksize) * pFS->nBlocksize;
+    if( p->iAhead>iOff ) p->iAhead = iOff;
+    if( iOff-p->iAhead<p->nWindow/2 ){
+      i64 iFrom = LSM_MAX(p->iAhead - p->nWindow, iBlkStart);
+      if( iFrom<p->iAhead ){
+        lsmEnvAdvise(pFS->pEnv, pFS->fdDb, 
+            iFrom, p->iAhead - iFrom, LSM_ADVISE_WILLNEED
+        );
+        pFS->nReadahead++;
+        p->iAhead = iFrom;
+        p->nWindow = LSM_MIN(p->nWindow*2, nMax);
+      }
+    }
+  }
+}
+
 /*
 ** This function is only called in compressed database mode. It reads and
 ** uncompresses the compressed data for page pPg from the database and
 ** populates the pPg->aData[] buffer and pPg->nCompress field.
 **
+** If the compressed page cache is enabled, the compressed data is taken
+** from it if possible. Otherwise, it is read from the database file and
+** added to the cache (unless the page was stored uncompressed). Either
+** way, the FileSystem.nRead counter is incremented.
+**
 ** It is possible that instead of a page record, there is free space
 ** at offset pPg->iPgno. In this case no data is read from the file, but
 ** output variable *pnSpace is set to the total number of free bytes.
@@ -4412,12 +6138,30 @@ static int fsReadPagedata(
   Page *pPg,                      /* Page to read and uncompress data for */
   int *pnSpace                    /* OUT: Total bytes of free space */
 ){
-  lsm_compress *p = pFS->pCompress;
+  lsm_compress *p = fsSegmentCompress(pFS, pSeg);
   i64 iOff = pPg->iPg;
   u8 aSz[3];
   int rc;
 
-  assert( p && pPg->nCompress==0 );
+  assert( pFS->pCompress && pPg->nCompress==0 );
+  if( p==0 ) return LSM_MISMATCH;
+
+  pFS->nRead++;
+  if( pFS->nCCacheMax>0 ){
+    CompressedPage *pCPg = fsCPageFind(pFS, iOff);
+    if( pCPg ){
+      int n = pFS->nPagesize;
+      pFS->nCHit++;
+      pPg->nCompress = pCPg->nData;
+      rc = p->xUncompress(p->pCtx, 
+          (char *)pPg->aData, &n, (const char *)pCPg->aData, pCPg->nData
+      );
+      if( rc==LSM_OK && n!=pFS->nPagesize ){
+        rc = LSM_CORRUPT_BKPT;
+      }
+      return rc;
+    }
+  }
 
   if( fsAllocateBuffer(pFS, 0) ) return LSM_NOMEM;
 
@@ -4425,8 +6169,9 @@ static int fsReadPagedata(
 
   if( rc==LSM_OK ){
     int bFree;
+    int bRaw = 0;
     if( aSz[0] & 0x80 ){
-      pPg->nCompress = (int)getRecordSize(aSz, &bFree);
+      pPg->nCompress = (int)getRecordSize(aSz, &bFree, &bRaw);
     }else{
       pPg->nCompress = (int)aSz[0] - sizeof(aSz)*2;
       bFree = 1;
@@ -4439,12 +6184,23 @@ static int fsReadPagedata(
       }
     }else{
       rc = fsAddOffset(pFS, pSeg, iOff, 3, &iOff);
-      if( rc==LSM_OK ){
+      if( rc==LSM_OK && bRaw ){
+        /* The page was stored uncompressed. Read it straight into place. */
+        if( pPg->nCompress!=pFS->nPagesize ){
+          rc = LSM_CORRUPT_BKPT;
+        }else{
+          rc = fsReadData(pFS, pSeg, iOff, pPg->aData, pPg->nCompress);
+        }
+      }else if( rc==LSM_OK ){
         if( pPg->nCompress>pFS->nBuffer ){
           rc = LSM_CORRUPT_BKPT;
         }else{
           rc = fsReadData(pFS, pSeg, iOff, pFS->aIBuffer, pPg->nCompress);
         }
+        if( rc==LSM_OK && pFS->nCCacheMax>0 ){
+          pFS->nCMiss++;
+          fsCPageAdd(pFS, pPg->iPg, pFS->aIBuffer, pPg->nCompress);
+        }
         if( rc==LSM_OK ){
           int n = pFS->nPagesize;
           rc = p->xUncompress(p->pCtx, 
@@ -4458,6 +6214,10 @@ static int fsReadPagedata(
       }
     }
   }
+
+  if( rc==LSM_OK ){
+    fsReadahead(pFS, pPg->iPg, pPg->nCompress + sizeof(aSz)*2);
+  }
   return rc;
 }
 
@@ -4546,8 +6306,9 @@ static int fsPageGet(
             int nByte = pFS->nPagesize;
             i64 iOff = (i64)(iReal-1) * pFS->nPagesize;
             rc = lsmEnvRead(pFS->pEnv, pFS->fdDb, iOff, p->aData, nByte);
+            pFS->nRead++;
+            if( rc==LSM_OK ) fsReadahead(pFS, iOff, nByte);
           }
-          pFS->nRead++;
         }
 
         /* If the xRead() call was successful (or not attempted), link the
@@ -4897,7 +6658,7 @@ static int fsGetPageBefore(
     int bFree;
     int nSz;
     if( aSz[2] & 0x80 ){
-      nSz = getRecordSize(aSz, &bFree) + sizeof(aSz)*2;
+      nSz = getRecordSize(aSz, &bFree, 0) + sizeof(aSz)*2;
     }else{
       nSz = (int)(aSz[2] & 0x7F);
       bFree = 1;
@@ -5056,6 +6817,10 @@ static int lsmFsSortedAppend(
     if( rc==LSM_OK ){
       pPg->pFS = pFS;
       pPg->pSeg = p;
+      pPg->pCompress = 0;
+      if( pFS->pCompress ){
+        pPg->pCompress = fsAppendCompress(pFS, p, pLvl->iAge);
+      }
       pPg->iPg = 0;
       pPg->flags |= PAGE_DIRTY;
       pPg->nData = pFS->nPagesize;
@@ -5392,6 +7157,60 @@ static int lsmFsMoveBlock(FileSystem *pFS, Segment *pSeg, int iTo, int iFrom){
   return rc;
 }
 
+/*
+** Start writing back the range of the database file written to since this
+** was last called (see LSM_CONFIG_WRITEBACK). If LSM_CONFIG_DROP_BEHIND is
+** set, first wait for the writeback of the range before it to complete, and
+** drop that one from the cache of the operating system.
+*/
+static int fsWritebackStart(FileSystem *pFS){
+  int rc = LSM_OK;
+  i64 iFirst = pFS->iWbFirst;
+  i64 iLast = pFS->iWbLast;
+
+  if( iLast>iFirst ){
+    rc = lsmEnvSyncRange(pFS->pEnv, pFS->fdDb, iFirst, iLast-iFirst, 0);
+    if( rc==LSM_OK && pFS->pDb->bDropBehind ){
+      i64 iDropFirst = pFS->iDropFirst;
+      i64 iDropLast = pFS->iDropLast;
+      if( iDropLast>iDropFirst ){
+        rc = lsmEnvSyncRange(pFS->pEnv, pFS->fdDb, 
+            iDropFirst, iDropLast-iDropFirst, 1
+        );
+        if( rc==LSM_OK ) fsDropBehind(pFS, iDropFirst, iDropLast);
+      }
+      pFS->iDropFirst = iFirst;
+      pFS->iDropLast = iLast;
+    }
+  }
+
+  pFS->iWbFirst = pFS->iWbLast = 0;
+  return rc;
+}
+
+/*
+** Write nData bytes from buffer aData[] to offset iOff of the database file.
+** If LSM_CONFIG_WRITEBACK is set, the write is added to the range of the
+** file to write back next, which is started being written back once it is
+** large enough, or if this write is not contiguous with it.
+*/
+static int fsWriteDb(FileSystem *pFS, i64 iOff, const u8 *aData, int nData){
+  int rc = lsmEnvWrite(pFS->pEnv, pFS->fdDb, iOff, aData, nData);
+  i64 nMax = (i64)pFS->pDb->nWritebackKB * 1024;
+
+  if( rc==LSM_OK && nMax>0 ){
+    if( iOff!=pFS->iWbLast ){
+      rc = fsWritebackStart(pFS);
+      pFS->iWbFirst = iOff;
+    }
+    pFS->iWbLast = iOff + nData;
+    if( rc==LSM_OK && pFS->iWbLast-pFS->iWbFirst>=nMax ){
+      rc = fsWritebackStart(pFS);
+    }
+  }
+  return rc;
+}
+
 /*
 ** Append raw data to a segment. Return the database file offset that the
 ** data is written to (this may be used as the page number if the data
@@ -5435,7 +7254,7 @@ static LsmPgno fsAppendData(
       nRem = nData - nWrite;
       assert( nWrite>=0 );
       if( nWrite!=0 ){
-        rc = lsmEnvWrite(pFS->pEnv, pFS->fdDb, iApp, aData, nWrite);
+        rc = fsWriteDb(pFS, iApp, aData, nWrite);
       }
       iApp += nWrite;
     }
@@ -5456,7 +7275,7 @@ static LsmPgno fsAppendData(
         if( rc==LSM_OK ){
           assert( iApp==(fsPageToBlock(pFS, iApp)*pFS->nBlocksize)-4 );
           lsmPutU32(aPtr, iBlk);
-          rc = lsmEnvWrite(pFS->pEnv, pFS->fdDb, iApp, aPtr, sizeof(aPtr));
+          rc = fsWriteDb(pFS, iApp, aPtr, sizeof(aPtr));
         }
 
         /* Set the "prev" pointer on the new block */
@@ -5464,7 +7283,7 @@ static LsmPgno fsAppendData(
           LsmPgno iWrite;
           lsmPutU32(aPtr, fsPageToBlock(pFS, iApp));
           iWrite = fsFirstPageOnBlock(pFS, iBlk);
-          rc = lsmEnvWrite(pFS->pEnv, pFS->fdDb, iWrite-4, aPtr, sizeof(aPtr));
+          rc = fsWriteDb(pFS, iWrite-4, aPtr, sizeof(aPtr));
           if( nRem>0 ) iApp = iWrite;
         }
       }else{
@@ -5477,7 +7296,7 @@ static LsmPgno fsAppendData(
 
       /* Write the remaining data into the new block */
       if( rc==LSM_OK && nRem>0 ){
-        rc = lsmEnvWrite(pFS->pEnv, pFS->fdDb, iApp, &aData[nWrite], nRem);
+        rc = fsWriteDb(pFS, iApp, &aData[nWrite], nRem);
         iApp += nRem;
       }
     }
@@ -5490,44 +7309,299 @@ static LsmPgno fsAppendData(
 }
 
 /*
-** This function is only called in compressed database mode. It 
-** compresses the contents of page pPg and writes the result to the 
-** buffer at pFS->aOBuffer. The size of the compressed data is stored in
-** pPg->nCompress.
-**
-** If buffer pFS->aOBuffer[] has not been allocated then this function
-** allocates it. If this fails, LSM_NOMEM is returned. Otherwise, LSM_OK.
+** Compress the page image of job pJob into its output buffer.
 */
-static int fsCompressIntoBuffer(FileSystem *pFS, Page *pPg){
-  lsm_compress *p = pFS->pCompress;
-
-  if( fsAllocateBuffer(pFS, 1) ) return LSM_NOMEM;
-  assert( pPg->nData==pFS->nPagesize );
-
-  pPg->nCompress = pFS->nBuffer;
-  return p->xCompress(p->pCtx, 
-      (char *)pFS->aOBuffer, &pPg->nCompress, 
-      (const char *)pPg->aData, pPg->nData
+static void fsCompressJobRun(CompressJob *pJob){
+  lsm_compress *p = pJob->p;
+  pJob->rc = p->xCompress(p->pCtx, 
+      (char *)pJob->aOut, &pJob->nOut, (const char *)pJob->aIn, pJob->nIn
   );
 }
 
 /*
-** Append a new page to segment pSeg. Set output variable *piNew to the
-** page number of the new page before returning.
-**
-** If the new page is the last on its block, then the 'next' block that
-** will be used by the segment is allocated here too. In this case output
-** variable *piNext is set to the block number of the next block.
-**
-** If the new page is the first on its block but not the first in the
-** entire segment, set output variable *piPrev to the block number of
-** the previous block in the segment.
-**
-** LSM_OK is returned if successful, or an lsm error code otherwise. If
-** any value other than LSM_OK is returned, then the final value of all
-** output variables is undefined.
+** The main routine of each thread of a CompressPool. Compress the pages of
+** queued jobs, oldest first, until the pool is shut down.
 */
-static int fsAppendPage(
+static void fsCompressMain(void *pCtx){
+  CompressPool *pPool = (CompressPool *)pCtx;
+  lsm_env *pEnv = pPool->pEnv;
+
+  lsmMutexEnter(pEnv, pPool->pMutex);
+  while( pPool->bShutdown==0 ){
+    CompressJob *pJob = pPool->pFirst;
+    if( pJob==0 ){
+      pPool->nWorkWait++;
+      lsmCondWait(pEnv, pPool->pWork, pPool->pMutex);
+      pPool->nWorkWait--;
+    }else{
+      pPool->pFirst = pJob->pNext;
+      if( pPool->pFirst==0 ) pPool->pLast = 0;
+      pJob->eState = COMPRESS_JOB_RUNNING;
+      lsmMutexLeave(pEnv, pPool->pMutex);
+      fsCompressJobRun(pJob);
+      lsmMutexEnter(pEnv, pPool->pMutex);
+      pJob->eState = COMPRESS_JOB_DONE;
+      if( pPool->nDoneWait ) lsmCondBroadcast(pEnv, pPool->pDone);
+    }
+  }
+  lsmMutexLeave(pEnv, pPool->pMutex);
+}
+
+/*
+** Stop the threads of the CompressPool of FileSystem pFS, if any, and free
+** it. No pages may be waiting to be compressed by them.
+*/
+static void fsCompressPoolFree(FileSystem *pFS){
+  CompressPool *pPool = pFS->pPool;
+  if( pPool ){
+    lsm_env *pEnv = pFS->pEnv;
+    int i;
+
+    assert( pPool->nJob==0 && pPool->pFirst==0 );
+    if( pPool->nThread>0 ){
+      lsmMutexEnter(pEnv, pPool->pMutex);
+      pPool->bShutdown = 1;
+      lsmCondBroadcast(pEnv, pPool->pWork);
+      lsmMutexLeave(pEnv, pPool->pMutex);
+    }
+    for(i=0; i<pPool->nThread; i++){
+      lsmThreadJoin(pEnv, pPool->apThread[i]);
+    }
+
+    while( pPool->pFree ){
+      CompressJob *pNext = pPool->pFree->pNext;
+      lsmFree(pEnv, pPool->pFree);
+      pPool->pFree = pNext;
+    }
+    lsmCondDel(pEnv, pPool->pWork);
+    lsmCondDel(pEnv, pPool->pDone);
+    lsmMutexDel(pEnv, pPool->pMutex);
+    lsmFree(pEnv, pPool);
+    pFS->pPool = 0;
+  }
+}
+
+/*
+** Make sure the CompressPool of FileSystem pFS has as many threads as
+** configured using LSM_CONFIG_COMPRESS_THREADS, and return this number.
+** Zero is returned if the database is not compressed, if no threads are
+** configured, or if they cannot be started (for example because the
+** environment does not support threads). Pages are then compressed by
+** lsmFsPagePersist() as usual, so this is not an error. The threads are
+** not replaced while pages are waiting to be compressed by them.
+**
+** No threads are used once the database has a compression dictionary 
+** either. The compression hook looks the dictionary up through the 
+** database handle (see lsm_dictionary_read()), which reads the database
+** file and so may only be done by the thread working on the database.
+*/
+static int lsmFsCompressThreads(FileSystem *pFS){
+  lsm_env *pEnv = pFS->pEnv;
+  CompressPool *pPool = pFS->pPool;
+  Snapshot *pWorker = pFS->pDb->pWorker;
+  int nThread = (pFS->pCompress ? pFS->pDb->nCompressThread : 0);
+
+  if( pWorker==0 || pWorker->iDictId ) nThread = 0;
+
+  if( pPool && (pPool->nJob>0 || pPool->nThread==nThread) ){
+    return pPool->nThread;
+  }
+  fsCompressPoolFree(pFS);
+
+  if( nThread>0 && fsAllocateBuffer(pFS, 1)==LSM_OK ){
+    int rc = LSM_OK;
+    int i;
+
+    pPool = (CompressPool *)lsmMallocZeroRc(pEnv, 
+        sizeof(CompressPool) + sizeof(lsm_thread *)*nThread, &rc
+    );
+    if( rc==LSM_OK ){
+      pFS->pPool = pPool;
+      pPool->pEnv = pEnv;
+      pPool->apThread = (lsm_thread **)&pPool[1];
+      rc = lsmMutexNew(pEnv, &pPool->pMutex);
+    }
+    if( rc==LSM_OK ) rc = lsmCondNew(pEnv, &pPool->pWork);
+    if( rc==LSM_OK ) rc = lsmCondNew(pEnv, &pPool->pDone);
+    for(i=0; rc==LSM_OK && i<nThread; i++){
+      rc = lsmThreadNew(pEnv, fsCompressMain, (void *)pPool, &pPool->apThread[i]);
+      if( rc==LSM_OK ) pPool->nThread++;
+    }
+    if( rc!=LSM_OK ) fsCompressPoolFree(pFS);
+  }
+
+  return (pFS->pPool ? pFS->pPool->nThread : 0);
+}
+
+/*
+** Page pPg of a compressed database is complete. It is passed to
+** lsmFsPagePersist() once some more pages of the same sorted run have 
+** been built. If FileSystem pFS has a CompressPool, queue the page to be
+** compressed by one of its threads in the meantime. The page image may not
+** be modified after this function is called. If the page cannot be queued,
+** lsmFsPagePersist() compresses it as usual.
+*/
+static void lsmFsPageCompress(Page *pPg){
+  FileSystem *pFS = pPg->pFS;
+  CompressPool *pPool = pFS->pPool;
+
+  if( pPool && (pPg->flags & PAGE_DIRTY) && pPg->pJob==0 ){
+    lsm_compress *p = pPg->pCompress;
+    CompressJob *pJob = pPool->pFree;
+
+    if( p==0 ) p = fsSegmentCompress(pFS, pPg->pSeg);
+    if( p==0 ) return;
+    if( pJob ){
+      pPool->pFree = pJob->pNext;
+    }else{
+      pJob = (CompressJob *)lsmMallocZero(
+          pFS->pEnv, sizeof(CompressJob) + pFS->nBuffer
+      );
+      if( pJob==0 ) return;
+      pJob->aOut = (u8 *)&pJob[1];
+    }
+
+    assert( pPg->nData==pFS->nPagesize );
+    pJob->aIn = pPg->aData;
+    pJob->nIn = pPg->nData;
+    pJob->p = p;
+    pJob->nOut = pFS->nBuffer;
+    pJob->eState = COMPRESS_JOB_QUEUED;
+    pJob->pNext = 0;
+    pPg->pJob = pJob;
+    pPool->nJob++;
+
+    lsmMutexEnter(pFS->pEnv, pPool->pMutex);
+    if( pPool->pLast ){
+      pPool->pLast->pNext = pJob;
+    }else{
+      pPool->pFirst = pJob;
+    }
+    pPool->pLast = pJob;
+    if( pPool->nWorkWait ) lsmCondBroadcast(pFS->pEnv, pPool->pWork);
+    lsmMutexLeave(pFS->pEnv, pPool->pMutex);
+  }
+}
+
+/*
+** Wait until the page of job pJob has been compressed and return the
+** return code of xCompress(). If no thread has picked the job up yet, it
+** is removed from the queue and the page compressed by the caller instead.
+*/
+static int fsCompressWait(FileSystem *pFS, CompressJob *pJob){
+  CompressPool *pPool = pFS->pPool;
+  lsm_env *pEnv = pFS->pEnv;
+  int bRun = 0;
+
+  lsmMutexEnter(pEnv, pPool->pMutex);
+  if( pJob->eState==COMPRESS_JOB_QUEUED ){
+    CompressJob *pPrev = 0;
+    CompressJob *p;
+    for(p=pPool->pFirst; p!=pJob; p=p->pNext) pPrev = p;
+    if( pPrev ){
+      pPrev->pNext = pJob->pNext;
+    }else{
+      pPool->pFirst = pJob->pNext;
+    }
+    if( pPool->pLast==pJob ) pPool->pLast = pPrev;
+    bRun = 1;
+  }else{
+    while( pJob->eState!=COMPRESS_JOB_DONE ){
+      pPool->nDoneWait++;
+      lsmCondWait(pEnv, pPool->pDone, pPool->pMutex);
+      pPool->nDoneWait--;
+    }
+  }
+  lsmMutexLeave(pEnv, pPool->pMutex);
+
+  if( bRun ) fsCompressJobRun(pJob);
+  return pJob->rc;
+}
+
+/*
+** Return the CompressJob of page pPg to the free list of the CompressPool.
+*/
+static void fsCompressJobFree(FileSystem *pFS, Page *pPg){
+  CompressPool *pPool = pFS->pPool;
+  CompressJob *pJob = pPg->pJob;
+
+  pJob->pNext = pPool->pFree;
+  pPool->pFree = pJob;
+  pPool->nJob--;
+  pPg->pJob = 0;
+}
+
+/*
+** This function is only called in compressed database mode. It 
+** compresses the contents of page pPg and writes the result to the 
+** buffer at pFS->aOBuffer. Or, if the page was handed to a thread by
+** lsmFsPageCompress(), waits for the thread to compress it into the buffer
+** of its CompressJob. Either way, *paOut is set to point to the buffer and
+** the size of the compressed data is stored in pPg->nCompress.
+**
+** If compressing the page does not shrink it by the fraction configured
+** using LSM_CONFIG_MIN_COMPRESS_SAVING, *pbRaw is set to true and
+** pPg->nCompress to the page size. In this case the page image itself
+** should be written instead of the contents of the buffer.
+**
+** If buffer pFS->aOBuffer[] has not been allocated then this function
+** allocates it. If this fails, LSM_NOMEM is returned. Otherwise, LSM_OK.
+*/
+static int fsCompressIntoBuffer(
+  FileSystem *pFS,                /* File system */
+  Page *pPg,                      /* Page to compress */
+  int *pbRaw,                     /* OUT: True to store the page as is */
+  u8 **paOut                      /* OUT: Buffer holding compressed page */
+){
+  int nMax;                       /* Largest compressed size worth keeping */
+  int rc;
+
+  *pbRaw = 0;
+  *paOut = pFS->aOBuffer;
+  if( pPg->pJob ){
+    rc = fsCompressWait(pFS, pPg->pJob);
+    pPg->nCompress = pPg->pJob->nOut;
+    *paOut = pPg->pJob->aOut;
+  }else{
+    lsm_compress *p = pPg->pCompress;
+    if( p==0 ) p = fsSegmentCompress(pFS, pPg->pSeg);
+    if( p==0 ) return LSM_MISMATCH;
+    if( fsAllocateBuffer(pFS, 1) ) return LSM_NOMEM;
+    assert( pPg->nData==pFS->nPagesize );
+
+    pPg->nCompress = pFS->nBuffer;
+    rc = p->xCompress(p->pCtx, 
+        (char *)pFS->aOBuffer, &pPg->nCompress, 
+        (const char *)pPg->aData, pPg->nData
+    );
+    *paOut = pFS->aOBuffer;
+  }
+
+  nMax = pPg->nData - 1 - (int)(((i64)pPg->nData*pFS->pDb->nMinCompressSaving)/100);
+  if( rc==LSM_OK && pPg->nCompress>nMax && pFS->pDb->bRawPages ){
+    *pbRaw = 1;
+    pPg->nCompress = pPg->nData;
+  }
+  return rc;
+}
+
+/*
+** Append a new page to segment pSeg. Set output variable *piNew to the
+** page number of the new page before returning.
+**
+** If the new page is the last on its block, then the 'next' block that
+** will be used by the segment is allocated here too. In this case output
+** variable *piNext is set to the block number of the next block.
+**
+** If the new page is the first on its block but not the first in the
+** entire segment, set output variable *piPrev to the block number of
+** the previous block in the segment.
+**
+** LSM_OK is returned if successful, or an lsm error code otherwise. If
+** any value other than LSM_OK is returned, then the final value of all
+** output variables is undefined.
+*/
+static int fsAppendPage(
   FileSystem *pFS, 
   Segment *pSeg,
   LsmPgno *piNew,
@@ -5624,20 +7698,30 @@ static int lsmFsPagePersist(Page *pPg){
     if( pFS->pCompress ){
       int iHash;                  /* Hash key of assigned page number */
       u8 aSz[3];                  /* pPg->nCompress as a 24-bit big-endian */
+      int bRaw;                   /* True to store the page uncompressed */
+      u8 *aOut;                   /* Buffer holding compressed page */
       assert( pPg->pSeg && pPg->iPg==0 && pPg->nCompress==0 );
 
-      /* Compress the page image. */
-      rc = fsCompressIntoBuffer(pFS, pPg);
+      /* Compress the page image (or wait for a thread to) */
+      rc = fsCompressIntoBuffer(pFS, pPg, &bRaw, &aOut);
 
       /* Serialize the compressed size into buffer aSz[] */
-      putRecordSize(aSz, pPg->nCompress, 0);
+      putRecordSize(aSz, pPg->nCompress, 0, bRaw);
 
       /* Write the serialized page record into the database file. */
       pPg->iPg = fsAppendData(pFS, pPg->pSeg, aSz, sizeof(aSz), &rc);
-      fsAppendData(pFS, pPg->pSeg, pFS->aOBuffer, pPg->nCompress, &rc);
+      fsAppendData(pFS, pPg->pSeg, 
+          (bRaw ? pPg->aData : aOut), pPg->nCompress, &rc
+      );
       fsAppendData(pFS, pPg->pSeg, aSz, sizeof(aSz), &rc);
+      if( pPg->pJob ) fsCompressJobFree(pFS, pPg);
 
-      /* Now that it has a page number, insert the page into the hash table */
+      /* Now that it has a page number, insert the page into the hash table.
+      ** Any record previously cached at this offset is stale.  */
+      if( pFS->apCHash ){
+        CompressedPage *pCPg = fsCPageFind(pFS, pPg->iPg);
+        if( pCPg ) fsCPageFree(pFS, pCPg);
+      }
       iHash = fsHashKey(pFS->nHash, pPg->iPg);
       pPg->pHashNext = pFS->apHash[iHash];
       pFS->apHash[iHash] = pPg;
@@ -5646,6 +7730,7 @@ static int lsmFsPagePersist(Page *pPg){
 
       pPg->flags &= ~PAGE_DIRTY;
       pFS->nWrite++;
+      if( bRaw ) pFS->nWriteRaw++;
     }else{
 
       if( pPg->iPg==0 ){
@@ -5702,7 +7787,7 @@ static int lsmFsPagePersist(Page *pPg){
         iOff = (i64)pFS->nPagesize * (i64)(pPg->iPg-1);
         if( fsMmapPage(pFS, pPg->iPg)==0 ){
           u8 *aData = pPg->aData - (pPg->flags & PAGE_HASPREV);
-          rc = lsmEnvWrite(pFS->pEnv, pFS->fdDb, iOff, aData, pFS->nPagesize);
+          rc = fsWriteDb(pFS, iOff, aData, pFS->nPagesize);
         }else if( pPg->flags & PAGE_FREE ){
           fsGrowMapping(pFS, iOff + pFS->nPagesize, &rc);
           if( rc==LSM_OK ){
@@ -5763,7 +7848,7 @@ static int lsmFsSortedPadding(
     if( nPad>=6 ){
       pSeg->nSize += nPad;
       nPad -= 6;
-      putRecordSize(aSz, nPad, 1);
+      putRecordSize(aSz, nPad, 1, 0);
       fsAppendData(pFS, pSeg, aSz, sizeof(aSz), &rc);
       memset(pFS->aOBuffer, 0, nPad);
       fsAppendData(pFS, pSeg, pFS->aOBuffer, nPad, &rc);
@@ -5844,6 +7929,27 @@ static int lsmFsNRead(FileSystem *pFS){ return pFS->nRead; }
 */
 static int lsmFsNWrite(FileSystem *pFS){ return pFS->nWrite; }
 
+/*
+** Return the number of pages written that were stored uncompressed.
+*/
+static int lsmFsNWriteRaw(FileSystem *pFS){ return pFS->nWriteRaw; }
+
+/*
+** Return the number of pages found in the compressed page cache.
+*/
+static int lsmFsNCompressedHit(FileSystem *pFS){ return pFS->nCHit; }
+
+/*
+** Return the number of compressed pages read from the database file while
+** the compressed page cache was enabled.
+*/
+static int lsmFsNCompressedMiss(FileSystem *pFS){ return pFS->nCMiss; }
+
+/*
+** Return the number of times the file-system read ahead of a sequential scan.
+*/
+static int lsmFsNReadahead(FileSystem *pFS){ return pFS->nReadahead; }
+
 /*
 ** Return a copy of the environment pointer used by the file-system object.
 */
@@ -6217,6 +8323,12 @@ static int lsmFsIntegrityCheck(lsm_db *pDb){
     }
   }
 
+  /* The block holding the compression dictionary (if any) is in use */
+  if( pWorker->iDictBlk ){
+    assert( pWorker->iDictBlk<=nBlock );
+    aUsed[pWorker->iDictBlk-1] |= INTEGRITY_CHECK_USED;
+  }
+
   /* Mark all blocks in the free-list as used */
   ctx.aUsed = aUsed;
   ctx.nBlock = nBlock;
@@ -6410,6 +8522,11 @@ static int lsmFsDbPageIsLast(Segment *pSeg, Page *pPg){
 **               * If the first byte was 0x09, an 8 byte checksum.
 **               * The key data.
 **
+**   LOG_MERGE:  Same as LOG_WRITE, except that the first byte is 0x0C or
+**               0x0D and that the value is a merge operand. It already 
+**               contains any operands written to the in-memory tree before
+**               it, so it is inserted as is when the log is replayed.
+**
 **   Varints are as described in lsm_varint.c (SQLite 4 format).
 **
 ** CHECKSUMS:
@@ -6457,6 +8574,9 @@ static int lsmFsDbPageIsLast(Segment *pSeg, Page *pPg){
 #define LSM_LOG_DRANGE       0x0A
 #define LSM_LOG_DRANGE_CKSUM 0x0B
 
+#define LSM_LOG_MERGE        0x0C
+#define LSM_LOG_MERGE_CKSUM  0x0D
+
 /* Require a checksum every 32KB. */
 #define LSM_CKSUM_MAXDATA (32*1024)
 
@@ -6918,10 +9038,13 @@ static int lsmLogWrite(
   int nReq;                       /* Bytes of space required in log */
   int bCksum = 0;                 /* True to embed a checksum in this record */
 
-  assert( eType==LSM_WRITE || eType==LSM_DELETE || eType==LSM_DRANGE );
+  assert( eType==LSM_WRITE || eType==LSM_DELETE || eType==LSM_DRANGE 
+       || eType==LSM_MERGE
+  );
   assert( LSM_LOG_WRITE==LSM_WRITE );
   assert( LSM_LOG_DELETE==LSM_DELETE );
   assert( LSM_LOG_DRANGE==LSM_DRANGE );
+  assert( LSM_LOG_MERGE==LSM_MERGE );
   assert( (eType==LSM_LOG_DELETE)==(nVal<0) );
 
   if( pDb->bUseLog==0 ) return LSM_OK;
@@ -6951,6 +9074,7 @@ static int lsmLogWrite(
     assert( LSM_LOG_WRITE_CKSUM == (LSM_LOG_WRITE | 0x0001) );
     assert( LSM_LOG_DELETE_CKSUM == (LSM_LOG_DELETE | 0x0001) );
     assert( LSM_LOG_DRANGE_CKSUM == (LSM_LOG_DRANGE | 0x0001) );
+    assert( LSM_LOG_MERGE_CKSUM == (LSM_LOG_MERGE | 0x0001) );
     *(a++) = (u8)eType | (u8)bCksum;
     a += lsmVarintPut32(a, nKey);
     if( eType!=LSM_LOG_DELETE ) a += lsmVarintPut32(a, nVal);
@@ -7271,6 +9395,8 @@ static int lsmLogRecover(lsm_db *pDb){
 
           case LSM_LOG_DRANGE:
           case LSM_LOG_DRANGE_CKSUM:
+          case LSM_LOG_MERGE:
+          case LSM_LOG_MERGE_CKSUM:
           case LSM_LOG_WRITE:
           case LSM_LOG_WRITE_CKSUM: {
             int nKey;
@@ -7279,7 +9405,9 @@ static int lsmLogRecover(lsm_db *pDb){
             logReaderVarint(&reader, &buf1, &nKey, &rc);
             logReaderVarint(&reader, &buf2, &nVal, &rc);
 
-            if( eType==LSM_LOG_WRITE_CKSUM || eType==LSM_LOG_DRANGE_CKSUM ){
+            if( eType==LSM_LOG_WRITE_CKSUM || eType==LSM_LOG_DRANGE_CKSUM 
+             || eType==LSM_LOG_MERGE_CKSUM
+            ){
               logReaderCksum(&reader, &buf1, &bEof, &rc);
             }else{
               bEof = logRequireCksum(&reader, nKey+nVal);
@@ -7291,6 +9419,8 @@ static int lsmLogRecover(lsm_db *pDb){
             if( iPass==1 && rc==LSM_OK ){ 
               if( eType==LSM_LOG_WRITE || eType==LSM_LOG_WRITE_CKSUM ){
                 rc = lsmTreeInsert(pDb, (u8 *)buf1.z, nKey, aVal, nVal);
+              }else if( eType==LSM_LOG_MERGE || eType==LSM_LOG_MERGE_CKSUM ){
+                rc = lsmTreeInsertOperand(pDb, (u8 *)buf1.z, nKey, aVal, nVal);
               }else{
                 rc = lsmTreeDelete(pDb, (u8 *)buf1.z, nKey, aVal, nVal);
               }
@@ -7449,7 +9579,8 @@ static void assert_db_state(lsm_db *pDb){
   ** - if there are no open cursors and no write transactions then there must 
   ** not be a client snapshot.  */
   
-  assert( (pDb->pCsr!=0||pDb->nTransOpen>0)==(pDb->iReader>=0||pDb->bRoTrans) );
+  assert( (pDb->pCsr!=0||pDb->nTransOpen>0||pDb->pBulk!=0)
+       ==(pDb->iReader>=0||pDb->bRoTrans) );
 
   assert( (pDb->iReader<0 && pDb->bRoTrans==0) || pDb->pClient!=0 );
 
@@ -7469,6 +9600,47 @@ static int xCmp(void *p1, int n1, void *p2, int n2){
   return res;
 }
 
+/*
+** Load the 8 byte big-endian integer stored at p. With GCC and Clang on
+** little-endian hosts, this is a single (unaligned) load and a byte swap.
+*/
+#if defined(__GNUC__) && defined(__BYTE_ORDER__) \
+ && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+static u64 keyGetU64(void *p){
+  u64 i;
+  memcpy(&i, p, sizeof(i));
+  return __builtin_bswap64(i);
+}
+#else
+# define keyGetU64(p) lsmGetU64((u8 *)(p))
+#endif
+
+/*
+** The key comparison functions of LSM_KEY_FORMAT_U64 and U128. Keys of the
+** size of the format are compared as big-endian integers, which orders them
+** exactly as xCmp() does. Other keys are passed to xCmp().
+*/
+static int xCmpU64(void *p1, int n1, void *p2, int n2){
+  if( n1==8 && n2==8 ){
+    u64 i1 = keyGetU64(p1);
+    u64 i2 = keyGetU64(p2);
+    return (i1>i2) - (i1<i2);
+  }
+  return xCmp(p1, n1, p2, n2);
+}
+static int xCmpU128(void *p1, int n1, void *p2, int n2){
+  if( n1==16 && n2==16 ){
+    u64 i1 = keyGetU64(p1);
+    u64 i2 = keyGetU64(p2);
+    if( i1==i2 ){
+      i1 = keyGetU64(&((u8 *)p1)[8]);
+      i2 = keyGetU64(&((u8 *)p2)[8]);
+    }
+    return (i1>i2) - (i1<i2);
+  }
+  return xCmp(p1, n1, p2, n2);
+}
+
 static void xLog(void *pCtx, int rc, const char *z){
   (void)(rc);
   (void)(pCtx);
@@ -7500,12 +9672,27 @@ int lsm_new(lsm_env *pEnv, lsm_db **ppDb){
   pDb->nDfltPgsz = LSM_DFLT_PAGE_SIZE;
   pDb->nDfltBlksz = LSM_DFLT_BLOCK_SIZE;
   pDb->nMerge = LSM_DFLT_AUTOMERGE;
+  pDb->eCompaction = LSM_DFLT_COMPACTION;
+  pDb->nSizeRatio = LSM_DFLT_SIZE_RATIO;
+  pDb->nTombstoneRatio = LSM_DFLT_TOMBSTONE_RATIO;
+  pDb->nMinCompressSaving = LSM_DFLT_MIN_COMPRESS_SAVING;
+  pDb->bRawPages = LSM_DFLT_RAW_PAGES;
   pDb->nMaxFreelist = LSM_MAX_FREELIST_ENTRIES;
   pDb->bUseLog = LSM_DFLT_USE_LOG;
   pDb->iReader = -1;
   pDb->iRwclient = -1;
   pDb->bMultiProc = LSM_DFLT_MULTIPLE_PROCESSES;
   pDb->iMmap = LSM_DFLT_MMAP;
+  pDb->eMmapAdvice = LSM_DFLT_MMAP_ADVICE;
+  pDb->nCacheKB = LSM_DFLT_CACHE_SIZE;
+  pDb->nCompressedCacheKB = LSM_DFLT_COMPRESSED_CACHE_SIZE;
+  pDb->nReadaheadKB = LSM_DFLT_READAHEAD;
+  pDb->nWritebackKB = LSM_DFLT_WRITEBACK;
+  pDb->bDropBehind = LSM_DFLT_DROP_BEHIND;
+  pDb->nPreallocKB = LSM_DFLT_PREALLOCATE;
+  pDb->bPunchHoles = LSM_DFLT_PUNCH_HOLES;
+  pDb->bPrefixKeys = LSM_DFLT_PREFIX_KEYS;
+  pDb->nCompressThread = LSM_DFLT_COMPRESS_THREADS;
   pDb->xLog = xLog;
   pDb->compress.iId = LSM_COMPRESSION_NONE;
   return LSM_OK;
@@ -7621,9 +9808,10 @@ int lsm_open(lsm_db *pDb, const char *zFilename){
 
 int lsm_close(lsm_db *pDb){
   int rc = LSM_OK;
+  int i;
   if( pDb ){
     assert_db_state(pDb);
-    if( pDb->pCsr || pDb->nTransOpen ){
+    if( pDb->pCsr || pDb->nTransOpen || pDb->pBulk ){
       rc = LSM_MISUSE_BKPT;
     }else{
       lsmMCursorFreeCache(pDb);
@@ -7633,6 +9821,7 @@ int lsm_close(lsm_db *pDb){
       assertRwclientLockValue(pDb);
 
       lsmDbDatabaseRelease(pDb);
+      lsmSortedFreeBounds(pDb);
       lsmLogClose(pDb);
       lsmFsClose(pDb->pFS);
       /* assert( pDb->mLock==0 ); */
@@ -7641,6 +9830,10 @@ int lsm_close(lsm_db *pDb){
       ** compression factory callbacks.  */
       if( pDb->factory.xFree ) pDb->factory.xFree(pDb->factory.pCtx);
       if( pDb->compress.xFree ) pDb->compress.xFree(pDb->compress.pCtx);
+      for(i=0; i<pDb->nAgeCompress; i++){
+        lsm_compress *p = &pDb->aAgeCompress[i].compress;
+        if( p->xFree ) p->xFree(p->pCtx);
+      }
 
       lsmFree(pDb->pEnv, pDb->rollback.aArray);
       lsmFree(pDb->pEnv, pDb->aTrans);
@@ -7746,6 +9939,114 @@ int lsm_config(lsm_db *pDb, int eParam, ...){
       break;
     }
 
+    case LSM_CONFIG_MMAP_ADVICE: {
+      int *piVal = va_arg(ap, int *);
+      if( pDb->iReader<0 
+       && *piVal>=LSM_ADVISE_NORMAL && *piVal<=LSM_ADVISE_WILLNEED 
+      ){
+        pDb->eMmapAdvice = *piVal;
+        rc = lsmFsConfigure(pDb);
+      }
+      *piVal = pDb->eMmapAdvice;
+      break;
+    }
+
+    case LSM_CONFIG_CACHE_SIZE: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=64 ){
+        pDb->nCacheKB = *piVal;
+        if( pDb->pFS ) lsmFsSetCacheSize(pDb->pFS, pDb->nCacheKB);
+      }
+      *piVal = pDb->nCacheKB;
+      break;
+    }
+
+    case LSM_CONFIG_COMPRESSED_CACHE_SIZE: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ){
+        pDb->nCompressedCacheKB = *piVal;
+        if( pDb->pFS ){
+          lsmFsSetCompressedCacheSize(pDb->pFS, pDb->nCompressedCacheKB);
+        }
+      }
+      *piVal = pDb->nCompressedCacheKB;
+      break;
+    }
+
+    case LSM_CONFIG_READAHEAD: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ) pDb->nReadaheadKB = *piVal;
+      *piVal = pDb->nReadaheadKB;
+      break;
+    }
+
+    case LSM_CONFIG_WRITEBACK: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ) pDb->nWritebackKB = *piVal;
+      *piVal = pDb->nWritebackKB;
+      break;
+    }
+
+    case LSM_CONFIG_DROP_BEHIND: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ) pDb->bDropBehind = (*piVal!=0);
+      *piVal = pDb->bDropBehind;
+      break;
+    }
+
+    case LSM_CONFIG_PREALLOCATE: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ) pDb->nPreallocKB = *piVal;
+      *piVal = pDb->nPreallocKB;
+      break;
+    }
+
+    case LSM_CONFIG_PUNCH_HOLES: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ) pDb->bPunchHoles = (*piVal!=0);
+      *piVal = pDb->bPunchHoles;
+      break;
+    }
+
+    case LSM_CONFIG_VALUE_LOG: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ) pDb->nVlogThreshold = *piVal;
+      *piVal = pDb->nVlogThreshold;
+      break;
+    }
+
+    case LSM_CONFIG_PREFIX_KEYS: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ) pDb->bPrefixKeys = (*piVal!=0);
+      *piVal = pDb->bPrefixKeys;
+      break;
+    }
+
+    case LSM_CONFIG_KEY_FORMAT: {
+      int *piVal = va_arg(ap, int *);
+      if( pDb->pDatabase==0 ){
+        switch( *piVal ){
+          case LSM_KEY_FORMAT_BYTES: pDb->xCmp = xCmp; break;
+          case LSM_KEY_FORMAT_U64:   pDb->xCmp = xCmpU64; break;
+          case LSM_KEY_FORMAT_U128:  pDb->xCmp = xCmpU128; break;
+        }
+        if( *piVal>=0 && *piVal<LSM_KEY_FORMAT_CUSTOM ){
+          pDb->eKeyFormat = *piVal;
+        }
+      }
+      *piVal = pDb->eKeyFormat;
+      break;
+    }
+
+    case LSM_CONFIG_COMPRESS_THREADS: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ){
+        pDb->nCompressThread = LSM_MIN(*piVal, LSM_MAX_COMPRESS_THREADS);
+      }
+      *piVal = pDb->nCompressThread;
+      break;
+    }
+
     case LSM_CONFIG_USE_LOG: {
       int *piVal = va_arg(ap, int *);
       if( pDb->nTransOpen==0 && (*piVal==0 || *piVal==1) ){
@@ -7762,6 +10063,43 @@ int lsm_config(lsm_db *pDb, int eParam, ...){
       break;
     }
 
+    case LSM_CONFIG_COMPACTION: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=LSM_COMPACTION_TIERED && *piVal<=LSM_COMPACTION_HYBRID ){
+        pDb->eCompaction = *piVal;
+      }
+      *piVal = pDb->eCompaction;
+      break;
+    }
+
+    case LSM_CONFIG_SIZE_RATIO: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>1 ) pDb->nSizeRatio = *piVal;
+      *piVal = pDb->nSizeRatio;
+      break;
+    }
+
+    case LSM_CONFIG_TOMBSTONE_RATIO: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 && *piVal<=100 ) pDb->nTombstoneRatio = *piVal;
+      *piVal = pDb->nTombstoneRatio;
+      break;
+    }
+
+    case LSM_CONFIG_MIN_COMPRESS_SAVING: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 && *piVal<100 ) pDb->nMinCompressSaving = *piVal;
+      *piVal = pDb->nMinCompressSaving;
+      break;
+    }
+
+    case LSM_CONFIG_RAW_PAGES: {
+      int *piVal = va_arg(ap, int *);
+      if( *piVal>=0 ) pDb->bRawPages = (*piVal!=0);
+      *piVal = pDb->bRawPages;
+      break;
+    }
+
     case LSM_CONFIG_MAX_FREELIST: {
       int *piVal = va_arg(ap, int *);
       if( *piVal>=2 && *piVal<=LSM_MAX_FREELIST_ENTRIES ){
@@ -7979,6 +10317,30 @@ int lsm_info(lsm_db *pDb, int eParam, ...){
       break;
     }
 
+    case LSM_INFO_NWRITE_RAW: {
+      int *piVal = va_arg(ap, int *);
+      *piVal = lsmFsNWriteRaw(pDb->pFS);
+      break;
+    }
+
+    case LSM_INFO_COMPRESSED_CACHE_HIT: {
+      int *piVal = va_arg(ap, int *);
+      *piVal = lsmFsNCompressedHit(pDb->pFS);
+      break;
+    }
+
+    case LSM_INFO_COMPRESSED_CACHE_MISS: {
+      int *piVal = va_arg(ap, int *);
+      *piVal = lsmFsNCompressedMiss(pDb->pFS);
+      break;
+    }
+
+    case LSM_INFO_NREADAHEAD: {
+      int *piVal = va_arg(ap, int *);
+      *piVal = lsmFsNReadahead(pDb->pFS);
+      break;
+    }
+
     case LSM_INFO_NREAD: {
       int *piVal = va_arg(ap, int *);
       *piVal = lsmFsNRead(pDb->pFS);
@@ -8066,6 +10428,7 @@ int lsm_info(lsm_db *pDb, int eParam, ...){
 static int doWriteOp(
   lsm_db *pDb,
   int bDeleteRange,
+  int bOperand,                   /* True if pVal/nVal is a merge operand */
   const void *pKey, int nKey,     /* Key to write or delete */
   const void *pVal, int nVal      /* Value to write. Or nVal==-1 for a delete */
 ){
@@ -8077,8 +10440,19 @@ static int doWriteOp(
     rc = lsm_begin(pDb, 1);
   }
 
+  /* A merge operand is combined with the entry for the same key already in
+  ** the in-memory tree (if any) before it is logged, so that replaying the
+  ** log does not require the merge function. If the tree already holds a
+  ** regular value or a delete for the key, the result is a regular write. */
+  if( rc==LSM_OK && bOperand ){
+    rc = lsmTreeMergeOperand(
+        pDb, (void *)pKey, nKey, (void **)&pVal, &nVal, &bOperand
+    );
+  }
+
   if( rc==LSM_OK ){
     int eType = (bDeleteRange ? LSM_DRANGE : (nVal>=0?LSM_WRITE:LSM_DELETE));
+    if( bOperand ) eType = LSM_MERGE;
     rc = lsmLogWrite(pDb, eType, (void *)pKey, nKey, (void *)pVal, nVal);
   }
 
@@ -8098,6 +10472,8 @@ static int doWriteOp(
     nBefore = lsmTreeSize(pDb);
     if( bDeleteRange ){
       rc = lsmTreeDelete(pDb, (void *)pKey, nKey, (void *)pVal, nVal);
+    }else if( bOperand ){
+      rc = lsmTreeInsertOperand(pDb, (void *)pKey, nKey, (void *)pVal, nVal);
     }else{
       rc = lsmTreeInsert(pDb, (void *)pKey, nKey, (void *)pVal, nVal);
     }
@@ -8130,14 +10506,26 @@ int lsm_insert(
   const void *pKey, int nKey,     /* Key to write or delete */
   const void *pVal, int nVal      /* Value to write. Or nVal==-1 for a delete */
 ){
-  return doWriteOp(db, 0, pKey, nKey, pVal, nVal);
+  return doWriteOp(db, 0, 0, pKey, nKey, pVal, nVal);
+}
+
+/*
+** Write a merge operand into the database.
+*/
+int lsm_merge(
+  lsm_db *db,                     /* Database connection */
+  const void *pKey, int nKey,     /* Key to write the operand to */
+  const void *pVal, int nVal      /* Merge operand */
+){
+  if( db->xMerge==0 || nVal<0 ) return LSM_MISUSE_BKPT;
+  return doWriteOp(db, 0, 1, pKey, nKey, pVal, nVal);
 }
 
 /*
 ** Delete a value from the database. 
 */
 int lsm_delete(lsm_db *db, const void *pKey, int nKey){
-  return doWriteOp(db, 0, pKey, nKey, 0, -1);
+  return doWriteOp(db, 0, 0, pKey, nKey, 0, -1);
 }
 
 /*
@@ -8150,7 +10538,7 @@ int lsm_delete_range(
 ){
   int rc = LSM_OK;
   if( db->xCmp((void *)pKey1, nKey1, (void *)pKey2, nKey2)<0 ){
-    rc = doWriteOp(db, 1, pKey1, nKey1, pKey2, nKey2);
+    rc = doWriteOp(db, 1, 0, pKey1, nKey1, pKey2, nKey2);
   }
   return rc;
 }
@@ -8167,6 +10555,7 @@ int lsm_csr_open(lsm_db *pDb, lsm_cursor **ppCsr){
 
   /* Open a read transaction if one is not already open. */
   assert_db_state(pDb);
+  if( pDb->pBulk ) return LSM_MISUSE_BKPT;
 
   if( pDb->pShmhdr==0 ){
     assert( pDb->bReadonly );
@@ -8216,10 +10605,26 @@ int lsm_csr_seek(lsm_cursor *pCsr, const void *pKey, int nKey, int eSeek){
   return lsmMCursorSeek((MultiCursor *)pCsr, 0, (void *)pKey, nKey, eSeek);
 }
 
+int lsm_csr_seek_forward(lsm_cursor *pCsr, const void *pKey, int nKey){
+  return lsmMCursorSeekForward((MultiCursor *)pCsr, (void *)pKey, nKey);
+}
+
 int lsm_csr_next(lsm_cursor *pCsr){
   return lsmMCursorNext((MultiCursor *)pCsr);
 }
 
+int lsm_csr_next_batch(
+  lsm_cursor *pCsr, 
+  int nMaxRecord, 
+  void *aBuf, int nBuf, 
+  int *pnRecord, 
+  int *pnByte
+){
+  return lsmMCursorNextBatch(
+      (MultiCursor *)pCsr, nMaxRecord, (u8 *)aBuf, nBuf, pnRecord, pnByte
+  );
+}
+
 int lsm_csr_prev(lsm_cursor *pCsr){
   return lsmMCursorPrev((MultiCursor *)pCsr);
 }
@@ -8244,6 +10649,17 @@ int lsm_csr_value(lsm_cursor *pCsr, const void **ppVal, int *pnVal){
   return lsmMCursorValue((MultiCursor *)pCsr, (void **)ppVal, pnVal);
 }
 
+int lsm_csr_values(lsm_cursor *pCsr, int eValues){
+  if( eValues!=LSM_CURSOR_VALUES_EAGER 
+   && eValues!=LSM_CURSOR_VALUES_LAZY 
+   && eValues!=LSM_CURSOR_VALUES_NONE 
+  ){
+    return LSM_MISUSE_BKPT;
+  }
+  lsmMCursorValues((MultiCursor *)pCsr, eValues);
+  return LSM_OK;
+}
+
 void lsm_config_log(
   lsm_db *pDb, 
   void (*xLog)(void *, int, const char *), 
@@ -8262,8 +10678,134 @@ void lsm_config_work_hook(
   pDb->pWorkCtx = pCtx;
 }
 
-static void lsmLogMessage(lsm_db *pDb, int rc, const char *zFormat, ...){
-  if( pDb->xLog ){
+void lsm_config_compaction_filter(
+  lsm_db *pDb, 
+  int (*xFilter)(void *, const void *, int, const void *, int, void **, int *),
+  void *pCtx
+){
+  pDb->xFilter = xFilter;
+  pDb->pFilterCtx = pCtx;
+}
+
+void lsm_config_merge_operator(
+  lsm_db *pDb, 
+  int (*xMerge)(void *, const void *, int, const void *, int, const void *, int,
+                void **, int *),
+  void *pCtx
+){
+  pDb->xMerge = xMerge;
+  pDb->pMergeCtx = pCtx;
+}
+
+int lsm_config_compare(lsm_db *pDb, int (*xCompare)(void *, int, void *, int)){
+  if( pDb->pDatabase || xCompare==0 ) return LSM_MISUSE_BKPT;
+  pDb->xCmp = xCompare;
+  pDb->eKeyFormat = LSM_KEY_FORMAT_CUSTOM;
+  return LSM_OK;
+}
+
+int lsm_dictionary_write(
+  lsm_db *pDb, 
+  unsigned int iDict, 
+  const void *pDict, 
+  int nDict
+){
+  int rc;
+
+  if( iDict==0 || nDict<=0 || pDb->pShmhdr==0 || pDb->bReadonly 
+   || pDb->nTransOpen || pDb->pCsr || pDb->compress.xCompress==0
+  ){
+    return LSM_MISUSE_BKPT;
+  }
+
+  rc = lsmBeginWork(pDb);
+  if( rc==LSM_OK ){
+    Snapshot *pWorker = pDb->pWorker;
+    int iBlk = 0;
+    if( pWorker->iDictId ){
+      rc = LSM_MISUSE_BKPT;
+    }else{
+      rc = lsmBlockAllocate(pDb, 0, &iBlk);
+    }
+    if( rc==LSM_OK ){
+      rc = lsmFsWriteDictionary(pDb->pFS, iBlk, pDict, nDict);
+    }
+    if( rc==LSM_OK ){
+      pWorker->iDictId = iDict;
+      pWorker->iDictBlk = iBlk;
+      pWorker->nDict = nDict;
+    }
+
+    /* If an error occurred, the worker snapshot is discarded. Including
+    ** the allocation of the block.  */
+    lsmFinishWork(pDb, 0, &rc);
+  }
+  return rc;
+}
+
+int lsm_dictionary_read(
+  lsm_db *pDb, 
+  unsigned int *piDict, 
+  void **ppDict, 
+  int *pnDict
+){
+  int rc = LSM_OK;
+  int bTrans = 0;                 /* True if a read transaction was opened */
+  Snapshot *pSnap = pDb->pWorker;
+
+  *piDict = 0;
+  if( ppDict ) *ppDict = 0;
+  if( pnDict ) *pnDict = 0;
+
+  /* Unless this is invoked while working on the database, the dictionary 
+  ** is looked up in the client snapshot. A read transaction is opened if 
+  ** there is none, so that the snapshot is up to date.  */
+  if( pSnap==0 ){
+    if( pDb->pShmhdr==0 ){
+      if( pDb->bReadonly==0 ) return LSM_MISUSE_BKPT;
+      rc = lsmBeginRoTrans(pDb);
+      bTrans = 1;
+    }else if( pDb->iReader<0 ){
+      rc = lsmBeginReadTrans(pDb);
+      bTrans = 1;
+    }
+    pSnap = pDb->pClient;
+  }
+
+  if( rc==LSM_OK && pSnap->iDictId ){
+    if( ppDict ){
+      rc = lsmFsReadDictionary(pDb->pFS, pSnap->iDictBlk, pSnap->nDict, ppDict);
+      if( rc==LSM_OK && pnDict ) *pnDict = pSnap->nDict;
+    }
+    if( rc==LSM_OK ) *piDict = pSnap->iDictId;
+  }
+
+  if( bTrans ) dbReleaseClientSnapshot(pDb);
+  return rc;
+}
+
+int lsm_config_age_compression(lsm_db *pDb, int iAge, lsm_compress *p){
+  AgeCompress *pAge;
+
+  if( pDb->pDatabase || pDb->compress.xCompress==0 
+   || pDb->nAgeCompress>=LSM_MAX_AGE_COMPRESS
+   || (p->xBound && (p->iId==0 || p->iId>0xFFFF))
+  ){
+    return LSM_MISUSE_BKPT;
+  }
+
+  pAge = &pDb->aAgeCompress[pDb->nAgeCompress++];
+  pAge->iAge = (iAge<0 ? -1 : iAge);
+  if( p->xBound==0 ){
+    lsmFsNoCompression(&pAge->compress);
+  }else{
+    memcpy(&pAge->compress, p, sizeof(lsm_compress));
+  }
+  return LSM_OK;
+}
+
+static void lsmLogMessage(lsm_db *pDb, int rc, const char *zFormat, ...){
+  if( pDb->xLog ){
     LsmString s;
     va_list ap, ap2;
     lsmStringInit(&s, pDb->pEnv);
@@ -8281,6 +10823,7 @@ int lsm_begin(lsm_db *pDb, int iLevel){
   int rc;
 
   assert_db_state( pDb );
+  if( pDb->pBulk ) return LSM_MISUSE_BKPT;
   rc = (pDb->bReadonly ? LSM_READONLY : LSM_OK);
 
   /* A value less than zero means open one more transaction. */
@@ -8612,6 +11155,61 @@ static int lsmMutexNotHeld(lsm_env *pEnv, lsm_mutex *pMutex){
 }
 #endif
 
+/*
+** Start a thread that invokes xMain(pArg). Environments older than version
+** 4, and those that set xThreadNew to NULL, do not support threads. In that
+** case LSM_ERROR is returned and no thread is started.
+*/
+static int lsmThreadNew(
+  lsm_env *pEnv, 
+  void (*xMain)(void *), 
+  void *pArg, 
+  lsm_thread **ppNew
+){
+  *ppNew = 0;
+  if( pEnv->iVersion<4 || pEnv->xThreadNew==0 ) return LSM_ERROR;
+  return pEnv->xThreadNew(pEnv, xMain, pArg, ppNew);
+}
+
+/*
+** Wait for a thread started by lsmThreadNew() to return.
+*/
+static void lsmThreadJoin(lsm_env *pEnv, lsm_thread *pThread){
+  if( pThread ) pEnv->xThreadJoin(pThread);
+}
+
+/*
+** Allocate a new condition variable. As with lsmThreadNew(), LSM_ERROR is
+** returned if the environment does not support threads.
+*/
+static int lsmCondNew(lsm_env *pEnv, lsm_cond **ppNew){
+  *ppNew = 0;
+  if( pEnv->iVersion<4 || pEnv->xThreadNew==0 ) return LSM_ERROR;
+  return pEnv->xCondNew(pEnv, ppNew);
+}
+
+/*
+** Free a condition variable allocated by lsmCondNew().
+*/
+static void lsmCondDel(lsm_env *pEnv, lsm_cond *pCond){
+  if( pCond ) pEnv->xCondDel(pCond);
+}
+
+/*
+** Leave the mutex and wait until the condition variable is signalled, then
+** enter the mutex again. This may return spuriously.
+*/
+static void lsmCondWait(lsm_env *pEnv, lsm_cond *pCond, lsm_mutex *pMutex){
+  pEnv->xCondWait(pCond, pMutex);
+}
+
+/*
+** Wake all threads waiting on the condition variable.
+*/
+static void lsmCondBroadcast(lsm_env *pEnv, lsm_cond *pCond){
+  pEnv->xCondBroadcast(pCond);
+}
+
 #line 1 "lsm_shared.c"
 /*
 ** 2012-01-23
@@ -8982,6 +11580,9 @@ static int doDbConnect(lsm_db *pDb){
     if( rc==LSM_OK ){
       rc = lsmLogRecover(pDb);
     }
+    if( rc==LSM_OK ){
+      rc = lsmFsVlogRecover(pDb->pFS);
+    }
     if( rc==LSM_OK ){
       ShmHeader *pShm = pDb->pShmhdr;
       pShm->aReader[0].iLsmId = lsmCheckpointId(pShm->aSnap1, 0);
@@ -9378,6 +11979,44 @@ static int findFreeblock(lsm_db *pDb, i64 iInUse, int bNotOne, int *piRet){
   return rc;
 }
 
+typedef struct PunchFreeblocksCtx PunchFreeblocksCtx;
+struct PunchFreeblocksCtx {
+  FileSystem *pFS;
+  i64 iPunched;
+  i64 iInUse;
+  int rc;
+};
+
+static int punchFreeblocksCb(void *pCtx, int iBlk, i64 iSnapshot){
+  PunchFreeblocksCtx *p = (PunchFreeblocksCtx *)pCtx;
+  if( iSnapshot>=p->iPunched && iSnapshot<p->iInUse ){
+    p->rc = lsmFsPunchBlock(p->pFS, iBlk);
+  }
+  return (p->rc!=LSM_OK);
+}
+
+/*
+** Deallocate the disk space of the blocks in the free block list that 
+** became reusable since this was last called, i.e. that were freed before
+** snapshot iInUse, but not before the snapshot this was last called with
+** (see LSM_CONFIG_PUNCH_HOLES). The first call made by a connection 
+** deallocates all reusable blocks.
+*/
+static int punchFreeblocks(lsm_db *pDb, i64 iInUse){
+  int rc = LSM_OK;
+  if( iInUse>pDb->iPunched ){
+    PunchFreeblocksCtx ctx;
+    ctx.pFS = pDb->pFS;
+    ctx.iPunched = pDb->iPunched;
+    ctx.iInUse = iInUse;
+    ctx.rc = LSM_OK;
+    rc = lsmWalkFreelist(pDb, 0, punchFreeblocksCb, (void *)&ctx);
+    if( rc==LSM_OK ) rc = ctx.rc;
+    if( rc==LSM_OK ) pDb->iPunched = iInUse;
+  }
+  return rc;
+}
+
 /*
 ** Allocate a new database file block to write data to, either by extending
 ** the database file or by recycling a free-list entry. The worker snapshot 
@@ -9445,6 +12084,9 @@ static int lsmBlockAllocate(lsm_db *pDb, int iBefore, int *piBlk){
     int bRotrans;
     rc = lsmDetectRoTrans(pDb, &bRotrans);
 
+    if( rc==LSM_OK && bRotrans==0 && pDb->bPunchHoles ){
+      rc = punchFreeblocks(pDb, iInUse);
+    }
     if( rc==LSM_OK && bRotrans==0 ){
       rc = findFreeblock(pDb, iInUse, (iBefore>0), &iRet);
     }
@@ -9471,6 +12113,7 @@ static int lsmBlockAllocate(lsm_db *pDb, int iBefore, int *piBlk){
 #ifdef LSM_LOG_FREELIST
       lsmLogMessage(pDb, 0, "extending file to %d blocks", iRet);
 #endif
+      rc = lsmFsPreallocate(pDb->pFS, iRet);
     }
   }
 
@@ -9565,7 +12208,8 @@ static int lsmCheckpointWrite(lsm_db *pDb, u32 *pnWrite){
 
     if( rc==LSM_OK && bDone==0 ){
       int iMeta = (pShm->iMetaPage % 2) + 1;
-      if( pDb->eSafety!=LSM_SAFETY_OFF ){
+      rc = lsmFsVlogSync(pDb->pFS, pDb->eSafety!=LSM_SAFETY_OFF);
+      if( rc==LSM_OK && pDb->eSafety!=LSM_SAFETY_OFF ){
         rc = lsmFsSyncDb(pDb->pFS, nBlock);
       }
       if( rc==LSM_OK ) rc = lsmCheckpointStore(pDb, iMeta);
@@ -10662,6 +13306,8 @@ int lsm_checkpoint(lsm_db *pDb, int *pnKB){
 **       LSM_INSERT    
 **       LSM_SEPARATOR
 **       LSM_SYSTEMKEY
+**       LSM_OPERAND
+**       LSM_VALUE_PTR
 **
 **   Immediately following the type byte is a pointer to the smallest key 
 **   in the next file that is larger than the key in the current record. The 
@@ -10676,6 +13322,16 @@ int lsm_checkpoint(lsm_db *pDb, int *pnKB){
 **
 **   Finally, the blob of data containing the key, and for LSM_INSERT
 **   records, the value as well.
+**
+**   On pages with the PGFTR_PREFIX_FLAG flag set (see LSM_CONFIG_PREFIX_KEYS),
+**   only every LSM_PREFIX_RESTART'th record (records 0, 16, 32...), the 
+**   restart points, is stored as above. In all other records, the number of
+**   leading bytes the key shares with the key of the previous record on the
+**   page is stored as a varint before the number of bytes in the key. The
+**   latter then counts, and the blob of data contains, only the bytes of 
+**   the key that follow the shared ones. Since only the last record that
+**   starts on a page may span pages, the key of any record on the page can 
+**   be decoded starting from the restart point before it.
 */
 
 #ifndef _LSM_INT_H
@@ -10708,6 +13364,15 @@ int lsm_checkpoint(lsm_db *pDb, int *pnKB){
 #define SEGMENT_BTREE_FLAG     0x0001
 #define PGFTR_SKIP_NEXT_FLAG   0x0002
 #define PGFTR_SKIP_THIS_FLAG   0x0004
+#define PGFTR_PREFIX_FLAG      0x0008
+
+/*
+** On pages with the PGFTR_PREFIX_FLAG flag set, the key of every record 
+** with an index that is a multiple of this value is stored in full.
+*/
+#define LSM_PREFIX_RESTART 16
+#define pageIsPrefixCell(flags, iCell) \
+  (((flags) & PGFTR_PREFIX_FLAG) && ((iCell) % LSM_PREFIX_RESTART)!=0)
 
 
 #ifndef LSM_SEGMENTPTR_FREE_THRESHOLD
@@ -10748,6 +13413,9 @@ struct SegmentPtr {
   LsmPgno iPgPtr;               /* Cascade pointer offset */
   void *pKey; int nKey;         /* Key associated with current record */
   void *pVal; int nVal;         /* Current record value (eType==WRITE only) */
+  int iValOff;                  /* Offset of value yet to be read, or 0 */
+  int iKeyCell;                 /* Cell whose key blob1 holds, or -1 */
+  int bLazyVal;                 /* True to read values only once required */
 
   /* Blobs used to allocate buffers for pKey and pVal as required */
   LsmBlob blob1;
@@ -10788,6 +13456,17 @@ struct BtreeCursor {
   LsmBlob blob;
 };
 
+/*
+** The first 8 bytes of the current key of a component of a MultiCursor,
+** as a big-endian integer (padded with zero bytes if the key is shorter).
+** Comparing two such prefixes orders the keys as memcmp() does, unless the
+** prefixes are equal. See multiCursorDoCompare().
+*/
+typedef struct CursorPrefix CursorPrefix;
+struct CursorPrefix {
+  u64 iPrefix;                    /* First 8 bytes of key */
+  int iTopic;                     /* rtTopic() of key, or -1 for EOF */
+};
 
 /*
 ** A cursor used for merged searches or iterations through up to one
@@ -10816,6 +13495,7 @@ struct MultiCursor {
   int eType;                      /* Cache of current key type */
   LsmBlob key;                    /* Cache of current key (or NULL) */
   LsmBlob val;                    /* Cache of current value */
+  LsmBlob vlog;                   /* Older value loaded from value log */
 
   /* All the component cursors: */
   TreeCursor *apTreeCsr[2];       /* Up to two tree cursors */
@@ -10827,6 +13507,7 @@ struct MultiCursor {
   /* Comparison results */
   int nTree;                      /* Size of aTree[] array */
   int *aTree;                     /* Array of comparison results */
+  CursorPrefix *aPrefix;          /* Key prefixes (part of aTree allocation) */
 
   /* Used by cursors flushing the in-memory tree only */
   void *pSystemVal;               /* Pointer to buffer to free */
@@ -10869,6 +13550,18 @@ struct MultiCursor {
 **   Cursor has undergone a successful lsm_csr_seek(LSM_SEEK_EQ) operation.
 **   The key and value are stored in MultiCursor.key and MultiCursor.val
 **   respectively.
+**
+** CURSOR_LAZY_VALUES
+**   Values are not read from segment pages as the cursor moves, only when
+**   they are requested. See lsm_csr_values().
+**
+** CURSOR_KEYS_ONLY
+**   Values are never read. Implies CURSOR_LAZY_VALUES.
+**
+** CURSOR_VALUE_MERGED
+**   The cursor points to a merge operand, and MultiCursor.val holds the 
+**   result of combining it with the older versions of the key. Cleared 
+**   whenever the cursor moves (see multiCursorCacheKey()).
 */
 #define CURSOR_IGNORE_DELETE    0x00000001
 #define CURSOR_FLUSH_FREELIST   0x00000002
@@ -10877,8 +13570,12 @@ struct MultiCursor {
 #define CURSOR_PREV_OK          0x00000040
 #define CURSOR_READ_SEPARATORS  0x00000080
 #define CURSOR_SEEK_EQ          0x00000100
+#define CURSOR_LAZY_VALUES      0x00000200
+#define CURSOR_KEYS_ONLY        0x00000400
+#define CURSOR_VALUE_MERGED     0x00000800
 
 typedef struct MergeWorker MergeWorker;
+typedef struct MergeOp MergeOp;
 typedef struct Hierarchy Hierarchy;
 
 struct Hierarchy {
@@ -10897,6 +13594,16 @@ struct Hierarchy {
 **   b-tree hierarchy. aSave[1] is used to save the page number of the
 **   page containing the indirect key most recently written to the b-tree.
 **   see mergeWorkerPushHierarchy() for details.
+**
+** pOpFirst/pOpLast:
+**   If the pages of the output segment are compressed by the threads of
+**   the FileSystem (see LSM_CONFIG_COMPRESS_THREADS), completed pages are 
+**   not persisted right away. As the page number of a page in a compressed
+**   database depends on the compressed size of the pages before it, so do
+**   the b-tree hierarchy updates that follow. Both are queued in this list
+**   instead, and applied in order once it contains more than nOpMax pages,
+**   by which time the oldest has usually been compressed. nOpMax is zero
+**   if the pages are compressed by the thread writing them.
 */
 struct MergeWorker {
   lsm_db *pDb;                    /* Database handle */
@@ -10907,12 +13614,53 @@ struct MergeWorker {
   Page *pPage;                    /* Current output page */
   int nWork;                      /* Number of calls to mergeWorkerNextPage() */
   LsmPgno *aGobble;               /* Gobble point for each input segment */
+  int nEntry;                     /* User entries written to the output */
+  int nTombstone;                 /* Delete markers among nEntry */
+  LsmBlob prefix;                 /* Key of record iPrefixCell of iPrefixPg */
+  LsmPgno iPrefixPg;              /* Output page prefix was last written to */
+  int iPrefixCell;                /* Cell of iPrefixPg prefix belongs to */
 
   LsmPgno iIndirect;
   struct SavedPgno {
     LsmPgno iPgno;
     int bStore;
   } aSave[2];
+
+  MergeOp *pOpFirst;              /* First queued operation */
+  MergeOp *pOpLast;               /* Last queued operation */
+  MergeOp *pOpFree;               /* Unused MergeOp objects */
+  int nOpPage;                    /* Number of pages in queue */
+  int nOpMax;                     /* Maximum pages in queue (or 0) */
+};
+
+/*
+** An operation queued by a MergeWorker. Either a completed output page to
+** persist and release (if pPg is not NULL), or a key to push into the 
+** b-tree hierarchy (see mergeWorkerPush()).
+*/
+struct MergeOp {
+  Page *pPg;                      /* Page to persist, or NULL */
+  int iTopic;                     /* Topic of key to push */
+  LsmBlob key;                    /* Key to push */
+  MergeOp *pNext;                 /* Next operation in queue or free list */
+};
+
+/*
+** State of a bulk load started by lsm_bulk_begin(). The records passed to
+** lsm_bulk_insert() are written straight into the lhs segment of a new
+** top level by a MergeWorker, which reads nothing from its cursor.
+**
+** key:
+**   Copy of the most recent key written. Each key must be larger than it.
+*/
+struct BulkLoad {
+  Level *pNew;                    /* New top level being written */
+  Level *pNext;                   /* Top level before the bulk load */
+  Merge merge;                    /* Merge object of level pNew */
+  MergeWorker mergeworker;        /* Writes the records into pNew */
+  LsmPgno iLeftPtr;               /* Pointer value of all records (zero) */
+  LsmBlob key;                    /* Most recent key written */
+  int rc;                         /* Error that ended the bulk load (if any) */
 };
 
 #ifdef LSM_DEBUG_EXPENSIVE
@@ -11127,25 +13875,108 @@ static LsmPgno pageGetRecordPtr(u8 *aData, int nData, int iCell){
   return iRet;
 }
 
+/*
+** Cell iCell of page pPg, which has the PGFTR_PREFIX_FLAG flag set, is 
+** either a restart point or stores its key relative to the key of the
+** previous cell. In the latter case, blob pBlob must contain the key of the
+** previous cell when this function is called. Either way, it is replaced by
+** the key of cell iCell. If peType is not NULL, *peType is set to the record
+** type of the cell.
+*/
+static int pagePrefixStep(
+  Segment *pSeg,                  /* Segment pPg belongs to */
+  Page *pPg,                      /* Page to read from */
+  int iCell,                      /* Index of cell on page to decode */
+  int *peType,                    /* OUT: Record type of cell iCell */
+  LsmBlob *pBlob                  /* IN/OUT: Key of cell iCell-1, or iCell */
+){
+  LsmBlob tmp = {0, 0, 0, 0};     /* Used if the key suffix spans pages */
+  u8 *pSuffix = 0;                /* Key bytes stored in the cell */
+  int nShared = 0;                /* Bytes shared with the previous key */
+  int nSuffix;                    /* Size of pSuffix in bytes */
+  int eType;
+  i64 nDummy;
+  u8 *aCell;
+  u8 *aData;
+  int nData;
+  int rc;
+
+  aData = fsPageData(pPg, &nData);
+  aCell = pageGetCell(aData, nData, iCell);
+  eType = *aCell++;
+  aCell += lsmVarintGet64(aCell, &nDummy);
+  if( iCell % LSM_PREFIX_RESTART ) aCell += lsmVarintGet32(aCell, &nShared);
+  aCell += lsmVarintGet32(aCell, &nSuffix);
+  if( rtIsWrite(eType) ) aCell += lsmVarintGet64(aCell, &nDummy);
+  if( peType ) *peType = eType;
+  if( nShared>pBlob->nData || nSuffix<0 ) return LSM_CORRUPT_BKPT;
+
+  rc = sortedReadData(pSeg, pPg, aCell-aData, nSuffix, (void **)&pSuffix, &tmp);
+  if( rc==LSM_OK ){
+    rc = sortedBlobGrow(lsmPageEnv(pPg), pBlob, nShared+nSuffix);
+  }
+  if( rc==LSM_OK ){
+    memcpy(&((u8 *)pBlob->pData)[nShared], pSuffix, nSuffix);
+    pBlob->nData = nShared+nSuffix;
+  }
+  sortedBlobFree(&tmp);
+  return rc;
+}
+
+/*
+** Decode the key of cell iCell of page pPg, which has the PGFTR_PREFIX_FLAG
+** flag set, into blob pBlob. The keys of the cells between the restart 
+** point before it and cell iCell are decoded in turn.
+*/
+static int pagePrefixKey(
+  Segment *pSeg,                  /* Segment pPg belongs to */
+  Page *pPg,                      /* Page to read from */
+  int iCell,                      /* Index of cell on page to decode */
+  int *peType,                    /* OUT: Record type of cell iCell */
+  LsmBlob *pBlob                  /* OUT: Key of cell iCell */
+){
+  int rc = LSM_OK;
+  int i;
+  for(i=iCell-(iCell % LSM_PREFIX_RESTART); rc==LSM_OK && i<=iCell; i++){
+    rc = pagePrefixStep(pSeg, pPg, i, peType, pBlob);
+  }
+  return rc;
+}
+
+/*
+** Return a pointer to the key of cell iCell of page pPg, and set *pnKey to
+** its size in bytes. If an error occurs, *pRc is set to an LSM error code 
+** and a zero-length key is returned.
+*/
 static u8 *pageGetKey(
   Segment *pSeg,                  /* Segment pPg belongs to */
   Page *pPg,                      /* Page to read from */
   int iCell,                      /* Index of cell on page to read */
   int *piTopic,                   /* OUT: Topic associated with this key */
   int *pnKey,                     /* OUT: Size of key in bytes */
-  LsmBlob *pBlob                  /* If required, use this for dynamic memory */
+  LsmBlob *pBlob,                 /* If required, use this for dynamic memory */
+  int *pRc                        /* IN/OUT: Error code */
 ){
   u8 *pKey;
   i64 nDummy;
-  int eType;
+  int eType = 0;
   u8 *aData;
   int nData;
+  int rc;
 
   aData = fsPageData(pPg, &nData);
 
   assert( !(pageGetFlags(aData, nData) & SEGMENT_BTREE_FLAG) );
   assert( iCell<pageGetNRec(aData, nData) );
 
+  if( pageIsPrefixCell(pageGetFlags(aData, nData), iCell) ){
+    rc = pagePrefixKey(pSeg, pPg, iCell, &eType, pBlob);
+    *piTopic = rtTopic(eType);
+    *pnKey = (rc==LSM_OK ? pBlob->nData : 0);
+    if( rc!=LSM_OK ) *pRc = rc;
+    return (u8 *)pBlob->pData;
+  }
+
   pKey = pageGetCell(aData, nData, iCell);
   eType = *pKey++;
   pKey += lsmVarintGet64(pKey, &nDummy);
@@ -11155,7 +13986,11 @@ static u8 *pageGetKey(
   }
   *piTopic = rtTopic(eType);
 
-  sortedReadData(pSeg, pPg, pKey-aData, *pnKey, (void **)&pKey, pBlob);
+  rc = sortedReadData(pSeg, pPg, pKey-aData, *pnKey, (void **)&pKey, pBlob);
+  if( rc!=LSM_OK ){
+    *pRc = rc;
+    *pnKey = 0;
+  }
   return pKey;
 }
 
@@ -11171,9 +14006,9 @@ static int pageGetKeyCopy(
   int nKey;
   u8 *aKey;
 
-  aKey = pageGetKey(pSeg, pPg, iCell, piTopic, &nKey, pBlob);
-  assert( (void *)aKey!=pBlob->pData || nKey==pBlob->nData );
-  if( (void *)aKey!=pBlob->pData ){
+  aKey = pageGetKey(pSeg, pPg, iCell, piTopic, &nKey, pBlob, &rc);
+  assert( rc!=LSM_OK || (void *)aKey!=pBlob->pData || nKey==pBlob->nData );
+  if( rc==LSM_OK && (void *)aKey!=pBlob->pData ){
     rc = sortedBlobSet(pEnv, pBlob, aKey, nKey);
   }
 
@@ -11431,13 +14266,22 @@ static void btreeCursorSplitkey(BtreeCursor *pCsr, MergeInput *p){
   }
 }
 
+/*
+** Compare two keys. Keys are ordered by topic first. Keys of the user topic
+** are compared using xCmp. System keys (the free-block list) are always 
+** compared as byte strings, whatever the configured key order, as the code
+** that walks the free-block list depends on their order.
+*/
 static int sortedKeyCompare(
   int (*xCmp)(void *, int, void *, int),
   int iLhsTopic, void *pLhsKey, int nLhsKey,
   int iRhsTopic, void *pRhsKey, int nRhsKey
 ){
   int res = iLhsTopic - iRhsTopic;
-  if( res==0 ){
+  if( res==0 && iLhsTopic ){
+    res = memcmp(pLhsKey, pRhsKey, LSM_MIN(nLhsKey, nRhsKey));
+    if( res==0 ) res = (nLhsKey - nRhsKey);
+  }else if( res==0 ){
     res = xCmp(pLhsKey, nLhsKey, pRhsKey, nRhsKey);
   }
   return res;
@@ -11616,6 +14460,8 @@ static void segmentPtrSetPage(SegmentPtr *pPtr, Page *pNext){
     pPtr->iPtr = pageGetPtr(aData, nData);
   }
   pPtr->pPg = pNext;
+  pPtr->iKeyCell = -1;
+  pPtr->iValOff = 0;
 }
 
 /*
@@ -11678,21 +14524,53 @@ static int segmentPtrLoadCell(
     aData = fsPageData(pPtr->pPg, &nPgsz);
     iOff = lsmGetU16(&aData[SEGMENT_CELLPTR_OFFSET(nPgsz, pPtr->iCell)]);
     pPtr->eType = aData[iOff];
+    if( pPtr->pSeg->bVlog==0 ) pPtr->eType &= ~LSM_VALUE_PTR;
     iOff++;
     iOff += GETVARINT64(&aData[iOff], pPtr->iPgPtr);
+    if( pageIsPrefixCell(pPtr->flags, iNew) ){
+      /* Skip the number of shared key bytes. See pagePrefixStep(). */
+      iOff += GETVARINT32(&aData[iOff], pPtr->nKey);
+    }
     iOff += GETVARINT32(&aData[iOff], pPtr->nKey);
     if( rtIsWrite(pPtr->eType) ){
       iOff += GETVARINT32(&aData[iOff], pPtr->nVal);
     }
     assert( pPtr->nKey>=0 );
 
-    rc = segmentPtrReadData(
-        pPtr, iOff, pPtr->nKey, &pPtr->pKey, &pPtr->blob1
-    );
-    if( rc==LSM_OK && rtIsWrite(pPtr->eType) ){
+    if( pageIsPrefixCell(pPtr->flags, iNew) ){
+      /* The key is decoded into blob1. If blob1 already holds the key of
+      ** the previous cell (as it does when iterating forwards), only this
+      ** cell needs to be decoded.  */
+      Segment *pSeg = pPtr->pSeg;
+      if( pPtr->iKeyCell==iNew-1 ){
+        rc = pagePrefixStep(pSeg, pPtr->pPg, iNew, 0, &pPtr->blob1);
+      }else if( pPtr->iKeyCell!=iNew ){
+        rc = pagePrefixKey(pSeg, pPtr->pPg, iNew, 0, &pPtr->blob1);
+      }
+      pPtr->iKeyCell = (rc==LSM_OK ? iNew : -1);
+      iOff += pPtr->nKey;
+      pPtr->pKey = pPtr->blob1.pData;
+      pPtr->nKey = pPtr->blob1.nData;
+    }else{
+      pPtr->iKeyCell = -1;
       rc = segmentPtrReadData(
-          pPtr, iOff+pPtr->nKey, pPtr->nVal, &pPtr->pVal, &pPtr->blob2
+          pPtr, iOff, pPtr->nKey, &pPtr->pKey, &pPtr->blob1
       );
+      iOff += pPtr->nKey;
+    }
+    pPtr->iValOff = 0;
+    if( rc==LSM_OK && rtIsWrite(pPtr->eType) ){
+      if( pPtr->bLazyVal ){
+        /* The value is read by segmentPtrLoadValue(), if it is required. 
+        ** This saves copying values that span pages, and reading the 
+        ** pages they overflow onto.  */
+        pPtr->pVal = 0;
+        pPtr->iValOff = iOff;
+      }else{
+        rc = segmentPtrReadData(
+            pPtr, iOff, pPtr->nVal, &pPtr->pVal, &pPtr->blob2
+        );
+      }
     }else{
       pPtr->nVal = 0;
       pPtr->pVal = 0;
@@ -11702,6 +14580,21 @@ static int segmentPtrLoadCell(
   return rc;
 }
 
+/*
+** If the value of the current cell of pPtr has not been read yet (see
+** SegmentPtr.bLazyVal), read it now.
+*/
+static int segmentPtrLoadValue(SegmentPtr *pPtr){
+  int rc = LSM_OK;
+  if( pPtr->iValOff ){
+    rc = segmentPtrReadData(
+        pPtr, pPtr->iValOff, pPtr->nVal, &pPtr->pVal, &pPtr->blob2
+    );
+    pPtr->iValOff = 0;
+  }
+  return rc;
+}
+
 
 static Segment *sortedSplitkeySegment(Level *pLevel){
   Merge *pMerge = pLevel->pMerge;
@@ -11776,8 +14669,10 @@ static void segmentPtrReset(SegmentPtr *pPtr, int nThreshold){
   pPtr->nKey = 0;
   pPtr->pVal = 0;
   pPtr->nVal = 0;
+  pPtr->iValOff = 0;
   pPtr->eType = 0;
   pPtr->iCell = 0;
+  pPtr->iKeyCell = -1;
   if( pPtr->blob1.nAlloc>=nThreshold ) sortedBlobFree(&pPtr->blob1);
   if( pPtr->blob2.nAlloc>=nThreshold ) sortedBlobFree(&pPtr->blob2);
 }
@@ -11983,9 +14878,16 @@ static int assertKeyLocation(
           int iCell;
 
           iCell = ((eDir < 0) ? (nCell-1) : 0);
-          pPgKey = pageGetKey(pSeg, pTest, iCell, &iPgTopic, &nPgKey, &blob);
-          res = iTopic - iPgTopic;
-          if( res==0 ) res = pCsr->pDb->xCmp(pKey, nKey, pPgKey, nPgKey);
+          pPgKey = pageGetKey(
+              pSeg, pTest, iCell, &iPgTopic, &nPgKey, &blob, &rc
+          );
+          if( rc ){
+            lsmFsPageRelease(pTest);
+            break;
+          }
+          res = sortedKeyCompare(pCsr->pDb->xCmp, 
+              iTopic, pKey, nKey, iPgTopic, pPgKey, nPgKey
+          );
           if( (eDir==1 && res>0) || (eDir==-1 && res<0) ){
             /* Taking this branch means something has gone wrong. */
             char *zMsg = lsmMallocPrintf(pEnv, "Key \"%s\" is not on page %d", 
@@ -12054,8 +14956,10 @@ static int segmentPtrSearchOversized(
 
     /* Load the last key on the current page. */
     pLastKey = pageGetKey(pPtr->pSeg,
-        pPtr->pPg, pPtr->nCell-1, &iLastTopic, &nLastKey, &pPtr->blob1
+        pPtr->pPg, pPtr->nCell-1, &iLastTopic, &nLastKey, &pPtr->blob1, &rc
     );
+    pPtr->iKeyCell = -1;
+    if( rc!=LSM_OK ) break;
 
     /* If the loaded key is >= than (pKey/nKey), break out of the loop.
     ** If (pKey/nKey) is present in this array, it must be on the current 
@@ -12140,7 +15044,12 @@ static int ptrFwdPointer(
 static int sortedRhsFirst(MultiCursor *pCsr, Level *pLvl, SegmentPtr *pPtr){
   int rc;
   rc = segmentPtrEnd(pCsr, pPtr, 0);
-  while( pPtr->pPg && rc==LSM_OK ){
+
+  /* If nothing has been written to the lhs yet, there is no split-key, and
+  ** every key on the rhs is valid. Do not compare against the (empty) 
+  ** split-key in this case, as the empty key is not necessarily the 
+  ** smallest one (see lsm_config_compare()).  */
+  while( pPtr->pPg && rc==LSM_OK && pLvl->lhs.iFirst ){
     int res = sortedKeyCompare(pCsr->pDb->xCmp,
         pLvl->iSplitTopic, pLvl->pSplitKey, pLvl->nSplitKey,
         rtTopic(pPtr->eType), pPtr->pKey, pPtr->nKey
@@ -12238,37 +15147,239 @@ static int segmentPtrFwdPointer(
   return rc;
 }
 
-static int segmentPtrSeek(
-  MultiCursor *pCsr,              /* Cursor context */
-  SegmentPtr *pPtr,               /* Pointer to seek */
-  int iTopic,                     /* Key topic to seek to */
-  void *pKey, int nKey,           /* Key to seek to */
-  int eSeek,                      /* Search bias - see above */
-  LsmPgno *piPtr,                 /* OUT: FC pointer */
-  int *pbStop
+/*
+** Combine the value in pCsr->val, which is a merge operand for the key in
+** pCsr->key, with the older value pOld/nOld of the same key using the merge
+** function configured on the connection. The result is left in pCsr->val.
+*/
+/*
+** Value pVal/nVal is the pointer to a value log entry stored by a record
+** with the LSM_VALUE_PTR flag set. Load the value it points to into blob 
+** pBlob.
+**
+** Only versions of keys that have been superseded by newer ones may point
+** to entries that lsm_vlog_gc() has reclaimed already (and their values 
+** are never observed). Such values are loaded as empty ones.
+*/
+static int sortedVlogRead(lsm_db *pDb, void *pVal, int nVal, LsmBlob *pBlob){
+  u8 *aPtr = (u8 *)pVal;
+  u8 *aData = 0;
+  int nStored;
+  int nKey = 0;
+  int nData = 0;
+  int rc;
+
+  if( nVal!=LSM_VLOG_PTR_SIZE ) return LSM_CORRUPT_BKPT;
+  nStored = (int)lsmGetU32(&aPtr[8]);
+  if( nStored<0 ) return LSM_CORRUPT_BKPT;
+  rc = lsmFsVlogRead(
+      pDb->pFS, (i64)lsmGetU64(aPtr), &nStored, &aData, &nKey, &nData
+  );
+  if( rc==LSM_OK ){
+    if( aData==0 ){
+      pBlob->nData = 0;
+    }else if( nData!=(int)lsmGetU32(&aPtr[12]) ){
+      rc = LSM_CORRUPT_BKPT;
+    }else{
+      rc = sortedBlobSet(pDb->pEnv, pBlob, &aData[nKey], nData);
+    }
+  }
+  return rc;
+}
+
+/*
+** This is called before a record is written to a segment. If the record is
+** a write with a value larger than the LSM_CONFIG_VALUE_LOG threshold, its
+** key and value are appended to the value log. In this case, *ppVal and
+** *pnVal are set to the pointer to the new entry (written to aPtr[]) and
+** the LSM_VALUE_PTR flag is set in *peType.
+*/
+static int sortedVlogSeparate(
+  lsm_db *pDb,                    /* Database handle */
+  int *peType,                    /* IN/OUT: Record flags */
+  void *pKey, int nKey,           /* Key of record */
+  void **ppVal, int *pnVal,       /* IN/OUT: Value of record */
+  u8 *aPtr                        /* Buffer of LSM_VLOG_PTR_SIZE bytes */
 ){
-  int (*xCmp)(void *, int, void *, int) = pCsr->pDb->xCmp;
-  int res = 0;                        /* Result of comparison operation */
   int rc = LSM_OK;
-  int iMin;
-  int iMax;
-  LsmPgno iPtrOut = 0;
+  int eType = *peType;
+  const int eNot = (LSM_OPERAND|LSM_VALUE_PTR|LSM_SEPARATOR|LSM_SYSTEMKEY);
 
-  /* If the current page contains an oversized entry, then there are no
-  ** pointers to one or more of the subsequent pages in the sorted run.
-  ** The following call ensures that the segment-ptr points to the correct 
-  ** page in this case.  */
-  rc = segmentPtrSearchOversized(pCsr, pPtr, iTopic, pKey, nKey);
-  iPtrOut = pPtr->iPtr;
+  if( pDb->nVlogThreshold>0 
+   && *pnVal>LSM_MAX(pDb->nVlogThreshold, LSM_VLOG_PTR_SIZE)
+   && rtIsWrite(eType) && (eType & eNot)==0
+  ){
+    rc = lsmFsVlogAppend(pDb->pFS, pKey, nKey, *ppVal, *pnVal, aPtr);
+    if( rc==LSM_OK ){
+      *peType = (eType | LSM_VALUE_PTR);
+      *ppVal = (void *)aPtr;
+      *pnVal = LSM_VLOG_PTR_SIZE;
+    }
+  }
+  return rc;
+}
 
-  /* Assert that this page is the right page of this segment for the key
-  ** that we are searching for. Do this by loading page (iPg-1) and testing
-  ** that pKey/nKey is greater than all keys on that page, and then by 
-  ** loading (iPg+1) and testing that pKey/nKey is smaller than all
-  ** the keys it houses.  
-  **
-  ** TODO: With range-deletes in the tree, the test described above may fail.
-  */
+static int multiCursorMergeValue(MultiCursor *pCsr, void *pOld, int nOld){
+  lsm_db *pDb = pCsr->pDb;
+  void *pOut = 0;
+  int nOut = 0;
+  int rc;
+
+  if( pDb->xMerge==0 ) return LSM_MISMATCH;
+  rc = pDb->xMerge(pDb->pMergeCtx, pCsr->key.pData, pCsr->key.nData, 
+      pOld, nOld, pCsr->val.pData, pCsr->val.nData, &pOut, &nOut
+  );
+  if( rc==LSM_OK ){
+    if( nOut<0 || (pOut==0 && nOut>0) ) return LSM_MISUSE_BKPT;
+    rc = sortedBlobSet(pDb->pEnv, &pCsr->val, pOut, nOut);
+  }
+  return rc;
+}
+
+/*
+** This function is called during an LSM_SEEK_EQ seek when an entry with 
+** the LSM_INSERT flag set matching the key being sought has been found. If
+** it is the first such entry, the caller has already populated pCsr->key;
+** pCsr->val is populated here. Otherwise, all entries found so far were 
+** merge operands and this (older) value is combined with them.
+**
+** *pbStop is set unless the entry is itself a merge operand and older 
+** versions of the key must still be searched for.
+*/
+static int seekFoundEq(
+  MultiCursor *pCsr,              /* Multi-cursor being seeked */
+  int eType,                      /* Flags of entry found */
+  void *pVal, int nVal,           /* Value of entry found */
+  int *pbStop                     /* OUT: Set to true to halt the search */
+){
+  const int SD_ED = (LSM_START_DELETE|LSM_END_DELETE);
+  int rc;
+
+  if( pCsr->flags & CURSOR_KEYS_ONLY ){
+    /* Only the type of the entry matters, its value is never read. */
+    pVal = 0;
+    nVal = 0;
+    eType &= ~LSM_VALUE_PTR;
+  }
+
+  if( eType & LSM_VALUE_PTR ){
+    rc = sortedVlogRead(pCsr->pDb, pVal, nVal, &pCsr->vlog);
+    if( rc!=LSM_OK ) return rc;
+    pVal = pCsr->vlog.pData;
+    nVal = pCsr->vlog.nData;
+    eType &= ~LSM_VALUE_PTR;
+  }
+
+  if( pCsr->flags & CURSOR_SEEK_EQ ){
+    assert( pCsr->eType & LSM_OPERAND );
+    rc = LSM_OK;
+    if( (pCsr->flags & CURSOR_KEYS_ONLY)==0 ){
+      rc = multiCursorMergeValue(pCsr, pVal, nVal);
+    }
+    if( (eType & LSM_OPERAND)==0 ) pCsr->eType &= ~LSM_OPERAND;
+  }else{
+    pCsr->flags |= CURSOR_SEEK_EQ;
+    pCsr->eType = eType;
+    rc = sortedBlobSet(pCsr->pDb->pEnv, &pCsr->val, pVal, nVal);
+  }
+
+  if( (eType & LSM_OPERAND)==0 || (eType & SD_ED)==SD_ED ){
+    *pbStop = 1;
+  }
+  return rc;
+}
+
+/*
+** Search page pPtr->pPg, which has the PGFTR_PREFIX_FLAG flag set, for key
+** (iTopic, pKey, nKey). The restart points, which store their keys in full,
+** are binary searched for the last one with a key no larger than the key
+** sought. The cells following it are then loaded in order, so that each 
+** key is decoded from the one before it, up to the first key that is not
+** smaller than the key sought, or the last cell before the next restart 
+** point.
+**
+** Cell pPtr->iCell is then the cell a binary search of all cells would 
+** have stopped at, and *pRes is set to the result of comparing its key with
+** the key sought. *piPtrOut is set to the cascade pointer of the last cell
+** loaded with a key not larger than the key sought, if any.
+*/
+static int segmentPtrSeekPrefix(
+  MultiCursor *pCsr,              /* Cursor context */
+  SegmentPtr *pPtr,               /* Pointer to seek */
+  int iTopic,                     /* Key topic to seek to */
+  void *pKey, int nKey,           /* Key to seek to */
+  LsmPgno *piPtrOut,              /* IN/OUT: FC pointer */
+  int *pRes                       /* OUT: Result of last comparison */
+){
+  int (*xCmp)(void *, int, void *, int) = pCsr->pDb->xCmp;
+  int rc = LSM_OK;
+  int res = 0;
+  int iMin = 0;
+  int iMax = (pPtr->nCell-1) / LSM_PREFIX_RESTART;
+  int iCell;
+  int iEnd;
+
+  while( iMin<iMax ){
+    int iTry = (iMin+iMax+1)/2;
+    rc = segmentPtrLoadCell(pPtr, iTry*LSM_PREFIX_RESTART);
+    if( rc!=LSM_OK ) return rc;
+    res = sortedKeyCompare(xCmp, rtTopic(pPtr->eType), 
+        pPtr->pKey, pPtr->nKey, iTopic, pKey, nKey
+    );
+    if( res>0 ){
+      iMax = iTry-1;
+    }else{
+      iMin = iTry;
+      if( res==0 ) break;
+    }
+  }
+
+  iEnd = LSM_MIN(pPtr->nCell, (iMin+1)*LSM_PREFIX_RESTART);
+  for(iCell=iMin*LSM_PREFIX_RESTART; iCell<iEnd; iCell++){
+    rc = segmentPtrLoadCell(pPtr, iCell);
+    if( rc!=LSM_OK ) return rc;
+    res = sortedKeyCompare(xCmp, rtTopic(pPtr->eType), 
+        pPtr->pKey, pPtr->nKey, iTopic, pKey, nKey
+    );
+    if( res<=0 ) *piPtrOut = pPtr->iPtr + pPtr->iPgPtr;
+    if( res>=0 ) break;
+  }
+
+  *pRes = res;
+  return rc;
+}
+
+static int segmentPtrSeek(
+  MultiCursor *pCsr,              /* Cursor context */
+  SegmentPtr *pPtr,               /* Pointer to seek */
+  int iTopic,                     /* Key topic to seek to */
+  void *pKey, int nKey,           /* Key to seek to */
+  int eSeek,                      /* Search bias - see above */
+  LsmPgno *piPtr,                 /* OUT: FC pointer */
+  int *pbStop
+){
+  int (*xCmp)(void *, int, void *, int) = pCsr->pDb->xCmp;
+  int res = 0;                        /* Result of comparison operation */
+  int rc = LSM_OK;
+  int iMin;
+  int iMax;
+  LsmPgno iPtrOut = 0;
+
+  /* If the current page contains an oversized entry, then there are no
+  ** pointers to one or more of the subsequent pages in the sorted run.
+  ** The following call ensures that the segment-ptr points to the correct 
+  ** page in this case.  */
+  rc = segmentPtrSearchOversized(pCsr, pPtr, iTopic, pKey, nKey);
+  iPtrOut = pPtr->iPtr;
+
+  /* Assert that this page is the right page of this segment for the key
+  ** that we are searching for. Do this by loading page (iPg-1) and testing
+  ** that pKey/nKey is greater than all keys on that page, and then by 
+  ** loading (iPg+1) and testing that pKey/nKey is smaller than all
+  ** the keys it houses.  
+  **
+  ** TODO: With range-deletes in the tree, the test described above may fail.
+  */
 #if 0
   assert( assertKeyLocation(pCsr, pPtr, pKey, nKey) );
 #endif
@@ -12283,30 +15394,35 @@ static int segmentPtrSeek(
     iMin = 0;
     iMax = pPtr->nCell-1;
 
-    while( 1 ){
-      int iTry = (iMin+iMax)/2;
-      void *pKeyT; int nKeyT;       /* Key for cell iTry */
-      int iTopicT;
+    if( pPtr->flags & PGFTR_PREFIX_FLAG ){
+      rc = segmentPtrSeekPrefix(pCsr, pPtr, iTopic, pKey, nKey, &iPtrOut, &res);
+      iMin = iMax = pPtr->iCell;
+    }else{
+      while( 1 ){
+        int iTry = (iMin+iMax)/2;
+        void *pKeyT; int nKeyT;       /* Key for cell iTry */
+        int iTopicT;
 
-      assert( iTry<iMax || iMin==iMax );
+        assert( iTry<iMax || iMin==iMax );
 
-      rc = segmentPtrLoadCell(pPtr, iTry);
-      if( rc!=LSM_OK ) break;
+        rc = segmentPtrLoadCell(pPtr, iTry);
+        if( rc!=LSM_OK ) break;
 
-      segmentPtrKey(pPtr, &pKeyT, &nKeyT);
-      iTopicT = rtTopic(pPtr->eType);
+        segmentPtrKey(pPtr, &pKeyT, &nKeyT);
+        iTopicT = rtTopic(pPtr->eType);
 
-      res = sortedKeyCompare(xCmp, iTopicT, pKeyT, nKeyT, iTopic, pKey, nKey);
-      if( res<=0 ){
-        iPtrOut = pPtr->iPtr + pPtr->iPgPtr;
-      }
+        res = sortedKeyCompare(xCmp, iTopicT, pKeyT, nKeyT, iTopic, pKey, nKey);
+        if( res<=0 ){
+          iPtrOut = pPtr->iPtr + pPtr->iPgPtr;
+        }
 
-      if( res==0 || iMin==iMax ){
-        break;
-      }else if( res>0 ){
-        iMax = LSM_MAX(iTry-1, iMin);
-      }else{
-        iMin = iTry+1;
+        if( res==0 || iMin==iMax ){
+          break;
+        }else if( res>0 ){
+          iMax = LSM_MAX(iTry-1, iMin);
+        }else{
+          iMin = iTry+1;
+        }
       }
     }
 
@@ -12328,13 +15444,15 @@ static int segmentPtrSeek(
               *pbStop = 1;
             }else if( res==0 && (eType & LSM_INSERT) ){
               lsm_env *pEnv = pCsr->pDb->pEnv;
-              *pbStop = 1;
-              pCsr->eType = pPtr->eType;
-              rc = sortedBlobSet(pEnv, &pCsr->key, pPtr->pKey, pPtr->nKey);
+              if( (pCsr->flags & CURSOR_SEEK_EQ)==0 ){
+                rc = sortedBlobSet(pEnv, &pCsr->key, pPtr->pKey, pPtr->nKey);
+              }
+              if( rc==LSM_OK && (pCsr->flags & CURSOR_KEYS_ONLY)==0 ){
+                rc = segmentPtrLoadValue(pPtr);
+              }
               if( rc==LSM_OK ){
-                rc = sortedBlobSet(pEnv, &pCsr->val, pPtr->pVal, pPtr->nVal);
+                rc = seekFoundEq(pCsr, eType, pPtr->pVal, pPtr->nVal, pbStop);
               }
-              pCsr->flags |= CURSOR_SEEK_EQ;
             }
             segmentPtrReset(pPtr, LSM_SEGMENTPTR_FREE_THRESHOLD);
             break;
@@ -12575,6 +15693,7 @@ static int seekInLevel(
             pPtr->nKey = pLvl->nSplitKey;
             pPtr->pVal = 0;
             pPtr->nVal = 0;
+            pPtr->iValOff = 0;
           }else{
             segmentPtrReset(pPtr, LSM_SEGMENTPTR_FREE_THRESHOLD);
           }
@@ -12612,6 +15731,7 @@ static void multiCursorGetKey(
       TreeCursor *pTreeCsr = pCsr->apTreeCsr[iKey-CURSOR_DATA_TREE0];
       if( lsmTreeCursorValid(pTreeCsr) ){
         lsmTreeCursorKey(pTreeCsr, &eType, &pKey, &nKey);
+        eType &= ~LSM_CONTIGUOUS;
       }
       break;
     }
@@ -12719,6 +15839,35 @@ static int sortedDbKeyCompare(
   return res;
 }
 
+/*
+** Set *p to the prefix of key pKey/nKey of type eType (or of no key at all,
+** if pKey is NULL).
+*/
+static void cursorPrefixSet(CursorPrefix *p, int eType, void *pKey, int nKey){
+  if( pKey==0 ){
+    p->iTopic = -1;
+  }else{
+    if( nKey>=8 ){
+      p->iPrefix = keyGetU64(pKey);
+    }else{
+      u8 aBuf[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+      memcpy(aBuf, pKey, nKey);
+      p->iPrefix = lsmGetU64(aBuf);
+    }
+    p->iTopic = rtTopic(eType);
+  }
+}
+
+/*
+** Set pCsr->aTree[iOut] to the winner of the two entries below it.
+**
+** Unless a custom comparison function is configured, keys are ordered by
+** memcmp(). In that case, the prefixes of both leaves are cached whenever a
+** node just above the leaves is compared (which is always the case before
+** the nodes above it are, as the tree is only ever updated bottom-up). At
+** inner nodes, the prefixes decide the comparison without loading either
+** key, unless they are the same.
+*/
 static void multiCursorDoCompare(MultiCursor *pCsr, int iOut, int bReverse){
   int i1;
   int i2;
@@ -12726,18 +15875,52 @@ static void multiCursorDoCompare(MultiCursor *pCsr, int iOut, int bReverse){
   void *pKey1; int nKey1; int eType1;
   void *pKey2; int nKey2; int eType2;
   const int mul = (bReverse ? -1 : 1);
+  const int bPrefix = (pCsr->pDb->eKeyFormat!=LSM_KEY_FORMAT_CUSTOM);
+  int bLoaded = 0;                /* True once both keys have been loaded */
 
   assert( pCsr->aTree && iOut<pCsr->nTree );
   if( iOut>=(pCsr->nTree/2) ){
     i1 = (iOut - pCsr->nTree/2) * 2;
     i2 = i1 + 1;
+    if( bPrefix ){
+      multiCursorGetKey(pCsr, i1, &eType1, &pKey1, &nKey1);
+      multiCursorGetKey(pCsr, i2, &eType2, &pKey2, &nKey2);
+      cursorPrefixSet(&pCsr->aPrefix[i1], eType1, pKey1, nKey1);
+      cursorPrefixSet(&pCsr->aPrefix[i2], eType2, pKey2, nKey2);
+      bLoaded = 1;
+    }
   }else{
     i1 = pCsr->aTree[iOut*2];
     i2 = pCsr->aTree[iOut*2+1];
   }
 
-  multiCursorGetKey(pCsr, i1, &eType1, &pKey1, &nKey1);
-  multiCursorGetKey(pCsr, i2, &eType2, &pKey2, &nKey2);
+  if( bPrefix ){
+    CursorPrefix *p1 = &pCsr->aPrefix[i1];
+    CursorPrefix *p2 = &pCsr->aPrefix[i2];
+    if( p1->iTopic<0 ){
+      pCsr->aTree[iOut] = i2;
+      return;
+    }
+    if( p2->iTopic<0 ){
+      pCsr->aTree[iOut] = i1;
+      return;
+    }
+    if( p1->iTopic!=p2->iTopic || p1->iPrefix!=p2->iPrefix ){
+      int res;
+      if( p1->iTopic!=p2->iTopic ){
+        res = p1->iTopic - p2->iTopic;
+      }else{
+        res = (p1->iPrefix<p2->iPrefix) ? -1 : +1;
+      }
+      pCsr->aTree[iOut] = ((res * mul)<0) ? i1 : i2;
+      return;
+    }
+  }
+
+  if( bLoaded==0 ){
+    multiCursorGetKey(pCsr, i1, &eType1, &pKey1, &nKey1);
+    multiCursorGetKey(pCsr, i2, &eType2, &pKey2, &nKey2);
+  }
 
   if( pKey1==0 ){
     iRes = i2;
@@ -12870,6 +16053,7 @@ static void mcursorFreeComponents(MultiCursor *pCsr){
   pCsr->aPtr = 0;
   pCsr->nTree = 0;
   pCsr->aTree = 0;
+  pCsr->aPrefix = 0;
   pCsr->pSystemVal = 0;
   pCsr->apTreeCsr[0] = 0;
   pCsr->apTreeCsr[1] = 0;
@@ -12928,6 +16112,7 @@ static void lsmMCursorClose(MultiCursor *pCsr, int bCache){
       /* Free the allocation used to cache the current key, if any. */
       sortedBlobFree(&pCsr->key);
       sortedBlobFree(&pCsr->val);
+      sortedBlobFree(&pCsr->vlog);
 
       /* Free the component cursors */
       mcursorFreeComponents(pCsr);
@@ -12986,13 +16171,16 @@ static int multiCursorAddRhs(MultiCursor *pCsr, Level *pLvl){
 static void multiCursorAddOne(MultiCursor *pCsr, Level *pLvl, int *pRc){
   if( *pRc==LSM_OK ){
     int iPtr = pCsr->nPtr;
+    int bLazyVal = (pCsr->flags & CURSOR_LAZY_VALUES)!=0;
     int i;
     pCsr->aPtr[iPtr].pLevel = pLvl;
     pCsr->aPtr[iPtr].pSeg = &pLvl->lhs;
+    pCsr->aPtr[iPtr].bLazyVal = bLazyVal;
     iPtr++;
     for(i=0; i<pLvl->nRight; i++){
       pCsr->aPtr[iPtr].pLevel = pLvl;
       pCsr->aPtr[iPtr].pSeg = &pLvl->aRhs[i];
+      pCsr->aPtr[iPtr].bLazyVal = bLazyVal;
       iPtr++;
     }
 
@@ -13124,6 +16312,7 @@ static int lsmMCursorNew(
     }
 
     pCsr->flags = (CURSOR_IGNORE_SYSTEM | CURSOR_IGNORE_DELETE);
+    lsmMCursorValues(pCsr, LSM_CURSOR_VALUES_EAGER);
 
   }else{
     pCsr = multiCursorNew(pDb, &rc);
@@ -13183,8 +16372,11 @@ static int multiCursorGetVal(
       if( iPtr<pCsr->nPtr ){
         SegmentPtr *pPtr = &pCsr->aPtr[iPtr];
         if( pPtr->pPg ){
-          *ppVal = pPtr->pVal;
-          *pnVal = pPtr->nVal;
+          rc = segmentPtrLoadValue(pPtr);
+          if( rc==LSM_OK ){
+            *ppVal = pPtr->pVal;
+            *pnVal = pPtr->nVal;
+          }
         }
       }
     }
@@ -13311,13 +16503,17 @@ static int multiCursorAllocTree(MultiCursor *pCsr){
       pCsr->nTree = pCsr->nTree*2;
     }
 
-    nByte = sizeof(int)*pCsr->nTree*2;
+    nByte = sizeof(int)*pCsr->nTree*2 + sizeof(CursorPrefix)*pCsr->nTree;
     pCsr->aTree = (int *)lsmMallocZeroRc(pCsr->pDb->pEnv, nByte, &rc);
+    if( pCsr->aTree ){
+      pCsr->aPrefix = (CursorPrefix *)&pCsr->aTree[pCsr->nTree*2];
+    }
   }
   return rc;
 }
 
 static void multiCursorCacheKey(MultiCursor *pCsr, int *pRc){
+  pCsr->flags &= ~CURSOR_VALUE_MERGED;
   if( *pRc==LSM_OK ){
     void *pKey;
     int nKey;
@@ -13330,6 +16526,7 @@ static void multiCursorCacheKey(MultiCursor *pCsr, int *pRc){
 static void assertCursorTree(MultiCursor *pCsr){
   int bRev = !!(pCsr->flags & CURSOR_PREV_OK);
   int *aSave = pCsr->aTree;
+  CursorPrefix *aPrefixSave = pCsr->aPrefix;
   int nSave = pCsr->nTree;
   int rc;
 
@@ -13350,6 +16547,7 @@ static void assertCursorTree(MultiCursor *pCsr){
   }
 
   pCsr->aTree = aSave;
+  pCsr->aPrefix = aPrefixSave;
   pCsr->nTree = nSave;
 }
 #else
@@ -13459,6 +16657,88 @@ static int mcursorLocationOk(MultiCursor *pCsr, int bDeleteOk){
   return 1;
 }
 
+/*
+** Sub-cursor iKey of multi-cursor pCsr points to an older version of the 
+** key that the multi-cursor currently points to. Return true if that 
+** version has been deleted by a range-delete in a newer sub-cursor. This is
+** the case if a newer sub-cursor points either to a key beyond the current
+** key (in the direction of iteration) that ends a range-delete, or to the
+** current key itself, flagged as being covered by a range-delete on both 
+** sides.
+*/
+static int multiCursorVersionDeleted(MultiCursor *pCsr, int iKey){
+  const int SD_ED = (LSM_START_DELETE|LSM_END_DELETE);
+  int rdmask;
+  int i;
+
+  rdmask = (pCsr->flags & CURSOR_NEXT_OK) ? LSM_END_DELETE : LSM_START_DELETE;
+  for(i=0; i<iKey; i++){
+    int eType; void *pKey; int nKey;
+    multiCursorGetKey(pCsr, i, &eType, &pKey, &nKey);
+    if( pKey ){
+      int res = sortedKeyCompare(pCsr->pDb->xCmp,
+          rtTopic(pCsr->eType), pCsr->key.pData, pCsr->key.nData,
+          rtTopic(eType), pKey, nKey
+      );
+      if( res==0 ){
+        if( (eType & SD_ED)==SD_ED ) return 1;
+      }else if( eType & rdmask ){
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+/*
+** The multi-cursor points to a merge operand, the value of which has been
+** loaded from sub-cursor iVal into pCsr->val. Combine it with the older 
+** versions of the same key that the other sub-cursors point to, from the 
+** newest to the oldest, until either a value that is not a merge operand 
+** or a delete is found. 
+**
+** *pbBase is set to true if such a value or delete is found, or to false
+** if the older versions are exhausted first. In the latter case, the 
+** result is the combination of all merge operands found.
+*/
+static int multiCursorMergeOperands(MultiCursor *pCsr, int iVal, int *pbBase){
+  int rc = LSM_OK;
+  int i;
+
+  *pbBase = 0;
+  for(i=iVal+1; rc==LSM_OK && i<(CURSOR_DATA_SEGMENT+pCsr->nPtr); i++){
+    int eType; void *pKey; int nKey;
+    multiCursorGetKey(pCsr, i, &eType, &pKey, &nKey);
+    if( pKey==0 
+     || rtIsSeparator(eType)
+     || (eType & (LSM_INSERT|LSM_POINT_DELETE))==0 
+     || sortedKeyCompare(pCsr->pDb->xCmp,
+          rtTopic(pCsr->eType), pCsr->key.pData, pCsr->key.nData,
+          rtTopic(eType), pKey, nKey
+        )
+    ){
+      continue;
+    }
+
+    if( (eType & LSM_POINT_DELETE) || multiCursorVersionDeleted(pCsr, i) ){
+      *pbBase = 1;
+    }else{
+      void *pOld; int nOld;
+      rc = multiCursorGetVal(pCsr, i, &pOld, &nOld);
+      if( rc==LSM_OK && (eType & LSM_VALUE_PTR) ){
+        rc = sortedVlogRead(pCsr->pDb, pOld, nOld, &pCsr->vlog);
+        pOld = pCsr->vlog.pData;
+        nOld = pCsr->vlog.nData;
+      }
+      if( rc==LSM_OK ) rc = multiCursorMergeValue(pCsr, pOld, nOld);
+      *pbBase = ((eType & LSM_OPERAND)==0);
+    }
+    if( *pbBase ) break;
+  }
+
+  return rc;
+}
+
 static int multiCursorSetupTree(MultiCursor *pCsr, int bRev){
   int rc;
 
@@ -13484,7 +16764,8 @@ static int multiCursorEnd(MultiCursor *pCsr, int bLast){
   int rc = LSM_OK;
   int i;
 
-  pCsr->flags &= ~(CURSOR_NEXT_OK | CURSOR_PREV_OK | CURSOR_SEEK_EQ);
+  pCsr->flags &= ~(CURSOR_NEXT_OK | CURSOR_PREV_OK | CURSOR_SEEK_EQ
+                 | CURSOR_VALUE_MERGED);
   pCsr->flags |= (bLast ? CURSOR_PREV_OK : CURSOR_NEXT_OK);
   pCsr->iFree = 0;
 
@@ -13631,12 +16912,12 @@ static int treeCursorSeek(
         }else if( res==0 && (eType & LSM_INSERT) ){
           lsm_env *pEnv = pCsr->pDb->pEnv;
           void *p; int n;         /* Key/value from tree-cursor */
-          *pbStop = 1;
-          pCsr->flags |= CURSOR_SEEK_EQ;
-          rc = lsmTreeCursorKey(pTreeCsr, &pCsr->eType, &p, &n);
-          if( rc==LSM_OK ) rc = sortedBlobSet(pEnv, &pCsr->key, p, n);
+          if( (pCsr->flags & CURSOR_SEEK_EQ)==0 ){
+            rc = lsmTreeCursorKey(pTreeCsr, 0, &p, &n);
+            if( rc==LSM_OK ) rc = sortedBlobSet(pEnv, &pCsr->key, p, n);
+          }
           if( rc==LSM_OK ) rc = lsmTreeCursorValue(pTreeCsr, &p, &n);
-          if( rc==LSM_OK ) rc = sortedBlobSet(pEnv, &pCsr->val, p, n);
+          if( rc==LSM_OK ) rc = seekFoundEq(pCsr, eType, p, n, pbStop);
         }
         lsmTreeCursorReset(pTreeCsr);
         break;
@@ -13682,7 +16963,8 @@ static int lsmMCursorSeek(
   assert( (pCsr->flags & CURSOR_FLUSH_FREELIST)==0 );
   assert( pCsr->nPtr==0 || pCsr->aPtr[0].pLevel );
 
-  pCsr->flags &= ~(CURSOR_NEXT_OK | CURSOR_PREV_OK | CURSOR_SEEK_EQ);
+  pCsr->flags &= ~(CURSOR_NEXT_OK | CURSOR_PREV_OK | CURSOR_SEEK_EQ
+                 | CURSOR_VALUE_MERGED);
   rc = treeCursorSeek(pCsr, pCsr->apTreeCsr[0], pKey, nKey, eESeek, &bStop);
   if( rc==LSM_OK && bStop==0 ){
     rc = treeCursorSeek(pCsr, pCsr->apTreeCsr[1], pKey, nKey, eESeek, &bStop);
@@ -13728,67 +17010,270 @@ static int lsmMCursorSeek(
   return rc;
 }
 
-static int lsmMCursorValid(MultiCursor *pCsr){
-  int res = 0;
-  if( pCsr->flags & CURSOR_SEEK_EQ ){
-    res = 1;
-  }else if( pCsr->aTree ){
-    int iKey = pCsr->aTree[1];
-    if( iKey==CURSOR_DATA_TREE0 || iKey==CURSOR_DATA_TREE1 ){
-      res = lsmTreeCursorValid(pCsr->apTreeCsr[iKey-CURSOR_DATA_TREE0]);
-    }else{
-      void *pKey; 
-      multiCursorGetKey(pCsr, iKey, 0, &pKey, 0);
-      res = pKey!=0;
-    }
-  }
-  return res;
-}
-
-static int mcursorAdvanceOk(
-  MultiCursor *pCsr, 
-  int bReverse,
-  int *pRc
+/*
+** Segment pointer pPtr belongs to a forward iterating cursor, so that it
+** points to the first entry of its segment with a key not smaller than the
+** current key of the cursor (or is at EOF). This function attempts to move
+** it to the first entry with a key not smaller than (pKey/nKey) instead,
+** which is assumed to be no smaller than the current key of the cursor.
+**
+** The key is searched for on the current page of pPtr only. If all keys on
+** the page are smaller, the first entry of the next page is tried as well.
+** If the entry cannot be found that way, *pbFound is set to 0 and the state
+** of pPtr is undefined. Otherwise, *pbFound is set to 1.
+*/
+static int segmentPtrSeekForward(
+  MultiCursor *pCsr,              /* Cursor context */
+  SegmentPtr *pPtr,               /* Pointer to seek */
+  void *pKey, int nKey,           /* Key to seek to */
+  int *pbFound                    /* OUT: True if entry was found */
 ){
-  void *pNew;                     /* Pointer to buffer containing new key */
-  int nNew;                       /* Size of buffer pNew in bytes */
-  int eNewType;                   /* Type of new record */
-
-  if( *pRc ) return 1;
+  int (*xCmp)(void *, int, void *, int) = pCsr->pDb->xCmp;
+  int rc = LSM_OK;
+  int iMin;
+  int iMax;
 
-  /* Check the current key value. If it is not greater than (if bReverse==0)
-  ** or less than (if bReverse!=0) the key currently cached in pCsr->key, 
-  ** then the cursor has not yet been successfully advanced.  
-  */
-  multiCursorGetKey(pCsr, pCsr->aTree[1], &eNewType, &pNew, &nNew);
-  if( pNew ){
-    int typemask = (pCsr->flags & CURSOR_IGNORE_DELETE) ? ~(0) : LSM_SYSTEMKEY;
-    int res = sortedDbKeyCompare(pCsr,
-      eNewType & typemask, pNew, nNew, 
-      pCsr->eType & typemask, pCsr->key.pData, pCsr->key.nData
-    );
+  /* Levels undergoing an incremental merge are sought from scratch, as 
+  ** their segment pointers do not simply follow each segment in order.  */
+  *pbFound = 0;
+  if( pPtr->pLevel->nRight ) return LSM_OK;
+  *pbFound = 1;
+  if( pPtr->pPg==0 ) return LSM_OK;
+  if( pPtr->nCell==0 ){
+    *pbFound = 0;
+    return LSM_OK;
+  }
 
-    if( (bReverse==0 && res<=0) || (bReverse!=0 && res>=0) ){
-      return 0;
+  /* Find the first cell on the page, starting with the current one, with a
+  ** key that is not smaller than (pKey/nKey). Or, if there is no such cell,
+  ** set iMin to nCell.  */
+  iMin = pPtr->iCell;
+  iMax = pPtr->nCell;
+  while( rc==LSM_OK && iMin<iMax ){
+    int iTry = (iMin+iMax)/2;
+    rc = segmentPtrLoadCell(pPtr, iTry);
+    if( rc==LSM_OK ){
+      int res = sortedKeyCompare(xCmp, 
+          rtTopic(pPtr->eType), pPtr->pKey, pPtr->nKey, 0, pKey, nKey
+      );
+      if( res<0 ){
+        iMin = iTry+1;
+      }else{
+        iMax = iTry;
+      }
     }
+  }
 
-    multiCursorCacheKey(pCsr, pRc);
-    assert( pCsr->eType==eNewType );
-
-    /* If this cursor is configured to skip deleted keys, and the current
-    ** cursor points to a SORTED_DELETE entry, then the cursor has not been 
-    ** successfully advanced.  
-    **
-    ** Similarly, if the cursor is configured to skip system keys and the
-    ** current cursor points to a system key, it has not yet been advanced.
-    */
-    if( *pRc==LSM_OK && 0==mcursorLocationOk(pCsr, 0) ) return 0;
+  if( rc==LSM_OK ){
+    if( iMin<pPtr->nCell ){
+      rc = segmentPtrLoadCell(pPtr, iMin);
+      if( rc==LSM_OK
+       && segmentPtrIgnoreSeparators(pCsr, pPtr) 
+       && rtIsSeparator(pPtr->eType)
+      ){
+        rc = segmentPtrAdvance(pCsr, pPtr, 0);
+      }
+    }else{
+      rc = segmentPtrLoadCell(pPtr, pPtr->nCell-1);
+      if( rc==LSM_OK ) rc = segmentPtrAdvance(pCsr, pPtr, 0);
+      if( rc==LSM_OK && pPtr->pPg ){
+        int res = sortedKeyCompare(xCmp, 
+            rtTopic(pPtr->eType), pPtr->pKey, pPtr->nKey, 0, pKey, nKey
+        );
+        if( res<0 ) *pbFound = 0;
+      }
+    }
   }
-  return 1;
+
+  return rc;
 }
 
-static void flCsrAdvance(MultiCursor *pCsr){
-  assert( pCsr->flags & CURSOR_FLUSH_FREELIST );
+/*
+** Seek the cursor to the first entry with a key not smaller than pKey/nKey,
+** as lsmMCursorSeek() does for LSM_SEEK_GE. If the cursor is iterating 
+** forwards, and the key is not smaller than its current key, the segment
+** pointers are moved forward from where they are (see 
+** segmentPtrSeekForward()). Otherwise, or if that fails for any of them, 
+** the cursor is sought from scratch.
+*/
+static int lsmMCursorSeekForward(MultiCursor *pCsr, void *pKey, int nKey){
+  int rc = LSM_OK;
+  int bFound = 0;
+
+  if( (pCsr->flags & CURSOR_NEXT_OK)
+   && (pCsr->flags & CURSOR_SEEK_EQ)==0
+   && pCsr->pBtCsr==0
+   && lsmMCursorValid(pCsr)
+   && sortedKeyCompare(pCsr->pDb->xCmp,
+         rtTopic(pCsr->eType), pCsr->key.pData, pCsr->key.nData, 0, pKey, nKey
+      )<=0
+  ){
+    int iPtr;
+    bFound = 1;
+    for(iPtr=0; rc==LSM_OK && bFound && iPtr<pCsr->nPtr; iPtr++){
+      rc = segmentPtrSeekForward(pCsr, &pCsr->aPtr[iPtr], pKey, nKey, &bFound);
+    }
+  }
+
+  if( rc!=LSM_OK ) return rc;
+  if( bFound==0 ){
+    return lsmMCursorSeek(pCsr, 0, pKey, nKey, LSM_SEEK_GE);
+  }
+
+  /* The in-memory trees are searched from their roots. */
+  rc = treeCursorSeek(pCsr, pCsr->apTreeCsr[0], pKey, nKey, LSM_SEEK_GE, 0);
+  if( rc==LSM_OK ){
+    rc = treeCursorSeek(pCsr, pCsr->apTreeCsr[1], pKey, nKey, LSM_SEEK_GE, 0);
+  }
+  if( rc==LSM_OK ){
+    int i;
+    for(i=pCsr->nTree-1; i>0; i--){
+      multiCursorDoCompare(pCsr, i, 0);
+    }
+    multiCursorCacheKey(pCsr, &rc);
+    if( rc==LSM_OK && 0==mcursorLocationOk(pCsr, 0) ){
+      rc = lsmMCursorNext(pCsr);
+    }
+  }
+
+  return rc;
+}
+
+/*
+** Configure how the cursor reads values. Parameter eValues must be one of
+** the LSM_CURSOR_VALUES_* constants. See lsm_csr_values() for details.
+*/
+static void lsmMCursorValues(MultiCursor *pCsr, int eValues){
+  int iPtr;
+  int bLazyVal = (eValues!=LSM_CURSOR_VALUES_EAGER);
+
+  pCsr->flags &= ~(CURSOR_LAZY_VALUES | CURSOR_KEYS_ONLY);
+  if( bLazyVal ) pCsr->flags |= CURSOR_LAZY_VALUES;
+  if( eValues==LSM_CURSOR_VALUES_NONE ) pCsr->flags |= CURSOR_KEYS_ONLY;
+  for(iPtr=0; iPtr<pCsr->nPtr; iPtr++){
+    pCsr->aPtr[iPtr].bLazyVal = bLazyVal;
+  }
+}
+
+/*
+** Copy entries into buffer aBuf, starting with the one the cursor points
+** to, and advance the cursor past them. See lsm_csr_next_batch() for 
+** details.
+*/
+static int lsmMCursorNextBatch(
+  MultiCursor *pCsr,              /* Cursor to read entries from */
+  int nMaxRecord,                 /* Maximum number of entries to copy */
+  u8 *aBuf, int nBuf,             /* Buffer to copy entries into */
+  int *pnRecord,                  /* OUT: Number of entries copied */
+  int *pnByte                     /* OUT: Bytes of aBuf used (or required) */
+){
+  int rc = LSM_OK;
+  int nRecord = 0;
+  int nByte = 0;
+
+  if( lsmMCursorValid(pCsr) && (pCsr->flags & CURSOR_NEXT_OK)==0 ){
+    rc = LSM_MISUSE_BKPT;
+  }
+
+  while( rc==LSM_OK && nRecord<nMaxRecord && lsmMCursorValid(pCsr) ){
+    void *pKey; int nKey;
+    void *pVal; int nVal;
+    int nEntry;
+
+    /* Values stored as they are are copied straight from the page (or the
+    ** in-memory tree) they are on, skipping the cursor's value buffer. */
+    rc = lsmMCursorKey(pCsr, &pKey, &nKey);
+    pVal = 0;
+    nVal = 0;
+    if( rc==LSM_OK && (pCsr->flags & CURSOR_KEYS_ONLY)==0 ){
+      rc = multiCursorGetVal(pCsr, pCsr->aTree[1], &pVal, &nVal);
+      if( rc==LSM_OK && (pCsr->eType & (LSM_VALUE_PTR|LSM_OPERAND)) ){
+        rc = lsmMCursorValue(pCsr, &pVal, &nVal);
+      }
+    }
+    if( rc!=LSM_OK ) break;
+
+    nEntry = 8 + nKey + nVal;
+    if( nEntry>nBuf-nByte ){
+      if( nRecord==0 ) nByte = nEntry;
+      break;
+    }
+    lsmPutU32(&aBuf[nByte], (u32)nKey);
+    lsmPutU32(&aBuf[nByte+4], (u32)nVal);
+    if( nKey ) memcpy(&aBuf[nByte+8], pKey, nKey);
+    if( nVal ) memcpy(&aBuf[nByte+8+nKey], pVal, nVal);
+    nByte += nEntry;
+    nRecord++;
+
+    rc = lsmMCursorNext(pCsr);
+  }
+
+  *pnRecord = nRecord;
+  *pnByte = nByte;
+  return rc;
+}
+
+static int lsmMCursorValid(MultiCursor *pCsr){
+  int res = 0;
+  if( pCsr->flags & CURSOR_SEEK_EQ ){
+    res = 1;
+  }else if( pCsr->aTree ){
+    int iKey = pCsr->aTree[1];
+    if( iKey==CURSOR_DATA_TREE0 || iKey==CURSOR_DATA_TREE1 ){
+      res = lsmTreeCursorValid(pCsr->apTreeCsr[iKey-CURSOR_DATA_TREE0]);
+    }else{
+      void *pKey; 
+      multiCursorGetKey(pCsr, iKey, 0, &pKey, 0);
+      res = pKey!=0;
+    }
+  }
+  return res;
+}
+
+static int mcursorAdvanceOk(
+  MultiCursor *pCsr, 
+  int bReverse,
+  int *pRc
+){
+  void *pNew;                     /* Pointer to buffer containing new key */
+  int nNew;                       /* Size of buffer pNew in bytes */
+  int eNewType;                   /* Type of new record */
+
+  if( *pRc ) return 1;
+
+  /* Check the current key value. If it is not greater than (if bReverse==0)
+  ** or less than (if bReverse!=0) the key currently cached in pCsr->key, 
+  ** then the cursor has not yet been successfully advanced.  
+  */
+  multiCursorGetKey(pCsr, pCsr->aTree[1], &eNewType, &pNew, &nNew);
+  if( pNew ){
+    int typemask = (pCsr->flags & CURSOR_IGNORE_DELETE) ? ~(0) : LSM_SYSTEMKEY;
+    int res = sortedDbKeyCompare(pCsr,
+      eNewType & typemask, pNew, nNew, 
+      pCsr->eType & typemask, pCsr->key.pData, pCsr->key.nData
+    );
+
+    if( (bReverse==0 && res<=0) || (bReverse!=0 && res>=0) ){
+      return 0;
+    }
+
+    multiCursorCacheKey(pCsr, pRc);
+    assert( pCsr->eType==eNewType );
+
+    /* If this cursor is configured to skip deleted keys, and the current
+    ** cursor points to a SORTED_DELETE entry, then the cursor has not been 
+    ** successfully advanced.  
+    **
+    ** Similarly, if the cursor is configured to skip system keys and the
+    ** current cursor points to a system key, it has not yet been advanced.
+    */
+    if( *pRc==LSM_OK && 0==mcursorLocationOk(pCsr, 0) ) return 0;
+  }
+  return 1;
+}
+
+static void flCsrAdvance(MultiCursor *pCsr){
+  assert( pCsr->flags & CURSOR_FLUSH_FREELIST );
   if( pCsr->iFree % 2 ){
     pCsr->iFree++;
   }else{
@@ -13930,7 +17415,13 @@ static int lsmMCursorValue(MultiCursor *pCsr, void **ppVal, int *pnVal){
   void *pVal;
   int nVal;
   int rc;
-  if( (pCsr->flags & CURSOR_SEEK_EQ) || pCsr->aTree==0 ){
+  if( pCsr->flags & CURSOR_KEYS_ONLY ){
+    rc = LSM_MISUSE_BKPT;
+    nVal = 0;
+    pVal = 0;
+  }else if( (pCsr->flags & (CURSOR_SEEK_EQ|CURSOR_VALUE_MERGED)) 
+         || pCsr->aTree==0 
+  ){
     rc = LSM_OK;
     nVal = pCsr->val.nData;
     pVal = pCsr->val.pData;
@@ -13940,11 +17431,26 @@ static int lsmMCursorValue(MultiCursor *pCsr, void **ppVal, int *pnVal){
     assert( mcursorLocationOk(pCsr, (pCsr->flags & CURSOR_IGNORE_DELETE)) );
 
     rc = multiCursorGetVal(pCsr, pCsr->aTree[1], &pVal, &nVal);
-    if( pVal && rc==LSM_OK ){
+    if( rc==LSM_OK && (pCsr->eType & LSM_VALUE_PTR) ){
+      rc = sortedVlogRead(pCsr->pDb, pVal, nVal, &pCsr->val);
+      pVal = pCsr->val.pData;
+      nVal = pCsr->val.nData;
+    }else if( (pVal || (pCsr->eType & LSM_OPERAND)) && rc==LSM_OK ){
       rc = sortedBlobSet(pCsr->pDb->pEnv, &pCsr->val, pVal, nVal);
       pVal = pCsr->val.pData;
     }
 
+    /* If the cursor points to a merge operand, combine it with the older
+    ** versions of the key to obtain the value. The result is kept until the
+    ** cursor moves, so that the operands are not combined again.  */
+    if( rc==LSM_OK && (pCsr->eType & LSM_OPERAND) ){
+      int bBase;
+      rc = multiCursorMergeOperands(pCsr, pCsr->aTree[1], &bBase);
+      if( rc==LSM_OK ) pCsr->flags |= CURSOR_VALUE_MERGED;
+      pVal = pCsr->val.pData;
+      nVal = pCsr->val.nData;
+    }
+
     if( rc!=LSM_OK ){
       pVal = 0;
       nVal = 0;
@@ -13955,6 +17461,50 @@ static int lsmMCursorValue(MultiCursor *pCsr, void **ppVal, int *pnVal){
   return rc;
 }
 
+/*
+** Set *pbRef to true if the current version of key pKey/nKey refers to the
+** value log entry at offset iOff, either as its value or as the value its
+** merge operands are combined with. Otherwise, set it to false. The cursor
+** is left pointing to the key, if it exists.
+*/
+static int lsmSortedVlogRef(
+  MultiCursor *pCsr,              /* Cursor to use */
+  void *pKey, int nKey,           /* Key of value log entry */
+  i64 iOff,                       /* Offset of value log entry */
+  int *pbRef                      /* OUT: True if entry is referenced */
+){
+  int rc;
+
+  *pbRef = 0;
+  rc = lsmMCursorSeek(pCsr, 0, pKey, nKey, LSM_SEEK_GE);
+  if( rc==LSM_OK && lsmMCursorValid(pCsr) ){
+    int i;
+    for(i=pCsr->aTree[1]; i<(CURSOR_DATA_SEGMENT+pCsr->nPtr); i++){
+      int eType; void *pK; int nK;
+      multiCursorGetKey(pCsr, i, &eType, &pK, &nK);
+      if( pK==0 
+       || rtIsSeparator(eType)
+       || (eType & (LSM_INSERT|LSM_POINT_DELETE))==0 
+       || sortedKeyCompare(pCsr->pDb->xCmp, 0, pKey, nKey, rtTopic(eType), pK, nK)
+      ){
+        continue;
+      }
+      if( (eType & LSM_POINT_DELETE) || multiCursorVersionDeleted(pCsr, i) ){
+        break;
+      }
+      if( eType & LSM_VALUE_PTR ){
+        void *pVal; int nVal;
+        rc = multiCursorGetVal(pCsr, i, &pVal, &nVal);
+        if( rc==LSM_OK && nVal==LSM_VLOG_PTR_SIZE ){
+          *pbRef = ((i64)lsmGetU64((u8 *)pVal)==iOff);
+        }
+      }
+      if( (eType & LSM_OPERAND)==0 ) break;
+    }
+  }
+  return rc;
+}
+
 static int lsmMCursorType(MultiCursor *pCsr, int *peType){
   assert( pCsr->aTree );
   multiCursorGetKey(pCsr, pCsr->aTree[1], peType, 0, 0);
@@ -14389,10 +17939,27 @@ static int mergeWorkerAddPadding(
 /*
 ** Release all page references currently held by the merge-worker passed
 ** as the only argument. Unless an error has occurred, all pages have
-** already been released.
+** already been released. Also free its MergeOp objects.
 */
 static void mergeWorkerReleaseAll(MergeWorker *pMW){
   int i;
+
+  while( pMW->pOpFirst ){
+    MergeOp *pOp = pMW->pOpFirst;
+    pMW->pOpFirst = pOp->pNext;
+    lsmFsPageRelease(pOp->pPg);
+    pOp->pNext = pMW->pOpFree;
+    pMW->pOpFree = pOp;
+  }
+  pMW->pOpLast = 0;
+  pMW->nOpPage = 0;
+  while( pMW->pOpFree ){
+    MergeOp *pOp = pMW->pOpFree;
+    pMW->pOpFree = pOp->pNext;
+    sortedBlobFree(&pOp->key);
+    lsmFree(pMW->pDb->pEnv, pOp);
+  }
+
   lsmFsPageRelease(pMW->pPage);
   pMW->pPage = 0;
 
@@ -14412,33 +17979,152 @@ static int keyszToSkip(FileSystem *pFS, int nKey){
 }
 
 /*
-** Release the reference to the current output page of merge-worker *pMW
-** (reference pMW->pPage). Set the page number values in aSave[] as 
-** required (see comments above struct MergeWorker for details).
+** Persist and release pPg, a completed output page of merge-worker *pMW.
+** Set the page number values in aSave[] as required (see comments above 
+** struct MergeWorker for details).
 */
-static int mergeWorkerPersistAndRelease(MergeWorker *pMW){
+static int mergeWorkerPageDone(MergeWorker *pMW, Page *pPg){
   int rc;
   int i;
 
-  assert( pMW->pPage || (pMW->aSave[0].bStore==0 && pMW->aSave[1].bStore==0) );
+  assert( pPg || (pMW->aSave[0].bStore==0 && pMW->aSave[1].bStore==0) );
 
   /* Persist the page */
-  rc = lsmFsPagePersist(pMW->pPage);
+  rc = lsmFsPagePersist(pPg);
 
   /* If required, save the page number. */
   for(i=0; i<2; i++){
     if( pMW->aSave[i].bStore ){
-      pMW->aSave[i].iPgno = lsmFsPageNumber(pMW->pPage);
+      pMW->aSave[i].iPgno = lsmFsPageNumber(pPg);
       pMW->aSave[i].bStore = 0;
     }
   }
 
   /* Release the completed output page. */
-  lsmFsPageRelease(pMW->pPage);
-  pMW->pPage = 0;
+  lsmFsPageRelease(pPg);
+  return rc;
+}
+
+/*
+** Push key pKey/nKey, the first key on the output page following the 
+** page most recently completed, into the b-tree hierarchy. And arrange for
+** the page number of that page to be saved in aSave[0] once it is done.
+*/
+static int mergeWorkerPush(
+  MergeWorker *pMW,               /* Merge worker object */
+  int iTopic,                     /* Topic value for this key */
+  void *pKey,                     /* Pointer to key buffer */
+  int nKey                        /* Size of pKey buffer in bytes */
+){
+  int rc = mergeWorkerPushHierarchy(pMW, iTopic, pKey, nKey);
+  assert( pMW->aSave[0].bStore==0 );
+  pMW->aSave[0].bStore = 1;
+  return rc;
+}
+
+/*
+** Apply operations queued by mergeWorkerQueue(), oldest first. If bAll is
+** true, until the queue is empty. Otherwise, until it contains no more 
+** than MergeWorker.nOpMax pages.
+*/
+static int mergeWorkerApplyOps(MergeWorker *pMW, int bAll){
+  int rc = LSM_OK;
+  while( rc==LSM_OK && pMW->pOpFirst && (bAll || pMW->nOpPage>pMW->nOpMax) ){
+    MergeOp *pOp = pMW->pOpFirst;
+    pMW->pOpFirst = pOp->pNext;
+    if( pMW->pOpFirst==0 ) pMW->pOpLast = 0;
+
+    if( pOp->pPg ){
+      pMW->nOpPage--;
+      rc = mergeWorkerPageDone(pMW, pOp->pPg);
+      pOp->pPg = 0;
+    }else{
+      rc = mergeWorkerPush(pMW, pOp->iTopic, pOp->key.pData, pOp->key.nData);
+    }
+
+    pOp->pNext = pMW->pOpFree;
+    pMW->pOpFree = pOp;
+  }
+  return rc;
+}
+
+/*
+** If the pages of the output segment are compressed by other threads 
+** (if pMW->nOpMax is not zero), append an operation to the queue of 
+** merge-worker pMW: either completed output page pPg, or, if pPg is NULL,
+** key pKey/nKey to push into the b-tree hierarchy. Otherwise, apply the
+** operation right away.
+*/
+static int mergeWorkerQueue(
+  MergeWorker *pMW,               /* Merge worker object */
+  Page *pPg,                      /* Completed output page, or NULL */
+  int iTopic,                     /* Topic value for key */
+  void *pKey,                     /* Pointer to key buffer */
+  int nKey                        /* Size of pKey buffer in bytes */
+){
+  lsm_env *pEnv = pMW->pDb->pEnv;
+  int rc = LSM_OK;
+  MergeOp *pOp;
+
+  if( pMW->nOpMax==0 ){
+    if( pPg ) return mergeWorkerPageDone(pMW, pPg);
+    return mergeWorkerPush(pMW, iTopic, pKey, nKey);
+  }
+
+  pOp = pMW->pOpFree;
+  if( pOp ){
+    pMW->pOpFree = pOp->pNext;
+  }else{
+    pOp = (MergeOp *)lsmMallocZeroRc(pEnv, sizeof(MergeOp), &rc);
+  }
+  if( pOp ){
+    pOp->pPg = pPg;
+    pOp->iTopic = iTopic;
+    pOp->pNext = 0;
+    if( pPg ){
+      lsmFsPageCompress(pPg);
+      pMW->nOpPage++;
+    }else{
+      pOp->key.pEnv = pEnv;
+      rc = sortedBlobSet(pEnv, &pOp->key, pKey, nKey);
+    }
+    if( pMW->pOpLast ){
+      pMW->pOpLast->pNext = pOp;
+    }else{
+      pMW->pOpFirst = pOp;
+    }
+    pMW->pOpLast = pOp;
+  }else{
+    lsmFsPageRelease(pPg);
+  }
+
+  if( rc==LSM_OK ) rc = mergeWorkerApplyOps(pMW, 0);
   return rc;
 }
 
+/*
+** Release the reference to the current output page of merge-worker *pMW
+** (reference pMW->pPage). Set the page number values in aSave[] as 
+** required (see comments above struct MergeWorker for details), either
+** now or once the operations queued before it have been applied.
+*/
+static int mergeWorkerPersistAndRelease(MergeWorker *pMW){
+  Page *pPg = pMW->pPage;
+  pMW->pPage = 0;
+  if( pPg==0 ) return mergeWorkerPageDone(pMW, 0);
+  return mergeWorkerQueue(pMW, pPg, 0, 0, 0);
+}
+
+/*
+** Configure merge-worker pMW to queue completed output pages while the
+** threads of the FileSystem compress them, if it has any. Up to two pages
+** per thread are queued, to keep all threads busy while the merge-worker
+** builds the following pages.
+*/
+static void mergeWorkerQueueInit(MergeWorker *pMW){
+  pMW->nOpMax = 2 * lsmFsCompressThreads(pMW->pDb->pFS);
+}
+
 /*
 ** Advance to the next page of an output run being populated by merge-worker
 ** pMW. The footer of the new page is initialized to indicate that it contains
@@ -14554,12 +18240,45 @@ static int mergeWorkerFirstPage(MergeWorker *pMW){
   if( rc==LSM_OK ){
     rc = mergeWorkerNextPage(pMW, iFPtr);
     if( pCsr->pPrevMergePtr ) *pCsr->pPrevMergePtr = iFPtr;
+    assert( pMW->pOpFirst==0 );
     pMW->aSave[0].bStore = 1;
   }
 
   return rc;
 }
 
+/*
+** A record with key pKey/nKey is about to be written as cell nRec of output
+** page pPg, which has the PGFTR_PREFIX_FLAG flag set. Set *pnShared to the
+** number of leading bytes the key shares with the key of the previous cell.
+** That key is cached in pMW->prefix. If the cache is for another cell (for
+** example because the merge resumed writing to the page), the key is 
+** decoded from the page instead.
+*/
+static int mergeWorkerPrefix(
+  MergeWorker *pMW,               /* Merge worker object */
+  Page *pPg,                      /* Page the record is written to */
+  int nRec,                       /* Cell the record is written to */
+  u8 *pKey, int nKey,             /* Key of record */
+  int *pnShared                   /* OUT: Bytes shared with previous key */
+){
+  LsmBlob *pPrev = &pMW->prefix;
+  int rc = LSM_OK;
+  int nShared = 0;
+
+  assert( nRec>0 );
+  if( pMW->iPrefixPg!=lsmFsPageNumber(pPg) || pMW->iPrefixCell!=nRec-1 ){
+    rc = pagePrefixKey(&pMW->pLevel->lhs, pPg, nRec-1, 0, pPrev);
+  }
+  if( rc==LSM_OK ){
+    u8 *aPrev = (u8 *)pPrev->pData;
+    int nMax = LSM_MIN(nKey, pPrev->nData);
+    while( nShared<nMax && aPrev[nShared]==pKey[nShared] ) nShared++;
+  }
+  *pnShared = nShared;
+  return rc;
+}
+
 static int mergeWorkerWrite(
   MergeWorker *pMW,               /* Merge worker object to write into */
   int eType,                      /* One of SORTED_SEPARATOR, WRITE or DELETE */
@@ -14580,12 +18299,15 @@ static int mergeWorkerWrite(
   Segment *pSeg;                  /* Segment being written */
   int flags = 0;                  /* If != 0, flags value for page footer */
   int bFirst = 0;                 /* True for first key of output run */
+  int bPrefix = 0;                /* True to store only part of the key */
+  int nShared = 0;                /* Key bytes shared with previous record */
 
   pMerge = pMW->pLevel->pMerge;    
   pSeg = &pMW->pLevel->lhs;
 
   if( pSeg->iFirst==0 && pMW->pPage==0 ){
     rc = mergeWorkerFirstPage(pMW);
+    pSeg->bVlog = 1;
     bFirst = 1;
   }
   pPg = pMW->pPage;
@@ -14607,11 +18329,22 @@ static int mergeWorkerWrite(
   **
   **     1) record type - 1 byte.
   **     2) Page-pointer-offset - 1 varint
-  **     3) Key size - 1 varint
+  **     3) Key size - 1 varint (preceded by the shared key size, if bPrefix)
   **     4) Value size - 1 varint (only if LSM_INSERT flag is set)
+  **
+  ** If the page stores prefix-compressed keys and the record is not a 
+  ** restart point, only the part of the key that follows the bytes it
+  ** shares with the previous key on the page is stored.
   */
+  if( rc==LSM_OK && pPg && pMerge->iOutputOff>=0 
+   && pageIsPrefixCell(pageGetFlags(aData, nData), nRec)
+  ){
+    bPrefix = 1;
+    rc = mergeWorkerPrefix(pMW, pPg, nRec, (u8 *)pKey, nKey, &nShared);
+  }
   if( rc==LSM_OK ){
-    nHdr = 1 + lsmVarintLen64(iRPtr) + lsmVarintLen32(nKey);
+    nHdr = 1 + lsmVarintLen64(iRPtr) + lsmVarintLen32(nKey-nShared);
+    if( bPrefix ) nHdr += lsmVarintLen32(nShared);
     if( rtIsWrite(eType) ) nHdr += lsmVarintLen32(nVal);
 
     /* If the entire header will not fit on page pPg, or if page pPg is 
@@ -14627,6 +18360,8 @@ static int mergeWorkerWrite(
       iRPtr = iPtr ? (iPtr - iFPtr) : 0;
       iOff = 0;
       nRec = 0;
+      bPrefix = 0;
+      nShared = 0;
       rc = mergeWorkerNextPage(pMW, iFPtr);
       pPg = pMW->pPage;
     }
@@ -14640,9 +18375,7 @@ static int mergeWorkerWrite(
     assert( pMerge->nSkip>=0 );
 
     if( pMerge->nSkip==0 ){
-      rc = mergeWorkerPushHierarchy(pMW, rtTopic(eType), pKey, nKey);
-      assert( pMW->aSave[0].bStore==0 );
-      pMW->aSave[0].bStore = 1;
+      rc = mergeWorkerQueue(pMW, 0, rtTopic(eType), pKey, nKey);
       pMerge->nSkip = keyszToSkip(pMW->pDb->pFS, nKey);
     }else{
       pMerge->nSkip--;
@@ -14651,6 +18384,9 @@ static int mergeWorkerWrite(
 
     if( pMerge->nSkip ) flags |= PGFTR_SKIP_NEXT_FLAG;
   }
+  if( rc==LSM_OK && nRec==0 && pMW->pDb->bPrefixKeys ){
+    flags |= PGFTR_PREFIX_FLAG;
+  }
 
   /* Update the output segment */
   if( rc==LSM_OK ){
@@ -14664,13 +18400,26 @@ static int mergeWorkerWrite(
     /* Write the entry header into the current page. */
     aData[iOff++] = (u8)eType;                                           /* 1 */
     iOff += lsmVarintPut64(&aData[iOff], iRPtr);                         /* 2 */
-    iOff += lsmVarintPut32(&aData[iOff], nKey);                          /* 3 */
+    if( bPrefix ) iOff += lsmVarintPut32(&aData[iOff], nShared);
+    iOff += lsmVarintPut32(&aData[iOff], nKey-nShared);                  /* 3 */
     if( rtIsWrite(eType) ) iOff += lsmVarintPut32(&aData[iOff], nVal);   /* 4 */
     pMerge->iOutputOff = iOff;
 
+    /* Cache the key, so that the next record written to the page can be
+    ** compressed against it.  */
+    if( pageGetFlags(aData, nData) & PGFTR_PREFIX_FLAG ){
+      rc = sortedBlobSet(pMW->pDb->pEnv, &pMW->prefix, pKey, nKey);
+      pMW->iPrefixPg = lsmFsPageNumber(pPg);
+      pMW->iPrefixCell = nRec;
+    }
+
     /* Write the key and data into the segment. */
     assert( iFPtr==pageGetPtr(aData, nData) );
-    rc = mergeWorkerData(pMW, 0, iFPtr+iRPtr, pKey, nKey);
+    if( rc==LSM_OK ){
+      rc = mergeWorkerData(pMW, 0, iFPtr+iRPtr, &((u8 *)pKey)[nShared], 
+          nKey-nShared
+      );
+    }
     if( rc==LSM_OK && rtIsWrite(eType) ){
       if( rc==LSM_OK ){
         rc = mergeWorkerData(pMW, 0, iFPtr+iRPtr, pVal, nVal);
@@ -14682,6 +18431,26 @@ static int mergeWorkerWrite(
 }
 
 
+/*
+** Update the fraction of delete markers recorded for the lhs segment of the
+** level that pMW writes to, to account for the entries written by pMW. The
+** fraction recorded previously is weighted by the number of pages written
+** to the segment before pMW was initialized.
+*/
+static void mergeWorkerRecordTombstones(MergeWorker *pMW){
+  Level *pLevel = pMW->pLevel;
+  if( pMW->nEntry>0 ){
+    i64 nNew = LSM_MAX(pMW->nWork, 1);
+    i64 nOld = LSM_MAX(pLevel->lhs.nSize - pMW->nWork, 0);
+    i64 iOld = (pLevel->flags & LEVEL_TOMBSTONE_MASK) >> LEVEL_TOMBSTONE_SHIFT;
+    i64 iNew = ((i64)pMW->nTombstone * 255) / pMW->nEntry;
+    int iVal = (int)((iOld*nOld + iNew*nNew) / (nOld + nNew));
+    pLevel->flags = (u16)(
+        (pLevel->flags & ~LEVEL_TOMBSTONE_MASK) | (iVal << LEVEL_TOMBSTONE_SHIFT)
+    );
+  }
+}
+
 /*
 ** Free all resources allocated by mergeWorkerInit().
 */
@@ -14743,8 +18512,9 @@ static void mergeWorkerShutdown(MergeWorker *pMW, int *pRc){
 
   lsmMCursorClose(pCsr, 0);
 
-  /* Persist and release the output page. */
+  /* Persist and release the output page, and any pages still queued. */
   if( rc==LSM_OK ) rc = mergeWorkerPersistAndRelease(pMW);
+  if( rc==LSM_OK ) rc = mergeWorkerApplyOps(pMW, 1);
   if( rc==LSM_OK ) rc = mergeWorkerBtreeIndirect(pMW);
   if( rc==LSM_OK ) rc = mergeWorkerFinishHierarchy(pMW);
   if( rc==LSM_OK ) rc = mergeWorkerAddPadding(pMW);
@@ -14754,7 +18524,9 @@ static void mergeWorkerShutdown(MergeWorker *pMW, int *pRc){
   lsmFree(pMW->pDb->pEnv, pMW->aGobble);
   pMW->aGobble = 0;
   pMW->pCsr = 0;
+  sortedBlobFree(&pMW->prefix);
 
+  if( rc==LSM_OK ) mergeWorkerRecordTombstones(pMW);
   *pRc = rc;
 }
 
@@ -14797,7 +18569,7 @@ static void mergeRangeDeletes(MultiCursor *pCsr, int *piVal, int *piFlags){
           if( res==0 ){
             if( (f & (LSM_INSERT|LSM_POINT_DELETE))==0 ){
               if( eType & LSM_INSERT ){
-                f |= LSM_INSERT;
+                f |= LSM_INSERT | (eType & LSM_OPERAND);
                 *piVal = i;
               }
               else if( eType & LSM_POINT_DELETE ){
@@ -14831,6 +18603,51 @@ static void mergeRangeDeletes(MultiCursor *pCsr, int *piVal, int *piFlags){
   *piFlags = f;
 }
 
+/*
+** Pass the key/value pair about to be written by merge-worker pMW to the
+** compaction filter configured by lsm_config_compaction_filter(), and
+** update *peType, *ppVal and *pnVal according to its verdict. If the entry
+** is dropped and the merge output is the oldest level in the database 
+** (delete markers are being discarded), *peType may be set to 0 to signal
+** that nothing is to be written.
+*/
+static int mergeWorkerFilter(
+  MergeWorker *pMW,               /* Merge worker writing the entry */
+  void *pKey, int nKey,           /* Key */
+  int *peType,                    /* IN/OUT: Entry flags */
+  void **ppVal, int *pnVal        /* IN/OUT: Value */
+){
+  lsm_db *pDb = pMW->pDb;
+  void *pNew = 0;
+  int nNew = 0;
+  int eRes;
+
+  eRes = pDb->xFilter(pDb->pFilterCtx, pKey, nKey, *ppVal, *pnVal, &pNew,&nNew);
+  switch( eRes ){
+    case LSM_FILTER_KEEP:
+      break;
+
+    case LSM_FILTER_DROP:
+      *peType &= ~LSM_INSERT;
+      if( (pMW->pCsr->flags & CURSOR_IGNORE_DELETE)==0 ){
+        *peType |= LSM_POINT_DELETE;
+      }
+      *ppVal = 0;
+      *pnVal = 0;
+      break;
+
+    case LSM_FILTER_CHANGE:
+      if( nNew<0 || (pNew==0 && nNew>0) ) return LSM_MISUSE_BKPT;
+      *ppVal = pNew;
+      *pnVal = nNew;
+      break;
+
+    default:
+      return LSM_MISUSE_BKPT;
+  }
+  return LSM_OK;
+}
+
 static int mergeWorkerStep(MergeWorker *pMW){
   lsm_db *pDb = pMW->pDb;       /* Database handle */
   MultiCursor *pCsr;            /* Cursor to read input data from */
@@ -14856,8 +18673,10 @@ static int mergeWorkerStep(MergeWorker *pMW){
   if( pCsr->pBtCsr ){
     BtreeCursor *pBtCsr = pCsr->pBtCsr;
     if( pBtCsr->pKey ){
-      int res = rtTopic(pBtCsr->eType) - rtTopic(eType);
-      if( res==0 ) res = pDb->xCmp(pBtCsr->pKey, pBtCsr->nKey, pKey, nKey);
+      int res = sortedKeyCompare(pDb->xCmp, 
+          rtTopic(pBtCsr->eType), pBtCsr->pKey, pBtCsr->nKey,
+          rtTopic(eType), pKey, nKey
+      );
       if( 0==res ) iPtr = pBtCsr->iPtr;
       assert( res>=0 );
     }
@@ -14873,6 +18692,14 @@ static int mergeWorkerStep(MergeWorker *pMW){
   iVal = pCsr->aTree[1];
   mergeRangeDeletes(pCsr, &iVal, &eType);
 
+  /* If the value is taken from an older version of the key, so is the
+  ** LSM_VALUE_PTR flag.  */
+  if( iVal!=pCsr->aTree[1] ){
+    int eVal = 0;
+    multiCursorGetKey(pCsr, iVal, &eVal, 0, 0);
+    eType = (eType & ~LSM_VALUE_PTR) | (eVal & LSM_VALUE_PTR);
+  }
+
   if( eType!=0 ){
     if( pMW->aGobble ){
       int iGobble = pCsr->aTree[1] - CURSOR_DATA_SEGMENT;
@@ -14889,20 +18716,90 @@ static int mergeWorkerStep(MergeWorker *pMW){
     ** proceed. */
     if( rc==LSM_OK && (rtIsSeparator(eType)==0 || iPtr!=0) ){
       /* Write the record into the main run. */
+      Segment *pSeg = &pMW->pLevel->lhs;
+      int bVlog = (pSeg->iFirst==0 || pSeg->bVlog);
+      int bLoaded = 0;            /* True if value loaded from value log */
+      u8 aPtr[LSM_VLOG_PTR_SIZE];
       void *pVal; int nVal;
       rc = multiCursorGetVal(pCsr, iVal, &pVal, &nVal);
-      if( pVal && rc==LSM_OK ){
+      if( (pVal || (eType & LSM_OPERAND)) && rc==LSM_OK ){
         assert( nVal>=0 );
         rc = sortedBlobSet(pDb->pEnv, &pCsr->val, pVal, nVal);
         pVal = pCsr->val.pData;
       }
-      if( rc==LSM_OK ){
-        rc = mergeWorkerWrite(pMW, eType, pKey, nKey, pVal, nVal, iPtr);
-      }
-    }
-  }
 
-  /* Advance the cursor to the next input record (assuming one exists). */
+      /* A pointer to a value log entry is copied to the output as is, unless
+      ** the value itself is required by the filter, or the output segment 
+      ** was started by a version of this code without value log support. */
+      if( rc==LSM_OK && (eType & LSM_VALUE_PTR) ){
+        if( nVal!=LSM_VLOG_PTR_SIZE ){
+          rc = LSM_CORRUPT_BKPT;
+        }else if( pDb->xFilter || bVlog==0 ){
+          memcpy(aPtr, pVal, LSM_VLOG_PTR_SIZE);
+          rc = sortedVlogRead(pDb, pVal, nVal, &pCsr->vlog);
+          pVal = pCsr->vlog.pData;
+          nVal = pCsr->vlog.nData;
+          eType &= ~LSM_VALUE_PTR;
+          bLoaded = 1;
+        }
+      }
+
+      /* If the record is a merge operand, combine it with the older versions
+      ** of the key being merged. If one of them is not a merge operand (or
+      ** is a delete), or if no older versions exist outside of this merge,
+      ** the result is written as a regular value.  */
+      if( rc==LSM_OK && (eType & LSM_OPERAND) && !rtIsSeparator(eType) ){
+        const int SD_ED = (LSM_START_DELETE|LSM_END_DELETE);
+        int bBase = 0;
+        rc = multiCursorMergeOperands(pCsr, iVal, &bBase);
+        if( bBase 
+         || (eType & SD_ED)==SD_ED 
+         || (pCsr->flags & CURSOR_IGNORE_DELETE)
+        ){
+          eType &= ~LSM_OPERAND;
+        }
+        pVal = pCsr->val.pData;
+        nVal = pCsr->val.nData;
+      }
+
+      if( rc==LSM_OK && pDb->xFilter 
+       && rtIsWrite(eType) && (eType & LSM_OPERAND)==0
+       && !rtIsSeparator(eType) && !rtIsSystem(eType)
+      ){
+        rc = mergeWorkerFilter(pMW, pKey, nKey, &eType, &pVal, &nVal);
+      }
+
+      /* If the value loaded from the value log was not changed by the
+      ** filter, the pointer to it is written instead. Otherwise, the value
+      ** may be appended to the value log now.  */
+      if( rc==LSM_OK && eType!=0 && bVlog ){
+        if( bLoaded && rtIsWrite(eType) 
+         && pVal==pCsr->vlog.pData && nVal==pCsr->vlog.nData
+        ){
+          eType |= LSM_VALUE_PTR;
+          pVal = (void *)aPtr;
+          nVal = LSM_VLOG_PTR_SIZE;
+        }else{
+          rc = sortedVlogSeparate(pDb, &eType, pKey, nKey, &pVal, &nVal, aPtr);
+        }
+      }
+      if( rc==LSM_OK && eType!=0 ){
+        rc = mergeWorkerWrite(pMW, eType, pKey, nKey, pVal, nVal, iPtr);
+      }
+      /* Count the entries written (records dropped by the filter are not)
+      ** for mergeWorkerRecordTombstones().  */
+      if( rc==LSM_OK && eType!=0 
+       && !rtIsSeparator(eType) && !rtIsSystem(eType) 
+      ){
+        pMW->nEntry++;
+        if( eType & (LSM_POINT_DELETE|LSM_START_DELETE|LSM_END_DELETE) ){
+          pMW->nTombstone++;
+        }
+      }
+    }
+  }
+
+  /* Advance the cursor to the next input record (assuming one exists). */
   assert( lsmMCursorValid(pMW->pCsr) );
   if( rc==LSM_OK ) rc = lsmMCursorNext(pMW->pCsr);
 
@@ -14928,6 +18825,8 @@ static void sortedInvokeWorkHook(lsm_db *pDb){
   }
 }
 
+static int sortedCacheBounds(lsm_db *, Level *);
+
 static int sortedNewToplevel(
   lsm_db *pDb,                    /* Connection handle */
   int eTree,                      /* One of the TREE_XXX constants */
@@ -15006,6 +18905,7 @@ static int sortedNewToplevel(
 
     /* Mark the separators array for the new level as a "phantom". */
     mergeworker.bFlush = 1;
+    mergeWorkerQueueInit(&mergeworker);
 
     /* Do the work to create the new merged segment on disk */
     if( rc==LSM_OK ) rc = lsmMCursorFirst(pCsr);
@@ -15052,6 +18952,9 @@ static int sortedNewToplevel(
       pDb->pWorker->freelist.nEntry = 0;
     }
 
+    /* Failing to cache the key range of the new level is not an error. It
+    ** is loaded again when it is needed.  */
+    sortedCacheBounds(pDb, pNew);
     assertBtreeOk(pDb, &pNew->lhs);
     sortedInvokeWorkHook(pDb);
   }
@@ -15167,6 +19070,7 @@ static int mergeWorkerInit(
   memset(pMW, 0, sizeof(MergeWorker));
   pMW->pDb = pDb;
   pMW->pLevel = pLevel;
+  mergeWorkerQueueInit(pMW);
   pMW->aGobble = lsmMallocZeroRc(pDb->pEnv, sizeof(LsmPgno)*pLevel->nRight,&rc);
 
   /* Create a multi-cursor to read the data to write to the new
@@ -15289,6 +19193,361 @@ static int sortedCountLevels(Level *p){
   return nRet;
 }
 
+/*
+** Return the total size in pages of all segments that make up level p.
+*/
+static LsmPgno sortedLevelSize(Level *p){
+  LsmPgno nSize = p->lhs.nSize;
+  int i;
+  for(i=0; i<p->nRight; i++){
+    nSize += p->aRhs[i].nSize;
+  }
+  return nSize;
+}
+
+/*
+** Load the smallest (bLast==0) or largest (bLast==1) key stored in the lhs
+** of level pLvl into blob pBlob, and its topic into *piTopic. Separators 
+** (copies of the b-tree keys of the next level) are not part of the data 
+** stored in the level and so are skipped. If the level contains nothing
+** but separators, *piTopic is set to -1.
+*/
+static int sortedLevelEndKey(
+  lsm_db *pDb,                    /* Database handle */
+  Level *pLvl,                    /* Level to read */
+  int bLast,                      /* True for the largest key */
+  int *piTopic,                   /* OUT: Topic of key */
+  LsmBlob *pBlob                  /* OUT: Key */
+){
+  int rc = LSM_OK;
+  int eDir = (bLast ? -1 : 1);
+  SegmentPtr ptr;
+
+  memset(&ptr, 0, sizeof(SegmentPtr));
+  ptr.pLevel = pLvl;
+  ptr.pSeg = &pLvl->lhs;
+  *piTopic = -1;
+
+  segmentPtrEndPage(pDb->pFS, &ptr, bLast, &rc);
+  while( rc==LSM_OK && ptr.pPg && *piTopic<0 ){
+    if( (ptr.flags & SEGMENT_BTREE_FLAG)==0 ){
+      int i;
+      for(i=0; rc==LSM_OK && i<ptr.nCell; i++){
+        rc = segmentPtrLoadCell(&ptr, bLast ? (ptr.nCell-1-i) : i);
+        if( rc==LSM_OK 
+         && rtIsSeparator(ptr.eType)==0 && rtIsSystem(ptr.eType)==0 
+        ){
+          *piTopic = rtTopic(ptr.eType);
+          rc = sortedBlobSet(pDb->pEnv, pBlob, ptr.pKey, ptr.nKey);
+          break;
+        }
+      }
+    }
+    if( rc==LSM_OK && *piTopic<0 ) rc = segmentPtrNextPage(&ptr, eDir);
+  }
+
+  segmentPtrReset(&ptr, 0);
+  return rc;
+}
+
+/*
+** The smallest and largest keys stored in the lhs of a level, as loaded by
+** sortedLevelEndKey(). Each connection caches them for the levels of the
+** structure in lsm_db.aBounds[], so that sortedMergeDeferrable() compares
+** key ranges in memory instead of reading the first and last pages of
+** every candidate level each time it is called. An entry is identified by
+** the first and last pages and the size of the segment, none of which
+** change once the segment is finished.
+*/
+struct LevelBounds {
+  LsmPgno iFirst;                 /* Segment.iFirst of the lhs */
+  LsmPgno iLastPg;                /* Segment.iLastPg of the lhs */
+  LsmPgno nSize;                  /* Segment.nSize of the lhs */
+  int aTopic[2];                  /* Topics of the keys (-1 if none) */
+  LsmBlob aKey[2];                /* Smallest and largest key */
+};
+
+/*
+** Return true if entry p of the key range cache describes segment pSeg.
+*/
+static int sortedBoundsMatch(LevelBounds *p, Segment *pSeg){
+  return p->iFirst==pSeg->iFirst
+      && p->iLastPg==pSeg->iLastPg
+      && p->nSize==pSeg->nSize;
+}
+
+/*
+** Return the cached key range of level pLvl, or NULL if it is not cached.
+*/
+static LevelBounds *sortedFindBounds(lsm_db *pDb, Level *pLvl){
+  int i;
+  for(i=0; i<pDb->nBounds; i++){
+    if( sortedBoundsMatch(&pDb->aBounds[i], &pLvl->lhs) ){
+      return &pDb->aBounds[i];
+    }
+  }
+  return 0;
+}
+
+/*
+** Free the keys of entry p of the key range cache.
+*/
+static void sortedBoundsFree(LevelBounds *p){
+  sortedBlobFree(&p->aKey[0]);
+  sortedBlobFree(&p->aKey[1]);
+}
+
+/*
+** Free the key range cache of connection pDb.
+*/
+static void lsmSortedFreeBounds(lsm_db *pDb){
+  int i;
+  for(i=0; i<pDb->nBounds; i++){
+    sortedBoundsFree(&pDb->aBounds[i]);
+  }
+  lsmFree(pDb->pEnv, pDb->aBounds);
+  pDb->aBounds = 0;
+  pDb->nBounds = 0;
+}
+
+/*
+** Make sure the key range of the finished level pLvl of the worker snapshot
+** is cached. This is done as soon as a level is written. Levels written by
+** other connections (or before the database was opened) are cached the
+** first time they are consulted. Entries for segments that are no longer
+** part of the structure are dropped before a new one is added.
+*/
+static int sortedCacheBounds(lsm_db *pDb, Level *pLvl){
+  int rc = LSM_OK;
+  if( sortedFindBounds(pDb, pLvl)==0 ){
+    LevelBounds *aNew;
+    LevelBounds *p;
+    int i = 0;
+
+    while( i<pDb->nBounds ){
+      Level *pIter = lsmDbSnapshotLevel(pDb->pWorker);
+      while( pIter && !sortedBoundsMatch(&pDb->aBounds[i], &pIter->lhs) ){
+        pIter = pIter->pNext;
+      }
+      if( pIter ){
+        i++;
+      }else{
+        sortedBoundsFree(&pDb->aBounds[i]);
+        pDb->aBounds[i] = pDb->aBounds[--pDb->nBounds];
+      }
+    }
+
+    aNew = (LevelBounds *)lsmRealloc(
+        pDb->pEnv, pDb->aBounds, sizeof(LevelBounds) * (pDb->nBounds+1)
+    );
+    if( aNew==0 ) return LSM_NOMEM_BKPT;
+    pDb->aBounds = aNew;
+
+    p = &aNew[pDb->nBounds];
+    memset(p, 0, sizeof(LevelBounds));
+    rc = sortedLevelEndKey(pDb, pLvl, 0, &p->aTopic[0], &p->aKey[0]);
+    if( rc==LSM_OK ){
+      rc = sortedLevelEndKey(pDb, pLvl, 1, &p->aTopic[1], &p->aKey[1]);
+    }
+    if( rc==LSM_OK ){
+      p->iFirst = pLvl->lhs.iFirst;
+      p->iLastPg = pLvl->lhs.iLastPg;
+      p->nSize = pLvl->lhs.nSize;
+      pDb->nBounds++;
+    }else{
+      sortedBoundsFree(p);
+    }
+  }
+  return rc;
+}
+
+static int sortedDbIsFull(lsm_db *);
+
+/*
+** Return true if the merge of the nLvl levels starting at pLvl may be 
+** deferred because the key ranges of the levels do not overlap. In that
+** case, merging them would not combine a single record: all it would do
+** is to copy every page of every level to a new segment. The levels are
+** left as they are instead, so that the pages are copied only once they 
+** get merged with content that does overlap, or once the structure runs
+** short of room for segments.
+**
+** lsm1 segments cannot be relinked into a new segment without copying, as
+** each segment is a single chain of pages (that may share blocks with 
+** other segments) carrying its own b-tree and pointers into the next 
+** level. Deferring the merge is the nearest equivalent.
+**
+** A merge is never deferred if the database is full (see sortedDbIsFull()),
+** or if deferring it would let the number of segments in the structure 
+** grow beyond half of LSM_MAX_RHS_SEGMENTS.
+*/
+static int sortedMergeDeferrable(
+  lsm_db *pDb,                    /* Worker connection */
+  Level *pLvl,                    /* First level to merge */
+  int nLvl,                       /* Number of levels to merge */
+  int *pRc                        /* IN/OUT: Error code */
+){
+  int bRet = 1;
+  int nSeg = 0;
+  Level *p;
+  Level *p2;
+  int i;
+  int j;
+
+  if( *pRc!=LSM_OK || nLvl<2 || sortedDbIsFull(pDb) ) return 0;
+  for(p=lsmDbSnapshotLevel(pDb->pWorker); p; p=p->pNext){
+    nSeg += (p->nRight ? p->nRight : 1);
+  }
+  if( nSeg>=LSM_MAX_RHS_SEGMENTS/2 ) return 0;
+
+  /* Make sure the smallest and largest key of each level are cached.  */
+  for(p=pLvl, i=0; *pRc==LSM_OK && bRet && i<nLvl; p=p->pNext, i++){
+    if( p->nRight || p->lhs.pRedirect ){
+      bRet = 0;
+    }else{
+      *pRc = sortedCacheBounds(pDb, p);
+      if( *pRc==LSM_OK && sortedFindBounds(pDb, p)->aTopic[0]<0 ) bRet = 0;
+    }
+  }
+
+  /* Check that no two ranges overlap.  */
+  if( *pRc!=LSM_OK ){
+    bRet = 0;
+  }else if( bRet ){
+    for(p=pLvl, i=0; bRet && i<nLvl; p=p->pNext, i++){
+      LevelBounds *p1 = sortedFindBounds(pDb, p);
+      for(p2=p->pNext, j=i+1; bRet && j<nLvl; p2=p2->pNext, j++){
+        LevelBounds *pB = sortedFindBounds(pDb, p2);
+        int res1 = sortedKeyCompare(pDb->xCmp,
+            p1->aTopic[1], p1->aKey[1].pData, p1->aKey[1].nData,
+            pB->aTopic[0], pB->aKey[0].pData, pB->aKey[0].nData
+        );
+        int res2 = sortedKeyCompare(pDb->xCmp,
+            pB->aTopic[1], pB->aKey[1].pData, pB->aKey[1].nData,
+            p1->aTopic[0], p1->aKey[0].pData, p1->aKey[0].nData
+        );
+        if( res1>=0 && res2>=0 ) bRet = 0;
+      }
+    }
+  }
+
+  return bRet;
+}
+
+/*
+** Select the levels to merge according to the LSM_COMPACTION_LEVELED or
+** LSM_COMPACTION_HYBRID strategy. If successful, set *ppBest to point to
+** the first level to merge and *pnBest to the number of levels to merge.
+** Or, if there is no work to do according to the strategy, leave both
+** output variables unmodified.
+**
+** Any level that is already undergoing an incremental merge is always
+** selected first. Otherwise, under LSM_COMPACTION_HYBRID, a run of 
+** nMerge or more age 0 levels at the top of the structure is selected. 
+** Finally, the first level (starting from the top) that is larger than 
+** 1/nSizeRatio of the level immediately below it is selected, along with
+** that level, unless the merge of the two may be deferred (see 
+** sortedMergeDeferrable()). Age 0 levels are not considered for this last 
+** step in LSM_COMPACTION_HYBRID mode.
+*/
+static void sortedSelectLeveled(
+  lsm_db *pDb,                    /* Worker connection */
+  int nMerge,                     /* Minimum age 0 levels to merge (hybrid) */
+  Level **ppBest,                 /* OUT: First level to merge */
+  int *pnBest,                    /* OUT: Number of levels to merge */
+  int *pRc                        /* IN/OUT: Error code */
+){
+  Level *pTopLevel = lsmDbSnapshotLevel(pDb->pWorker);
+  Level *pLevel;
+  int bHybrid = (pDb->eCompaction==LSM_COMPACTION_HYBRID);
+
+  for(pLevel=pTopLevel; pLevel; pLevel=pLevel->pNext){
+    if( pLevel->nRight ){
+      *ppBest = pLevel;
+      *pnBest = pLevel->nRight;
+      return;
+    }
+  }
+
+  pLevel = pTopLevel;
+  if( bHybrid ){
+    int nAge0 = 0;
+    while( pLevel && pLevel->iAge==0 ){
+      nAge0++;
+      pLevel = pLevel->pNext;
+    }
+    if( nAge0>=LSM_MAX(2, nMerge) ){
+      *ppBest = pTopLevel;
+      *pnBest = nAge0;
+      return;
+    }
+  }
+
+  for(/* noop */; pLevel && pLevel->pNext; pLevel=pLevel->pNext){
+    LsmPgno nThis = sortedLevelSize(pLevel);
+    LsmPgno nNext = sortedLevelSize(pLevel->pNext);
+    if( nThis * pDb->nSizeRatio > nNext 
+     && sortedMergeDeferrable(pDb, pLevel, 2, pRc)==0
+    ){
+      *ppBest = pLevel;
+      *pnBest = 2;
+      return;
+    }
+  }
+}
+
+/*
+** Return the fraction of the entries in the lhs of level p that are delete
+** markers, in units of 1/255. See LEVEL_TOMBSTONE_MASK.
+*/
+static int sortedLevelTombstones(Level *p){
+  return (p->flags & LEVEL_TOMBSTONE_MASK) >> LEVEL_TOMBSTONE_SHIFT;
+}
+
+/*
+** If LSM_CONFIG_TOMBSTONE_RATIO is configured, search for a level that
+** consists largely of delete markers. If one is found, set *ppBest to
+** point to it and *pnBest to the number of levels to merge: 2 to merge it
+** into the level below, or 1 if it is the oldest level (in which case the
+** delete markers are discarded by the merge). Otherwise, leave both output
+** variables unmodified.
+**
+** Age 0 levels are not considered, as they are merged soon regardless.
+** If a merge is already underway, it is selected instead, as it may have
+** fewer input segments than the tiered selection requires to resume it.
+** Nothing is selected while the database is full (see sortedDbIsFull()),
+** as the number of levels must be reduced first in that case.
+*/
+static void sortedSelectTombstones(
+  lsm_db *pDb,                    /* Worker connection */
+  Level **ppBest,                 /* OUT: First level to merge */
+  int *pnBest                     /* OUT: Number of levels to merge */
+){
+  Level *pTopLevel = lsmDbSnapshotLevel(pDb->pWorker);
+  Level *pLevel;
+  int iLimit = (pDb->nTombstoneRatio * 255 + 99) / 100;
+
+  if( pDb->nTombstoneRatio==0 || sortedDbIsFull(pDb) ) return;
+  for(pLevel=pTopLevel; pLevel; pLevel=pLevel->pNext){
+    if( pLevel->nRight ){
+      *ppBest = pLevel;
+      *pnBest = pLevel->nRight;
+      return;
+    }
+  }
+
+  for(pLevel=pTopLevel; pLevel; pLevel=pLevel->pNext){
+    if( pLevel->iAge>0 
+     && (pLevel->flags & LEVEL_FREELIST_ONLY)==0
+     && sortedLevelTombstones(pLevel)>=iLimit
+    ){
+      *ppBest = pLevel;
+      *pnBest = (pLevel->pNext ? 2 : 1);
+      return;
+    }
+  }
+}
+
 static int sortedSelectLevel(lsm_db *pDb, int nMerge, Level **ppOut){
   Level *pTopLevel = lsmDbSnapshotLevel(pDb->pWorker);
   int rc = LSM_OK;
@@ -15301,16 +19560,32 @@ static int sortedSelectLevel(lsm_db *pDb, int nMerge, Level **ppOut){
   assert( nMerge>=1 );
   nBest = LSM_MAX(1, nMerge-1);
 
+  /* Levels consisting largely of delete markers are merged first. Then, if
+  ** a strategy other than the default is configured, it is consulted.
+  ** Requests to optimize the database (nMerge==1) are handled as usual. If
+  ** neither finds anything to do, fall back to the tiered selection
+  ** below. This guarantees that callers that require the number of levels 
+  ** in the structure to be reduced (see sortedDbIsFull()) make progress. */
+  if( nMerge>1 ){
+    sortedSelectTombstones(pDb, &pBest, &nBest);
+  }
+  if( pBest==0 && nMerge>1 && pDb->eCompaction!=LSM_COMPACTION_TIERED ){
+    sortedSelectLeveled(pDb, nMerge, &pBest, &nBest, &rc);
+  }
+
   /* Find the longest contiguous run of levels not currently undergoing a 
   ** merge with the same age in the structure. Or the level being merged
-  ** with the largest number of right-hand segments. Work on it. */
-  for(pLevel=pTopLevel; pLevel; pLevel=pLevel->pNext){
+  ** with the largest number of right-hand segments. Work on it. Runs of
+  ** levels with disjoint key ranges are skipped while there is room for
+  ** them in the structure (see sortedMergeDeferrable()).  */
+  for(pLevel=(pBest ? 0 : pTopLevel); pLevel; pLevel=pLevel->pNext){
     if( pLevel->nRight==0 && pThis && pLevel->iAge==pThis->iAge ){
       nThis++;
     }else{
       if( nThis>nBest ){
-        if( (pLevel->iAge!=pThis->iAge+1)
-         || (pLevel->nRight==0 && sortedCountLevels(pLevel)<=pDb->nMerge)
+        if( ((pLevel->iAge!=pThis->iAge+1)
+          || (pLevel->nRight==0 && sortedCountLevels(pLevel)<=pDb->nMerge))
+         && (nMerge==1 || 0==sortedMergeDeferrable(pDb, pThis, nThis, &rc))
         ){
           pBest = pThis;
           nBest = nThis;
@@ -15329,7 +19604,9 @@ static int sortedSelectLevel(lsm_db *pDb, int nMerge, Level **ppOut){
       }
     }
   }
-  if( nThis>nBest ){
+  if( nThis>nBest 
+   && (nMerge==1 || 0==sortedMergeDeferrable(pDb, pThis, nThis, &rc))
+  ){
     assert( pThis );
     pBest = pThis;
     nBest = nThis;
@@ -15352,7 +19629,23 @@ static int sortedSelectLevel(lsm_db *pDb, int nMerge, Level **ppOut){
     }
   }
 
-  if( pBest ){
+  /* A level written by a bulk load may be older than the levels flushed
+  ** from the in-memory tree below it (see lsmSortedBulkBegin()). If there
+  ** are enough of those, there may be no run of levels of the same age left
+  ** to merge. If the structure has to shrink, merge the top levels anyway,
+  ** so that callers waiting on sortedDbIsFull() make progress.  */
+  if( pBest==0 && nMerge>1 && rc==LSM_OK && sortedDbIsFull(pDb) ){
+    int nTop = 0;
+    for(pLevel=pTopLevel; pLevel && pLevel->nRight==0; pLevel=pLevel->pNext){
+      if( ++nTop==nMerge ) break;
+    }
+    if( nTop>1 ){
+      pBest = pTopLevel;
+      nBest = nTop;
+    }
+  }
+
+  if( pBest && rc==LSM_OK ){
     if( pBest->nRight==0 ){
       rc = sortedMergeSetup(pDb, pBest, nBest, ppOut);
     }else{
@@ -15505,6 +19798,7 @@ static int mergeInsertFreelistSegments(
     lsmFree(pDb->pEnv, pCsr->aTree);
     lsmFree(pDb->pEnv, pCsr->aPtr);
     pCsr->aTree = 0;
+    pCsr->aPrefix = 0;
     pCsr->aPtr = aNew1;
 
     aNew2 = (Segment *)lsmMallocZeroRc(
@@ -15615,7 +19909,12 @@ static int sortedWork(
           }
           if( pLvl==mergeworker.pLevel ){
 
-            rc = mergeInsertFreelistSegments(pDb, nFree, &mergeworker);
+            /* Blocks for the pages still queued are allocated before the
+            ** free-list is read, as if they had been written already.  */
+            rc = mergeWorkerApplyOps(&mergeworker, 1);
+            if( rc==LSM_OK ){
+              rc = mergeInsertFreelistSegments(pDb, nFree, &mergeworker);
+            }
             if( rc==LSM_OK ){
               rc = multiCursorVisitFreelist(mergeworker.pCsr);
             }
@@ -15629,6 +19928,11 @@ static int sortedWork(
       }
       nRemaining -= LSM_MAX(mergeworker.nWork, 1);
 
+      /* Write the pages queued while other threads compressed them before
+      ** any input pages are gobbled, as if they had been written as they
+      ** were completed.  */
+      if( rc==LSM_OK ) rc = mergeWorkerApplyOps(&mergeworker, 1);
+
       if( rc==LSM_OK ){
         /* Check if the merge operation is completely finished. If not,
         ** gobble up (declare eligible for recycling) any pages from rhs
@@ -15702,6 +20006,10 @@ static int sortedWork(
             /* Free the Merge object */
             lsmFree(pDb->pEnv, pLevel->pMerge);
             pLevel->pMerge = 0;
+
+            /* Cache the key range of the merged level. As above, failing to
+            ** do so is not an error.  */
+            if( rc==LSM_OK ) sortedCacheBounds(pDb, pLevel);
           }
 
           if( bSave && rc==LSM_OK ){
@@ -15937,60 +20245,253 @@ static int doLsmWork(lsm_db *pDb, int nMerge, int nPage, int *pnWrite){
 }
 
 /*
-** Perform work to merge database segments together.
+** Perform work to merge database segments together.
+*/
+int lsm_work(lsm_db *pDb, int nMerge, int nKB, int *pnWrite){
+  int rc;                         /* Return code */
+  int nPgsz;                      /* Nominal page size in bytes */
+  int nPage;                      /* Equivalent of nKB in pages */
+  int nWrite = 0;                 /* Number of pages written */
+
+  /* This function may not be called if pDb has an open read or write
+  ** transaction. Return LSM_MISUSE if an application attempts this.  */
+  if( pDb->nTransOpen || pDb->pCsr || pDb->pBulk ) return LSM_MISUSE_BKPT;
+  if( nMerge<=0 ) nMerge = pDb->nMerge;
+
+  lsmFsPurgeCache(pDb->pFS);
+
+  /* Convert from KB to pages */
+  nPgsz = lsmFsPageSize(pDb->pFS);
+  if( nKB>=0 ){
+    nPage = ((i64)nKB * 1024 + nPgsz - 1) / nPgsz;
+  }else{
+    nPage = -1;
+  }
+
+  rc = doLsmWork(pDb, nMerge, nPage, &nWrite);
+  
+  if( pnWrite ){
+    /* Convert back from pages to KB */
+    *pnWrite = (int)(((i64)nWrite * 1024 + nPgsz - 1) / nPgsz);
+  }
+  return rc;
+}
+
+int lsm_flush(lsm_db *db){
+  int rc;
+
+  if( db->nTransOpen>0 || db->pCsr || db->pBulk ){
+    rc = LSM_MISUSE_BKPT;
+  }else{
+    rc = lsmBeginWriteTrans(db);
+    if( rc==LSM_OK ){
+      lsmFlushTreeToDisk(db);
+      lsmTreeDiscardOld(db);
+      lsmTreeMakeOld(db);
+      lsmTreeDiscardOld(db);
+    }
+
+    if( rc==LSM_OK ){
+      rc = lsmFinishWriteTrans(db, 1);
+    }else{
+      lsmFinishWriteTrans(db, 0);
+    }
+    lsmFinishReadTrans(db);
+  }
+
+  return rc;
+}
+
+int lsm_bulk_begin(lsm_db *db){
+  int rc;
+
+  if( db->nTransOpen>0 || db->pCsr || db->pBulk ) return LSM_MISUSE_BKPT;
+  if( db->bReadonly ) return LSM_READONLY;
+
+  /* The WRITER lock is held until lsm_bulk_end() is called. Whatever is in
+  ** the in-memory tree is flushed to disk first, so that the records loaded
+  ** are the most recent ones in the database. An empty tree is not flushed,
+  ** as that would only add a level holding the free-list to the structure.  */
+  rc = lsmBeginWriteTrans(db);
+  if( rc==LSM_OK ){
+    int bFlushed;
+    if( lsmTreeHasOld(db) || lsmTreeSize(db)>0 ){
+      rc = lsmFlushTreeToDisk(db);
+    }
+    bFlushed = (rc==LSM_OK);
+    if( bFlushed ){
+      lsmTreeDiscardOld(db);
+      lsmTreeMakeOld(db);
+      lsmTreeDiscardOld(db);
+      rc = lsmBeginWork(db);
+      if( rc==LSM_OK ) rc = lsmSortedBulkBegin(db);
+      if( rc!=LSM_OK ) lsmFinishWork(db, 0, &rc);
+    }
+    if( rc!=LSM_OK ){
+      lsmFinishWriteTrans(db, bFlushed);
+      lsmFinishReadTrans(db);
+    }
+  }
+
+  return rc;
+}
+
+int lsm_bulk_insert(
+  lsm_db *db, 
+  const void *pKey, int nKey,
+  const void *pVal, int nVal
+){
+  if( db->pBulk==0 || nKey<0 || nVal<0 ) return LSM_MISUSE_BKPT;
+  return lsmSortedBulkInsert(db, (void *)pKey, nKey, (void *)pVal, nVal);
+}
+
+int lsm_bulk_end(lsm_db *db, int bCommit){
+  int rc;
+
+  if( db->pBulk==0 ) return LSM_MISUSE_BKPT;
+
+  rc = lsmSortedBulkEnd(db, bCommit);
+  if( rc==LSM_OK && bCommit ){
+    lsmFinishWork(db, 0, &rc);
+  }else{
+    int rcdummy = LSM_BUSY;
+    lsmFinishWork(db, 0, &rcdummy);
+  }
+  if( rc==LSM_OK ){
+    rc = lsmFinishWriteTrans(db, 1);
+  }else{
+    lsmFinishWriteTrans(db, 1);
+  }
+  lsmFinishReadTrans(db);
+
+  /* Write the snapshot containing the new level to the database file. If
+  ** another connection is checkpointing, it is left to the next checkpoint,
+  ** as the new level has already been published in shared memory.  */
+  if( rc==LSM_OK && bCommit ){
+    rc = lsm_checkpoint(db, 0);
+    if( rc==LSM_BUSY ) rc = LSM_OK;
+  }
+  return rc;
+}
+
+/*
+** Read the entry at offset *piOff of the value log. If the current version
+** of its key still refers to it, write the current value of the key to the
+** database again (within the write transaction open on db). Set *piOff to
+** the offset of the next entry. Buffer *pBuf is used to hold the key and
+** value.
 */
-int lsm_work(lsm_db *pDb, int nMerge, int nKB, int *pnWrite){
-  int rc;                         /* Return code */
-  int nPgsz;                      /* Nominal page size in bytes */
-  int nPage;                      /* Equivalent of nKB in pages */
-  int nWrite = 0;                 /* Number of pages written */
-
-  /* This function may not be called if pDb has an open read or write
-  ** transaction. Return LSM_MISUSE if an application attempts this.  */
-  if( pDb->nTransOpen || pDb->pCsr ) return LSM_MISUSE_BKPT;
-  if( nMerge<=0 ) nMerge = pDb->nMerge;
-
-  lsmFsPurgeCache(pDb->pFS);
+static int vlogRewriteEntry(lsm_db *db, i64 *piOff, LsmBlob *pBuf){
+  i64 iOff = *piOff;
+  int nStored = -1;
+  u8 *aData = 0;
+  int nKey = 0;
+  int nVal = 0;
+  lsm_cursor *pCsr = 0;
+  int bRef = 0;
+  int rc;
 
-  /* Convert from KB to pages */
-  nPgsz = lsmFsPageSize(pDb->pFS);
-  if( nKB>=0 ){
-    nPage = ((i64)nKB * 1024 + nPgsz - 1) / nPgsz;
-  }else{
-    nPage = -1;
+  rc = lsmFsVlogRead(db->pFS, iOff, &nStored, &aData, &nKey, &nVal);
+  if( rc==LSM_OK && aData==0 ) rc = LSM_CORRUPT_BKPT;
+  if( rc==LSM_OK ) rc = sortedBlobSet(db->pEnv, pBuf, aData, nKey);
+  if( rc==LSM_OK ) rc = lsm_csr_open(db, &pCsr);
+  if( rc==LSM_OK ){
+    rc = lsmSortedVlogRef((MultiCursor *)pCsr, pBuf->pData, nKey, iOff, &bRef);
   }
-
-  rc = doLsmWork(pDb, nMerge, nPage, &nWrite);
-  
-  if( pnWrite ){
-    /* Convert back from pages to KB */
-    *pnWrite = (int)(((i64)nWrite * 1024 + nPgsz - 1) / nPgsz);
+  if( rc==LSM_OK && bRef ){
+    void *pVal = 0;
+    rc = lsmMCursorValue((MultiCursor *)pCsr, &pVal, &nVal);
+    if( rc==LSM_OK ) rc = sortedBlobGrow(db->pEnv, pBuf, nKey+nVal);
+    if( rc==LSM_OK ) memcpy(&((u8 *)pBuf->pData)[nKey], pVal, nVal);
+  }
+  lsm_csr_close(pCsr);
+  if( rc==LSM_OK && bRef ){
+    u8 *aBuf = (u8 *)pBuf->pData;
+    rc = lsm_insert(db, aBuf, nKey, &aBuf[nKey], nVal);
   }
+
+  *piOff = iOff + LSM_VLOG_ENTRY_HDR + nStored;
   return rc;
 }
 
-int lsm_flush(lsm_db *db){
+int lsm_vlog_gc(lsm_db *db, int nKB, int *pnKB){
   int rc;
+  i64 iTail = 0;                  /* Tail of value log */
+  i64 iHead = 0;                  /* Head of value log */
+  i64 iEnd;                       /* End of range to reclaim */
+  int nReclaim = 0;               /* KB reclaimed */
+
+  if( pnKB ) *pnKB = 0;
+  if( db->nTransOpen>0 || db->pCsr || db->pBulk ) return LSM_MISUSE_BKPT;
+  if( db->bReadonly ) return LSM_READONLY;
+
+  rc = lsmFsVlogRange(db->pFS, &iTail, &iHead);
+  if( rc!=LSM_OK || iTail>=iHead ) return rc;
+
+  /* Write the values in the range that are still referenced to the 
+  ** database again. The range ends after the entry that crosses the
+  ** nKB KB limit.  */
+  iEnd = iTail;
+  rc = lsm_begin(db, 1);
+  if( rc==LSM_OK ){
+    LsmBlob buf = {0, 0, 0, 0};
+    i64 iLimit = (nKB<0 ? iHead : iTail + (i64)nKB*1024);
+    buf.pEnv = db->pEnv;
+    while( rc==LSM_OK && iEnd<iHead && iEnd<iLimit ){
+      rc = vlogRewriteEntry(db, &iEnd, &buf);
+    }
+    if( rc==LSM_OK && iEnd>iHead ) rc = LSM_CORRUPT_BKPT;
+    sortedBlobFree(&buf);
+    if( rc==LSM_OK ){
+      rc = lsm_commit(db, 0);
+    }else{
+      lsm_rollback(db, 0);
+    }
+  }
 
-  if( db->nTransOpen>0 || db->pCsr ){
-    rc = LSM_MISUSE_BKPT;
-  }else{
+  /* Flush the in-memory tree to disk, so that no record in the tree or
+  ** the log refers to the range, and checkpoint the result.  */
+  if( rc==LSM_OK && iEnd>iTail ){
     rc = lsmBeginWriteTrans(db);
     if( rc==LSM_OK ){
-      lsmFlushTreeToDisk(db);
-      lsmTreeDiscardOld(db);
-      lsmTreeMakeOld(db);
-      lsmTreeDiscardOld(db);
+      int bFlushed;
+      rc = lsmFlushTreeToDisk(db);
+      bFlushed = (rc==LSM_OK);
+      if( bFlushed ){
+        lsmTreeDiscardOld(db);
+        lsmTreeMakeOld(db);
+        lsmTreeDiscardOld(db);
+        rc = lsmFinishWriteTrans(db, 1);
+      }else{
+        lsmFinishWriteTrans(db, 0);
+      }
+      lsmFinishReadTrans(db);
     }
+    if( rc==LSM_OK ) rc = lsm_checkpoint(db, 0);
 
+    /* Deallocate the range, unless a reader might still use a snapshot
+    ** from before the flush (in which the superseded records referring to
+    ** the range are current), or another call has already done so.  */
+    if( rc==LSM_OK ) rc = lsmBeginWriteTrans(db);
     if( rc==LSM_OK ){
-      rc = lsmFinishWriteTrans(db, 1);
-    }else{
+      i64 iId = lsmCheckpointId(db->aSnapshot, 0);
+      i64 iInUse = iId;
+      i64 iTailNow = 0;
+      int bRotrans = 0;
+      rc = lsmDetectRoTrans(db, &bRotrans);
+      if( rc==LSM_OK ) rc = firstSnapshotInUse(db, &iInUse);
+      if( rc==LSM_OK ) rc = lsmFsVlogRange(db->pFS, &iTailNow, &iHead);
+      if( rc==LSM_OK && bRotrans==0 && iInUse==iId && iTailNow==iTail ){
+        rc = lsmFsVlogReclaim(db->pFS, iTail, iEnd);
+        if( rc==LSM_OK ) nReclaim = (int)((iEnd - iTail) / 1024);
+      }
       lsmFinishWriteTrans(db, 0);
+      lsmFinishReadTrans(db);
     }
-    lsmFinishReadTrans(db);
+    if( rc==LSM_BUSY ) rc = LSM_OK;
   }
 
+  if( pnKB ) *pnKB = nReclaim;
   return rc;
 }
 
@@ -16077,6 +20578,123 @@ static int lsmFlushTreeToDisk(lsm_db *pDb){
   return rc;
 }
 
+/*
+** Start a bulk load (see lsm_bulk_begin()). The caller holds the WORKER
+** lock. A new, empty, top level is added to the worker snapshot, to be
+** populated by lsmSortedBulkInsert().
+*/
+static int lsmSortedBulkBegin(lsm_db *pDb){
+  int rc = LSM_OK;                /* Return code */
+  BulkLoad *p;                    /* New bulk load object */
+  Level *pNew = 0;                /* New top level */
+  MultiCursor *pCsr = 0;          /* Empty cursor for the MergeWorker */
+
+  assert( pDb->pWorker && pDb->pBulk==0 );
+  p = (BulkLoad *)lsmMallocZeroRc(pDb->pEnv, sizeof(BulkLoad), &rc);
+  pNew = (Level *)lsmMallocZeroRc(pDb->pEnv, sizeof(Level), &rc);
+  pCsr = (MultiCursor *)lsmMallocZeroRc(pDb->pEnv, sizeof(MultiCursor), &rc);
+  if( rc!=LSM_OK ){
+    lsmFree(pDb->pEnv, pCsr);
+    lsmFree(pDb->pEnv, pNew);
+    lsmFree(pDb->pEnv, p);
+    return rc;
+  }
+
+  /* The new level is given the age of the level below it (at least 1), so
+  ** that it is not merged with the levels flushed from the in-memory tree
+  ** right away. Its records carry no pointers into the level below, which
+  ** is searched as if the new level did not exist.  */
+  p->pNext = lsmDbSnapshotLevel(pDb->pWorker);
+  pNew->pNext = p->pNext;
+  pNew->iAge = (u16)LSM_MAX(1, p->pNext ? p->pNext->iAge : 0);
+  pNew->pMerge = &p->merge;
+  pNew->flags |= LEVEL_INCOMPLETE;
+  lsmDbSnapshotSetLevel(pDb->pWorker, pNew);
+  p->pNew = pNew;
+
+  pCsr->pDb = pDb;
+  pCsr->pPrevMergePtr = &p->iLeftPtr;
+  p->mergeworker.pDb = pDb;
+  p->mergeworker.pLevel = pNew;
+  p->mergeworker.pCsr = pCsr;
+  p->mergeworker.bFlush = 1;
+  mergeWorkerQueueInit(&p->mergeworker);
+  p->key.pEnv = pDb->pEnv;
+
+  pDb->pBulk = p;
+  return LSM_OK;
+}
+
+/*
+** Append a record to the segment of a bulk load. LSM_MISUSE is returned,
+** and nothing written, if the key is not larger than that of the previous
+** record. Once writing a record fails, so does the rest of the bulk load.
+*/
+static int lsmSortedBulkInsert(
+  lsm_db *pDb,                    /* Connection handle */
+  void *pKey, int nKey,           /* Key to write */
+  void *pVal, int nVal            /* Value to write */
+){
+  BulkLoad *p = pDb->pBulk;
+  MergeWorker *pMW = &p->mergeworker;
+  int eType = LSM_INSERT;
+  u8 aPtr[LSM_VLOG_PTR_SIZE];
+
+  if( p->rc!=LSM_OK ) return p->rc;
+  if( pMW->nEntry>0 && pDb->xCmp(p->key.pData, p->key.nData, pKey, nKey)>=0 ){
+    return LSM_MISUSE_BKPT;
+  }
+
+  p->rc = sortedVlogSeparate(pDb, &eType, pKey, nKey, &pVal, &nVal, aPtr);
+  if( p->rc==LSM_OK ){
+    p->rc = mergeWorkerWrite(pMW, eType, pKey, nKey, pVal, nVal, 0);
+  }
+  if( p->rc==LSM_OK ){
+    pMW->nEntry++;
+    p->rc = sortedBlobSet(pDb->pEnv, &p->key, pKey, nKey);
+  }
+  return p->rc;
+}
+
+/*
+** Finish the segment of a bulk load and leave the new level in the worker
+** snapshot if bCommit is true. Otherwise, or if an error occurs, the new
+** level is removed from the worker snapshot. Either way, the bulk load
+** object is freed.
+*/
+static int lsmSortedBulkEnd(lsm_db *pDb, int bCommit){
+  BulkLoad *p = pDb->pBulk;
+  Level *pNew = p->pNew;
+  int rc = (bCommit ? p->rc : LSM_BUSY);
+
+  /* If the bulk load is rolled back, mergeWorkerShutdown() only releases
+  ** the pages of the segment, without finishing it.  */
+  mergeWorkerShutdown(&p->mergeworker, &rc);
+  if( rc==LSM_OK && pNew->lhs.iFirst ){
+    rc = lsmFsSortedFinish(pDb->pFS, &pNew->lhs);
+  }
+  pNew->flags &= ~LEVEL_INCOMPLETE;
+  pNew->pMerge = 0;
+
+  if( rc!=LSM_OK || pNew->lhs.iFirst==0 ){
+    lsmDbSnapshotSetLevel(pDb->pWorker, p->pNext);
+    sortedFreeLevel(pDb->pEnv, pNew);
+  }else{
+#if LSM_LOG_STRUCTURE
+    lsmSortedDumpStructure(pDb, pDb->pWorker, LSM_LOG_DATA, 0, "bulk-load");
+#endif
+    pDb->pWorker->nWrite += p->mergeworker.nWork;
+    sortedCacheBounds(pDb, pNew);
+    assertBtreeOk(pDb, &pNew->lhs);
+    sortedInvokeWorkHook(pDb);
+  }
+
+  sortedBlobFree(&p->key);
+  lsmFree(pDb->pEnv, p);
+  pDb->pBulk = 0;
+  return (bCommit ? rc : LSM_OK);
+}
+
 /*
 ** Return a string representation of the segment passed as the only argument.
 ** Space for the returned string is allocated using lsmMalloc(), and should
@@ -16144,6 +20762,49 @@ static int fileToString(
   return i;
 }
 
+/*
+** Load the key of cell iCell of page pPg, which must not be a restart point
+** of a page with the PGFTR_PREFIX_FLAG flag set, into blob pBlob, followed
+** by its value. Set *pnKey and *pnVal to their sizes.
+*/
+static void infoPrefixCell(
+  Segment *pSeg,                  /* Segment pPg belongs to */
+  Page *pPg,                      /* Page to read from */
+  int iCell,                      /* Index of cell on page to read */
+  LsmBlob *pBlob,                 /* OUT: Key and value of cell */
+  int *pnKey, int *pnVal          /* OUT: Size of key and value */
+){
+  LsmBlob val = {0, 0, 0, 0};
+  u8 *aVal = 0; int nVal = 0;
+  u8 *aCell;
+  u8 *aData;
+  int nData;
+  int nSuffix;
+  int eType;
+  i64 nDummy;
+
+  aData = fsPageData(pPg, &nData);
+  aCell = pageGetCell(aData, nData, iCell);
+  eType = *aCell++;
+  aCell += lsmVarintGet64(aCell, &nDummy);
+  aCell += lsmVarintGet32(aCell, &nSuffix);
+  aCell += lsmVarintGet32(aCell, &nSuffix);
+  if( rtIsWrite(eType) ) aCell += lsmVarintGet32(aCell, &nVal);
+
+  *pnKey = 0;
+  *pnVal = 0;
+  if( pagePrefixKey(pSeg, pPg, iCell, 0, pBlob)==LSM_OK
+   && sortedReadData(pSeg, pPg, (aCell-aData)+nSuffix, nVal, 
+                     (void **)&aVal, &val)==LSM_OK
+   && sortedBlobGrow(lsmPageEnv(pPg), pBlob, pBlob->nData+nVal)==LSM_OK
+  ){
+    memcpy(&((u8 *)pBlob->pData)[pBlob->nData], aVal, nVal);
+    *pnKey = pBlob->nData;
+    *pnVal = nVal;
+  }
+  sortedBlobFree(&val);
+}
+
 void sortedDumpPage(lsm_db *pDb, Segment *pRun, Page *pPg, int bVals){
   LsmBlob blob = {0, 0, 0};       /* LsmBlob used for keys */
   LsmString s;
@@ -16182,9 +20843,15 @@ void sortedDumpPage(lsm_db *pDb, Segment *pRun, Page *pPg, int bVals){
 
     if( eType==0 ){
       LsmPgno iRef;               /* Page number of referenced page */
+      int rcKey = LSM_OK;         /* Ignored, the key is printed regardless */
       aCell += lsmVarintGet64(aCell, &iRef);
       lsmFsDbPageGet(pDb->pFS, pRun, iRef, &pRef);
-      aKey = pageGetKey(pRun, pRef, 0, &iTopic, &nKey, &blob);
+      aKey = pageGetKey(pRun, pRef, 0, &iTopic, &nKey, &blob, &rcKey);
+    }else if( pageIsPrefixCell(flags, i) ){
+      infoPrefixCell(0, pPg, i, &blob, &nKey, &nVal);
+      aKey = (u8 *)blob.pData;
+      aVal = &aKey[nKey];
+      iTopic = eType;
     }else{
       aCell += lsmVarintGet32(aCell, &nKey);
       if( rtIsWrite(eType) ) aCell += lsmVarintGet32(aCell, &nVal);
@@ -16255,6 +20922,10 @@ static void infoCellDump(
       aKey = (u8 *)"<indirect>";
       nKey = 11;
     }
+  }else if( pageIsPrefixCell(pageGetFlags(aData, nData), iCell) ){
+    infoPrefixCell(pSeg, pPg, iCell, pBlob, &nKey, &nVal);
+    aKey = (u8 *)pBlob->pData;
+    aVal = &aKey[nKey];
   }else{
     aCell += lsmVarintGet32(aCell, &nKey);
     if( rtIsWrite(eType) ) aCell += lsmVarintGet32(aCell, &nVal);
@@ -16713,10 +21384,10 @@ static int assertPointersOk(
       ** key ptr2.pKey/nKey. This key should have a pointer to the page that
       ** ptr2 currently points to. */
       while( rc==LSM_OK ){
-        int res = rtTopic(ptr1.eType) - rtTopic(ptr2.eType);
-        if( res==0 ){
-          res = pDb->xCmp(ptr1.pKey, ptr1.nKey, ptr2.pKey, ptr2.nKey);
-        }
+        int res = sortedKeyCompare(pDb->xCmp,
+            rtTopic(ptr1.eType), ptr1.pKey, ptr1.nKey,
+            rtTopic(ptr2.eType), ptr2.pKey, ptr2.nKey
+        );
 
         if( res<0 ){
           assert( bRhs || ptr1.iPtr+ptr1.iPgPtr==iPrev );
@@ -16787,10 +21458,12 @@ static int assertBtreeOk(
         u8 *pKey;
         int nKey;
         int iTopic;
-        pKey = pageGetKey(pSeg, pPg, 0, &iTopic, &nKey, &blob);
-        assert( nKey==pCsr->nKey && 0==memcmp(pKey, pCsr->pKey, nKey) );
+        pKey = pageGetKey(pSeg, pPg, 0, &iTopic, &nKey, &blob, &rc);
+        assert( rc!=LSM_OK 
+             || (nKey==pCsr->nKey && 0==memcmp(pKey, pCsr->pKey, nKey)) 
+        );
         assert( lsmFsPageNumber(pPg)==pCsr->iPtr );
-        rc = btreeCursorNext(pCsr);
+        if( rc==LSM_OK ) rc = btreeCursorNext(pCsr);
       }
     }
     assert( rc!=LSM_OK || pCsr->pKey==0 );
@@ -17223,11 +21896,12 @@ static void intArrayTruncate(IntArray *p, int nVal){
 /* End of IntArray methods.
 ***********************************************************************/
 
-static int treeKeycmp(void *p1, int n1, void *p2, int n2){
-  int res;
-  res = memcmp(p1, p2, LSM_MIN(n1, n2));
-  if( res==0 ) res = (n1-n2);
-  return res;
+/*
+** Compare two keys in the order of the database handle, which is either the
+** order of its key format or that of a user supplied comparator.
+*/
+static int treeKeycmp(lsm_db *db, void *p1, int n1, void *p2, int n2){
+  return db->xCmp(p1, n1, p2, n2);
 }
 
 /*
@@ -18415,6 +23089,7 @@ static int treeInsertEntry(
   assert_tree_looks_ok(LSM_OK, pTree);
   assert( flags==LSM_INSERT       || flags==LSM_POINT_DELETE 
        || flags==LSM_START_DELETE || flags==LSM_END_DELETE 
+       || flags==(LSM_INSERT|LSM_OPERAND)
   );
   assert( (flags & LSM_CONTIGUOUS)==0 );
 #if 0
@@ -18546,6 +23221,82 @@ static int lsmTreeInsert(
   return treeInsertEntry(pDb, flags, pKey, nKey, pVal, nVal);
 }
 
+/*
+** Insert a merge operand into the in-memory tree. The operand replaces
+** any entry for the same key already in the tree, so it must already have
+** been combined with that entry by lsmTreeMergeOperand().
+*/
+static int lsmTreeInsertOperand(
+  lsm_db *pDb,                    /* Database handle */
+  void *pKey,                     /* Pointer to key data */
+  int nKey,                       /* Size of key data in bytes */
+  void *pVal,                     /* Pointer to value data */
+  int nVal                        /* Bytes in value data */
+){
+  assert( nVal>=0 );
+  return treeInsertEntry(pDb, LSM_INSERT|LSM_OPERAND, pKey, nKey, pVal, nVal);
+}
+
+/*
+** Merge operand *ppVal (size *pnVal) is about to be written to key pKey.
+** Combine it with the entry for the same key in the current in-memory tree
+** (if any) using the merge function configured on the connection, and set
+** *ppVal and *pnVal to the result.
+**
+** *pbOperand is set to true if the result is still a merge operand, as 
+** older versions of the key may exist outside of the tree. Or to false if 
+** the tree contains either a value that is not a merge operand or a delete
+** for the key, in which case the result is a regular value.
+*/
+static int lsmTreeMergeOperand(
+  lsm_db *pDb,                    /* Database handle */
+  void *pKey, int nKey,           /* Key being written */
+  void **ppVal, int *pnVal,       /* IN/OUT: Operand being written */
+  int *pbOperand                  /* OUT: True if result is an operand */
+){
+  const int SD_ED = (LSM_START_DELETE|LSM_END_DELETE);
+  int rc = LSM_OK;
+  TreeRoot *p = &pDb->treehdr.root;
+
+  *pbOperand = 1;
+  if( p->iRoot ){
+    TreeCursor csr;               /* Cursor to seek to pKey/nKey */
+    TreeKey *pRes;                /* Key at end of seek operation */
+    int res = 0;                  /* Result of seek operation on csr */
+
+    treeCursorInit(pDb, 0, &csr);
+    rc = lsmTreeCursorSeek(&csr, pKey, nKey, &res);
+    pRes = csrGetKey(&csr, &csr.blob, &rc);
+    if( rc==LSM_OK ){
+      if( (res<0 && (pRes->flags & LSM_START_DELETE))
+       || (res>0 && (pRes->flags & LSM_END_DELETE))
+       || (res==0 && (pRes->flags & LSM_POINT_DELETE))
+       || (res==0 && (pRes->flags & SD_ED)==SD_ED)
+      ){
+        *pbOperand = 0;
+      }else if( res==0 && (pRes->flags & LSM_INSERT) ){
+        void *pOut = 0;
+        int nOut = 0;
+        rc = pDb->xMerge(pDb->pMergeCtx, pKey, nKey, 
+            TKV_VAL(pRes), pRes->nValue, *ppVal, *pnVal, &pOut, &nOut
+        );
+        if( rc==LSM_OK ){
+          if( nOut<0 || (pOut==0 && nOut>0) ){
+            rc = LSM_MISUSE_BKPT;
+          }else{
+            *ppVal = pOut;
+            *pnVal = nOut;
+            *pbOperand = ((pRes->flags & LSM_OPERAND)!=0);
+          }
+        }
+      }
+    }
+    tblobFree(pDb, &csr.blob);
+  }
+
+  return rc;
+}
+
 static int treeDeleteEntry(lsm_db *db, TreeCursor *pCsr, u32 iNewptr){
   TreeRoot *p = &db->treehdr.root;
   TreeNode *pNode = pCsr->apTreeNode[pCsr->iNode];
@@ -18762,7 +23513,7 @@ static int lsmTreeDelete(
   TreeBlob blob = {0, 0};
 
   /* The range must be sensible - that (key1 < key2). */
-  assert( treeKeycmp(pKey1, nKey1, pKey2, nKey2)<0 );
+  assert( treeKeycmp(db, pKey1, nKey1, pKey2, nKey2)<0 );
   assert( assert_delete_ranges_match(db) );
 
 #if 0
@@ -18794,7 +23545,7 @@ static int lsmTreeDelete(
     bDone = 1;
     if( lsmTreeCursorValid(&csr) ){
       lsmTreeCursorKey(&csr, 0, &pDel, &nDel);
-      if( treeKeycmp(pDel, nDel, pKey2, nKey2)<0 ) bDone = 0;
+      if( treeKeycmp(db, pDel, nDel, pKey2, nKey2)<0 ) bDone = 0;
     }
 
     if( bDone==0 ){
@@ -18910,7 +23661,7 @@ static int treeCsrCompare(TreeCursor *pCsr, void *pKey, int nKey, int *pRc){
   assert( pCsr->iNode>=0 );
   p = csrGetKey(pCsr, &pCsr->blob, pRc);
   if( p ){
-    cmp = treeKeycmp(TKV_KEY(p), p->nKey, pKey, nKey);
+    cmp = treeKeycmp(pCsr->pDb, TKV_KEY(p), p->nKey, pKey, nKey);
   }
   return cmp;
 }
@@ -18968,7 +23719,7 @@ static int lsmTreeCursorSeek(TreeCursor *pCsr, void *pKey, int nKey, int *pRes){
         pTreeKey = treeShmkey(pDb, pNode->aiKeyPtr[1], TKV_LOADKEY, &b, &rc);
         if( rc!=LSM_OK ) break;
       }
-      res = treeKeycmp((void *)&pTreeKey[1], pTreeKey->nKey, pKey, nKey);
+      res = treeKeycmp(pDb, (void *)&pTreeKey[1], pTreeKey->nKey, pKey,nKey);
       if( res==0 ){
         pCsr->aiCell[iNode] = 1;
         break;
@@ -18985,7 +23736,7 @@ static int lsmTreeCursorSeek(TreeCursor *pCsr, void *pKey, int nKey, int *pRes){
           pTreeKey = treeShmkey(pDb, iTreeKey, TKV_LOADKEY, &b, &rc);
           if( rc ) break;
         }
-        res = treeKeycmp((void *)&pTreeKey[1], pTreeKey->nKey, pKey, nKey);
+        res = treeKeycmp(pDb, (void *)&pTreeKey[1], pTreeKey->nKey, pKey,nKey);
         if( res==0 ){
           pCsr->aiCell[iNode] = (u8)iTest;
           break;
@@ -19076,7 +23827,8 @@ static int lsmTreeCursorNext(TreeCursor *pCsr){
 #ifndef NDEBUG
   if( pCsr->iNode>=0 ){
     TreeKey *pK2 = csrGetKey(pCsr, &pCsr->blob, &rc);
-    assert( rc||treeKeycmp(TKV_KEY(pK2),pK2->nKey,TKV_KEY(pK1),pK1->nKey)>=0 );
+    assert( rc || treeKeycmp(pDb,
+          TKV_KEY(pK2), pK2->nKey, TKV_KEY(pK1), pK1->nKey)>=0 );
   }
   tblobFree(pDb, &key1);
 #endif
@@ -19144,7 +23896,8 @@ static int lsmTreeCursorPrev(TreeCursor *pCsr){
 #ifndef NDEBUG
   if( pCsr->iNode>=0 ){
     TreeKey *pK2 = csrGetKey(pCsr, &pCsr->blob, &rc);
-    assert( rc || treeKeycmp(TKV_KEY(pK2),pK2->nKey,TKV_KEY(pK1),pK1->nKey)<0 );
+    assert( rc || treeKeycmp(pDb,
+          TKV_KEY(pK2), pK2->nKey, TKV_KEY(pK1), pK1->nKey)<0 );
   }
   tblobFree(pDb, &key1);
 #endif
@@ -19615,6 +24368,62 @@ static int lsmPosixOsSync(lsm_file *pFile){
   return rc;
 }
 
+static int lsmPosixOsSyncRange(
+  lsm_file *pFile,
+  lsm_i64 iOff,
+  lsm_i64 nByte,
+  int bWait
+){
+  int rc = LSM_OK;
+
+  /* Only Linux implements sync_file_range(). Elsewhere, this is a no-op. */
+#if !defined(LSM_NO_SYNC) && defined(__linux__)
+  PosixFile *p = (PosixFile *)pFile;
+  unsigned int flags = SYNC_FILE_RANGE_WRITE;
+  if( bWait ){
+    flags |= SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WAIT_AFTER;
+  }
+  if( sync_file_range(p->fd, (off_t)iOff, (off_t)nByte, flags) ){
+    rc = LSM_IOERR_BKPT;
+  }
+#else
+  (void)pFile;
+  (void)iOff;
+  (void)nByte;
+  (void)bWait;
+#endif
+
+  return rc;
+}
+
+static int lsmPosixOsFallocate(
+  lsm_file *pFile,
+  lsm_i64 iOff,
+  lsm_i64 nByte,
+  int bPunch
+){
+  int rc = LSM_OK;
+
+  /* Only Linux implements fallocate(). Elsewhere, this is a no-op. So it is
+  ** if the file-system does not support the operation.  */
+#if defined(__linux__)
+  PosixFile *p = (PosixFile *)pFile;
+  int mode = (bPunch ? FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE : 0);
+  if( fallocate(p->fd, mode, (off_t)iOff, (off_t)nByte) 
+   && errno!=EOPNOTSUPP && errno!=ENOSYS
+  ){
+    rc = LSM_IOERR_BKPT;
+  }
+#else
+  (void)pFile;
+  (void)iOff;
+  (void)nByte;
+  (void)bPunch;
+#endif
+
+  return rc;
+}
+
 static int lsmPosixOsSectorSize(lsm_file *pFile){
   return 512;
 }
@@ -19665,6 +24474,53 @@ static int lsmPosixOsRemap(
   return LSM_OK;
 }
 
+static int lsmPosixOsAdvise(
+  lsm_file *pFile,
+  lsm_i64 iOff,
+  lsm_i64 nByte,
+  int eAdvice
+){
+  PosixFile *p = (PosixFile *)pFile;
+
+  /* The mapped part of the range is advised on through the mapping. */
+  if( p->pMap && iOff<p->nMap ){
+    i64 nMap = LSM_MIN(nByte, p->nMap - iOff);
+    int eMadv;
+    switch( eAdvice ){
+      case LSM_ADVISE_RANDOM:     eMadv = POSIX_MADV_RANDOM;     break;
+      case LSM_ADVISE_SEQUENTIAL: eMadv = POSIX_MADV_SEQUENTIAL; break;
+      case LSM_ADVISE_WILLNEED:   eMadv = POSIX_MADV_WILLNEED;   break;
+      case LSM_ADVISE_DONTNEED:   eMadv = POSIX_MADV_DONTNEED;   break;
+      default:                    eMadv = POSIX_MADV_NORMAL;     break;
+    }
+    if( posix_madvise(&((u8 *)p->pMap)[iOff], (size_t)nMap, eMadv) ){
+      return LSM_IOERR_BKPT;
+    }
+    iOff += nMap;
+    nByte -= nMap;
+  }
+
+  /* The rest of it, which is read using read(), through the descriptor. 
+  ** Some systems (e.g. macOS) do not implement posix_fadvise(), in which 
+  ** case this advice is dropped.  */
+#ifdef POSIX_FADV_WILLNEED
+  if( nByte>0 ){
+    int eFadv;
+    switch( eAdvice ){
+      case LSM_ADVISE_RANDOM:     eFadv = POSIX_FADV_RANDOM;     break;
+      case LSM_ADVISE_SEQUENTIAL: eFadv = POSIX_FADV_SEQUENTIAL; break;
+      case LSM_ADVISE_WILLNEED:   eFadv = POSIX_FADV_WILLNEED;   break;
+      case LSM_ADVISE_DONTNEED:   eFadv = POSIX_FADV_DONTNEED;   break;
+      default:                    eFadv = POSIX_FADV_NORMAL;     break;
+    }
+    if( posix_fadvise(p->fd, (off_t)iOff, (off_t)nByte, eFadv) ){
+      return LSM_IOERR_BKPT;
+    }
+  }
+#endif
+  return LSM_OK;
+}
+
 static int lsmPosixOsFullpath(
   lsm_env *pEnv,
   const char *zName,
@@ -20057,6 +24913,95 @@ static int lsmPosixOsMutexNotHeld(lsm_mutex *p){
   return pMutex ? !pthread_equal(pMutex->owner, pthread_self()) : 1;
 }
 #endif
+
+/*
+** Threads and condition variables, used to compress pages on background
+** threads (see LSM_CONFIG_COMPRESS_THREADS).
+*/
+typedef struct PthreadThread PthreadThread;
+struct PthreadThread {
+  lsm_env *pEnv;                  /* Environment handle (for xFree()) */
+  pthread_t thread;               /* Thread handle */
+  void (*xMain)(void *);          /* Function run by the thread */
+  void *pArg;                     /* Argument passed to xMain */
+};
+
+typedef struct PthreadCond PthreadCond;
+struct PthreadCond {
+  lsm_env *pEnv;                  /* Environment handle (for xFree()) */
+  pthread_cond_t cond;            /* Condition variable */
+};
+
+static void *lsmPosixOsThreadMain(void *pCtx){
+  PthreadThread *p = (PthreadThread *)pCtx;
+  p->xMain(p->pArg);
+  return 0;
+}
+
+static int lsmPosixOsThreadNew(
+  lsm_env *pEnv, 
+  void (*xMain)(void *), 
+  void *pArg, 
+  lsm_thread **ppNew
+){
+  PthreadThread *p;
+
+  *ppNew = 0;
+  p = (PthreadThread *)lsmMallocZero(pEnv, sizeof(PthreadThread));
+  if( !p ) return LSM_NOMEM_BKPT;
+
+  p->pEnv = pEnv;
+  p->xMain = xMain;
+  p->pArg = pArg;
+  if( pthread_create(&p->thread, 0, lsmPosixOsThreadMain, (void *)p) ){
+    lsmFree(pEnv, p);
+    return LSM_ERROR;
+  }
+
+  *ppNew = (lsm_thread *)p;
+  return LSM_OK;
+}
+
+static void lsmPosixOsThreadJoin(lsm_thread *pThread){
+  PthreadThread *p = (PthreadThread *)pThread;
+  pthread_join(p->thread, 0);
+  lsmFree(p->pEnv, p);
+}
+
+static int lsmPosixOsCondNew(lsm_env *pEnv, lsm_cond **ppNew){
+  PthreadCond *p;
+
+  *ppNew = 0;
+  p = (PthreadCond *)lsmMallocZero(pEnv, sizeof(PthreadCond));
+  if( !p ) return LSM_NOMEM_BKPT;
+
+  p->pEnv = pEnv;
+  pthread_cond_init(&p->cond, 0);
+  *ppNew = (lsm_cond *)p;
+  return LSM_OK;
+}
+
+static void lsmPosixOsCondDel(lsm_cond *pCond){
+  PthreadCond *p = (PthreadCond *)pCond;
+  pthread_cond_destroy(&p->cond);
+  lsmFree(p->pEnv, p);
+}
+
+static void lsmPosixOsCondWait(lsm_cond *pCond, lsm_mutex *p){
+  PthreadMutex *pMutex = (PthreadMutex *)p;
+#ifdef LSM_DEBUG
+  assert( pthread_equal(pMutex->owner, pthread_self()) );
+  pMutex->owner = 0;
+#endif
+  pthread_cond_wait(&((PthreadCond *)pCond)->cond, &pMutex->mutex);
+#ifdef LSM_DEBUG
+  pMutex->owner = pthread_self();
+#endif
+}
+
+static void lsmPosixOsCondBroadcast(lsm_cond *pCond){
+  pthread_cond_broadcast(&((PthreadCond *)pCond)->cond);
+}
 /*
 ** End of pthreads mutex implementation.
 *************************************************************************/
@@ -20122,6 +25067,14 @@ static int lsmPosixOsMutexNotHeld(lsm_mutex *pMutex){
   return p ? !p->bHeld : 1;
 }
 #endif
+
+/* Without pthreads, pages are compressed by the thread that writes them */
+#define lsmPosixOsThreadNew     0
+#define lsmPosixOsThreadJoin    0
+#define lsmPosixOsCondNew       0
+#define lsmPosixOsCondDel       0
+#define lsmPosixOsCondWait      0
+#define lsmPosixOsCondBroadcast 0
 /***************************************************************************/
 #endif /* else LSM_MUTEX_NONE */
 
@@ -20134,7 +25087,7 @@ static int lsmPosixOsMutexNotHeld(lsm_mutex *pMutex){
 lsm_env *lsm_default_env(void){
   static lsm_env posix_env = {
     sizeof(lsm_env),         /* nByte */
-    1,                       /* iVersion */
+    4,                       /* iVersion */
     /***** file i/o ******************/
     0,                       /* pVfsCtx */
     lsmPosixOsFullpath,      /* xFullpath */
@@ -20171,6 +25124,18 @@ lsm_env *lsm_default_env(void){
     lsmPosixOsMutexNotHeld,  /* xMutexNotHeld */
     /***** other *********************/
     lsmPosixOsSleep,         /* xSleep */
+    /***** version 2 *****************/
+    lsmPosixOsAdvise,        /* xAdvise */
+    /***** version 3 *****************/
+    lsmPosixOsSyncRange,     /* xSyncRange */
+    lsmPosixOsFallocate,     /* xFallocate */
+    /***** version 4 *****************/
+    lsmPosixOsThreadNew,     /* xThreadNew */
+    lsmPosixOsThreadJoin,    /* xThreadJoin */
+    lsmPosixOsCondNew,       /* xCondNew */
+    lsmPosixOsCondDel,       /* xCondDel */
+    lsmPosixOsCondWait,      /* xCondWait */
+    lsmPosixOsCondBroadcast, /* xCondBroadcast */
   };
   return &posix_env;
 }
@@ -13,21 +13,25 @@
 // limitations under the License.
 use std::cmp::Ordering;
 use std::convert::TryFrom;
-use std::ffi::CString;
+use std::ffi::{c_void, CStr, CString};
 use std::os::raw::c_char;
 use std::ptr::null_mut;
 use std::thread::park_timeout;
 use std::time::{Duration, Instant};
 
-use crate::compression::lz4::LsmLz4;
-use crate::compression::zlib::LsmZLib;
-use crate::compression::zstd::LsmZStd;
-use crate::compression::Compression;
-use crate::threads::NUM_MERGE_SEGMENTS;
+use crate::compaction_filter::LsmCompactionFilterCtx;
+use crate::compression::{
+    configure_compression_policy, get_compression_methods, lsm_compress,
+    store_compression_dictionary,
+};
+use crate::key_comparator::configure_key_order;
+use crate::merge_operator::LsmMergeOperatorCtx;
+use crate::threads::{LEVEL_SIZE_RATIO, NUM_MERGE_SEGMENTS};
 use crate::{
     lsm_cursor, lsm_db, lsm_env, Cursor, DbConf, Disk, LsmBgWorkerMessage, LsmBgWorkers,
-    LsmCompressionLib, LsmCursor, LsmCursorSeekOp, LsmDb, LsmErrorCode, LsmHandleMode, LsmInfo,
-    LsmMode, LsmParam, LsmSafety,
+    LsmBulkLoader, LsmCompressionLib, LsmCursor, LsmCursorBatch, LsmCursorBatchIter,
+    LsmCursorRecords, LsmCursorSeekOp, LsmCursorValues, LsmDb, LsmErrorCode, LsmHandleMode,
+    LsmInfo, LsmKeyFormat, LsmMode, LsmParam, LsmSafety, LsmSortingLoader,
 };
 
 // This is the amount of time a writer sleeps while a background worker does some work.
@@ -49,6 +53,11 @@ pub(crate) const MAX_CHECKPOINT_SIZE_KB: i32 = 2 * MIN_CHECKPOINT_SIZE_KB;
 pub(crate) const BLOCK_SIZE_KB: i32 = 8 << 10;
 // Page size of the database (unit of bytes into which blocks are divided).
 pub(crate) const PAGE_SIZE_B: i32 = 4 << 10;
+// Size of the cache of decompressed pages of a handle to a compressed database.
+pub(crate) const COMPRESSED_PAGE_CACHE_SIZE_KB: i32 = 32 << 10; // X KiBs * 1024 = X MiB
+
+// Largest amount of the file read ahead of a scan.
+pub(crate) const READAHEAD_KB: i32 = 1 << 10; // X KiBs * 1024 = X MiB
 
 // These functions translate to internal LSM functions. Thus the signatures have
 // to match. Observe that we treat LSM's types as opaque, and thus they are passed
@@ -63,6 +72,68 @@ extern "C" {
     pub(crate) fn lsm_new(env: *mut lsm_env, db: *mut *mut lsm_db) -> i32;
     pub(crate) fn lsm_open(db: *mut lsm_db, file_name: *const c_char) -> i32;
     pub(crate) fn lsm_close(db: *mut lsm_db) -> i32;
+    pub(crate) fn lsm_config_compaction_filter(
+        db: *mut lsm_db,
+        x_filter: Option<
+            unsafe extern "C" fn(
+                ctx: *mut c_void,
+                key: *const c_void,
+                key_len: i32,
+                value: *const c_void,
+                value_len: i32,
+                new_value: *mut *mut c_void,
+                new_value_len: *mut i32,
+            ) -> i32,
+        >,
+        ctx: *mut c_void,
+    );
+    pub(crate) fn lsm_config_merge_operator(
+        db: *mut lsm_db,
+        x_merge: Option<
+            unsafe extern "C" fn(
+                ctx: *mut c_void,
+                key: *const c_void,
+                key_len: i32,
+                existing: *const c_void,
+                existing_len: i32,
+                operand: *const c_void,
+                operand_len: i32,
+                new_value: *mut *mut c_void,
+                new_value_len: *mut i32,
+            ) -> i32,
+        >,
+        ctx: *mut c_void,
+    );
+    pub(crate) fn lsm_config_compare(
+        db: *mut lsm_db,
+        x_cmp: Option<
+            unsafe extern "C" fn(
+                lhs: *mut c_void,
+                lhs_len: i32,
+                rhs: *mut c_void,
+                rhs_len: i32,
+            ) -> i32,
+        >,
+    ) -> i32;
+    pub(crate) fn lsm_dictionary_write(
+        db: *mut lsm_db,
+        dict_id: u32,
+        p_dict: *const c_void,
+        n_dict: i32,
+    ) -> i32;
+    pub(crate) fn lsm_dictionary_read(
+        db: *mut lsm_db,
+        p_dict_id: *mut u32,
+        pp_dict: *mut *mut c_void,
+        pn_dict: *mut i32,
+    ) -> i32;
+    pub(crate) fn lsm_config_age_compression(
+        db: *mut lsm_db,
+        age: i32,
+        compress: *const lsm_compress,
+    ) -> i32;
+    pub(crate) fn lsm_get_env(db: *mut lsm_db) -> *mut lsm_env;
+    pub(crate) fn lsm_free(env: *mut lsm_env, ptr: *mut c_char);
 
     // These functions are private to this file.
     fn lsm_insert(
@@ -72,6 +143,13 @@ extern "C" {
         p_val: *const u8,
         n_val: i32,
     ) -> i32;
+    fn lsm_merge(
+        db: *mut lsm_db,
+        p_key: *const u8,
+        n_key: i32,
+        p_val: *const u8,
+        n_val: i32,
+    ) -> i32;
     fn lsm_delete(db: *mut lsm_db, p_key: *const u8, n_key: i32) -> i32;
     fn lsm_delete_range(
         db: *mut lsm_db,
@@ -80,6 +158,16 @@ extern "C" {
         p_key2: *const u8,
         n_key2: i32,
     ) -> i32;
+    fn lsm_bulk_begin(db: *mut lsm_db) -> i32;
+    fn lsm_bulk_insert(
+        db: *mut lsm_db,
+        p_key: *const u8,
+        n_key: i32,
+        p_val: *const u8,
+        n_val: i32,
+    ) -> i32;
+    fn lsm_bulk_end(db: *mut lsm_db, commit: i32) -> i32;
+    fn lsm_vlog_gc(db: *mut lsm_db, n_kb: i32, p_n_kb: *mut i32) -> i32;
     fn lsm_begin(db: *mut lsm_db, level: i32) -> i32;
     fn lsm_commit(db: *mut lsm_db, level: i32) -> i32;
     fn lsm_rollback(db: *mut lsm_db, level: i32) -> i32;
@@ -87,15 +175,23 @@ extern "C" {
     fn lsm_csr_close(cursor: *mut lsm_cursor) -> i32;
     fn lsm_csr_first(cursor: *mut lsm_cursor) -> i32;
     fn lsm_csr_seek(cursor: *mut lsm_cursor, p_key: *const u8, n_key: i32, e_seek: i32) -> i32;
+    fn lsm_csr_seek_forward(cursor: *mut lsm_cursor, p_key: *const u8, n_key: i32) -> i32;
     fn lsm_csr_last(cursor: *mut lsm_cursor) -> i32;
     fn lsm_csr_next(cursor: *mut lsm_cursor) -> i32;
+    fn lsm_csr_next_batch(
+        cursor: *mut lsm_cursor,
+        n_max_record: i32,
+        a_buf: *mut u8,
+        n_buf: i32,
+        pn_record: *mut i32,
+        pn_byte: *mut i32,
+    ) -> i32;
     fn lsm_csr_prev(cursor: *mut lsm_cursor) -> i32;
     fn lsm_csr_valid(cursor: *mut lsm_cursor) -> i32;
     fn lsm_csr_key(cursor: *mut lsm_cursor, pp_key: *const *mut u8, pn_key: *mut i32) -> i32; // # spellchecker:disable-line
     fn lsm_csr_value(cursor: *mut lsm_cursor, pp_val: *const *mut u8, pn_val: *mut i32) -> i32; // # spellchecker:disable-line
+    fn lsm_csr_values(cursor: *mut lsm_cursor, e_values: i32) -> i32;
     fn lsm_csr_cmp(cursor: *mut lsm_cursor, p_key: *const u8, n_key: i32, pi_res: *mut i32) -> i32;
-    #[allow(dead_code)]
-    fn lsm_free(env: *mut lsm_env, ptr: *mut c_char);
 }
 
 /// Custom implementation of [`Disk`] for [`LsmDb`].
@@ -251,10 +347,160 @@ impl Disk for LsmDb {
                 return Err(LsmErrorCode::try_from(rc)?);
             }
 
-            // How much of the file is kept in memory.
-            let mmap_size: i32 = 0;
+            // How much of the file is kept in memory. Only read-only handles
+            // to databases without compression (nor encryption) may map the
+            // file (if asked to).
+            let mmap_size: i32 = match self.db_conf.mmap_advice {
+                None => 0,
+                Some(_)
+                    if self.db_conf.handle_mode == LsmHandleMode::ReadOnly
+                        && !self.db_conf.transforms_pages() =>
+                {
+                    1
+                }
+                Some(_) => {
+                    self.disconnect()?;
+                    return Err(LsmErrorCode::LsmMisuse);
+                }
+            };
             rc = lsm_config(self.db_handle, LsmParam::Mmap as i32, &mmap_size);
 
+            if rc == 0 {
+                if let Some(advice) = self.db_conf.mmap_advice {
+                    let advice: i32 = advice as i32;
+                    rc = lsm_config(self.db_handle, LsmParam::MmapAdvice as i32, &advice);
+                }
+            }
+
+            if rc != 0 {
+                self.disconnect()?;
+                return Err(LsmErrorCode::try_from(rc)?);
+            }
+
+            // Pages that are not mapped are cached. Pages of compressed (or
+            // encrypted) databases are cached once decompressed, thus more of
+            // them are cached.
+            let page_cache_kb: i32 = match self.db_conf.page_cache_size_kb {
+                Some(size_kb) => i32::try_from(size_kb).unwrap_or(i32::MAX),
+                None if self.db_conf.transforms_pages() => COMPRESSED_PAGE_CACHE_SIZE_KB,
+                None => -1,
+            };
+            rc = lsm_config(self.db_handle, LsmParam::CacheSize as i32, &page_cache_kb);
+
+            if rc != 0 {
+                self.disconnect()?;
+                return Err(LsmErrorCode::try_from(rc)?);
+            }
+
+            // Compressed pages can additionally be cached before they are decompressed.
+            if let Some(size_kb) = self.db_conf.compressed_page_cache_size_kb {
+                if !self.db_conf.transforms_pages() {
+                    self.disconnect()?;
+                    return Err(LsmErrorCode::LsmMisuse);
+                }
+                let compressed_cache_kb: i32 = i32::try_from(size_kb).unwrap_or(i32::MAX);
+                rc = lsm_config(
+                    self.db_handle,
+                    LsmParam::CompressedCacheSize as i32,
+                    &compressed_cache_kb,
+                );
+
+                if rc != 0 {
+                    self.disconnect()?;
+                    return Err(LsmErrorCode::try_from(rc)?);
+                }
+            }
+
+            // Pages of segments can be compressed on threads of their own.
+            if let Some(num_threads) = self.db_conf.compression_threads {
+                // The compression hooks look the dictionary up through this handle,
+                // which cannot be done from the threads compressing pages.
+                if !self.db_conf.transforms_pages()
+                    || (num_threads > 0 && self.db_conf.compression_dictionary.is_some())
+                {
+                    self.disconnect()?;
+                    return Err(LsmErrorCode::LsmMisuse);
+                }
+                let compress_threads: i32 = i32::try_from(num_threads).unwrap_or(i32::MAX);
+                rc = lsm_config(
+                    self.db_handle,
+                    LsmParam::CompressThreads as i32,
+                    &compress_threads,
+                );
+
+                if rc != 0 {
+                    self.disconnect()?;
+                    return Err(LsmErrorCode::try_from(rc)?);
+                }
+            }
+
+            // Scans are read ahead of.
+            let readahead_kb: i32 = match self.db_conf.readahead_kb {
+                Some(max_kb) => i32::try_from(max_kb).unwrap_or(i32::MAX),
+                None => READAHEAD_KB,
+            };
+            rc = lsm_config(self.db_handle, LsmParam::Readahead as i32, &readahead_kb);
+
+            if rc != 0 {
+                self.disconnect()?;
+                return Err(LsmErrorCode::try_from(rc)?);
+            }
+
+            // Pages written can be written back (and dropped from the cache of the
+            // operating system) early. Dropping pages requires writing them back.
+            if let Some((size_kb, drop_behind)) = self.db_conf.writeback {
+                if size_kb == 0 && drop_behind {
+                    self.disconnect()?;
+                    return Err(LsmErrorCode::LsmMisuse);
+                }
+                let writeback_kb: i32 = i32::try_from(size_kb).unwrap_or(i32::MAX);
+                let drop_behind: i32 = drop_behind as i32;
+                rc = lsm_config(self.db_handle, LsmParam::Writeback as i32, &writeback_kb);
+                if rc == 0 {
+                    rc = lsm_config(self.db_handle, LsmParam::DropBehind as i32, &drop_behind);
+                }
+
+                if rc != 0 {
+                    self.disconnect()?;
+                    return Err(LsmErrorCode::try_from(rc)?);
+                }
+            }
+
+            // Disk space can be allocated for several blocks at once, and the one
+            // of free blocks released.
+            let preallocate_kb: i32 = self
+                .db_conf
+                .preallocation_kb
+                .map_or(0, |size_kb| i32::try_from(size_kb).unwrap_or(i32::MAX));
+            let punch_holes: i32 = self.db_conf.punch_holes as i32;
+            rc = lsm_config(
+                self.db_handle,
+                LsmParam::Preallocate as i32,
+                &preallocate_kb,
+            );
+            if rc == 0 {
+                rc = lsm_config(self.db_handle, LsmParam::PunchHoles as i32, &punch_holes);
+            }
+
+            // Large values can be separated from their keys into the value log.
+            let value_log_b: i32 = self.db_conf.value_log_threshold_b.map_or(0, |threshold_b| {
+                i32::try_from(threshold_b).unwrap_or(i32::MAX)
+            });
+            if rc == 0 {
+                rc = lsm_config(self.db_handle, LsmParam::ValueLog as i32, &value_log_b);
+            }
+
+            // Keys can be stored prefix-compressed in the pages of segments.
+            let prefix_keys: i32 = self.db_conf.prefix_keys as i32;
+            if rc == 0 {
+                rc = lsm_config(self.db_handle, LsmParam::PrefixKeys as i32, &prefix_keys);
+            }
+
+            // Keys are ordered as the key format, or the key comparator, says.
+            if rc == 0 {
+                rc = configure_key_order(self.db_handle, &self.db_conf);
+            }
+
             if rc != 0 {
                 self.disconnect()?;
                 return Err(LsmErrorCode::try_from(rc)?);
@@ -268,6 +514,56 @@ impl Disk for LsmDb {
                 return Err(LsmErrorCode::try_from(rc)?);
             }
 
+            // Strategy used to select the segments to merge, and the size ratio
+            // between adjacent segments it aims for (if the strategy uses it).
+            let compaction: i32 = self.db_conf.compaction as i32;
+            rc = lsm_config(self.db_handle, LsmParam::Compaction as i32, &compaction);
+
+            if rc != 0 {
+                self.disconnect()?;
+                return Err(LsmErrorCode::try_from(rc)?);
+            }
+
+            if self.db_conf.level_size_ratio.is_some_and(|ratio| ratio < 2) {
+                self.disconnect()?;
+                return Err(LsmErrorCode::LsmMisuse);
+            }
+            let size_ratio: i32 = self
+                .db_conf
+                .level_size_ratio
+                .map_or(LEVEL_SIZE_RATIO, |ratio| {
+                    i32::try_from(ratio).unwrap_or(i32::MAX)
+                });
+            rc = lsm_config(self.db_handle, LsmParam::SizeRatio as i32, &size_ratio);
+
+            if rc != 0 {
+                self.disconnect()?;
+                return Err(LsmErrorCode::try_from(rc)?);
+            }
+
+            // Segments made up mostly of delete markers (e.g. after deleting a range
+            // of keys) can be merged with priority, so that scans do not have to skip
+            // them for long, and the space of the deleted records is reclaimed.
+            if self
+                .db_conf
+                .tombstone_ratio_pct
+                .is_some_and(|ratio_pct| ratio_pct > 100)
+            {
+                self.disconnect()?;
+                return Err(LsmErrorCode::LsmMisuse);
+            }
+            let tombstone_ratio: i32 = self.db_conf.tombstone_ratio_pct.map_or(0, i32::from);
+            rc = lsm_config(
+                self.db_handle,
+                LsmParam::TombstoneRatio as i32,
+                &tombstone_ratio,
+            );
+
+            if rc != 0 {
+                self.disconnect()?;
+                return Err(LsmErrorCode::try_from(rc)?);
+            }
+
             if self.db_conf.handle_mode == LsmHandleMode::ReadOnly {
                 // Here are parameters set that are only relevant in read-only mode.
                 // Observe that this overwrites the mode the handle operates in,
@@ -289,24 +585,17 @@ impl Disk for LsmDb {
             // compression can be done only when the database was created, once set,
             // trying to do it again or not setting it to the same compression scheme
             // will be considered an error (LsmErrorCode::LsmMismatch).
-            match self.db_conf.compression {
-                LsmCompressionLib::NoCompression => {}
-                LsmCompressionLib::LZ4 => {
-                    let lz4 = LsmLz4::new();
-                    self.db_compress = lz4.get_compression_methods().ok();
-                }
-                LsmCompressionLib::ZLib => {
-                    let zlib = LsmZLib::new();
-                    self.db_compress = zlib.get_compression_methods().ok();
-                }
-                LsmCompressionLib::ZStd => {
-                    let zstd = LsmZStd::new();
-                    self.db_compress = zstd.get_compression_methods().ok();
+            self.db_compress = match get_compression_methods(self.db_handle, &self.db_conf) {
+                Ok(db_compress) => db_compress,
+                Err(ec) => {
+                    self.disconnect()?;
+                    return Err(ec);
                 }
             };
 
             // Only if the compression library is defined we pass it onto
-            // the engine. Otherwise no compression whatsoever.
+            // the engine. Otherwise no compression whatsoever. From then on, the
+            // engine owns the context of the hooks.
             if let Some(lsm_compress) = self.db_compress.as_ref() {
                 rc = lsm_config(
                     self.db_handle,
@@ -315,11 +604,22 @@ impl Disk for LsmDb {
                 );
 
                 if rc != 0 {
+                    if let Some(free) = lsm_compress.free {
+                        free(lsm_compress.ctx);
+                    }
+                    self.db_compress = None;
                     self.disconnect()?;
                     return Err(LsmErrorCode::try_from(rc)?);
                 }
             }
 
+            // Which pages are worth compressing, and the libraries segments of certain
+            // ages are compressed with (if any).
+            if let Err(ec) = configure_compression_policy(self.db_handle, &self.db_conf) {
+                self.disconnect()?;
+                return Err(ec);
+            }
+
             rc = lsm_open(self.db_handle, self.db_fq_name.as_ptr());
 
             if rc != 0 {
@@ -329,6 +629,18 @@ impl Disk for LsmDb {
 
             self.connected = true;
 
+            // If there is a compaction filter, it is applied by this handle whenever
+            // it merges segments (or flushes main memory to disk).
+            if let Some(filter) = self.db_conf.compaction_filter.as_ref() {
+                self.db_filter = Some(LsmCompactionFilterCtx::register(self.db_handle, filter));
+            }
+
+            // If there is a merge operator, this handle combines merge operands
+            // whenever it reads them or merges segments.
+            if let Some(operator) = self.db_conf.merge_operator.as_ref() {
+                self.db_merge = Some(LsmMergeOperatorCtx::register(self.db_handle, operator));
+            }
+
             // Whether we spawn background threads is at this point properly set.
             // Currently we spawn only one background thread at most, and thus its
             // id is set to 0. This has to be executed after we have connected
@@ -370,6 +682,58 @@ impl Disk for LsmDb {
             let mmap_size: i32 = -1;
             let _ = lsm_config(self.db_handle, LsmParam::Mmap as i32, &mmap_size);
 
+            let page_cache_kb: i32 = -1;
+            let _ = lsm_config(self.db_handle, LsmParam::CacheSize as i32, &page_cache_kb);
+
+            let compressed_cache_kb: i32 = -1;
+            let _ = lsm_config(
+                self.db_handle,
+                LsmParam::CompressedCacheSize as i32,
+                &compressed_cache_kb,
+            );
+
+            let compress_threads: i32 = -1;
+            let _ = lsm_config(
+                self.db_handle,
+                LsmParam::CompressThreads as i32,
+                &compress_threads,
+            );
+
+            let readahead_kb: i32 = -1;
+            let _ = lsm_config(self.db_handle, LsmParam::Readahead as i32, &readahead_kb);
+
+            let writeback_kb: i32 = -1;
+            let _ = lsm_config(self.db_handle, LsmParam::Writeback as i32, &writeback_kb);
+
+            let drop_behind: i32 = -1;
+            let _ = lsm_config(self.db_handle, LsmParam::DropBehind as i32, &drop_behind);
+
+            let preallocate_kb: i32 = -1;
+            let _ = lsm_config(
+                self.db_handle,
+                LsmParam::Preallocate as i32,
+                &preallocate_kb,
+            );
+
+            let punch_holes: i32 = -1;
+            let _ = lsm_config(self.db_handle, LsmParam::PunchHoles as i32, &punch_holes);
+
+            let value_log_b: i32 = -1;
+            let _ = lsm_config(self.db_handle, LsmParam::ValueLog as i32, &value_log_b);
+
+            let prefix_keys: i32 = -1;
+            let _ = lsm_config(self.db_handle, LsmParam::PrefixKeys as i32, &prefix_keys);
+
+            let key_format: i32 = -1;
+            let _ = lsm_config(self.db_handle, LsmParam::KeyFormat as i32, &key_format);
+
+            let tombstone_ratio: i32 = -1;
+            let _ = lsm_config(
+                self.db_handle,
+                LsmParam::TombstoneRatio as i32,
+                &tombstone_ratio,
+            );
+
             let safety: i32 = -1;
             let _ = lsm_config(self.db_handle, LsmParam::Safety as i32, &safety);
 
@@ -387,7 +751,24 @@ impl Disk for LsmDb {
                     "no"
                 },
                 mmap_overhead = format!("{mmap_size} KBs"),
+                page_cache = format!("{page_cache_kb} KBs"),
+                compressed_page_cache = format!("{compressed_cache_kb} KBs"),
+                readahead = format!("{readahead_kb} KBs"),
+                writeback = format!("{writeback_kb} KBs"),
+                drop_behind = if drop_behind != 0 { "yes" } else { "no" },
+                preallocation = format!("{preallocate_kb} KBs"),
+                punch_holes = if punch_holes != 0 { "yes" } else { "no" },
+                value_log = format!("{value_log_b} Bs"),
+                prefix_keys = if prefix_keys != 0 { "yes" } else { "no" },
+                key_format = match LsmKeyFormat::try_from(key_format) {
+                    Ok(key_format) => format!("{key_format:?}"),
+                    Err(_) => "Custom".to_string(),
+                },
                 compression = ?self.db_conf.compression,
+                compression_threads = compress_threads,
+                encryption = ?self.db_conf.encryption.as_ref().map(|(cipher, _)| cipher),
+                compaction = ?self.db_conf.compaction,
+                tombstone_ratio = format!("{tombstone_ratio}%"),
                 safety = if safety == 0 { "None" } else if safety == 1 { "Normal" } else { "Full" },
                 "lsmlite-rs parameters.",
             );
@@ -452,7 +833,11 @@ impl Disk for LsmDb {
         }
 
         // We reset the pointer once we know we were able to cleanly close the database.
+        // Only then the compaction filter and merge operator (if any) can be released.
         self.db_handle = null_mut();
+        self.db_compress = None;
+        self.db_filter = None;
+        self.db_merge = None;
         self.connected = false;
 
         // If we get through, then everything is fine.
@@ -525,6 +910,7 @@ impl Disk for LsmDb {
                 return Err(LsmErrorCode::try_from(rc)?);
             }
         }
+        self.deal_with_compression_dictionary(false);
 
         let current_request_duration = Instant::now()
             .checked_duration_since(start)
@@ -592,6 +978,7 @@ impl Disk for LsmDb {
         if rc != 0 {
             return Err(LsmErrorCode::try_from(rc)?);
         }
+        self.deal_with_compression_dictionary(false);
 
         Ok(())
     }
@@ -620,6 +1007,7 @@ impl Disk for LsmDb {
         if rc != 0 {
             return Err(LsmErrorCode::try_from(rc)?);
         }
+        self.deal_with_compression_dictionary(false);
 
         Ok(())
     }
@@ -634,6 +1022,11 @@ impl Disk for LsmDb {
             return Err(LsmErrorCode::LsmMisuse);
         }
 
+        // If a compression dictionary is to be trained, the pages merged so far
+        // are enough to do so. In this manner, the segment produced here is
+        // already compressed with it.
+        self.deal_with_compression_dictionary(true);
+
         let rc: i32;
         unsafe {
             // Let's work all the way through.
@@ -650,6 +1043,7 @@ impl Disk for LsmDb {
                 );
             }
         }
+        self.deal_with_compression_dictionary(true);
 
         Ok(())
     }
@@ -699,6 +1093,7 @@ impl Disk for LsmDb {
         if rc != 0 {
             return Err(LsmErrorCode::try_from(rc)?);
         }
+        self.deal_with_compression_dictionary(false);
 
         Ok(())
     }
@@ -1256,6 +1651,15 @@ impl LsmDb {
         Ok(())
     }
 
+    /// If this handle is to train a compression dictionary (see
+    /// [`DbConf::with_compression_dictionary`]), this stores it in the database
+    /// once the pages this handle merged are enough to train it from.
+    fn deal_with_compression_dictionary(&self, force: bool) {
+        if self.db_conf.compression_dictionary.is_some() {
+            store_compression_dictionary(self.db_compress.as_ref(), force);
+        }
+    }
+
     fn deal_with_bg_threads(&mut self) -> Result<(), LsmErrorCode> {
         match self.db_conf.mode {
             LsmMode::LsmNoBackgroundThreads => {}
@@ -1435,56 +1839,518 @@ impl LsmDb {
         Ok(())
     }
 
-    /// This function tests whether a database handle has been initialized.
-    pub fn is_initialized(&self) -> bool {
-        self.initialized
-    }
+    /// This function writes a merge operand under the given key (in a transactional
+    /// manner). Instead of overwriting the current value of the key, the operand is
+    /// combined with it using the merge operator of the database (see
+    /// [`DbConf::with_merge_operator`]). This allows read-modify-write updates (like
+    /// incrementing a counter) without having to read the current value first.
+    /// If the key does not exist, the operand becomes its value.
+    ///
+    /// Merging data using a handle whose configuration carries no merge operator,
+    /// or one that is not yet connected to a database, is considered
+    /// [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// // Adds up little-endian 64-bit counters.
+    /// struct Add;
+    ///
+    /// impl LsmMergeOperator for Add {
+    ///     fn merge(&self, _key: &[u8], existing: &[u8], operand: &[u8]) -> Vec<u8> {
+    ///         let existing = u64::from_le_bytes(existing.try_into().unwrap_or_default());
+    ///         let operand = u64::from_le_bytes(operand.try_into().unwrap_or_default());
+    ///         (existing + operand).to_le_bytes().to_vec()
+    ///     }
+    /// }
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_m".to_string()).with_merge_operator(Add);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    ///
+    /// let rc = db.merge(b"counter", &1u64.to_le_bytes());
+    /// assert_eq!(rc, Ok(()));
+    /// let rc = db.merge(b"counter", &2u64.to_le_bytes());
+    /// assert_eq!(rc, Ok(()));
+    ///
+    /// let rc = db.disconnect();
+    /// ```
+    pub fn merge(&mut self, key: &[u8], operand: &[u8]) -> Result<(), LsmErrorCode> {
+        if !self.initialized || !self.connected || self.db_merge.is_none() {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
 
-    /// This function tests whether a database handle is connected.
-    pub fn is_connected(&self) -> bool {
-        self.connected
-    }
+        let start = Instant::now();
+        let rc: i32;
 
-    /// This function outputs the full-qualified path of the database.
-    /// It errors if the database has not been initialized.
-    pub fn get_full_db_path(&self) -> Result<String, LsmErrorCode> {
-        if !self.initialized {
-            return Err(LsmErrorCode::LsmMisuse);
+        unsafe {
+            // As with any other write, we have to synchronize with background threads
+            // (if any) to avoid exceeding the resources we are told.
+            self.deal_with_bg_threads()?;
+
+            rc = lsm_merge(
+                self.db_handle,
+                key.as_ptr(),
+                key.len() as i32,
+                operand.as_ptr(),
+                operand.len() as i32,
+            );
+            if rc != 0 {
+                return Err(LsmErrorCode::try_from(rc)?);
+            }
         }
-        Ok(String::from_utf8_lossy(self.db_fq_name.as_bytes()).to_string())
+        self.deal_with_compression_dictionary(false);
+
+        let current_request_duration = Instant::now()
+            .checked_duration_since(start)
+            .unwrap_or_default();
+        match &self.db_conf.metrics {
+            None => {}
+            Some(metrics) => metrics
+                .write_times_s
+                .observe(current_request_duration.as_secs_f64()),
+        }
+        Ok(())
     }
 
-    /// This function outputs the compression id of the database. The only possible
-    /// error is [`LsmErrorCode::LsmMismatch`] which means that records of the database
-    /// have been compressed with a unknown library. At this point there is not much
-    /// to do, and this error should be considered unrecoverable. That is, the database
-    /// can be considered corrupted, and its data is most probably lost.
-    pub fn get_compression_id(&self) -> Result<LsmCompressionLib, LsmErrorCode> {
+    /// This function starts a bulk load of records into the database. Instead of
+    /// going through the log and main memory first, and being merged over and
+    /// over into larger segments later on, the records inserted through the
+    /// returned [`LsmBulkLoader`] are written exactly once, straight into a new
+    /// segment of the database file (b-tree included). Once committed, the new
+    /// segment becomes the most recent one of the database, and is published
+    /// in a single checkpoint. Thus, either all records loaded are visible, or
+    /// none.
+    ///
+    /// Records have to be inserted in strictly increasing order of their keys.
+    /// Records with the same key as existing ones replace them, as with
+    /// [`Disk::update`]. Whatever was written to the database before the bulk
+    /// load started is flushed to the database file first. While the bulk load
+    /// is in progress, no other handle may write to the database or merge its
+    /// segments.
+    ///
+    /// Starting a bulk load through a handle that is not yet connected to a
+    /// database, or that has an open transaction, is considered
+    /// [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_z".to_string());
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    ///
+    /// let mut loader = db.bulk_loader().unwrap();
+    /// for key in 0_u64..1000 {
+    ///     let rc = loader.insert(&key.to_be_bytes(), b"value");
+    ///     assert_eq!(rc, Ok(()));
+    /// }
+    /// // Keys have to be strictly increasing.
+    /// let rc = loader.insert(&0_u64.to_be_bytes(), b"value");
+    /// assert_eq!(rc, Err(LsmErrorCode::LsmMisuse));
+    /// let rc = loader.commit();
+    /// assert_eq!(rc, Ok(()));
+    ///
+    /// let rc = db.disconnect();
+    /// ```
+    pub fn bulk_loader(&mut self) -> Result<LsmBulkLoader<'_>, LsmErrorCode> {
         if !self.initialized || !self.connected {
             return Err(LsmErrorCode::LsmMisuse);
         }
 
-        let compression_id: i32 = -1;
+        let rc: i32;
         unsafe {
-            let _ = lsm_info(
-                self.db_handle,
-                LsmInfo::LsmCompressionId as i32,
-                &compression_id,
-            );
+            rc = lsm_bulk_begin(self.db_handle);
         }
-        LsmCompressionLib::try_from(compression_id)
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(LsmBulkLoader {
+            db: self,
+            finished: false,
+        })
     }
-}
 
-/// A default database. This database is not useful without
-/// getting first initialized using [`Disk::initialize`]. The purpose
-/// of this method is to simply zero all attributes of [`LsmDb`].
-impl Default for LsmDb {
+    /// This function starts a load of records given in arbitrary order into the
+    /// database. Records are buffered using at most (roughly) the given amount of
+    /// memory. Whenever it is exhausted, the buffered records are sorted by all
+    /// cores and written to a temporary file next to the database file. Once
+    /// committed, these sorted runs are merged straight into a new segment of the
+    /// database through a bulk load (see [`LsmDb::bulk_loader`]). Thus, records are
+    /// written twice in total, regardless of their number, without going through
+    /// the log or main memory of the database. As with a bulk load, either all
+    /// records become visible in the database, or none.
+    ///
+    /// The database is only locked (as for a bulk load) once the loader is
+    /// committed. Starting a load through a handle that is not yet connected to a
+    /// database, or giving it no memory, is considered [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_aa".to_string());
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    ///
+    /// // Records are sorted using (at most) 64 MiB of memory.
+    /// let mut loader = db.sorting_loader(64 << 10).unwrap();
+    /// for key in (0_u64..1000).rev() {
+    ///     let rc = loader.insert(&key.to_be_bytes(), b"value");
+    ///     assert_eq!(rc, Ok(()));
+    /// }
+    /// let rc = loader.commit();
+    /// assert_eq!(rc, Ok(()));
+    ///
+    /// let rc = db.disconnect();
+    /// ```
+    pub fn sorting_loader(&mut self, memory_kb: u32) -> Result<LsmSortingLoader<'_>, LsmErrorCode> {
+        if !self.initialized || !self.connected || memory_kb == 0 {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        Ok(LsmSortingLoader {
+            db: self,
+            memory_b: (memory_kb as usize) << 10,
+            arena: Vec::new(),
+            records: Vec::new(),
+            runs: Vec::new(),
+            num_runs_written: 0,
+        })
+    }
+
+    /// This function reclaims the disk space taken by values in the value log (see
+    /// [`DbConf::with_value_log`]) that are no longer referenced, because the records
+    /// they belonged to were overwritten or deleted. Up to `max_kb` KBs of the value
+    /// log (the oldest ones) are examined; `u32::MAX` examines all of it. The values
+    /// in there that are still referenced are written to the database again (which
+    /// appends them to the value log anew), the database is checkpointed, and the
+    /// examined part of the value log is released by punching a hole into it. It
+    /// returns the amount of disk space released in KBs.
+    ///
+    /// If a reader still uses a snapshot of the database from before the values
+    /// were written again, or another handle is merging segments at the time,
+    /// nothing is released, and a later call releases the space instead. Calling
+    /// this function through a handle that is not yet connected to a database, or
+    /// that has an open transaction, is considered [`LsmErrorCode::LsmMisuse`].
+    ///
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new("/tmp/", "my_db_ac".to_string()).with_value_log(1 << 10);
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    ///
+    /// for value in [b'a', b'b'] {
+    ///     let rc = db.persist(b"key", &[value; 64 << 10]);
+    ///     assert_eq!(rc, Ok(()));
+    ///     let rc = db.optimize();
+    ///     assert_eq!(rc, Ok(()));
+    /// }
+    /// // The first value is no longer referenced.
+    /// let released_kb = db.collect_value_log_garbage(u32::MAX);
+    /// assert!(released_kb.is_ok());
+    ///
+    /// let rc = db.disconnect();
+    /// ```
+    pub fn collect_value_log_garbage(&mut self, max_kb: u32) -> Result<u32, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let max_kb: i32 = i32::try_from(max_kb).unwrap_or(-1);
+        let mut released_kb: i32 = 0;
+        let rc: i32;
+        unsafe {
+            rc = lsm_vlog_gc(self.db_handle, max_kb, &mut released_kb);
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(released_kb as u32)
+    }
+
+    /// This function tests whether a database handle has been initialized.
+    pub fn is_initialized(&self) -> bool {
+        self.initialized
+    }
+
+    /// This function tests whether a database handle is connected.
+    pub fn is_connected(&self) -> bool {
+        self.connected
+    }
+
+    /// This function outputs the full-qualified path of the database.
+    /// It errors if the database has not been initialized.
+    pub fn get_full_db_path(&self) -> Result<String, LsmErrorCode> {
+        if !self.initialized {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+        Ok(String::from_utf8_lossy(self.db_fq_name.as_bytes()).to_string())
+    }
+
+    /// This function outputs the number of pages this handle has written to the
+    /// database file so far, that is, when flushing main-memory data and merging
+    /// segments. Pages written by background threads are not accounted for.
+    /// Together with the amount of data persisted, this number gives the write
+    /// amplification of the database.
+    pub fn get_num_pages_written(&self) -> Result<i32, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let mut num_pages: i32 = 0;
+        let rc: i32;
+        unsafe {
+            rc = lsm_info(
+                self.db_handle,
+                LsmInfo::Lsm4KbPagesWritten as i32,
+                &mut num_pages,
+            );
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(num_pages)
+    }
+
+    /// This function outputs how many of the pages this handle has written to the
+    /// database file so far (see [`LsmDb::get_num_pages_written`]) were stored
+    /// uncompressed, as compressing them did not save enough space (see
+    /// [`DbConf::with_min_compression_saving`]). It is always zero for databases
+    /// without compression.
+    pub fn get_num_pages_written_raw(&self) -> Result<i32, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let mut num_pages: i32 = 0;
+        let rc: i32;
+        unsafe {
+            rc = lsm_info(
+                self.db_handle,
+                LsmInfo::LsmPagesWrittenRaw as i32,
+                &mut num_pages,
+            );
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(num_pages)
+    }
+
+    /// This function outputs how many of the pages this handle (and its cursors) has
+    /// read so far were found in the cache of compressed pages (see
+    /// [`DbConf::with_compressed_page_cache_size`]), and thus only had to be
+    /// decompressed. These pages are accounted for in
+    /// [`LsmDb::get_num_pages_read`] as well.
+    pub fn get_num_compressed_cache_hits(&self) -> Result<i32, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let mut num_pages: i32 = 0;
+        let rc: i32;
+        unsafe {
+            rc = lsm_info(
+                self.db_handle,
+                LsmInfo::LsmCompressedCacheHits as i32,
+                &mut num_pages,
+            );
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(num_pages)
+    }
+
+    /// This function outputs how many compressed pages this handle (and its cursors)
+    /// has read from the database file so far because they were not found in the
+    /// cache of compressed pages (see [`DbConf::with_compressed_page_cache_size`]).
+    /// It is always zero if that cache is not configured.
+    pub fn get_num_compressed_cache_misses(&self) -> Result<i32, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let mut num_pages: i32 = 0;
+        let rc: i32;
+        unsafe {
+            rc = lsm_info(
+                self.db_handle,
+                LsmInfo::LsmCompressedCacheMisses as i32,
+                &mut num_pages,
+            );
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(num_pages)
+    }
+
+    /// This function outputs the number of times this handle (and its cursors) has
+    /// asked the operating system to read ahead of a scan so far (see
+    /// [`DbConf::with_readahead`]).
+    pub fn get_num_readaheads(&self) -> Result<i32, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let mut num_readaheads: i32 = 0;
+        let rc: i32;
+        unsafe {
+            rc = lsm_info(
+                self.db_handle,
+                LsmInfo::LsmReadaheads as i32,
+                &mut num_readaheads,
+            );
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(num_readaheads)
+    }
+
+    /// This function outputs the number of pages this handle (and its cursors) has
+    /// read from the database file so far. Pages found in the page cache are not
+    /// accounted for, but pages found in the cache of compressed pages are (see
+    /// [`LsmDb::get_num_compressed_cache_hits`]).
+    pub fn get_num_pages_read(&self) -> Result<i32, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let mut num_pages: i32 = 0;
+        let rc: i32;
+        unsafe {
+            rc = lsm_info(
+                self.db_handle,
+                LsmInfo::Lsm4KbPagesRead as i32,
+                &mut num_pages,
+            );
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(num_pages)
+    }
+
+    /// This function outputs the number of segments the database file currently
+    /// consists of. A read has to visit (at most) this many segments, plus the
+    /// main-memory component. Thus, it gives the read amplification of the database.
+    /// If a background thread is currently working on the database file,
+    /// [`LsmErrorCode::LsmBusy`] may be returned.
+    pub fn get_num_segments(&self) -> Result<usize, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let mut structure: *mut c_char = null_mut();
+        let rc: i32;
+        let num_segments: usize;
+        unsafe {
+            rc = lsm_info(
+                self.db_handle,
+                LsmInfo::LsmDbStructure as i32,
+                &mut structure,
+            );
+            if rc != 0 {
+                return Err(LsmErrorCode::try_from(rc)?);
+            }
+            if structure.is_null() {
+                return Ok(0);
+            }
+
+            // The structure is a list of levels of the form {age {segment} {segment}...},
+            // from the most recent level to the oldest one. Thus, every curly brace opened
+            // within a level corresponds to a segment.
+            let mut depth: usize = 0;
+            let mut segments: usize = 0;
+            for c in CStr::from_ptr(structure).to_bytes() {
+                match c {
+                    b'{' => {
+                        depth += 1;
+                        if depth == 2 {
+                            segments += 1;
+                        }
+                    }
+                    b'}' => depth = depth.saturating_sub(1),
+                    _ => {}
+                }
+            }
+            num_segments = segments;
+            lsm_free(lsm_get_env(self.db_handle), structure);
+        }
+        Ok(num_segments)
+    }
+
+    /// This function outputs the compression id of the database. The only possible
+    /// error is [`LsmErrorCode::LsmMismatch`] which means that records of the database
+    /// have been compressed with a unknown library. At this point there is not much
+    /// to do, and this error should be considered unrecoverable. That is, the database
+    /// can be considered corrupted, and its data is most probably lost.
+    pub fn get_compression_id(&self) -> Result<LsmCompressionLib, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let mut compression_id: i32 = -1;
+        unsafe {
+            let _ = lsm_info(
+                self.db_handle,
+                LsmInfo::LsmCompressionId as i32,
+                &mut compression_id,
+            );
+        }
+        LsmCompressionLib::try_from(compression_id)
+    }
+
+    /// This function outputs the id of the compression dictionary stored in the
+    /// database (see [`DbConf::with_compression_dictionary`]), if any. Once stored,
+    /// the dictionary is used by every handle to compress and decompress pages.
+    pub fn get_compression_dictionary_id(&self) -> Result<Option<u32>, LsmErrorCode> {
+        if !self.initialized || !self.connected {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let mut dictionary_id: u32 = 0;
+        let rc: i32;
+        unsafe {
+            rc = lsm_dictionary_read(self.db_handle, &mut dictionary_id, null_mut(), null_mut());
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok((dictionary_id != 0).then_some(dictionary_id))
+    }
+}
+
+/// A default database. This database is not useful without
+/// getting first initialized using [`Disk::initialize`]. The purpose
+/// of this method is to simply zero all attributes of [`LsmDb`].
+impl Default for LsmDb {
     fn default() -> Self {
         Self {
             db_env: null_mut(),
             db_handle: null_mut(),
             db_compress: None,
+            db_filter: None,
+            db_merge: None,
             db_fq_name: Default::default(),
             db_conf: Default::default(),
             db_bg_threads: Default::default(),
@@ -1531,6 +2397,426 @@ impl Drop for LsmDb {
     }
 }
 
+impl LsmBulkLoader<'_> {
+    /// This function appends a record to the segment being loaded. Its key has to
+    /// be larger than the key of the previous record inserted, otherwise
+    /// [`LsmErrorCode::LsmMisuse`] is returned and nothing is written. If writing
+    /// the record fails, the bulk load can only be rolled back from then on.
+    pub fn insert(&mut self, key: &[u8], value: &[u8]) -> Result<(), LsmErrorCode> {
+        if self.finished {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let rc: i32;
+        unsafe {
+            rc = lsm_bulk_insert(
+                self.db.db_handle,
+                key.as_ptr(),
+                key.len() as i32,
+                value.as_ptr(),
+                value.len() as i32,
+            );
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(())
+    }
+
+    /// This function finishes the segment being loaded, and publishes it in the
+    /// database. If this fails, nothing of the bulk load is visible.
+    pub fn commit(mut self) -> Result<(), LsmErrorCode> {
+        self.end(true)?;
+        self.db.deal_with_compression_dictionary(false);
+        Ok(())
+    }
+
+    /// This function discards the records loaded so far. The database is left
+    /// as it was before the bulk load started (except for the records that were
+    /// flushed to the database file by then). This is also what happens when
+    /// a [`LsmBulkLoader`] goes out of scope without being committed.
+    pub fn rollback(mut self) -> Result<(), LsmErrorCode> {
+        self.end(false)
+    }
+
+    fn end(&mut self, commit: bool) -> Result<(), LsmErrorCode> {
+        if self.finished {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+        self.finished = true;
+
+        let rc: i32;
+        unsafe {
+            rc = lsm_bulk_end(self.db.db_handle, commit as i32);
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+        Ok(())
+    }
+}
+
+impl<'a> LsmCursor<'a> {
+    /// This positions the cursor on the entry that is greater or equal than the
+    /// provided key, exactly as [`Cursor::seek`] with [`LsmCursorSeekOp::LsmCursorSeekGe`]
+    /// does. It is meant for cursors moving forward through the database in jumps,
+    /// for instance to skip over ranges of keys that are of no interest: if the cursor
+    /// is positioned at a valid entry, was last moved forward, and the key lies a short
+    /// way ahead of it, the cursor is moved from where it is instead of searching the
+    /// database from scratch. In any other case, this is a regular seek.
+    /// Positioning an uninitialized [`LsmCursor`] is considered [`LsmErrorCode::LsmMisuse`].
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new(
+    ///                           "/tmp/",
+    ///                           "my_db_ag".to_string(),
+    /// );
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    ///
+    /// // Insert all even keys.
+    /// let value = vec![0; 16];
+    /// for key in (0..100_usize).step_by(2) {
+    ///     let rc = db.persist(&key.to_be_bytes(), &value)?;
+    /// }
+    ///
+    /// let mut cursor = db.cursor_open()?;
+    /// cursor.first()?;
+    ///
+    /// // Visit every tenth key, landing on the next key present when it is not.
+    /// for key in (5..100_usize).step_by(10) {
+    ///     cursor.seek_forward(&key.to_be_bytes())?;
+    ///     assert_eq!(Cursor::get_key(&cursor)?, (key + 1).to_be_bytes());
+    /// }
+    ///
+    /// // EOF
+    /// cursor.seek_forward(&100_usize.to_be_bytes())?;
+    /// assert!(cursor.valid().is_err());
+    ///
+    /// # Result::<(), LsmErrorCode>::Ok(())
+    /// ```
+    pub fn seek_forward(&mut self, key: &[u8]) -> Result<(), LsmErrorCode> {
+        if self.db_cursor.is_null() {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let rc: i32;
+        unsafe {
+            rc = lsm_csr_seek_forward(self.db_cursor, key.as_ptr(), key.len() as i32);
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+
+        Ok(())
+    }
+
+    /// This sets how the cursor reads the values of the records it visits, from the next
+    /// record it is positioned at onwards (see [`LsmCursorValues`]). By default, a cursor
+    /// reads the value of every record as it moves onto it, whether the value is retrieved
+    /// or not. Scans that only need the keys, or the values of few records, are cheaper
+    /// with [`LsmCursorValues::KeysOnly`] or [`LsmCursorValues::Lazy`].
+    /// Configuring an uninitialized [`LsmCursor`] is considered [`LsmErrorCode::LsmMisuse`].
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new(
+    ///                           "/tmp/",
+    ///                           "my_db_aj".to_string(),
+    /// );
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    ///
+    /// // 64 KB zeroed payloads.
+    /// let value = vec![0; 64 << 10];
+    /// for key in 0..100_usize {
+    ///     let rc = db.persist(&key.to_be_bytes(), &value)?;
+    /// }
+    ///
+    /// // Count the records, without reading any of their values.
+    /// let mut cursor = db.cursor_open()?;
+    /// cursor.set_values(LsmCursorValues::KeysOnly)?;
+    /// cursor.first()?;
+    /// let mut num_records = 0;
+    /// while cursor.valid().is_ok() {
+    ///     num_records += 1;
+    ///     cursor.next()?;
+    /// }
+    /// assert_eq!(num_records, 100);
+    ///
+    /// // Values are not available.
+    /// cursor.first()?;
+    /// assert_eq!(Cursor::get_value(&cursor), Err(LsmErrorCode::LsmMisuse));
+    ///
+    /// // Unless they are read once retrieved.
+    /// cursor.set_values(LsmCursorValues::Lazy)?;
+    /// cursor.first()?;
+    /// assert_eq!(Cursor::get_value(&cursor)?, value);
+    ///
+    /// # Result::<(), LsmErrorCode>::Ok(())
+    /// ```
+    pub fn set_values(&mut self, values: LsmCursorValues) -> Result<(), LsmErrorCode> {
+        if self.db_cursor.is_null() {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let rc: i32;
+        unsafe {
+            rc = lsm_csr_values(self.db_cursor, values as i32);
+        }
+        if rc != 0 {
+            return Err(LsmErrorCode::try_from(rc)?);
+        }
+
+        Ok(())
+    }
+
+    /// This reads the record the cursor is positioned at, and the ones following it,
+    /// into the given batch, replacing what the batch held before. The cursor is moved
+    /// past every record read, as [`Cursor::next`] does, thus it has to be moving forward
+    /// on the database. Records are read until the end of the database is reached,
+    /// `max_records` records are read, or the next record would take the batch over
+    /// `max_bytes` bytes. Each record takes the size of its key and value, plus 8 bytes.
+    /// A record larger than `max_bytes` is read on its own (so that reading batches
+    /// always makes progress).
+    ///
+    /// The whole batch is read in a single call into the engine, with keys and values
+    /// copied into the buffer of the batch. This is considerably cheaper than reading
+    /// records one by one through [`Cursor::get_key`] and [`Cursor::get_value`], in
+    /// particular for small records. On success, the number of records read is returned,
+    /// which is zero only if the cursor is not positioned at a valid entry.
+    /// Reading from an uninitialized [`LsmCursor`] is considered [`LsmErrorCode::LsmMisuse`].
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new(
+    ///                           "/tmp/",
+    ///                           "my_db_ah".to_string(),
+    /// );
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    ///
+    /// let value = vec![0; 16];
+    /// for key in 0..100_usize {
+    ///     let rc = db.persist(&key.to_be_bytes(), &value)?;
+    /// }
+    ///
+    /// let mut cursor = db.cursor_open()?;
+    /// cursor.first()?;
+    ///
+    /// // Read the whole database in batches of at most 32 records.
+    /// let mut batch = LsmCursorBatch::default();
+    /// let mut num_records: usize = 0;
+    /// while cursor.next_batch(32, 64 << 10, &mut batch)? > 0 {
+    ///     for (key, value) in batch.iter() {
+    ///         assert_eq!(key, num_records.to_be_bytes());
+    ///         assert_eq!(value, &[0; 16]);
+    ///         num_records += 1;
+    ///     }
+    /// }
+    /// assert_eq!(num_records, 100);
+    ///
+    /// // EOF
+    /// assert!(cursor.valid().is_err());
+    ///
+    /// # Result::<(), LsmErrorCode>::Ok(())
+    /// ```
+    pub fn next_batch(
+        &mut self,
+        max_records: usize,
+        max_bytes: usize,
+        batch: &mut LsmCursorBatch,
+    ) -> Result<usize, LsmErrorCode> {
+        if self.db_cursor.is_null() {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        batch.num_records = 0;
+        batch.num_bytes = 0;
+        let max_records = max_records.min(i32::MAX as usize) as i32;
+        let mut buf_len = max_bytes.min(i32::MAX as usize);
+        loop {
+            if batch.arena.len() < buf_len {
+                batch.arena.resize(buf_len, 0);
+            }
+            let rc: i32;
+            let mut num_records: i32 = 0;
+            let mut num_bytes: i32 = 0;
+            unsafe {
+                rc = lsm_csr_next_batch(
+                    self.db_cursor,
+                    max_records,
+                    batch.arena.as_mut_ptr(),
+                    buf_len as i32,
+                    &mut num_records,
+                    &mut num_bytes,
+                );
+            }
+            if rc != 0 {
+                return Err(LsmErrorCode::try_from(rc)?);
+            }
+            // The next record does not fit, we make room for it alone.
+            if num_records == 0 && num_bytes as usize > buf_len {
+                buf_len = num_bytes as usize;
+                continue;
+            }
+            batch.num_records = num_records as usize;
+            batch.num_bytes = num_bytes as usize;
+            return Ok(batch.num_records);
+        }
+    }
+
+    /// This returns an iterator over the record the cursor is positioned at, and the
+    /// ones following it, up to the end of the database. The cursor has to be moving
+    /// forward on the database. Records are read through [`LsmCursor::next_batch`],
+    /// with each batch holding at most `max_records` records and `max_bytes` bytes.
+    /// The cursor is thus moved past every record in the batch the iterator
+    /// is currently at, not just the ones already returned.
+    ///
+    /// Every record returned is a copy of the key and value owned by the caller. To
+    /// read records without allocating memory for each, use [`LsmCursor::next_batch`]
+    /// directly. If an error occurs, it is returned once, and the iterator ends.
+    /// # Example
+    ///
+    /// ```rust
+    /// use lsmlite_rs::*;
+    ///
+    /// let db_conf = DbConf::new(
+    ///                           "/tmp/",
+    ///                           "my_db_ai".to_string(),
+    /// );
+    ///
+    /// let mut db: LsmDb = Default::default();
+    /// let rc = db.initialize(db_conf);
+    /// let rc = db.connect();
+    ///
+    /// let value = vec![0; 16];
+    /// for key in 0..100_usize {
+    ///     let rc = db.persist(&key.to_be_bytes(), &value)?;
+    /// }
+    ///
+    /// // Collect the keys from 50 onwards.
+    /// let mut cursor = db.cursor_open()?;
+    /// cursor.seek(&50_usize.to_be_bytes(), LsmCursorSeekOp::LsmCursorSeekGe)?;
+    /// let keys = cursor
+    ///     .records(32, 64 << 10)
+    ///     .map(|record| record.map(|(key, _)| key))
+    ///     .collect::<Result<Vec<_>, _>>()?;
+    /// assert_eq!(keys.len(), 50);
+    /// assert_eq!(keys[0], 50_usize.to_be_bytes());
+    ///
+    /// # Result::<(), LsmErrorCode>::Ok(())
+    /// ```
+    pub fn records(&mut self, max_records: usize, max_bytes: usize) -> LsmCursorRecords<'_, 'a> {
+        LsmCursorRecords {
+            cursor: self,
+            batch: Default::default(),
+            max_records,
+            max_bytes,
+            offset: 0,
+            finished: false,
+        }
+    }
+}
+
+/// Splits the first record off the records of a batch, as laid out by
+/// `lsm_csr_next_batch`: the sizes of the key and the value (4 bytes each,
+/// big-endian), followed by the key and the value themselves.
+fn split_batch_record(records: &[u8]) -> (&[u8], &[u8], &[u8]) {
+    let (sizes, records) = records.split_at(8);
+    let key_len = u32::from_be_bytes([sizes[0], sizes[1], sizes[2], sizes[3]]) as usize;
+    let value_len = u32::from_be_bytes([sizes[4], sizes[5], sizes[6], sizes[7]]) as usize;
+    let (key, records) = records.split_at(key_len);
+    let (value, records) = records.split_at(value_len);
+    (key, value, records)
+}
+
+impl LsmCursorBatch {
+    /// The number of records in the batch.
+    pub fn len(&self) -> usize {
+        self.num_records
+    }
+
+    /// Whether the batch holds no records.
+    pub fn is_empty(&self) -> bool {
+        self.num_records == 0
+    }
+
+    /// Returns an iterator over the keys and values of the batch, in the order
+    /// they were read from the cursor.
+    pub fn iter(&self) -> LsmCursorBatchIter<'_> {
+        LsmCursorBatchIter {
+            arena: &self.arena[..self.num_bytes],
+        }
+    }
+}
+
+impl<'b> IntoIterator for &'b LsmCursorBatch {
+    type Item = (&'b [u8], &'b [u8]);
+    type IntoIter = LsmCursorBatchIter<'b>;
+
+    fn into_iter(self) -> Self::IntoIter {
+        self.iter()
+    }
+}
+
+impl<'b> Iterator for LsmCursorBatchIter<'b> {
+    type Item = (&'b [u8], &'b [u8]);
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.arena.is_empty() {
+            return None;
+        }
+        let (key, value, rest) = split_batch_record(self.arena);
+        self.arena = rest;
+        Some((key, value))
+    }
+}
+
+impl Iterator for LsmCursorRecords<'_, '_> {
+    type Item = Result<(Vec<u8>, Vec<u8>), LsmErrorCode>;
+
+    fn next(&mut self) -> Option<Self::Item> {
+        if self.offset == self.batch.num_bytes {
+            if self.finished {
+                return None;
+            }
+            self.offset = 0;
+            match self
+                .cursor
+                .next_batch(self.max_records, self.max_bytes, &mut self.batch)
+            {
+                Ok(0) => {
+                    self.finished = true;
+                    return None;
+                }
+                Ok(_) => {}
+                Err(rc) => {
+                    self.finished = true;
+                    return Some(Err(rc));
+                }
+            }
+        }
+        let records = &self.batch.arena[self.offset..self.batch.num_bytes];
+        let (key, value, rest) = split_batch_record(records);
+        self.offset = self.batch.num_bytes - rest.len();
+        Some(Ok((key.to_vec(), value.to_vec())))
+    }
+}
+
 /// Drop for `LsmCursor` so that it gets properly terminated when it goes out of scope for example.
 impl Drop for LsmCursor<'_> {
     fn drop(&mut self) {
@@ -1540,6 +2826,16 @@ impl Drop for LsmCursor<'_> {
     }
 }
 
+/// Drop for [`LsmBulkLoader`] so that a bulk load that was not committed is rolled
+/// back (thus releasing the locks it holds on the database).
+impl Drop for LsmBulkLoader<'_> {
+    fn drop(&mut self) {
+        if !self.finished {
+            let _ = self.end(false);
+        }
+    }
+}
+
 /// A database handle is marked as [`Send`] as it can be safely sent to another
 /// thread (for further usage), for example in async code.
 unsafe impl Send for LsmDb {}
@@ -0,0 +1,116 @@
+// Copyright 2023 Helsing GmbH
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+use std::ffi::c_void;
+use std::panic::{catch_unwind, AssertUnwindSafe};
+use std::slice::from_raw_parts;
+use std::sync::Arc;
+
+use crate::lsmdb::lsm_config_merge_operator;
+use crate::{lsm_db, LsmMergeOperator};
+
+/// This is the context `lsm1` hands back to us every time it invokes the
+/// merge operator. Besides the user's operator, it owns the buffer holding
+/// the last value produced by the operator, as `lsm1` expects that buffer
+/// to stay valid until the operator is invoked again.
+pub(crate) struct LsmMergeOperatorCtx {
+    operator: Arc<dyn LsmMergeOperator>,
+    value: Vec<u8>,
+}
+
+impl LsmMergeOperatorCtx {
+    /// Configures the given operator on the given handle. The returned context
+    /// has to outlive the handle (or at least until the handle is closed).
+    pub(crate) fn register(
+        db_handle: *mut lsm_db,
+        operator: &Arc<dyn LsmMergeOperator>,
+    ) -> Box<LsmMergeOperatorCtx> {
+        let mut ctx = Box::new(LsmMergeOperatorCtx {
+            operator: operator.clone(),
+            value: Vec::new(),
+        });
+        unsafe {
+            lsm_config_merge_operator(
+                db_handle,
+                Some(LsmMergeOperatorCtx::merge_entry),
+                &mut *ctx as *mut LsmMergeOperatorCtx as *mut c_void,
+            );
+        }
+        ctx
+    }
+
+    #[allow(clippy::too_many_arguments)]
+    unsafe extern "C" fn merge_entry(
+        ctx: *mut c_void,
+        key: *const c_void,
+        key_len: i32,
+        existing: *const c_void,
+        existing_len: i32,
+        operand: *const c_void,
+        operand_len: i32,
+        new_value: *mut *mut c_void,
+        new_value_len: *mut i32,
+    ) -> i32 {
+        // Unlike a compaction filter, there is no safe fallback here: the
+        // merge cannot go on without a result.
+        if ctx.is_null() || new_value.is_null() || new_value_len.is_null() {
+            // This is LSM_MISUSE.
+            return 21;
+        }
+        let ctx = &mut *(ctx as *mut LsmMergeOperatorCtx);
+
+        let key: &[u8] = if key.is_null() || key_len <= 0 {
+            &[]
+        } else {
+            from_raw_parts(key as *const u8, key_len as usize)
+        };
+        let existing: &[u8] = if existing.is_null() || existing_len <= 0 {
+            &[]
+        } else {
+            from_raw_parts(existing as *const u8, existing_len as usize)
+        };
+        let operand: &[u8] = if operand.is_null() || operand_len <= 0 {
+            &[]
+        } else {
+            from_raw_parts(operand as *const u8, operand_len as usize)
+        };
+
+        // A panic must not cross the FFI boundary. If the operator panics, the
+        // operation that required the merge (a write, a read, or a merge of
+        // segments) fails.
+        match catch_unwind(AssertUnwindSafe(|| {
+            ctx.operator.merge(key, existing, operand)
+        })) {
+            Ok(value) => {
+                let Ok(len) = i32::try_from(value.len()) else {
+                    tracing::error!(
+                        len = value.len(),
+                        "Value produced by the merge operator is too large.",
+                    );
+                    // This is LSM_ERROR.
+                    return 1;
+                };
+                ctx.value = value;
+                *new_value = ctx.value.as_mut_ptr() as *mut c_void;
+                *new_value_len = len;
+                // This is LSM_OK.
+                0
+            }
+            Err(_) => {
+                tracing::error!("Merge operator panicked.");
+                // This is LSM_ERROR.
+                1
+            }
+        }
+    }
+}
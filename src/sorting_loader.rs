@@ -0,0 +1,360 @@
+// Copyright 2023 Helsing GmbH
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+use std::cmp::{Ordering, Reverse};
+use std::collections::BinaryHeap;
+use std::fs::File;
+use std::io::{BufReader, BufWriter, Read, Write};
+use std::path::PathBuf;
+use std::thread;
+
+use crate::{DbConf, LsmErrorCode, LsmSortingLoader};
+
+// Runs are read and written through buffers of this size.
+const RUN_BUFFER_B: usize = 256 << 10;
+// At most this many runs are merged at once. If there are more, the oldest ones
+// are merged into a single run first, so that the number of open files (and
+// the memory taken by their buffers) stays bounded.
+const MAX_MERGE_RUNS: usize = 64;
+// Fewer records than this are sorted by the calling thread alone.
+const MIN_PARALLEL_SORT_RECORDS: usize = 1 << 14;
+
+/// A record buffered by a [`LsmSortingLoader`]. Its key and value are stored
+/// back to back in the buffer of the loader, starting at the given offset.
+#[derive(Copy, Clone, Debug, Default)]
+pub(crate) struct LsmSortRecord {
+    offset: usize,
+    key_len: u32,
+    value_len: u32,
+}
+
+impl LsmSortRecord {
+    /// The memory taken by a record while it is buffered and sorted: the record
+    /// itself plus its slot in the scratch buffer of [`sort_records`].
+    const SORT_B: usize = 2 * size_of::<LsmSortRecord>();
+
+    fn key<'a>(&self, arena: &'a [u8]) -> &'a [u8] {
+        &arena[self.offset..self.offset + self.key_len as usize]
+    }
+
+    fn value<'a>(&self, arena: &'a [u8]) -> &'a [u8] {
+        let start = self.offset + self.key_len as usize;
+        &arena[start..start + self.value_len as usize]
+    }
+}
+
+fn io_error(_: std::io::Error) -> LsmErrorCode {
+    LsmErrorCode::LsmIOErr
+}
+
+fn write_record(run: &mut impl Write, key: &[u8], value: &[u8]) -> std::io::Result<()> {
+    run.write_all(&(key.len() as u32).to_le_bytes())?;
+    run.write_all(&(value.len() as u32).to_le_bytes())?;
+    run.write_all(key)?;
+    run.write_all(value)
+}
+
+/// The order of keys of the database (see [`DbConf::key_order`]).
+type LsmKeyOrder = fn(&[u8], &[u8]) -> Ordering;
+
+impl DbConf {
+    /// The order of keys of the database, as seen from the Rust side. Unless a
+    /// key comparator is given, keys are ordered as byte strings (every key
+    /// format orders keys that way).
+    pub(crate) fn key_order(&self) -> LsmKeyOrder {
+        self.key_comparator
+            .map_or(<[u8] as Ord>::cmp, |comparator| comparator.compare)
+    }
+}
+
+/// Merges two sorted slices of records into `dst`. Records of `left` come
+/// first among records with the same key, as they were inserted earlier.
+fn merge_records(
+    left: &[LsmSortRecord],
+    right: &[LsmSortRecord],
+    dst: &mut [LsmSortRecord],
+    arena: &[u8],
+    order: LsmKeyOrder,
+) {
+    let (mut i, mut j) = (0, 0);
+    for slot in dst.iter_mut() {
+        if j == right.len()
+            || (i < left.len() && order(left[i].key(arena), right[j].key(arena)).is_le())
+        {
+            *slot = left[i];
+            i += 1;
+        } else {
+            *slot = right[j];
+            j += 1;
+        }
+    }
+}
+
+/// Sorts the records by key, keeping records with the same key in the order
+/// they were inserted. Slices of the records are sorted by as many threads as
+/// there are cores, and then merged pairwise, also in parallel. Merging takes
+/// a scratch buffer as large as the records (see [`LsmSortRecord::SORT_B`]).
+fn sort_records(records: &mut Vec<LsmSortRecord>, arena: &[u8], order: LsmKeyOrder) {
+    let num_threads = thread::available_parallelism().map_or(1, |n| n.get());
+    if num_threads == 1 || records.len() < MIN_PARALLEL_SORT_RECORDS {
+        records.sort_by(|a, b| order(a.key(arena), b.key(arena)));
+        return;
+    }
+
+    let mut run_len = records.len().div_ceil(num_threads);
+    thread::scope(|s| {
+        for run in records.chunks_mut(run_len) {
+            s.spawn(move || run.sort_by(|a, b| order(a.key(arena), b.key(arena))));
+        }
+    });
+    let mut merged = vec![LsmSortRecord::default(); records.len()];
+    while run_len < records.len() {
+        thread::scope(|s| {
+            for (src, dst) in records
+                .chunks(2 * run_len)
+                .zip(merged.chunks_mut(2 * run_len))
+            {
+                s.spawn(move || {
+                    let (left, right) = src.split_at(run_len.min(src.len()));
+                    merge_records(left, right, dst, arena, order);
+                });
+            }
+        });
+        std::mem::swap(records, &mut merged);
+        run_len *= 2;
+    }
+}
+
+/// Reads the records of a run back, one at a time.
+struct LsmRunReader {
+    run: BufReader<File>,
+    value: Vec<u8>,
+}
+
+impl LsmRunReader {
+    fn open(path: &PathBuf) -> Result<Self, LsmErrorCode> {
+        Ok(Self {
+            run: BufReader::with_capacity(RUN_BUFFER_B, File::open(path).map_err(io_error)?),
+            value: Vec::new(),
+        })
+    }
+
+    /// Reads the next record into `key` and `self.value`. Returns `false` once
+    /// the run is exhausted.
+    fn next(&mut self, key: &mut Vec<u8>) -> Result<bool, LsmErrorCode> {
+        let mut lens = [0; 8];
+        match self.run.read_exact(&mut lens) {
+            Ok(()) => {}
+            Err(e) if e.kind() == std::io::ErrorKind::UnexpectedEof => return Ok(false),
+            Err(e) => return Err(io_error(e)),
+        }
+        // These conversions are infallible.
+        let key_len = u32::from_le_bytes(lens[..4].try_into().unwrap()) as usize;
+        let value_len = u32::from_le_bytes(lens[4..].try_into().unwrap()) as usize;
+        key.resize(key_len, 0);
+        self.run.read_exact(key).map_err(io_error)?;
+        self.value.resize(value_len, 0);
+        self.run.read_exact(&mut self.value).map_err(io_error)?;
+        Ok(true)
+    }
+}
+
+/// The current key of a run being merged. Keys are ordered ascending, and
+/// records of older runs (smaller index) come first among equal keys.
+struct LsmRunHead {
+    key: Vec<u8>,
+    run: usize,
+    order: LsmKeyOrder,
+}
+
+impl Ord for LsmRunHead {
+    fn cmp(&self, other: &Self) -> Ordering {
+        (self.order)(&self.key, &other.key).then(self.run.cmp(&other.run))
+    }
+}
+
+impl PartialEq for LsmRunHead {
+    fn eq(&self, other: &Self) -> bool {
+        self.cmp(other).is_eq()
+    }
+}
+
+impl Eq for LsmRunHead {}
+
+impl PartialOrd for LsmRunHead {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
+    }
+}
+
+/// Merges the given runs, and hands their records to `sink` in order of their
+/// keys. Of the records with the same key, only the one of the most recent
+/// run (the last one given) is handed over.
+fn merge_runs(
+    runs: &[PathBuf],
+    order: LsmKeyOrder,
+    mut sink: impl FnMut(&[u8], &[u8]) -> Result<(), LsmErrorCode>,
+) -> Result<(), LsmErrorCode> {
+    let mut readers = Vec::with_capacity(runs.len());
+    let mut heap = BinaryHeap::with_capacity(runs.len());
+    for (run, path) in runs.iter().enumerate() {
+        let mut reader = LsmRunReader::open(path)?;
+        let mut key = Vec::new();
+        if reader.next(&mut key)? {
+            heap.push(Reverse(LsmRunHead { key, run, order }));
+        }
+        readers.push(reader);
+    }
+
+    while let Some(Reverse(mut head)) = heap.pop() {
+        let reader = &mut readers[head.run];
+        let superseded = heap
+            .peek()
+            .is_some_and(|Reverse(next)| order(&next.key, &head.key).is_eq());
+        if !superseded {
+            sink(&head.key, &reader.value)?;
+        }
+        // The key's buffer is reused for the next key of the same run.
+        if reader.next(&mut head.key)? {
+            heap.push(Reverse(head));
+        }
+    }
+    Ok(())
+}
+
+impl LsmSortingLoader<'_> {
+    /// This function buffers a record to be loaded into the database. Records can
+    /// be inserted in any order. If a key is inserted more than once, the record
+    /// inserted last is the one loaded. Once the memory given to the loader is
+    /// exhausted, the records buffered are sorted and written to a temporary file
+    /// next to the database file (a run). Keys and values of more than 2 GiB are
+    /// considered [`LsmErrorCode::LsmMisuse`].
+    pub fn insert(&mut self, key: &[u8], value: &[u8]) -> Result<(), LsmErrorCode> {
+        if key.len() > i32::MAX as usize || value.len() > i32::MAX as usize {
+            return Err(LsmErrorCode::LsmMisuse);
+        }
+
+        let record_b = key.len() + value.len() + LsmSortRecord::SORT_B;
+        if !self.records.is_empty() && self.memory_used_b() + record_b > self.memory_b {
+            self.spill()?;
+        }
+        self.records.push(LsmSortRecord {
+            offset: self.arena.len(),
+            key_len: key.len() as u32,
+            value_len: value.len() as u32,
+        });
+        self.arena.extend_from_slice(key);
+        self.arena.extend_from_slice(value);
+        Ok(())
+    }
+
+    /// This function sorts the records inserted, and loads them into the database
+    /// through a bulk load (see [`crate::LsmDb::bulk_loader`]). If runs were written,
+    /// they are merged straight into the new segment of the database. Either all
+    /// records inserted become visible in the database, or none. The temporary
+    /// files of the loader are removed in any case.
+    pub fn commit(mut self) -> Result<(), LsmErrorCode> {
+        let order = self.db.db_conf.key_order();
+        if self.runs.is_empty() {
+            let arena = std::mem::take(&mut self.arena);
+            let mut records = std::mem::take(&mut self.records);
+            sort_records(&mut records, &arena, order);
+
+            let mut loader = self.db.bulk_loader()?;
+            for (i, record) in records.iter().enumerate() {
+                // Of the records with the same key, the one inserted last is loaded.
+                let key = record.key(&arena);
+                if records
+                    .get(i + 1)
+                    .is_some_and(|next| order(next.key(&arena), key).is_eq())
+                {
+                    continue;
+                }
+                loader.insert(key, record.value(&arena))?;
+            }
+            return loader.commit();
+        }
+
+        if !self.records.is_empty() {
+            self.spill()?;
+        }
+        // The oldest runs are merged into a single one until few enough remain.
+        while self.runs.len() > MAX_MERGE_RUNS {
+            let path = self.next_run_path();
+            let mut run =
+                BufWriter::with_capacity(RUN_BUFFER_B, File::create(&path).map_err(io_error)?);
+            self.runs.insert(MAX_MERGE_RUNS, path);
+            merge_runs(&self.runs[..MAX_MERGE_RUNS], order, |key, value| {
+                write_record(&mut run, key, value).map_err(io_error)
+            })?;
+            run.flush().map_err(io_error)?;
+            for path in self.runs.drain(..MAX_MERGE_RUNS) {
+                let _ = std::fs::remove_file(path);
+            }
+        }
+
+        let runs = self.runs.clone();
+        let mut loader = self.db.bulk_loader()?;
+        merge_runs(&runs, order, |key, value| loader.insert(key, value))?;
+        loader.commit()
+    }
+
+    fn memory_used_b(&self) -> usize {
+        self.arena.len() + self.records.len() * LsmSortRecord::SORT_B
+    }
+
+    fn next_run_path(&mut self) -> PathBuf {
+        self.num_runs_written += 1;
+        let db_path = String::from_utf8_lossy(self.db.db_fq_name.as_bytes()).to_string();
+        PathBuf::from(format!("{db_path}-sort-{}", self.num_runs_written))
+    }
+
+    /// Sorts the records buffered and writes them to a new run. Of the records
+    /// with the same key, only the one inserted last is written.
+    fn spill(&mut self) -> Result<(), LsmErrorCode> {
+        let order = self.db.db_conf.key_order();
+        sort_records(&mut self.records, &self.arena, order);
+
+        let path = self.next_run_path();
+        let mut run =
+            BufWriter::with_capacity(RUN_BUFFER_B, File::create(&path).map_err(io_error)?);
+        // The run is removed when the loader is dropped, even if writing it fails.
+        self.runs.push(path);
+        for (i, record) in self.records.iter().enumerate() {
+            let key = record.key(&self.arena);
+            if self
+                .records
+                .get(i + 1)
+                .is_some_and(|next| order(next.key(&self.arena), key).is_eq())
+            {
+                continue;
+            }
+            write_record(&mut run, key, record.value(&self.arena)).map_err(io_error)?;
+        }
+        run.flush().map_err(io_error)?;
+
+        self.records.clear();
+        self.arena.clear();
+        Ok(())
+    }
+}
+
+/// Drop for [`LsmSortingLoader`] so that its temporary files are removed, whether
+/// its records were loaded or not.
+impl Drop for LsmSortingLoader<'_> {
+    fn drop(&mut self) {
+        for path in self.runs.drain(..) {
+            let _ = std::fs::remove_file(path);
+        }
+    }
+}
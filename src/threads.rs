@@ -18,21 +18,25 @@ use std::sync::mpsc::TrySendError;
 use std::sync::{mpsc, Arc, Mutex};
 use std::thread;
 
-use crate::compression::lz4::LsmLz4;
-use crate::compression::zlib::LsmZLib;
-use crate::compression::zstd::LsmZStd;
-use crate::compression::Compression;
+use crate::compaction_filter::LsmCompactionFilterCtx;
+use crate::compression::{
+    configure_compression_policy, get_compression_methods, store_compression_dictionary,
+};
+use crate::key_comparator::configure_key_order;
 use crate::lsmdb::{
     lsm_checkpoint, lsm_close, lsm_config, lsm_info, lsm_new, lsm_open, lsm_work, BLOCK_SIZE_KB,
-    MAX_CHECKPOINT_SIZE_KB, MIN_CHECKPOINT_SIZE_KB, PAGE_SIZE_B,
+    MAX_CHECKPOINT_SIZE_KB, MIN_CHECKPOINT_SIZE_KB, PAGE_SIZE_B, READAHEAD_KB,
 };
+use crate::merge_operator::LsmMergeOperatorCtx;
 use crate::{
-    DbConf, LsmBgWorker, LsmBgWorkerMessage, LsmBgWorkers, LsmCompressionLib, LsmDb, LsmErrorCode,
-    LsmInfo, LsmMode, LsmParam,
+    DbConf, LsmBgWorker, LsmBgWorkerMessage, LsmBgWorkers, LsmDb, LsmErrorCode, LsmInfo, LsmMode,
+    LsmParam,
 };
 
 // Do not modify these constants unless you know what you are doing.
 pub(crate) const NUM_MERGE_SEGMENTS: i32 = 4;
+// Default size ratio between adjacent segments (see `DbConf::with_level_size_ratio`).
+pub(crate) const LEVEL_SIZE_RATIO: i32 = 10;
 const WORK_KB: i32 = 64 << 10; // X KiBs * 1024 = X MiB
 
 /// A thread is spawn here with the right mode of execution (either merger or checkpointer).
@@ -57,6 +61,11 @@ impl LsmBgWorker {
                 rc = lsm_work(db.db_handle, n_segments, n_kb, &mut written_kb);
                 overall_written_kb += written_kb;
 
+                // The pages merged so far might suffice to train a compression dictionary.
+                if db.db_conf.compression_dictionary.is_some() {
+                    store_compression_dictionary(db.db_compress.as_ref(), false);
+                }
+
                 // Anything different than ok (0), or busy (5) is wrong!
                 if rc != 0 && rc != 5 {
                     let ec = LsmErrorCode::try_from(rc);
@@ -182,6 +191,9 @@ impl LsmBgWorker {
 
         // We reset the pointer once we know we were able to cleanly close the database.
         db.db_handle = null_mut();
+        db.db_compress = None;
+        db.db_filter = None;
+        db.db_merge = None;
     }
 
     /// Produces a new background worker for the corresponding data segment.
@@ -271,24 +283,23 @@ impl LsmBgWorker {
         // compression can be done only when the database was created, once set,
         // trying to do it again or not setting it to the same compression scheme
         // will be considered an error (LsmErrorCode::LsmMismatch).
-        match db.db_conf.compression {
-            LsmCompressionLib::NoCompression => {}
-            LsmCompressionLib::LZ4 => {
-                let lz4 = LsmLz4::new();
-                db.db_compress = lz4.get_compression_methods().ok();
-            }
-            LsmCompressionLib::ZLib => {
-                let zlib = LsmZLib::new();
-                db.db_compress = zlib.get_compression_methods().ok();
-            }
-            LsmCompressionLib::ZStd => {
-                let zstd = LsmZStd::new();
-                db.db_compress = zstd.get_compression_methods().ok();
+        db.db_compress = match get_compression_methods(db.db_handle, &db.db_conf) {
+            Ok(db_compress) => db_compress,
+            Err(ec) => {
+                tracing::error!(
+                    datafile = ?db.get_full_db_path(),
+                    rc = ?ec,
+                    "Error occurred while producing compression hooks.",
+                );
+
+                LsmBgWorker::close_thread_connection(&mut db);
+                return LsmBgWorker { thread: None };
             }
         };
 
         // Only if the compression library is defined we pass it onto
-        // the engine. Otherwise no compression whatsoever.
+        // the engine. Otherwise no compression whatsoever. From then on, the
+        // engine owns the context of the hooks.
         if let Some(lsm_compress) = db.db_compress.as_ref() {
             unsafe {
                 rc = lsm_config(db.db_handle, LsmParam::SetCompression as i32, lsm_compress);
@@ -301,11 +312,28 @@ impl LsmBgWorker {
                     "Error occurred while setting compression hooks.",
                 );
 
+                if let Some(free) = lsm_compress.free {
+                    unsafe { free(lsm_compress.ctx) };
+                }
+                db.db_compress = None;
                 LsmBgWorker::close_thread_connection(&mut db);
                 return LsmBgWorker { thread: None };
             }
         }
 
+        // Which pages are worth compressing, and the libraries segments of certain
+        // ages are compressed with (if any).
+        if let Err(ec) = unsafe { configure_compression_policy(db.db_handle, &db.db_conf) } {
+            tracing::error!(
+                datafile = ?db.get_full_db_path(),
+                rc = ?ec,
+                "Error occurred while setting compression hooks.",
+            );
+
+            LsmBgWorker::close_thread_connection(&mut db);
+            return LsmBgWorker { thread: None };
+        }
+
         // Whichever worker connection sets page size the same.
         unsafe {
             rc = lsm_config(db.db_handle, LsmParam::PageSize as i32, &PAGE_SIZE_B);
@@ -378,6 +406,110 @@ impl LsmBgWorker {
             return LsmBgWorker { thread: None };
         }
 
+        // Whichever worker connection selects segments to merge like the writer does.
+        let compaction: i32 = db.db_conf.compaction as i32;
+        let size_ratio: i32 = db
+            .db_conf
+            .level_size_ratio
+            .map_or(LEVEL_SIZE_RATIO, |ratio| {
+                i32::try_from(ratio).unwrap_or(i32::MAX)
+            });
+        let tombstone_ratio: i32 = db.db_conf.tombstone_ratio_pct.map_or(0, i32::from);
+        unsafe {
+            rc = lsm_config(db.db_handle, LsmParam::Compaction as i32, &compaction);
+            if rc == 0 {
+                rc = lsm_config(db.db_handle, LsmParam::SizeRatio as i32, &size_ratio);
+            }
+            if rc == 0 {
+                rc = lsm_config(
+                    db.db_handle,
+                    LsmParam::TombstoneRatio as i32,
+                    &tombstone_ratio,
+                );
+            }
+        }
+
+        if rc != 0 {
+            tracing::error!(
+                datafile = ?db.get_full_db_path(),
+                rc = ?LsmErrorCode::try_from(rc),
+                "Error occurred while setting thread handle parameter.",
+            );
+
+            LsmBgWorker::close_thread_connection(&mut db);
+            return LsmBgWorker { thread: None };
+        }
+
+        // Whichever worker connection reads ahead of the segments it merges, writes
+        // their output back, and manages the disk space of blocks, like the writer
+        // does.
+        let readahead_kb: i32 = db.db_conf.readahead_kb.map_or(READAHEAD_KB, |max_kb| {
+            i32::try_from(max_kb).unwrap_or(i32::MAX)
+        });
+        let (writeback_kb, drop_behind): (i32, i32) =
+            db.db_conf
+                .writeback
+                .map_or((0, 0), |(size_kb, drop_behind)| {
+                    (
+                        i32::try_from(size_kb).unwrap_or(i32::MAX),
+                        drop_behind as i32,
+                    )
+                });
+        let preallocate_kb: i32 = db
+            .db_conf
+            .preallocation_kb
+            .map_or(0, |size_kb| i32::try_from(size_kb).unwrap_or(i32::MAX));
+        let punch_holes: i32 = db.db_conf.punch_holes as i32;
+        let value_log_b: i32 = db.db_conf.value_log_threshold_b.map_or(0, |threshold_b| {
+            i32::try_from(threshold_b).unwrap_or(i32::MAX)
+        });
+        let prefix_keys: i32 = db.db_conf.prefix_keys as i32;
+        let compress_threads: i32 = db.db_conf.compression_threads.map_or(0, |num_threads| {
+            i32::try_from(num_threads).unwrap_or(i32::MAX)
+        });
+        unsafe {
+            rc = lsm_config(db.db_handle, LsmParam::Readahead as i32, &readahead_kb);
+            if rc == 0 {
+                rc = lsm_config(db.db_handle, LsmParam::Writeback as i32, &writeback_kb);
+            }
+            if rc == 0 {
+                rc = lsm_config(db.db_handle, LsmParam::DropBehind as i32, &drop_behind);
+            }
+            if rc == 0 {
+                rc = lsm_config(db.db_handle, LsmParam::Preallocate as i32, &preallocate_kb);
+            }
+            if rc == 0 {
+                rc = lsm_config(db.db_handle, LsmParam::PunchHoles as i32, &punch_holes);
+            }
+            if rc == 0 {
+                rc = lsm_config(db.db_handle, LsmParam::ValueLog as i32, &value_log_b);
+            }
+            if rc == 0 {
+                rc = lsm_config(db.db_handle, LsmParam::PrefixKeys as i32, &prefix_keys);
+            }
+            if rc == 0 {
+                rc = lsm_config(
+                    db.db_handle,
+                    LsmParam::CompressThreads as i32,
+                    &compress_threads,
+                );
+            }
+            if rc == 0 {
+                rc = configure_key_order(db.db_handle, &db.db_conf);
+            }
+        }
+
+        if rc != 0 {
+            tracing::error!(
+                datafile = ?db.get_full_db_path(),
+                rc = ?LsmErrorCode::try_from(rc),
+                "Error occurred while setting thread handle parameter.",
+            );
+
+            LsmBgWorker::close_thread_connection(&mut db);
+            return LsmBgWorker { thread: None };
+        }
+
         // We finally open the handle to the database.
         unsafe {
             rc = lsm_open(db.db_handle, db.db_fq_name.as_ptr());
@@ -393,6 +525,15 @@ impl LsmBgWorker {
             }
         }
 
+        // Merges performed by this worker apply the compaction filter as well.
+        if let Some(filter) = db.db_conf.compaction_filter.as_ref() {
+            db.db_filter = Some(LsmCompactionFilterCtx::register(db.db_handle, filter));
+        }
+        // And they combine merge operands, if any.
+        if let Some(operator) = db.db_conf.merge_operator.as_ref() {
+            db.db_merge = Some(LsmMergeOperatorCtx::register(db.db_handle, operator));
+        }
+
         let thread = thread::spawn(move || loop {
             // The thread will yield if no message is received.
             let message = receiver.lock().unwrap().recv().unwrap();